@@ -0,0 +1,264 @@
+/* Times the SIMD kernels of 310simd.c against the plain functions of
+310matrix.c and 350isometry.c, and the batched transforms of 310simdBatch.c
+against one call per point, and checks that they agree. On macOS, compile
+with...
+    clang -O2 310mainSIMDBenchmark.c -I/usr/local/gl3w/include
+...which uses the AVX2 kernels if the CPU has AVX2 and FMA, and the SSE2 ones
+otherwise, or add -mavx2 -mfma to inline the AVX2 ones, and run with...
+    ./a.out [repetitions]
+On Linux, add -lm.
+Each test works through a batch of random matrices, so that the timings
+include realistic loads and stores but stay in cache. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <GL/gl3w.h>
+
+/* M_PI is not in the C standard, so -std=c99 hides it. */
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#include "310vector.c"
+#include "310matrix.c"
+#include "310simd.c"
+#include "310simdBatch.c"
+#include "350isometry.c"
+
+#define BATCH 256
+#define POINTNUM 1000000
+
+GLdouble ms[BATCH][4][4], ns[BATCH][4][4], outs[BATCH][4][4];
+GLdouble simdOuts[BATCH][4][4], vs[BATCH][4];
+GLfloat msFloat[BATCH][4][4], nsFloat[BATCH][4][4], outsFloat[BATCH][4][4];
+GLfloat vsFloat[BATCH][4];
+isoIsometry isos[BATCH];
+
+double getTime(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec * 0.000001;
+}
+
+/* Fills the batches with random matrices and vectors, and the isometries with
+random rigid motions. */
+void initializeBatches(void) {
+    GLdouble axis[3], rot[3][3], transl[3];
+    int b, i, j;
+    for (b = 0; b < BATCH; b += 1) {
+        for (i = 0; i < 4; i += 1) {
+            for (j = 0; j < 4; j += 1) {
+                ms[b][i][j] = rand() / (GLdouble)RAND_MAX - 0.5;
+                ns[b][i][j] = rand() / (GLdouble)RAND_MAX - 0.5;
+                msFloat[b][i][j] = (GLfloat)ms[b][i][j];
+                nsFloat[b][i][j] = (GLfloat)ns[b][i][j];
+            }
+            vs[b][i] = rand() / (GLdouble)RAND_MAX - 0.5;
+            vsFloat[b][i] = (GLfloat)vs[b][i];
+        }
+        vec3Spherical(1.0, M_PI * rand() / RAND_MAX,
+            2.0 * M_PI * rand() / RAND_MAX, axis);
+        mat33AngleAxisRotation(2.0 * M_PI * rand() / RAND_MAX, axis, rot);
+        for (i = 0; i < 3; i += 1)
+            transl[i] = 10.0 * (rand() / (GLdouble)RAND_MAX - 0.5);
+        isoSetRotation(&isos[b], rot);
+        isoSetTranslation(&isos[b], transl);
+        isoGetHomogeneous(&isos[b], ms[b]);
+        for (i = 0; i < 4; i += 1)
+            for (j = 0; j < 4; j += 1)
+                msFloat[b][i][j] = (GLfloat)ms[b][i][j];
+    }
+}
+
+/* Times transforming POINTNUM points, reps times: one mat441Multiply per
+point, then simdTransformPoints on interleaved points (with 8 attributes, as
+in a typical mesh), and then simdTransformStreams. */
+void benchmarkPoints(int reps) {
+    GLdouble *points = (GLdouble *)malloc((size_t)POINTNUM * 8 *
+        sizeof(GLdouble));
+    GLdouble *outs = (GLdouble *)malloc((size_t)POINTNUM * 3 *
+        sizeof(GLdouble));
+    GLdouble *streams = (GLdouble *)malloc((size_t)POINTNUM * 6 *
+        sizeof(GLdouble));
+    GLdouble p[4], q[4], error = 0.0, times[3];
+    double start;
+    int r, k;
+    GLuint i;
+    if (points == NULL || outs == NULL || streams == NULL) {
+        free(points);
+        free(outs);
+        free(streams);
+        return;
+    }
+    for (i = 0; i < POINTNUM * 8; i += 1)
+        points[i] = rand() / (GLdouble)RAND_MAX - 0.5;
+    for (i = 0; i < POINTNUM; i += 1)
+        for (k = 0; k < 3; k += 1)
+            streams[k * POINTNUM + i] = points[i * 8 + k];
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (i = 0; i < POINTNUM; i += 1) {
+            vec4Set(points[i * 8], points[i * 8 + 1], points[i * 8 + 2], 1.0,
+                p);
+            mat441Multiply(ms[0], p, q);
+            vecCopy(3, q, &outs[i * 3]);
+        }
+    times[0] = getTime() - start;
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        simdTransformPoints(ms[0], simdPOINTS, POINTNUM, points, 8,
+            &streams[3 * POINTNUM], 3);
+    times[1] = getTime() - start;
+    for (i = 0; i < POINTNUM * 3; i += 1)
+        error = fmax(error, fabs(outs[i] - streams[3 * POINTNUM + i]));
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        simdTransformStreams(ms[0], simdPOINTS, POINTNUM, streams,
+            &streams[POINTNUM], &streams[2 * POINTNUM], &streams[3 * POINTNUM],
+            &streams[4 * POINTNUM], &streams[5 * POINTNUM]);
+    times[2] = getTime() - start;
+    for (i = 0; i < POINTNUM; i += 1)
+        for (k = 0; k < 3; k += 1)
+            error = fmax(error, fabs(outs[i * 3 + k] -
+                streams[(3 + k) * POINTNUM + i]));
+    printf("%d x %d points: per call %.2f ns, strided %.2f ns, streams "
+        "%.2f ns per point, error %.1e\n", reps, POINTNUM,
+        times[0] * 1.0e9 / ((double)reps * POINTNUM),
+        times[1] * 1.0e9 / ((double)reps * POINTNUM),
+        times[2] * 1.0e9 / ((double)reps * POINTNUM), error);
+    free(points);
+    free(outs);
+    free(streams);
+}
+
+/* Returns the largest difference between the two batches of matrices. */
+GLdouble getMaxError(GLdouble as[][4][4], GLdouble bs[][4][4]) {
+    GLdouble error = 0.0;
+    int b, i, j;
+    for (b = 0; b < BATCH; b += 1)
+        for (i = 0; i < 4; i += 1)
+            for (j = 0; j < 4; j += 1)
+                if (fabs(as[b][i][j] - bs[b][i][j]) > error)
+                    error = fabs(as[b][i][j] - bs[b][i][j]);
+    return error;
+}
+
+/* Like getMaxError, but against the single-precision results. */
+GLdouble getMaxErrorFloat(GLdouble as[][4][4], GLfloat bs[][4][4]) {
+    GLdouble error = 0.0;
+    int b, i, j;
+    for (b = 0; b < BATCH; b += 1)
+        for (i = 0; i < 4; i += 1)
+            for (j = 0; j < 4; j += 1)
+                if (fabs(as[b][i][j] - bs[b][i][j]) > error)
+                    error = fabs(as[b][i][j] - bs[b][i][j]);
+    return error;
+}
+
+/* Prints one line of the report. */
+void report(
+        const char *name, double plain, double simd, double simdFloat,
+        GLdouble error, GLdouble errorFloat, int reps) {
+    double scale = 1.0e9 / ((double)reps * BATCH);
+    printf("%-10s %8.2f ns %8.2f ns (%5.2fx) %8.2f ns (%5.2fx)   %.1e %.1e\n",
+        name, plain * scale, simd * scale, plain / simd, simdFloat * scale,
+        plain / simdFloat, error, errorFloat);
+}
+
+int main(int argc, char *argv[]) {
+    int reps = (argc > 1) ? atoi(argv[1]) : 20000, r, b, i;
+    double start, plain, simd, simdFloat;
+    GLdouble error, errorFloat;
+    if (reps < 1)
+        reps = 1;
+    initializeBatches();
+    printf("SIMD level: %s, %d x %d calls per test\n", simdGetLevel(), reps,
+        BATCH);
+    printf("%-10s %11s %21s %21s   %s\n", "kernel", "plain", "SIMD double",
+        "SIMD float", "errors");
+    /* 4x4 times 4x4. */
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            mat444Multiply(ms[b], ns[b], outs[b]);
+    plain = getTime() - start;
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            simdMat444Multiply(ms[b], ns[b], simdOuts[b]);
+    simd = getTime() - start;
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            simdMat444MultiplyFloat(msFloat[b], nsFloat[b], outsFloat[b]);
+    simdFloat = getTime() - start;
+    report("multiply", plain, simd, simdFloat, getMaxError(outs, simdOuts),
+        getMaxErrorFloat(outs, outsFloat), reps);
+    /* 4x4 times 4. The results go in the first rows of the outputs. */
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            mat441Multiply(ms[b], vs[b], outs[b][0]);
+    plain = getTime() - start;
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            simdMat441Multiply(ms[b], vs[b], simdOuts[b][0]);
+    simd = getTime() - start;
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            simdMat441MultiplyFloat(msFloat[b], vsFloat[b], outsFloat[b][0]);
+    simdFloat = getTime() - start;
+    error = 0.0;
+    errorFloat = 0.0;
+    for (b = 0; b < BATCH; b += 1)
+        for (i = 0; i < 4; i += 1) {
+            error = fmax(error, fabs(outs[b][0][i] - simdOuts[b][0][i]));
+            errorFloat = fmax(errorFloat,
+                fabs(outs[b][0][i] - outsFloat[b][0][i]));
+        }
+    report("vector", plain, simd, simdFloat, error, errorFloat, reps);
+    /* Transpose. */
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            mTranspose4(ns[b], outs[b]);
+    plain = getTime() - start;
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            simdMat44Transpose(ns[b], simdOuts[b]);
+    simd = getTime() - start;
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            simdMat44TransposeFloat(nsFloat[b], outsFloat[b]);
+    simdFloat = getTime() - start;
+    report("transpose", plain, simd, simdFloat, getMaxError(outs, simdOuts),
+        getMaxErrorFloat(outs, outsFloat), reps);
+    /* Inverse of a rigid isometry. */
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            isoGetInverseHomogeneous(&isos[b], outs[b]);
+    plain = getTime() - start;
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            simdMat44InvertIsometry(ms[b], simdOuts[b]);
+    simd = getTime() - start;
+    start = getTime();
+    for (r = 0; r < reps; r += 1)
+        for (b = 0; b < BATCH; b += 1)
+            simdMat44InvertIsometryFloat(msFloat[b], outsFloat[b]);
+    simdFloat = getTime() - start;
+    report("inverse", plain, simd, simdFloat, getMaxError(outs, simdOuts),
+        getMaxErrorFloat(outs, outsFloat), reps);
+    benchmarkPoints((reps + 999) / 1000);
+    return 0;
+}
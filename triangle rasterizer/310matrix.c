@@ -256,7 +256,7 @@ input. */
 void mat331TransposeMultiply(
                              const GLdouble m[3][3], const GLdouble v[3], GLdouble mTimesV[3]){
     mTimesV[0] = (m[0][0]*v[0])+(m[1][0]*v[1])+(m[2][0]*v[2]);
-    mTimesV[1] = (m[0][1]*v[0])+(m[1][1]*v[1])+(m[1][2]*v[2]);
+    mTimesV[1] = (m[0][1]*v[0])+(m[1][1]*v[1])+(m[2][1]*v[2]);
     mTimesV[2] = (m[0][2]*v[0])+(m[1][2]*v[1])+(m[2][2]*v[2]);
 }
 
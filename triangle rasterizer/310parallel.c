@@ -0,0 +1,79 @@
+/*** Parallel loops ***/
+
+/* This file offers a minimal layer over POSIX threads, for splitting a large
+CPU-side job (parsing a file, computing normals, transforming vertices) into
+one piece per processor core. It is deliberately not a thread pool: threads
+are created and joined for each job, which costs tens of microseconds, so use
+it only for jobs that take much longer than that. On Linux, link with
+-lpthread. */
+
+#define parMAXTHREADS 64
+
+/* Returns the number of threads that a job should use by default: the number
+of online processors, but at least 1 and at most parMAXTHREADS. */
+int parGetDefaultThreadNum(void) {
+    long cpuNum = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpuNum < 1)
+        return 1;
+    if (cpuNum > parMAXTHREADS)
+        return parMAXTHREADS;
+    return (int)cpuNum;
+}
+
+/* Splits the index range [0, count) into threadNum nearly equal, contiguous
+pieces, and places the thread-th piece into [*first, *last). Some pieces are
+empty if count < threadNum. */
+void parGetRange(
+        GLuint count, int thread, int threadNum, GLuint *first, GLuint *last) {
+    *first = (GLuint)((uint64_t)count * thread / threadNum);
+    *last = (GLuint)((uint64_t)count * (thread + 1) / threadNum);
+}
+
+typedef struct parTask parTask;
+struct parTask {
+    void (*function)(void *data, int thread, int threadNum);
+    void *data;
+    int thread, threadNum;
+};
+
+/* Helper function for parRun. */
+void *parTaskMain(void *task) {
+    parTask *t = (parTask *)task;
+    t->function(t->data, t->thread, t->threadNum);
+    return NULL;
+}
+
+/* Calls function(data, thread, threadNum) once for each thread in
+0, ..., threadNum - 1, concurrently, and returns when all calls have returned.
+Call 0 runs on the calling thread. If a thread cannot be created, then its call
+runs on the calling thread instead, so every call happens exactly once no
+matter what. The function must not write to memory that another call reads or
+writes; typically each call handles the piece of a job given by parGetRange. */
+void parRun(
+        int threadNum, void (*function)(void *data, int thread, int threadNum),
+        void *data) {
+    pthread_t threads[parMAXTHREADS];
+    parTask tasks[parMAXTHREADS];
+    int created[parMAXTHREADS];
+    int i;
+    if (threadNum < 1)
+        threadNum = 1;
+    if (threadNum > parMAXTHREADS)
+        threadNum = parMAXTHREADS;
+    for (i = 0; i < threadNum; i += 1) {
+        tasks[i].function = function;
+        tasks[i].data = data;
+        tasks[i].thread = i;
+        tasks[i].threadNum = threadNum;
+    }
+    for (i = 1; i < threadNum; i += 1)
+        created[i] = (pthread_create(&threads[i], NULL, parTaskMain,
+            &tasks[i]) == 0);
+    function(data, 0, threadNum);
+    for (i = 1; i < threadNum; i += 1) {
+        if (created[i])
+            pthread_join(threads[i], NULL);
+        else
+            function(data, i, threadNum);
+    }
+}
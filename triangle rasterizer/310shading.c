@@ -19,8 +19,8 @@ checking. */
 /* Compiles a shader from GLSL source code. type is either GL_VERTEX_SHADER or
 GL_FRAGMENT_SHADER. If an error occurs, then returns 0. Otherwise, returns a
 compiled shader, which the user must eventually deallocate with glDeleteShader.
-(But usually this function is called from shaMakeProgram, which calls
-glDeleteShader on the user's behalf.) */
+(shaMakeProgram doesn't use this function, but compiles its shaders through
+shaStartProgram, which doesn't wait for each shader in turn.) */
 GLuint shaMakeShader(GLenum type, const GLchar *shaderCode) {
     GLuint shader = glCreateShader(type);
     if (shader == 0) {
@@ -44,51 +44,114 @@ GLuint shaMakeShader(GLenum type, const GLchar *shaderCode) {
     return shader;
 }
 
-/* Compiles and links a shader program from two pieces of GLSL source code. If
-an error occurs, then returns 0. Otherwise, returns a shader program, which the
-user should eventually deallocate using glDeleteProgram. */
-GLuint shaMakeProgram(const GLchar *vertexCode, const GLchar *fragmentCode) {
-    GLuint vertexShader, fragmentShader, program;
-    vertexShader = shaMakeShader(GL_VERTEX_SHADER, vertexCode);
-    if (vertexShader == 0)
-        return 0;
-    fragmentShader = shaMakeShader(GL_FRAGMENT_SHADER, fragmentCode);
-    if (fragmentShader == 0) {
-        glDeleteShader(vertexShader);
-        return 0;
+/* Helper function for shaFinishProgram. Prints the info log of the shader or
+program. */
+void shaPrintInfoLog(GLuint object, int isProgram) {
+    GLsizei length = 0;
+    if (isProgram)
+        glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+    else
+        glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+    GLchar *infoLog = (GLchar *)malloc(length + 1);
+    if (infoLog == NULL)
+        return;
+    infoLog[0] = '\0';
+    if (isProgram) {
+        glGetProgramInfoLog(object, length + 1, &length, infoLog);
+        fprintf(stderr, "error: shaFinishProgram: glGetProgramInfoLog:\n%s\n",
+            infoLog);
+    } else {
+        glGetShaderInfoLog(object, length + 1, &length, infoLog);
+        fprintf(stderr, "error: shaFinishProgram: glGetShaderInfoLog:\n%s\n",
+            infoLog);
     }
-    program = glCreateProgram();
-    if (program == 0) {
-        fprintf(stderr, "error: shaMakeProgram: glCreateProgram failed\n");
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+    free(infoLog);
+}
+
+/* Starts compiling and linking a shader program from two pieces of GLSL source
+code, but doesn't wait for the results: no status is asked for, because asking
+makes the driver finish the work on the spot. That lets a driver that compiles
+in the background (see shaVariantsBuild) work on many programs at once. If
+retrievable is non-zero, then the program's binary is requested to be
+retrievable (see shaMakeCachedProgram). shaders receives the two shaders.
+Returns the program, or 0 if an error occurs. Either way, pass the program and
+the shaders to shaFinishProgram. */
+GLuint shaStartProgram(
+        const GLchar *vertexCode, const GLchar *fragmentCode, int retrievable,
+        GLuint shaders[2]) {
+    GLenum types[2] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    const GLchar *codes[2] = {vertexCode, fragmentCode};
+    GLuint program = glCreateProgram();
+    int i;
+    for (i = 0; i < 2; i += 1)
+        shaders[i] = glCreateShader(types[i]);
+    if (program == 0 || shaders[0] == 0 || shaders[1] == 0) {
+        fprintf(stderr, "error: shaStartProgram: glCreateProgram or "
+            "glCreateShader failed\n");
+        glDeleteProgram(program);
         return 0;
     }
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
+    for (i = 0; i < 2; i += 1) {
+        glShaderSource(shaders[i], 1, &codes[i], NULL);
+        glCompileShader(shaders[i]);
+        glAttachShader(program, shaders[i]);
+    }
+    if (retrievable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+            GL_TRUE);
     glLinkProgram(program);
-    GLint status;
-    glGetProgramiv(program, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE) {
-        GLsizei length;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
-        GLchar *infoLog = (GLchar *)malloc(length);
-        glGetProgramInfoLog(program, length, &length, infoLog);
-        fprintf(stderr, "error: shaMakeProgram: glGetProgramInfoLog:\n%s\n",
-            infoLog);
-        free(infoLog);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+    return program;
+}
+
+/* Finishes the work begun by shaStartProgram, waiting for the driver if it
+isn't done. Reports any compiler or linker errors. Either way, deletes the
+shaders, which are built into the program and don't need to be remembered
+separately. Returns the program, or 0 if an error occurred. */
+GLuint shaFinishProgram(GLuint program, GLuint shaders[2]) {
+    GLint status = GL_FALSE, compiled;
+    int i, reported = 0;
+    if (program != 0)
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (program != 0 && status != GL_TRUE) {
+        for (i = 0; i < 2; i += 1) {
+            glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+            if (compiled != GL_TRUE) {
+                shaPrintInfoLog(shaders[i], 0);
+                reported = 1;
+            }
+        }
+        if (!reported)
+            shaPrintInfoLog(program, 1);
         glDeleteProgram(program);
-        return 0;
+        program = 0;
     }
-    /* Success. The shaders are built into the program and don't need to be
-    remembered separately, so delete them. */
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    /* Deleting shader 0 is silently ignored. */
+    glDeleteShader(shaders[0]);
+    glDeleteShader(shaders[1]);
     return program;
 }
 
+/* Compiles and links a shader program from two pieces of GLSL source code. If
+retrievable is non-zero, then the program's binary is requested to be
+retrievable (see shaMakeCachedProgram). If an error occurs, then returns 0.
+Otherwise, returns a shader program, which the user should eventually
+deallocate using glDeleteProgram. */
+GLuint shaMakeRetrievableProgram(
+        const GLchar *vertexCode, const GLchar *fragmentCode,
+        int retrievable) {
+    GLuint shaders[2] = {0, 0};
+    GLuint program = shaStartProgram(vertexCode, fragmentCode, retrievable,
+        shaders);
+    return shaFinishProgram(program, shaders);
+}
+
+/* Compiles and links a shader program from two pieces of GLSL source code. If
+an error occurs, then returns 0. Otherwise, returns a shader program, which the
+user should eventually deallocate using glDeleteProgram. */
+GLuint shaMakeProgram(const GLchar *vertexCode, const GLchar *fragmentCode) {
+    return shaMakeRetrievableProgram(vertexCode, fragmentCode, 0);
+}
+
 /* Checks the validity of a shader program against the rest of the current
 OpenGL state. If you choose to use this function, invoke it *after*
 shaMakeProgram, setting up textures, etc. Returns 0 if okay, non-zero if error.
@@ -110,17 +173,416 @@ int shaValidateProgram(GLuint program) {
     return 0;
 }
 
+/*** Program cache ***/
+
+/* Compiling and linking GLSL takes the driver milliseconds per program, which
+adds up at startup when there are many programs. So, once a program has been
+built, its binary (as produced by the driver, with glGetProgramBinary) can be
+saved to disk, and loaded with glProgramBinary at the next launch instead of
+compiled. The file is named by a 64-bit hash of everything that determines the
+binary: the two shaders' code, the attribute names, and the driver's vendor,
+renderer, and version strings. A binary that the driver rejects anyway (say,
+after a driver update with the same version string) is recompiled and
+overwritten. The cache is off until shaSetProgramCache is called. Binaries
+require OpenGL 4.1; with an older context or a driver that offers no binary
+formats, every program is compiled. */
+
+#define shaCACHEMAGIC 0x43414853
+#define shaCACHEPATHLENGTH 1024
+
+typedef struct shaCacheHeader shaCacheHeader;
+struct shaCacheHeader {
+    uint32_t magic, format;
+    uint64_t hash;
+    uint32_t length, padding;
+};
+
+char shaCacheDirectory[shaCACHEPATHLENGTH] = "";
+
+/* Counts of the programs loaded from the cache and compiled instead, since the
+start of the program. Feel free to read them. */
+GLuint shaCacheHitNum = 0, shaCacheMissNum = 0;
+
+/* Turns the program cache on, with the binaries stored in the given directory,
+which is created if it doesn't exist. If directory is NULL, turns the cache
+off. Returns 0 on success, non-zero on failure. */
+int shaSetProgramCache(const char *directory) {
+    if (directory == NULL) {
+        shaCacheDirectory[0] = '\0';
+        return 0;
+    }
+    if (strlen(directory) + 32 > shaCACHEPATHLENGTH) {
+        fprintf(stderr, "error: shaSetProgramCache: path too long\n");
+        return 1;
+    }
+    mkdir(directory, 0755);
+    struct stat info;
+    if (stat(directory, &info) != 0 || !S_ISDIR(info.st_mode)) {
+        fprintf(stderr, "error: shaSetProgramCache: can't make %s\n",
+            directory);
+        return 2;
+    }
+    strcpy(shaCacheDirectory, directory);
+    return 0;
+}
+
+/* Helper function for shaMakeCachedProgram. Returns the current time in
+seconds. */
+GLdouble shaGetTime(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 0.000001;
+}
+
+/* Helper function for shaMakeCachedProgram. Continues the FNV-1a hash over the
+string, including its terminating null, so that adjacent strings can't run
+together. A NULL string hashes like an empty one. */
+uint64_t shaHashString(uint64_t hash, const char *string) {
+    if (string != NULL)
+        for (; *string != '\0'; string += 1)
+            hash = (hash ^ (unsigned char)*string) * 1099511628211u;
+    return hash * 1099511628211u;
+}
+
+/* Helper function for shaMakeCachedProgram. Tries to make a program from the
+binary in the file. Returns the program, or 0 if there is no usable binary. The
+length in the header is checked against the file's size before anything is
+allocated, so that a truncated or corrupt file is just a miss. */
+GLuint shaLoadProgramBinary(const char *path, uint64_t hash) {
+    shaCacheHeader header;
+    struct stat info;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return 0;
+    if (fstat(fileno(file), &info) != 0 ||
+            fread(&header, sizeof(header), 1, file) != 1 ||
+            header.magic != shaCACHEMAGIC || header.hash != hash ||
+            header.length == 0 ||
+            header.length > (uint64_t)info.st_size - sizeof(header)) {
+        fclose(file);
+        return 0;
+    }
+    void *binary = malloc(header.length);
+    if (binary == NULL ||
+            fread(binary, 1, header.length, file) != header.length) {
+        free(binary);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    GLuint program = glCreateProgram();
+    GLint status = GL_FALSE;
+    if (program != 0) {
+        glProgramBinary(program, header.format, binary, header.length);
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (status != GL_TRUE) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    free(binary);
+    return program;
+}
+
+/* Helper function for shaMakeCachedProgram. Writes the program's binary to the
+file, by way of a temporary file, so that a concurrent or interrupted launch
+never sees half a binary. Failure just means a miss next time. */
+void shaSaveProgramBinary(GLuint program, const char *path, uint64_t hash) {
+    shaCacheHeader header;
+    char temporary[shaCACHEPATHLENGTH + 16];
+    GLint length = 0;
+    GLenum format;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    void *binary = malloc(length);
+    if (binary == NULL)
+        return;
+    glGetProgramBinary(program, length, &length, &format, binary);
+    header.magic = shaCACHEMAGIC;
+    header.format = format;
+    header.hash = hash;
+    header.length = length;
+    header.padding = 0;
+    sprintf(temporary, "%s.%d", path, (int)getpid());
+    FILE *file = fopen(temporary, "wb");
+    if (file != NULL) {
+        int failed = (fwrite(&header, sizeof(header), 1, file) != 1 ||
+            fwrite(binary, 1, length, file) != (size_t)length);
+        if (fclose(file) != 0 || failed || rename(temporary, path) != 0) {
+            fprintf(stderr, "error: shaSaveProgramBinary: can't write %s\n",
+                path);
+            remove(temporary);
+        }
+    }
+    free(binary);
+}
+
+/* Helper function for shaMakeCachedProgram and shaVariantsBuild. If the cache
+is on and the driver can save binaries, then writes the program's hash and the
+path of its cache file, and returns 1. Otherwise returns 0. path must have room
+for shaCACHEPATHLENGTH + 32 characters. */
+int shaGetCacheKey(
+        const GLchar *vertexCode, const GLchar *fragmentCode, int attrNum,
+        const GLchar *attrNames[], uint64_t *hash, char path[]) {
+    GLint major = 0, minor = 0, formatNum = 0;
+    int i;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major > 4 || (major == 4 && minor >= 1))
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatNum);
+    if (shaCacheDirectory[0] == '\0' || formatNum <= 0)
+        return 0;
+    *hash = 14695981039346656037u;
+    *hash = shaHashString(*hash, vertexCode);
+    *hash = shaHashString(*hash, fragmentCode);
+    for (i = 0; i < attrNum; i += 1)
+        *hash = shaHashString(*hash, attrNames[i]);
+    *hash = shaHashString(*hash, (const char *)glGetString(GL_VENDOR));
+    *hash = shaHashString(*hash, (const char *)glGetString(GL_RENDERER));
+    *hash = shaHashString(*hash, (const char *)glGetString(GL_VERSION));
+    sprintf(path, "%s/%016llx.bin", shaCacheDirectory,
+        (unsigned long long)*hash);
+    return 1;
+}
+
+/* Like shaMakeProgram, but loads the program from the program cache if
+possible, and otherwise saves the compiled program there. The attribute names
+are those that the user will look up; they are part of the cache key. If
+seconds is not NULL, then it receives the time taken to load or build the
+program. If hit is not NULL, then it receives 1 if the program came from the
+cache and 0 if it was compiled. */
+GLuint shaMakeCachedProgram(
+        const GLchar *vertexCode, const GLchar *fragmentCode, int attrNum,
+        const GLchar *attrNames[], GLdouble *seconds, int *hit) {
+    char path[shaCACHEPATHLENGTH + 32];
+    uint64_t hash;
+    GLdouble start = shaGetTime();
+    GLuint program = 0;
+    int cached = 0;
+    if (shaGetCacheKey(vertexCode, fragmentCode, attrNum, attrNames, &hash,
+            path) == 0)
+        program = shaMakeProgram(vertexCode, fragmentCode);
+    else {
+        program = shaLoadProgramBinary(path, hash);
+        if (program != 0) {
+            cached = 1;
+            shaCacheHitNum += 1;
+        } else {
+            shaCacheMissNum += 1;
+            program = shaMakeRetrievableProgram(vertexCode, fragmentCode, 1);
+            if (program != 0)
+                shaSaveProgramBinary(program, path, hash);
+        }
+    }
+    if (seconds != NULL)
+        *seconds = shaGetTime() - start;
+    if (hit != NULL)
+        *hit = cached;
+    return program;
+}
+
+
+/*** State cache ***/
+
+/* Redundant state changes and uniform uploads are cheap for us to detect, but
+costly for the driver to perform. So the functions in this section remember the
+program, VAO, active texture unit, and 2D textures bound through them, and skip
+calls that would change nothing. Likewise, each shading program keeps a shadow
+copy of the last value sent to each of its uniform locations, and the uniform
+setters below skip values that haven't changed. For the cache to stay right,
+all of those binds must go through these functions, and uniforms must be set
+through the setters below; after doing otherwise, call shaInvalidateState. */
+
+#define shaUNKNOWN 0xFFFFFFFF
+#define shaMAXUNITS 32
+
+/* An entry in a program's shadow table. A location of -1 marks an empty entry.
+Vectors use the first few values; matrices are stored as sent. */
+typedef struct shaShadow shaShadow;
+struct shaShadow {
+    GLint location;
+    GLfloat value[16];
+};
+
+/* The shadow tables of the programs made by shaInitialize, which grow as
+needed, so that every variant of every shaVariants can have one. cap is a power
+of two. */
+typedef struct shaShadowTable shaShadowTable;
+struct shaShadowTable {
+    GLuint program, cap;
+    shaShadow *shadows;
+};
+
+GLuint shaProgramNow = shaUNKNOWN, shaVAONow = shaUNKNOWN;
+GLuint shaUnitNow = shaUNKNOWN, shaTexturesNow[shaMAXUNITS];
+GLuint shaTexturesKnown = 0;
+shaShadowTable *shaTables = NULL;
+GLuint shaTableNum = 0, shaTableCap = 0;
+shaShadowTable *shaTableNow = NULL;
+
+/* Counts of the calls issued to OpenGL, and of the calls skipped because they
+would have changed nothing, by the functions in this section and by the uniform
+setters, since the last call to shaResetCounters. Feel free to read them. */
+GLuint shaIssuedNum = 0, shaSkippedNum = 0;
+
+/* Zeroes the counters above. Call this once per frame to get per-frame counts.
+*/
+void shaResetCounters(void) {
+    shaIssuedNum = 0;
+    shaSkippedNum = 0;
+}
+
+/* Forgets all cached state and uniform values, so that the next calls are
+issued whatever their values. */
+void shaInvalidateState(void) {
+    GLuint i, k;
+    shaProgramNow = shaUNKNOWN;
+    shaVAONow = shaUNKNOWN;
+    shaUnitNow = shaUNKNOWN;
+    shaTexturesKnown = 0;
+    shaTableNow = NULL;
+    for (i = 0; i < shaTableNum; i += 1)
+        for (k = 0; k < shaTables[i].cap; k += 1)
+            shaTables[i].shadows[k].location = -1;
+}
+
+/* Helper function for the uniform setters. Compares the count values with the
+current program's shadow copy for the location. Returns 0 if they are the same,
+so that the upload can be skipped. Otherwise updates the shadow copy (if there
+is room) and returns 1. Updates the counters. */
+int shaShadowUpdate(GLint location, const GLfloat *value, GLuint count) {
+    shaShadowTable *table = shaTableNow;
+    GLuint probe, k;
+    if (location < 0 || table == NULL) {
+        shaIssuedNum += 1;
+        return 1;
+    }
+    k = ((GLuint)location * 2654435761u) & (table->cap - 1);
+    for (probe = 0; probe < table->cap; probe += 1) {
+        shaShadow *shadow = &(table->shadows[k]);
+        if (shadow->location == location) {
+            if (memcmp(shadow->value, value, count * sizeof(GLfloat)) == 0) {
+                shaSkippedNum += 1;
+                return 0;
+            }
+            memcpy(shadow->value, value, count * sizeof(GLfloat));
+            break;
+        }
+        if (shadow->location == -1) {
+            shadow->location = location;
+            memcpy(shadow->value, value, count * sizeof(GLfloat));
+            break;
+        }
+        k = (k + 1) & (table->cap - 1);
+    }
+    shaIssuedNum += 1;
+    return 1;
+}
+
+/* Makes the program current, unless it already is. */
+void shaUseProgram(GLuint program) {
+    GLuint i;
+    if (program == shaProgramNow) {
+        shaSkippedNum += 1;
+        return;
+    }
+    glUseProgram(program);
+    shaIssuedNum += 1;
+    shaProgramNow = program;
+    shaTableNow = NULL;
+    for (i = 0; i < shaTableNum; i += 1)
+        if (shaTables[i].program == program)
+            shaTableNow = &(shaTables[i]);
+}
+
+/* Binds the VAO, unless it already is bound. */
+void shaBindVertexArray(GLuint vao) {
+    if (vao == shaVAONow) {
+        shaSkippedNum += 1;
+        return;
+    }
+    glBindVertexArray(vao);
+    shaIssuedNum += 1;
+    shaVAONow = vao;
+}
+
+/* Makes texture unit GL_TEXTURE0 + unit active, unless it already is. */
+void shaActiveTexture(GLuint unit) {
+    if (unit == shaUnitNow) {
+        shaSkippedNum += 1;
+        return;
+    }
+    glActiveTexture(GL_TEXTURE0 + unit);
+    shaIssuedNum += 1;
+    shaUnitNow = unit;
+}
+
+/* Binds the 2D texture to texture unit GL_TEXTURE0 + unit, unless it already
+is bound there. Leaves that unit active if it binds. */
+void shaBindTexture(GLuint unit, GLuint texture) {
+    if (unit < shaMAXUNITS && ((shaTexturesKnown >> unit) & 1) &&
+            shaTexturesNow[unit] == texture) {
+        shaSkippedNum += 1;
+        return;
+    }
+    shaActiveTexture(unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    shaIssuedNum += 1;
+    if (unit < shaMAXUNITS) {
+        shaTexturesNow[unit] = texture;
+        shaTexturesKnown |= 1u << unit;
+    }
+}
+
+/* Call after glDeleteVertexArrays, which unbinds the deleted VAO. */
+void shaForgetVertexArray(GLuint vao) {
+    if (vao == shaVAONow)
+        shaVAONow = 0;
+}
+
+/* Call after glDeleteTextures, which unbinds the deleted texture. */
+void shaForgetTexture(GLuint texture) {
+    for (GLuint unit = 0; unit < shaMAXUNITS; unit += 1)
+        if (((shaTexturesKnown >> unit) & 1) &&
+                shaTexturesNow[unit] == texture)
+            shaTexturesNow[unit] = 0;
+}
+
+
+
+/*** Uniforms ***/
+
 /* We want to pass 4x4 matrices into uniforms in OpenGL shaders, but there are
 two obstacles. First, our matrix library uses GLdouble matrices, but OpenGL
 shaders expect GLfloat matrices. Second, C matrices are implicitly stored one-
 row-after-another, while OpenGL shaders expect matrices to be stored one-column-
-after-another. This function plows through both of those obstacles. */
+after-another. This function plows through both of those obstacles. Like the
+other setters here, it skips the upload if the current program's uniform
+already has the value. */
 void shaSetUniform44(GLdouble m[4][4], GLint uniformLocation) {
     GLfloat mTFloat[4][4];
     for (int i = 0; i < 4; i += 1)
         for (int j = 0; j < 4; j += 1)
             mTFloat[i][j] = m[j][i];
-    glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, (GLfloat *)mTFloat);
+    if (shaShadowUpdate(uniformLocation, (GLfloat *)mTFloat, 16))
+        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, (GLfloat *)mTFloat);
+}
+
+/* When the same matrix is sent many times, it is cheaper to do the conversion
+once. This function fills mTFloat with m converted as in shaSetUniform44. */
+void shaConvertUniform44(const GLdouble m[4][4], GLfloat mTFloat[4][4]) {
+    for (int i = 0; i < 4; i += 1)
+        for (int j = 0; j < 4; j += 1)
+            mTFloat[i][j] = m[j][i];
+}
+
+/* Sends a matrix already converted by shaConvertUniform44. */
+void shaSetConvertedUniform44(
+        const GLfloat mTFloat[4][4], GLint uniformLocation) {
+    if (shaShadowUpdate(uniformLocation, (const GLfloat *)mTFloat, 16))
+        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE,
+            (const GLfloat *)mTFloat);
 }
 
 /* Here is a similar function for vectors. */
@@ -128,7 +590,8 @@ void shaSetUniform3(GLdouble v[3], GLint uniformLocation) {
     GLfloat vFloat[3];
     for (int i = 0; i < 3; i += 1)
         vFloat[i] = v[i];
-    glUniform3fv(uniformLocation, 1, vFloat);
+    if (shaShadowUpdate(uniformLocation, vFloat, 3))
+        glUniform3fv(uniformLocation, 1, vFloat);
 }
 
 /* Here is a similar function for vectors. */
@@ -136,7 +599,16 @@ void shaSetUniform4(double v[4], GLint uniformLocation) {
     GLfloat vFloat[4];
     for (int i = 0; i < 4; i += 1)
         vFloat[i] = v[i];
-    glUniform4fv(uniformLocation, 1, vFloat);
+    if (shaShadowUpdate(uniformLocation, vFloat, 4))
+        glUniform4fv(uniformLocation, 1, vFloat);
+}
+
+/* Here is a similar function for integers, such as the texture units of
+samplers. */
+void shaSetUniform1i(GLint value, GLint uniformLocation) {
+    GLfloat vFloat = (GLfloat)value;
+    if (shaShadowUpdate(uniformLocation, &vFloat, 1))
+        glUniform1i(uniformLocation, value);
 }
 
 
@@ -146,43 +618,108 @@ void shaSetUniform4(double v[4], GLint uniformLocation) {
 /* This data structure packages a compiled shader program with its locations. */
 
 /* Feel free to read from this struct's members, but don't write to them except
-through the accessor functions. */
+through the accessor functions. shadows is the program's shadow table (see
+shaShadowUpdate), with shadowCap entries. buildTime is the time taken to load
+or compile the program, and cacheHit is 1 if it was loaded from the program
+cache. */
 typedef struct shaShading shaShading;
 struct shaShading {
     GLuint program;
     int unifNum, attrNum;
     GLint *unifLocs, *attrLocs;
+    GLuint shadowCap;
+    shaShadow *shadows;
+    GLdouble buildTime;
+    int cacheHit;
 };
 
 /* Frees the resources underlying the shading program. You must call this
 function when you are done using the program. */
 void shaDestroy(shaShading *sha) {
+    GLuint i;
+    for (i = 0; i < shaTableNum; i += 1)
+        if (shaTables[i].shadows == sha->shadows) {
+            shaTableNum -= 1;
+            shaTables[i] = shaTables[shaTableNum];
+            break;
+        }
+    if (shaTableNum == 0) {
+        free(shaTables);
+        shaTables = NULL;
+        shaTableCap = 0;
+    }
+    /* A deleted program's name can be reused by the next one made. */
+    if (shaProgramNow == sha->program)
+        shaProgramNow = shaUNKNOWN;
+    shaTableNow = NULL;
     glDeleteProgram(sha->program);
     free(sha->unifLocs);
+    free(sha->shadows);
 }
 
-/* Returns error code; 0 on success and non-zero on failure. Don't forget to
-shaDestroy when you are done using the shader program. */
-int shaInitialize(
-        shaShading *sha, const GLchar *vertexCode, const GLchar *fragmentCode,
-        int unifNum, const GLchar *unifNames[], int attrNum,
-        const GLchar *attrNames[]) {
+/* Helper function for shaInitialize and shaVariantsBuild. Wraps an already
+linked program, which the shading then owns, and looks up its locations. If
+strict is non-zero, then a missing uniform or attribute is an error; otherwise
+its location is -1. Returns error code; 0 on success and non-zero on failure,
+in which case the program has been deleted. */
+int shaInitializeFromProgram(
+        shaShading *sha, GLuint program, int unifNum,
+        const GLchar *unifNames[], int attrNum, const GLchar *attrNames[],
+        int strict) {
+    sha->program = program;
     sha->unifLocs = (GLint *)malloc((unifNum + attrNum) * sizeof(GLint));
-    if (sha->unifLocs == NULL)
+    if (sha->unifLocs == NULL) {
+        fprintf(stderr, "error: shaInitialize: can't allocate locations\n");
+        glDeleteProgram(program);
         return 1;
-    sha->program = shaMakeProgram(vertexCode, fragmentCode);
-    if (sha->program == 0) {
+    }
+    /* Give the shadow table room for every active uniform (counting array
+    elements generously), at most half full. */
+    GLint activeNum = 0;
+    glGetProgramiv(sha->program, GL_ACTIVE_UNIFORMS, &activeNum);
+    sha->shadowCap = 16;
+    while (sha->shadowCap < 4 * ((GLuint)activeNum + 4))
+        sha->shadowCap *= 2;
+    sha->shadows = (shaShadow *)malloc(sha->shadowCap * sizeof(shaShadow));
+    if (sha->shadows != NULL && shaTableNum == shaTableCap) {
+        GLuint cap = (shaTableCap == 0) ? 64 : 2 * shaTableCap;
+        shaShadowTable *tables = (shaShadowTable *)realloc(shaTables,
+            cap * sizeof(shaShadowTable));
+        if (tables == NULL) {
+            free(sha->shadows);
+            sha->shadows = NULL;
+        } else {
+            /* The current table moved with the others. */
+            shaTables = tables;
+            shaTableCap = cap;
+            shaTableNow = NULL;
+            shaProgramNow = shaUNKNOWN;
+        }
+    }
+    if (sha->shadows == NULL) {
+        fprintf(stderr, "error: shaInitialize: can't allocate a shadow "
+            "table\n");
+        glDeleteProgram(sha->program);
         free(sha->unifLocs);
         return 2;
     }
+    for (GLuint k = 0; k < sha->shadowCap; k += 1)
+        sha->shadows[k].location = -1;
+    shaTables[shaTableNum].program = sha->program;
+    shaTables[shaTableNum].cap = sha->shadowCap;
+    shaTables[shaTableNum].shadows = sha->shadows;
+    shaTableNum += 1;
     sha->unifNum = unifNum;
     sha->attrNum = attrNum;
     sha->attrLocs = &(sha->unifLocs[unifNum]);
-    glUseProgram(sha->program);
+    /* The program's name may be that of a deleted one, so make sure it is
+    really used. */
+    shaProgramNow = shaUNKNOWN;
+    shaUseProgram(sha->program);
     int i;
     for (i = 0; i < unifNum; i += 1) {
         sha->unifLocs[i] = glGetUniformLocation(sha->program, unifNames[i]);
-        if (sha->unifLocs[i] == -1) {
+        if (sha->unifLocs[i] == -1 && strict) {
             fprintf(stderr,
                 "error: shaInitialize: uniform location %s does not exist\n",
                 unifNames[i]);
@@ -192,7 +729,7 @@ int shaInitialize(
     }
     for (i = 0; i < attrNum; i += 1) {
         sha->attrLocs[i] = glGetAttribLocation(sha->program, attrNames[i]);
-        if (sha->attrLocs[i] == -1) {
+        if (sha->attrLocs[i] == -1 && strict) {
             fprintf(stderr,
                 "error: shaInitialize: attribute location %s does not exist\n",
                 attrNames[i]);
@@ -203,4 +740,529 @@ int shaInitialize(
     return 0;
 }
 
+/* Returns error code; 0 on success and non-zero on failure. Don't forget to
+shaDestroy when you are done using the shader program. The program is loaded
+from the program cache, if that is on (see shaSetProgramCache). */
+int shaInitialize(
+        shaShading *sha, const GLchar *vertexCode, const GLchar *fragmentCode,
+        int unifNum, const GLchar *unifNames[], int attrNum,
+        const GLchar *attrNames[]) {
+    GLdouble seconds;
+    int hit;
+    GLuint program = shaMakeCachedProgram(vertexCode, fragmentCode, attrNum,
+        attrNames, &seconds, &hit);
+    if (program == 0)
+        return 2;
+    int error = shaInitializeFromProgram(sha, program, unifNum, unifNames,
+        attrNum, attrNames, 1);
+    sha->buildTime = seconds;
+    sha->cacheHit = hit;
+    return error;
+}
+
+
+
+/*** Variants ***/
+
+/* A shader that branches on a material's features (is it specular? does it
+have a normal map?) pays for the branches at every vertex or fragment. Instead,
+the features can be decided when compiling, by #defines, with one program for
+each combination of features that the scene uses. A variant set does that for
+a pair of GLSL sources and up to shaMAXFEATURES features. Each feature has a
+name and a number of values, 0, 1, ..., valueNum - 1. The variant with feature
+values values[0], values[1], ... is the sources with the lines
+    #define featureNames[0] values[0]
+    #define featureNames[1] values[1]
+    ...
+inserted after their #version lines. So GLSL like
+    #if SPECULAR
+        (specular lighting)
+    #endif
+costs nothing in the variants where SPECULAR is 0. Because a feature can
+compile away a uniform or attribute, a variant's missing locations are -1,
+rather than errors.
+
+Many variants take a while to build, so mark the ones needed with
+shaVariantsRequire, and build them together with shaVariantsBuild. It starts
+every compile and link before asking about any, so that the driver can work on
+them in parallel; with KHR_parallel_shader_compile, it asks the driver to use
+as many threads as it likes, and collects the programs as they complete.
+Variants in the program cache (see shaSetProgramCache) are loaded instead. */
+
+#define shaMAXFEATURES 8
+#define shaMAXVARIANTS 4096
+#define shaVARIANTUNNEEDED 0
+#define shaVARIANTNEEDED 1
+#define shaVARIANTBUILT 2
+#define shaVARIANTFAILED 3
+
+/* Feel free to read from this struct's members, but don't write to them. The
+code and name strings are not copied; they must stay valid until the last call
+to shaVariantsBuild. states holds one of the shaVARIANT constants for each
+variant. */
+typedef struct shaVariants shaVariants;
+struct shaVariants {
+    const GLchar *vertexCode, *fragmentCode;
+    int unifNum, attrNum;
+    const GLchar **unifNames, **attrNames;
+    GLuint featureNum, variantNum;
+    const GLchar *featureNames[shaMAXFEATURES];
+    GLuint valueNums[shaMAXFEATURES];
+    int *states;
+    shaShading *variants;
+};
+
+/* Initializes an empty variant set, with featureNum features. No programs are
+built yet. Returns error code; 0 on success and non-zero on failure. Don't
+forget to call shaVariantsDestroy when you are done with the set. */
+int shaVariantsInitialize(
+        shaVariants *vars, const GLchar *vertexCode,
+        const GLchar *fragmentCode, GLuint featureNum,
+        const GLchar *featureNames[], const GLuint valueNums[], int unifNum,
+        const GLchar *unifNames[], int attrNum, const GLchar *attrNames[]) {
+    GLuint k;
+    if (featureNum > shaMAXFEATURES) {
+        fprintf(stderr, "error: shaVariantsInitialize: more than %d "
+            "features\n", shaMAXFEATURES);
+        return 1;
+    }
+    vars->variantNum = 1;
+    for (k = 0; k < featureNum; k += 1) {
+        if (valueNums[k] == 0 ||
+                vars->variantNum * valueNums[k] > shaMAXVARIANTS) {
+            fprintf(stderr, "error: shaVariantsInitialize: feature %s makes "
+                "too many variants\n", featureNames[k]);
+            return 2;
+        }
+        vars->variantNum *= valueNums[k];
+        vars->featureNames[k] = featureNames[k];
+        vars->valueNums[k] = valueNums[k];
+    }
+    vars->states = (int *)calloc(vars->variantNum, sizeof(int));
+    vars->variants = (shaShading *)malloc(
+        vars->variantNum * sizeof(shaShading));
+    if (vars->states == NULL || vars->variants == NULL) {
+        free(vars->states);
+        free(vars->variants);
+        return 3;
+    }
+    vars->vertexCode = vertexCode;
+    vars->fragmentCode = fragmentCode;
+    vars->featureNum = featureNum;
+    vars->unifNum = unifNum;
+    vars->unifNames = unifNames;
+    vars->attrNum = attrNum;
+    vars->attrNames = attrNames;
+    return 0;
+}
+
+/* Releases the variants that have been built, and the set itself. */
+void shaVariantsDestroy(shaVariants *vars) {
+    GLuint i;
+    for (i = 0; i < vars->variantNum; i += 1)
+        if (vars->states[i] == shaVARIANTBUILT)
+            shaDestroy(&(vars->variants[i]));
+    free(vars->states);
+    free(vars->variants);
+}
+
+/* Returns the index of the variant with the given feature values (featureNum
+of them), or variantNum if a value is out of range. The first feature varies
+slowest. */
+GLuint shaVariantsGetIndex(const shaVariants *vars, const GLuint values[]) {
+    GLuint index = 0, k;
+    for (k = 0; k < vars->featureNum; k += 1) {
+        if (values[k] >= vars->valueNums[k])
+            return vars->variantNum;
+        index = index * vars->valueNums[k] + values[k];
+    }
+    return index;
+}
+
+/* Marks the variant with the given feature values as needed, so that the next
+shaVariantsBuild builds it, if it isn't built already. */
+void shaVariantsRequire(shaVariants *vars, const GLuint values[]) {
+    GLuint index = shaVariantsGetIndex(vars, values);
+    if (index < vars->variantNum &&
+            vars->states[index] == shaVARIANTUNNEEDED)
+        vars->states[index] = shaVARIANTNEEDED;
+}
+
+/* Marks every variant as needed. */
+void shaVariantsRequireAll(shaVariants *vars) {
+    GLuint i;
+    for (i = 0; i < vars->variantNum; i += 1)
+        if (vars->states[i] == shaVARIANTUNNEEDED)
+            vars->states[i] = shaVARIANTNEEDED;
+}
+
+/* Returns the built variant with the given feature values, or NULL if that
+variant hasn't been built (or failed to build). */
+const shaShading *shaVariantsGet(
+        const shaVariants *vars, const GLuint values[]) {
+    GLuint index = shaVariantsGetIndex(vars, values);
+    if (index < vars->variantNum && vars->states[index] == shaVARIANTBUILT)
+        return &(vars->variants[index]);
+    return NULL;
+}
+
+/* Helper function for shaVariantsBuild. Returns a copy of the code, with the
+defines for variant index inserted after the #version line (or at the start, if
+there is none), or NULL on allocation failure. The user must free the copy. */
+GLchar *shaVariantsMakeCode(
+        const shaVariants *vars, const GLchar *code, GLuint index) {
+    GLuint values[shaMAXFEATURES], k;
+    size_t length = strlen(code) + 1, split = 0;
+    for (k = vars->featureNum; k > 0; k -= 1) {
+        values[k - 1] = index % vars->valueNums[k - 1];
+        index /= vars->valueNums[k - 1];
+        length += strlen(vars->featureNames[k - 1]) + 32;
+    }
+    /* The #version line must come first, but whitespace may precede it. */
+    const GLchar *version = code + strspn(code, " \t\r\n");
+    if (strncmp(version, "#version", 8) == 0) {
+        const GLchar *newline = strchr(version, '\n');
+        split = (newline == NULL) ? strlen(code) :
+            (size_t)(newline + 1 - code);
+    }
+    GLchar *result = (GLchar *)malloc(length + 1);
+    if (result == NULL)
+        return NULL;
+    memcpy(result, code, split);
+    GLchar *at = result + split;
+    /* A #version line without a newline would swallow the first define. */
+    if (split > 0 && code[split - 1] != '\n')
+        *at++ = '\n';
+    for (k = 0; k < vars->featureNum; k += 1)
+        at += sprintf(at, "#define %s %u\n", vars->featureNames[k],
+            values[k]);
+    strcpy(at, code + split);
+    return result;
+}
+
+/* Helper function for shaVariantsBuild. Finishes the pending variant i, whose
+program and shaders are work[0], work[1], and work[2], and wraps it. A variant
+that came from the cache is passed with work[1] and work[2] 0, and hit 1. A
+compiled one is saved to the cache if keyed is non-zero. */
+void shaVariantsFinish(
+        shaVariants *vars, GLuint i, GLuint work[3], int keyed, uint64_t hash,
+        int hit, GLdouble start) {
+    char path[shaCACHEPATHLENGTH + 32];
+    GLuint program = hit ? work[0] : shaFinishProgram(work[0], &work[1]);
+    work[0] = 0;
+    if (program != 0 && keyed && !hit) {
+        sprintf(path, "%s/%016llx.bin", shaCacheDirectory,
+            (unsigned long long)hash);
+        shaSaveProgramBinary(program, path, hash);
+    }
+    if (program == 0 || shaInitializeFromProgram(&(vars->variants[i]),
+            program, vars->unifNum, vars->unifNames, vars->attrNum,
+            vars->attrNames, 0) != 0) {
+        vars->states[i] = shaVARIANTFAILED;
+        return;
+    }
+    vars->variants[i].buildTime = shaGetTime() - start;
+    vars->variants[i].cacheHit = hit;
+    vars->states[i] = shaVARIANTBUILT;
+}
 
+/* Returns 1 if the context supports the named extension, and 0 otherwise. */
+int shaHasExtension(const char *name) {
+    GLint extNum = 0, i;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extNum);
+    for (i = 0; i < extNum; i += 1)
+        if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return 1;
+    return 0;
+}
+
+/* Builds every variant that has been marked as needed, but not yet built. If
+seconds is not NULL, then it receives the total time taken. Each variant's
+buildTime is the time from the start of this call until it was ready. Returns
+0 if every variant was built, or the number that failed (which are reported to
+stderr, and stay unbuilt). */
+int shaVariantsBuild(shaVariants *vars, GLdouble *seconds) {
+    char path[shaCACHEPATHLENGTH + 32];
+    GLdouble start = shaGetTime();
+    GLuint i, pendingNum = 0, *work;
+    uint64_t *hashes;
+    int failNum = 0, *keyed;
+    /* For each variant, its program and two shaders while pending. */
+    work = (GLuint *)malloc(vars->variantNum * 3 * sizeof(GLuint));
+    hashes = (uint64_t *)malloc(vars->variantNum * sizeof(uint64_t));
+    keyed = (int *)malloc(vars->variantNum * sizeof(int));
+    if (work == NULL || hashes == NULL || keyed == NULL) {
+        free(work);
+        free(hashes);
+        free(keyed);
+        return vars->variantNum;
+    }
+    int parallel = shaHasExtension("GL_KHR_parallel_shader_compile");
+    if (parallel)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    /* Load what the cache has, and start compiling the rest. */
+    for (i = 0; i < vars->variantNum; i += 1) {
+        work[i * 3] = 0;
+        if (vars->states[i] != shaVARIANTNEEDED)
+            continue;
+        GLchar *vertexCode = shaVariantsMakeCode(vars, vars->vertexCode, i);
+        GLchar *fragmentCode = shaVariantsMakeCode(vars, vars->fragmentCode,
+            i);
+        if (vertexCode == NULL || fragmentCode == NULL) {
+            free(vertexCode);
+            free(fragmentCode);
+            vars->states[i] = shaVARIANTFAILED;
+            continue;
+        }
+        keyed[i] = shaGetCacheKey(vertexCode, fragmentCode, vars->attrNum,
+            vars->attrNames, &hashes[i], path);
+        GLuint program = 0;
+        if (keyed[i]) {
+            program = shaLoadProgramBinary(path, hashes[i]);
+            if (program != 0)
+                shaCacheHitNum += 1;
+            else
+                shaCacheMissNum += 1;
+        }
+        work[i * 3] = program;
+        if (program != 0)
+            shaVariantsFinish(vars, i, &work[i * 3], 1, hashes[i], 1, start);
+        else {
+            /* The driver has copied the code by the time this returns. */
+            work[i * 3] = shaStartProgram(vertexCode, fragmentCode, keyed[i],
+                &work[i * 3 + 1]);
+            if (work[i * 3] == 0)
+                shaVariantsFinish(vars, i, &work[i * 3], 0, 0, 0, start);
+            else
+                pendingNum += 1;
+        }
+        free(vertexCode);
+        free(fragmentCode);
+    }
+    /* Collect the programs in whatever order they complete. If none has, then
+    wait for the first one. */
+    while (pendingNum > 0) {
+        GLuint first = vars->variantNum, finishedNum = 0;
+        for (i = 0; i < vars->variantNum; i += 1) {
+            if (work[i * 3] == 0)
+                continue;
+            if (first == vars->variantNum)
+                first = i;
+            GLint complete = GL_FALSE;
+            if (parallel)
+                glGetProgramiv(work[i * 3], GL_COMPLETION_STATUS_KHR,
+                    &complete);
+            if (complete == GL_TRUE) {
+                shaVariantsFinish(vars, i, &work[i * 3], keyed[i], hashes[i],
+                    0, start);
+                finishedNum += 1;
+            }
+        }
+        if (finishedNum == 0) {
+            shaVariantsFinish(vars, first, &work[first * 3], keyed[first],
+                hashes[first], 0, start);
+            finishedNum = 1;
+        }
+        pendingNum -= finishedNum;
+    }
+    for (i = 0; i < vars->variantNum; i += 1)
+        if (vars->states[i] == shaVARIANTFAILED)
+            failNum += 1;
+    free(work);
+    free(hashes);
+    free(keyed);
+    if (seconds != NULL)
+        *seconds = shaGetTime() - start;
+    return failNum;
+}
+
+
+
+/*** Uniform buffers ***/
+
+/* Setting uniforms one glUniform call at a time, converting doubles to floats
+each time, costs a driver call per value per draw. A uniform block instead
+gathers many uniforms into a buffer object, laid out by the std140 rules, which
+is written with one buffer update and attached to the program by a binding
+point. For example, the GLSL declaration
+    layout(std140) uniform frame {
+        mat4 viewing;
+        vec3 cLight;
+        vec3 dLight;
+    };
+puts viewing at byte offset 0, cLight at 64, and dLight at 80 (because a vec3
+is aligned like a vec4), for a size of 96. Each program using the block calls
+shaBindBlock once, to connect it to a binding point. */
+
+/* Feel free to read from this struct's members, but don't write to them. data
+is a copy of the buffer in CPU memory, where the setters write. */
+typedef struct shaBlock shaBlock;
+struct shaBlock {
+    GLuint buffer, binding;
+    GLsizeiptr size;
+    GLubyte *data;
+};
+
+/* Connects the program's uniform block of the given name to the binding point.
+Returns 0 on success, or non-zero if the program has no such block. */
+int shaBindBlock(GLuint program, const GLchar *name, GLuint binding) {
+    GLuint index = glGetUniformBlockIndex(program, name);
+    if (index == GL_INVALID_INDEX) {
+        fprintf(stderr, "error: shaBindBlock: uniform block %s does not "
+            "exist\n", name);
+        return 1;
+    }
+    glUniformBlockBinding(program, index, binding);
+    return 0;
+}
+
+/* Initializes a uniform block of size bytes, attached to the binding point.
+Returns 0 on success, non-zero on failure. Don't forget to call shaBlockDestroy
+when finished. */
+int shaBlockInitialize(shaBlock *block, GLsizeiptr size, GLuint binding) {
+    block->data = (GLubyte *)calloc(size, 1);
+    if (block->data == NULL)
+        return 1;
+    block->size = size;
+    block->binding = binding;
+    glGenBuffers(1, &(block->buffer));
+    glBindBuffer(GL_UNIFORM_BUFFER, block->buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, block->buffer);
+    return 0;
+}
+
+/* Releases the resources backing the block. */
+void shaBlockDestroy(shaBlock *block) {
+    glDeleteBuffers(1, &(block->buffer));
+    free(block->data);
+}
+
+/* Writes a 4x4 matrix at the given byte offset into the block, converted as
+in shaSetUniform44. The change reaches the GPU at the next shaBlockUpload. */
+void shaBlockSetUniform44(
+        shaBlock *block, GLsizeiptr offset, const GLdouble m[4][4]) {
+    shaConvertUniform44(m, (GLfloat (*)[4])&(block->data[offset]));
+}
+
+/* Writes a 3D vector at the given byte offset into the block. */
+void shaBlockSetUniform3(
+        shaBlock *block, GLsizeiptr offset, const GLdouble v[3]) {
+    GLfloat *dest = (GLfloat *)&(block->data[offset]);
+    for (int i = 0; i < 3; i += 1)
+        dest[i] = v[i];
+}
+
+/* Writes a 4D vector at the given byte offset into the block. */
+void shaBlockSetUniform4(
+        shaBlock *block, GLsizeiptr offset, const GLdouble v[4]) {
+    GLfloat *dest = (GLfloat *)&(block->data[offset]);
+    for (int i = 0; i < 4; i += 1)
+        dest[i] = v[i];
+}
+
+/* Sends the block's data to the GPU, and attaches the block to its binding
+point again (in case another buffer has been attached there since). Call this
+once per frame, after the setters and before drawing. */
+void shaBlockUpload(shaBlock *block) {
+    glBindBuffer(GL_UNIFORM_BUFFER, block->buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, block->size, block->data);
+    glBindBufferBase(GL_UNIFORM_BUFFER, block->binding, block->buffer);
+}
+
+/* For data that changes with every draw, such as the modeling matrix, a ring
+holds one record per draw in a large buffer. The records of a whole frame are
+written to CPU memory, sent with one buffer update, and then, before each draw,
+its record is selected with glBindBufferRange. Records start at multiples of
+GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+
+The ring does no synchronization of its own. It relies on glBufferSubData,
+which OpenGL defines to behave as if it waited for all earlier draws that read
+the buffer, so a frame's update can never corrupt records that the GPU is still
+reading. The driver meets that either by copying the data aside or by stalling.
+Each frame continues around the ring where the last one stopped, so the bytes
+written are usually ones that no draw in flight reads, which keeps the copy or
+stall cheap, but nothing depends on that. Writing the buffer through a mapping
+(glMapBufferRange with GL_MAP_UNSYNCHRONIZED_BIT, or a persistent mapping)
+would need fences, as in meshGLStream. */
+
+/* Feel free to read from this struct's members, but don't write to them. */
+typedef struct shaRing shaRing;
+struct shaRing {
+    GLuint buffer, binding;
+    GLsizeiptr size, alignment, head, start, frameUsed;
+    GLubyte *data;
+};
+
+/* Initializes a ring of size bytes, for the binding point. Returns 0 on
+success, non-zero on failure. Don't forget to call shaRingDestroy when
+finished. */
+int shaRingInitialize(shaRing *ring, GLsizeiptr size, GLuint binding) {
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    ring->alignment = (alignment > 0) ? alignment : 256;
+    ring->data = (GLubyte *)malloc(size);
+    if (ring->data == NULL)
+        return 1;
+    ring->size = size;
+    ring->binding = binding;
+    ring->head = 0;
+    ring->start = 0;
+    ring->frameUsed = 0;
+    glGenBuffers(1, &(ring->buffer));
+    glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+    return 0;
+}
+
+/* Releases the resources backing the ring. */
+void shaRingDestroy(shaRing *ring) {
+    glDeleteBuffers(1, &(ring->buffer));
+    free(ring->data);
+}
+
+/* Sends the records written since the last upload to the GPU. */
+void shaRingUpload(shaRing *ring) {
+    if (ring->head > ring->start) {
+        glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, ring->start,
+            ring->head - ring->start, &(ring->data[ring->start]));
+    }
+    ring->start = ring->head;
+}
+
+/* Starts a frame's worth of records. */
+void shaRingBeginFrame(shaRing *ring) {
+    ring->frameUsed = 0;
+}
+
+/* Reserves a record of size bytes, and returns its byte offset, at which the
+record should be written into ring->data. Returns -1 if the frame's records
+would wrap around onto themselves; the ring is too small for the frame. */
+GLsizeiptr shaRingAllocate(shaRing *ring, GLsizeiptr size) {
+    GLsizeiptr offset = (ring->head + ring->alignment - 1) /
+        ring->alignment * ring->alignment;
+    int wrap = (offset + size > ring->size);
+    /* Bytes passed over, for alignment or by wrapping around. */
+    GLsizeiptr skipped = wrap ? ring->size - ring->head : offset - ring->head;
+    if (ring->frameUsed + skipped + size > ring->size) {
+        fprintf(stderr, "error: shaRingAllocate: ring too small for frame\n");
+        return -1;
+    }
+    if (wrap) {
+        /* Send what's pending at the end, and start again at the start. */
+        shaRingUpload(ring);
+        ring->start = 0;
+        offset = 0;
+    }
+    ring->frameUsed += skipped + size;
+    ring->head = offset + size;
+    return offset;
+}
+
+/* Attaches the record at offset, of size bytes, to the ring's binding point.
+Call shaRingUpload first. */
+void shaRingBind(const shaRing *ring, GLsizeiptr offset, GLsizeiptr size) {
+    glBindBufferRange(GL_UNIFORM_BUFFER, ring->binding, ring->buffer, offset,
+        size);
+}
@@ -0,0 +1,412 @@
+/*** SIMD kernels ***/
+
+/* The functions in 310matrix.c are plain loops over doubles, which compilers
+rarely vectorize well across the 4x4 shapes that dominate scene graph and
+camera updates. The kernels here do the same jobs (4x4 times 4x4, 4x4 times 4,
+transpose, and inverse of a rigid isometry) with explicit SIMD, in GLdouble
+and in GLfloat. The double kernels gain little from SSE2, whose 128-bit
+registers hold only half a row, but about 2x from AVX2. So the instruction set
+is chosen as follows:
+    * with AVX2 and FMA enabled when compiling (say, clang -mavx2 -mfma, or
+      -march=native on a recent x86-64), each double row is one 256-bit
+      register, and the kernels are inlined;
+    * otherwise, on any x86-64 (where SSE2 is always present) with GCC or
+      Clang, the AVX2 kernels are compiled anyway, and used if the CPU running
+      the program has AVX2 and FMA (see simdGetLevel), and otherwise each
+      double row is two 128-bit registers;
+    * otherwise, plain C.
+The float kernels use 128-bit registers whenever SSE2 is present. A 4x4 matrix
+times a 4-vector needs horizontal sums, which cost what SSE2 saves, so those
+two kernels are plain C except with AVX2. Unlike their counterparts in
+310matrix.c, these functions allow the output to alias an input. Matrices need
+no special alignment. */
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define simdAVX2 1
+#define simdSSE2 1
+#define simdDISPATCH 0
+#define simdTARGET
+#elif defined(__SSE2__) && defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define simdAVX2 0
+#define simdSSE2 1
+#define simdDISPATCH 1
+#define simdTARGET __attribute__((target("avx2,fma")))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define simdAVX2 0
+#define simdSSE2 1
+#define simdDISPATCH 0
+#else
+#define simdAVX2 0
+#define simdSSE2 0
+#define simdDISPATCH 0
+#endif
+
+/* 1 if the AVX2 kernels are used, 0 if not, and -1 if not yet known. */
+int simdUseAVX2 = simdAVX2 ? 1 : -1;
+
+/* Returns whether the double kernels use AVX2, checking the CPU the first
+time. */
+int simdHasAVX2(void) {
+#if simdDISPATCH
+    if (simdUseAVX2 < 0) {
+        __builtin_cpu_init();
+        simdUseAVX2 = (__builtin_cpu_supports("avx2") &&
+            __builtin_cpu_supports("fma")) ? 1 : 0;
+    }
+#else
+    simdUseAVX2 = simdAVX2;
+#endif
+    return simdUseAVX2;
+}
+
+/* Returns the name of the instruction set used by the double kernels. */
+const char *simdGetLevel(void) {
+    if (simdHasAVX2())
+        return simdDISPATCH ? "AVX2 (chosen at run time)" : "AVX2";
+    return simdSSE2 ? "SSE2" : "scalar";
+}
+
+#if simdAVX2 || simdDISPATCH
+/* Helper macro for the AVX2 kernels, in the manner of _MM_TRANSPOSE4_PS.
+Transposes four rows, held in variables, in place. (Arrays of vectors passed
+to a helper function tend to be spilled to memory.) */
+#define simdTRANSPOSE4(r0, r1, r2, r3) { \
+    __m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1); \
+    __m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3); \
+    r0 = _mm256_permute2f128_pd(t0, t2, 0x20); \
+    r1 = _mm256_permute2f128_pd(t1, t3, 0x20); \
+    r2 = _mm256_permute2f128_pd(t0, t2, 0x31); \
+    r3 = _mm256_permute2f128_pd(t1, t3, 0x31); \
+}
+
+/* The AVX2 versions of simdMat444Multiply and its relatives below. */
+simdTARGET void simdMat444MultiplyAVX2(
+        const GLdouble m[4][4], const GLdouble n[4][4],
+        GLdouble mTimesN[4][4]) {
+    __m256d n0 = _mm256_loadu_pd(n[0]), n1 = _mm256_loadu_pd(n[1]);
+    __m256d n2 = _mm256_loadu_pd(n[2]), n3 = _mm256_loadu_pd(n[3]);
+    __m256d rows[4];
+    int i;
+    for (i = 0; i < 4; i += 1) {
+        rows[i] = _mm256_mul_pd(_mm256_broadcast_sd(&m[i][0]), n0);
+        rows[i] = _mm256_fmadd_pd(_mm256_broadcast_sd(&m[i][1]), n1,
+            rows[i]);
+        rows[i] = _mm256_fmadd_pd(_mm256_broadcast_sd(&m[i][2]), n2,
+            rows[i]);
+        rows[i] = _mm256_fmadd_pd(_mm256_broadcast_sd(&m[i][3]), n3,
+            rows[i]);
+    }
+    for (i = 0; i < 4; i += 1)
+        _mm256_storeu_pd(mTimesN[i], rows[i]);
+}
+
+simdTARGET void simdMat441MultiplyAVX2(
+        const GLdouble m[4][4], const GLdouble v[4], GLdouble mTimesV[4]) {
+    __m256d w = _mm256_loadu_pd(v);
+    __m256d p0 = _mm256_mul_pd(_mm256_loadu_pd(m[0]), w);
+    __m256d p1 = _mm256_mul_pd(_mm256_loadu_pd(m[1]), w);
+    __m256d p2 = _mm256_mul_pd(_mm256_loadu_pd(m[2]), w);
+    __m256d p3 = _mm256_mul_pd(_mm256_loadu_pd(m[3]), w);
+    /* Pairwise sums within each row, and then across the 128-bit halves. */
+    __m256d h01 = _mm256_hadd_pd(p0, p1), h23 = _mm256_hadd_pd(p2, p3);
+    _mm256_storeu_pd(mTimesV, _mm256_add_pd(
+        _mm256_permute2f128_pd(h01, h23, 0x20),
+        _mm256_permute2f128_pd(h01, h23, 0x31)));
+}
+
+#if simdAVX2
+void simdMat44TransposeAVX2(const GLdouble m[4][4], GLdouble mT[4][4]) {
+    __m256d r0 = _mm256_loadu_pd(m[0]), r1 = _mm256_loadu_pd(m[1]);
+    __m256d r2 = _mm256_loadu_pd(m[2]), r3 = _mm256_loadu_pd(m[3]);
+    simdTRANSPOSE4(r0, r1, r2, r3);
+    _mm256_storeu_pd(mT[0], r0);
+    _mm256_storeu_pd(mT[1], r1);
+    _mm256_storeu_pd(mT[2], r2);
+    _mm256_storeu_pd(mT[3], r3);
+}
+#endif
+
+simdTARGET void simdMat44InvertIsometryAVX2(
+        const GLdouble isom[4][4], GLdouble isomInv[4][4]) {
+    /* The inverse's transpose has rows (R's rows, 0) and (-R^T t, 1), where
+    R^T t = t0 R0 + t1 R1 + t2 R2 in terms of R's rows. */
+    __m256d mask = _mm256_castsi256_pd(_mm256_set_epi64x(0, -1, -1, -1));
+    __m256d r0 = _mm256_and_pd(_mm256_loadu_pd(isom[0]), mask);
+    __m256d r1 = _mm256_and_pd(_mm256_loadu_pd(isom[1]), mask);
+    __m256d r2 = _mm256_and_pd(_mm256_loadu_pd(isom[2]), mask);
+    __m256d r3 = _mm256_mul_pd(_mm256_set1_pd(isom[0][3]), r0);
+    r3 = _mm256_fmadd_pd(_mm256_set1_pd(isom[1][3]), r1, r3);
+    r3 = _mm256_fmadd_pd(_mm256_set1_pd(isom[2][3]), r2, r3);
+    r3 = _mm256_sub_pd(_mm256_set_pd(1.0, 0.0, 0.0, 0.0), r3);
+    simdTRANSPOSE4(r0, r1, r2, r3);
+    _mm256_storeu_pd(isomInv[0], r0);
+    _mm256_storeu_pd(isomInv[1], r1);
+    _mm256_storeu_pd(isomInv[2], r2);
+    _mm256_storeu_pd(isomInv[3], r3);
+}
+#endif
+
+#if simdSSE2
+/* Like simdTRANSPOSE4, but with each row held as a low and a high half, and
+the matrix transposed one 2x2 block at a time. */
+#define simdTRANSPOSE4SSE2(l0, h0, l1, h1, l2, h2, l3, h3) { \
+    __m128d a0 = _mm_unpacklo_pd(l0, l1), a1 = _mm_unpackhi_pd(l0, l1); \
+    __m128d b0 = _mm_unpacklo_pd(l2, l3), b1 = _mm_unpackhi_pd(l2, l3); \
+    __m128d c0 = _mm_unpacklo_pd(h0, h1), c1 = _mm_unpackhi_pd(h0, h1); \
+    __m128d d0 = _mm_unpacklo_pd(h2, h3), d1 = _mm_unpackhi_pd(h2, h3); \
+    l0 = a0; h0 = b0; l1 = a1; h1 = b1; \
+    l2 = c0; h2 = d0; l3 = c1; h3 = d1; \
+}
+#endif
+
+/* Multiplies m by n, placing the answer in mTimesN. The output can safely alias
+either input. */
+void simdMat444Multiply(
+        const GLdouble m[4][4], const GLdouble n[4][4],
+        GLdouble mTimesN[4][4]) {
+#if simdAVX2
+    simdMat444MultiplyAVX2(m, n, mTimesN);
+#else
+#if simdDISPATCH
+    if (simdUseAVX2 > 0 || (simdUseAVX2 < 0 && simdHasAVX2())) {
+        simdMat444MultiplyAVX2(m, n, mTimesN);
+        return;
+    }
+#endif
+    int i;
+#if simdSSE2
+    __m128d lo[4], hi[4], nLo[4], nHi[4], c;
+    int k;
+    for (k = 0; k < 4; k += 1) {
+        nLo[k] = _mm_loadu_pd(&n[k][0]);
+        nHi[k] = _mm_loadu_pd(&n[k][2]);
+    }
+    for (i = 0; i < 4; i += 1) {
+        c = _mm_set1_pd(m[i][0]);
+        lo[i] = _mm_mul_pd(c, nLo[0]);
+        hi[i] = _mm_mul_pd(c, nHi[0]);
+        for (k = 1; k < 4; k += 1) {
+            c = _mm_set1_pd(m[i][k]);
+            lo[i] = _mm_add_pd(lo[i], _mm_mul_pd(c, nLo[k]));
+            hi[i] = _mm_add_pd(hi[i], _mm_mul_pd(c, nHi[k]));
+        }
+    }
+    for (i = 0; i < 4; i += 1) {
+        _mm_storeu_pd(&mTimesN[i][0], lo[i]);
+        _mm_storeu_pd(&mTimesN[i][2], hi[i]);
+    }
+#else
+    GLdouble result[4][4];
+    int j;
+    for (i = 0; i < 4; i += 1)
+        for (j = 0; j < 4; j += 1)
+            result[i][j] = m[i][0] * n[0][j] + m[i][1] * n[1][j] +
+                m[i][2] * n[2][j] + m[i][3] * n[3][j];
+    memcpy(mTimesN, result, sizeof(result));
+#endif
+#endif
+}
+
+/* Multiplies m by v, placing the answer in mTimesV. The output can safely
+alias the input. */
+void simdMat441Multiply(
+        const GLdouble m[4][4], const GLdouble v[4], GLdouble mTimesV[4]) {
+#if simdAVX2
+    simdMat441MultiplyAVX2(m, v, mTimesV);
+#else
+#if simdDISPATCH
+    if (simdUseAVX2 > 0 || (simdUseAVX2 < 0 && simdHasAVX2())) {
+        simdMat441MultiplyAVX2(m, v, mTimesV);
+        return;
+    }
+#endif
+    GLdouble result[4];
+    int i;
+    for (i = 0; i < 4; i += 1)
+        result[i] = m[i][0] * v[0] + m[i][1] * v[1] + m[i][2] * v[2] +
+            m[i][3] * v[3];
+    memcpy(mTimesV, result, sizeof(result));
+#endif
+}
+
+/* Places the transpose of m into mT. The output can safely alias the input.
+Only data moves, so SSE2 does as well as AVX2 would after the call through the
+dispatch, which isn't made. */
+void simdMat44Transpose(const GLdouble m[4][4], GLdouble mT[4][4]) {
+#if simdAVX2
+    simdMat44TransposeAVX2(m, mT);
+#else
+#if simdSSE2
+    __m128d l0 = _mm_loadu_pd(&m[0][0]), h0 = _mm_loadu_pd(&m[0][2]);
+    __m128d l1 = _mm_loadu_pd(&m[1][0]), h1 = _mm_loadu_pd(&m[1][2]);
+    __m128d l2 = _mm_loadu_pd(&m[2][0]), h2 = _mm_loadu_pd(&m[2][2]);
+    __m128d l3 = _mm_loadu_pd(&m[3][0]), h3 = _mm_loadu_pd(&m[3][2]);
+    simdTRANSPOSE4SSE2(l0, h0, l1, h1, l2, h2, l3, h3);
+    _mm_storeu_pd(&mT[0][0], l0);
+    _mm_storeu_pd(&mT[0][2], h0);
+    _mm_storeu_pd(&mT[1][0], l1);
+    _mm_storeu_pd(&mT[1][2], h1);
+    _mm_storeu_pd(&mT[2][0], l2);
+    _mm_storeu_pd(&mT[2][2], h2);
+    _mm_storeu_pd(&mT[3][0], l3);
+    _mm_storeu_pd(&mT[3][2], h3);
+#else
+    GLdouble result[4][4];
+    int i, j;
+    for (i = 0; i < 4; i += 1)
+        for (j = 0; j < 4; j += 1)
+            result[i][j] = m[j][i];
+    memcpy(mT, result, sizeof(result));
+#endif
+#endif
+}
+
+/* Given a rigid isometry in homogeneous form (as from mat44Isometry or
+isoGetHomogeneous), places its inverse into isomInv. The inverse of
+[R t; 0 1] is [R^T -R^T t; 0 1], so no general inversion is needed. The output
+can safely alias the input. */
+void simdMat44InvertIsometry(
+        const GLdouble isom[4][4], GLdouble isomInv[4][4]) {
+#if simdAVX2
+    simdMat44InvertIsometryAVX2(isom, isomInv);
+#else
+#if simdDISPATCH
+    if (simdUseAVX2 > 0 || (simdUseAVX2 < 0 && simdHasAVX2())) {
+        simdMat44InvertIsometryAVX2(isom, isomInv);
+        return;
+    }
+#endif
+#if simdSSE2
+    __m128d mask = _mm_castsi128_pd(_mm_set_epi64x(0, -1));
+    __m128d t0 = _mm_set1_pd(isom[0][3]), t1 = _mm_set1_pd(isom[1][3]);
+    __m128d t2 = _mm_set1_pd(isom[2][3]);
+    __m128d l0 = _mm_loadu_pd(&isom[0][0]);
+    __m128d h0 = _mm_and_pd(_mm_loadu_pd(&isom[0][2]), mask);
+    __m128d l1 = _mm_loadu_pd(&isom[1][0]);
+    __m128d h1 = _mm_and_pd(_mm_loadu_pd(&isom[1][2]), mask);
+    __m128d l2 = _mm_loadu_pd(&isom[2][0]);
+    __m128d h2 = _mm_and_pd(_mm_loadu_pd(&isom[2][2]), mask);
+    __m128d l3 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(t0, l0),
+        _mm_mul_pd(t1, l1)), _mm_mul_pd(t2, l2));
+    __m128d h3 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(t0, h0),
+        _mm_mul_pd(t1, h1)), _mm_mul_pd(t2, h2));
+    l3 = _mm_sub_pd(_mm_setzero_pd(), l3);
+    h3 = _mm_sub_pd(_mm_set_pd(1.0, 0.0), h3);
+    simdTRANSPOSE4SSE2(l0, h0, l1, h1, l2, h2, l3, h3);
+    _mm_storeu_pd(&isomInv[0][0], l0);
+    _mm_storeu_pd(&isomInv[0][2], h0);
+    _mm_storeu_pd(&isomInv[1][0], l1);
+    _mm_storeu_pd(&isomInv[1][2], h1);
+    _mm_storeu_pd(&isomInv[2][0], l2);
+    _mm_storeu_pd(&isomInv[2][2], h2);
+    _mm_storeu_pd(&isomInv[3][0], l3);
+    _mm_storeu_pd(&isomInv[3][2], h3);
+#else
+    GLdouble result[4][4];
+    int i, j;
+    for (i = 0; i < 3; i += 1) {
+        for (j = 0; j < 3; j += 1)
+            result[i][j] = isom[j][i];
+        result[i][3] = -(isom[0][i] * isom[0][3] + isom[1][i] * isom[1][3] +
+            isom[2][i] * isom[2][3]);
+        result[3][i] = 0.0;
+    }
+    result[3][3] = 1.0;
+    memcpy(isomInv, result, sizeof(result));
+#endif
+#endif
+}
+
+/* Like simdMat444Multiply, but in single precision. */
+void simdMat444MultiplyFloat(
+        const GLfloat m[4][4], const GLfloat n[4][4], GLfloat mTimesN[4][4]) {
+    int i;
+#if simdSSE2
+    __m128 n0 = _mm_loadu_ps(n[0]), n1 = _mm_loadu_ps(n[1]);
+    __m128 n2 = _mm_loadu_ps(n[2]), n3 = _mm_loadu_ps(n[3]);
+    __m128 rows[4];
+    for (i = 0; i < 4; i += 1) {
+        rows[i] = _mm_mul_ps(_mm_set1_ps(m[i][0]), n0);
+        rows[i] = _mm_add_ps(rows[i], _mm_mul_ps(_mm_set1_ps(m[i][1]), n1));
+        rows[i] = _mm_add_ps(rows[i], _mm_mul_ps(_mm_set1_ps(m[i][2]), n2));
+        rows[i] = _mm_add_ps(rows[i], _mm_mul_ps(_mm_set1_ps(m[i][3]), n3));
+    }
+    for (i = 0; i < 4; i += 1)
+        _mm_storeu_ps(mTimesN[i], rows[i]);
+#else
+    GLfloat result[4][4];
+    int j;
+    for (i = 0; i < 4; i += 1)
+        for (j = 0; j < 4; j += 1)
+            result[i][j] = m[i][0] * n[0][j] + m[i][1] * n[1][j] +
+                m[i][2] * n[2][j] + m[i][3] * n[3][j];
+    memcpy(mTimesN, result, sizeof(result));
+#endif
+}
+
+/* Like simdMat441Multiply, but in single precision. Plain C, as explained
+above. */
+void simdMat441MultiplyFloat(
+        const GLfloat m[4][4], const GLfloat v[4], GLfloat mTimesV[4]) {
+    GLfloat result[4];
+    int i;
+    for (i = 0; i < 4; i += 1)
+        result[i] = m[i][0] * v[0] + m[i][1] * v[1] + m[i][2] * v[2] +
+            m[i][3] * v[3];
+    memcpy(mTimesV, result, sizeof(result));
+}
+
+/* Like simdMat44Transpose, but in single precision. */
+void simdMat44TransposeFloat(const GLfloat m[4][4], GLfloat mT[4][4]) {
+#if simdSSE2
+    __m128 r0 = _mm_loadu_ps(m[0]), r1 = _mm_loadu_ps(m[1]);
+    __m128 r2 = _mm_loadu_ps(m[2]), r3 = _mm_loadu_ps(m[3]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(mT[0], r0);
+    _mm_storeu_ps(mT[1], r1);
+    _mm_storeu_ps(mT[2], r2);
+    _mm_storeu_ps(mT[3], r3);
+#else
+    GLfloat result[4][4];
+    int i, j;
+    for (i = 0; i < 4; i += 1)
+        for (j = 0; j < 4; j += 1)
+            result[i][j] = m[j][i];
+    memcpy(mT, result, sizeof(result));
+#endif
+}
+
+/* Like simdMat44InvertIsometry, but in single precision. */
+void simdMat44InvertIsometryFloat(
+        const GLfloat isom[4][4], GLfloat isomInv[4][4]) {
+#if simdSSE2
+    __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    __m128 r0 = _mm_and_ps(_mm_loadu_ps(isom[0]), mask);
+    __m128 r1 = _mm_and_ps(_mm_loadu_ps(isom[1]), mask);
+    __m128 r2 = _mm_and_ps(_mm_loadu_ps(isom[2]), mask);
+    __m128 r3 = _mm_mul_ps(_mm_set1_ps(isom[0][3]), r0);
+    r3 = _mm_add_ps(r3, _mm_mul_ps(_mm_set1_ps(isom[1][3]), r1));
+    r3 = _mm_add_ps(r3, _mm_mul_ps(_mm_set1_ps(isom[2][3]), r2));
+    r3 = _mm_sub_ps(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f), r3);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(isomInv[0], r0);
+    _mm_storeu_ps(isomInv[1], r1);
+    _mm_storeu_ps(isomInv[2], r2);
+    _mm_storeu_ps(isomInv[3], r3);
+#else
+    GLfloat result[4][4];
+    int i, j;
+    for (i = 0; i < 3; i += 1) {
+        for (j = 0; j < 3; j += 1)
+            result[i][j] = isom[j][i];
+        result[i][3] = -(isom[0][i] * isom[0][3] + isom[1][i] * isom[1][3] +
+            isom[2][i] * isom[2][3]);
+        result[3][i] = 0.0f;
+    }
+    result[3][3] = 1.0f;
+    memcpy(isomInv, result, sizeof(result));
+#endif
+}
@@ -0,0 +1,300 @@
+/*** Batched transforms ***/
+
+/* mat441Multiply and isoTransformPoint handle one vector per call, so a pass
+over many vertices (computing bounds, picking, moving a mesh) pays for a call,
+and for reloading the matrix, at every vertex. The functions here transform n
+points or directions at once, by a 4x4 matrix (for an isometry, use
+isoGetHomogeneous or isoTransformPoints), in either of two layouts:
+    * strided: point i is the three GLdoubles at src[i * srcStride], as in an
+      interleaved meshMesh's vert, offset to the attribute of interest;
+    * structure-of-arrays: the x, y, and z of point i are xs[i], ys[i], and
+      zs[i], as in the streams of a meshMesh in SoA layout (see meshToStreams).
+The flags say what the three numbers are: simdPOINTS have an implicit w of 1,
+and simdDIRECTIONS an implicit w of 0 (so they are not translated). Adding
+simdDIVIDE to simdPOINTS divides the result by its w, as for projecting points
+to the screen. The kernels use the instruction set chosen in 310simd.c. They
+run on the calling thread: at a few nanoseconds per point, the pass is bound by
+memory bandwidth, and starting threads with parRun costs more than it saves
+for any mesh this program draws. The output can be the input, for transforming
+in place, but must not otherwise overlap it. */
+
+#define simdPOINTS 0
+#define simdDIRECTIONS 1
+#define simdDIVIDE 2
+
+typedef struct simdBatch simdBatch;
+struct simdBatch {
+    GLdouble m[4][4];
+    int flags;
+    const GLdouble *src;
+    GLdouble *dst;
+    GLuint srcStride, dstStride;
+    const GLdouble *ins[3];
+    GLdouble *outs[3];
+};
+
+/* Helper function for the batched transforms. Copies m into the batch, with
+the translation column zeroed for directions. */
+void simdBatchInitialize(simdBatch *batch, const GLdouble m[4][4], int flags) {
+    int i;
+    memcpy(batch->m, m, sizeof(batch->m));
+    batch->flags = flags;
+    if (flags & simdDIRECTIONS)
+        for (i = 0; i < 4; i += 1)
+            batch->m[i][3] = 0.0;
+}
+
+/* Helper function for simdTransformPoints. Transforms strided points first,
+..., last - 1. */
+void simdBatchStrided(const simdBatch *batch, GLuint first, GLuint last) {
+    const GLdouble *src;
+    GLdouble *dst;
+    GLuint i;
+    int divide = (batch->flags == simdDIVIDE);
+#if simdAVX2
+    /* Each result is x times column 0, plus y times column 1, and so on. */
+    __m256d c0 = _mm256_set_pd(batch->m[3][0], batch->m[2][0],
+        batch->m[1][0], batch->m[0][0]);
+    __m256d c1 = _mm256_set_pd(batch->m[3][1], batch->m[2][1],
+        batch->m[1][1], batch->m[0][1]);
+    __m256d c2 = _mm256_set_pd(batch->m[3][2], batch->m[2][2],
+        batch->m[1][2], batch->m[0][2]);
+    __m256d c3 = _mm256_set_pd(batch->m[3][3], batch->m[2][3],
+        batch->m[1][3], batch->m[0][3]);
+    __m256i mask = _mm256_set_epi64x(0, -1, -1, -1);
+    __m256d r;
+    for (i = first; i < last; i += 1) {
+        src = &(batch->src[(size_t)i * batch->srcStride]);
+        dst = &(batch->dst[(size_t)i * batch->dstStride]);
+        r = _mm256_fmadd_pd(_mm256_broadcast_sd(&src[2]), c2, c3);
+        r = _mm256_fmadd_pd(_mm256_broadcast_sd(&src[1]), c1, r);
+        r = _mm256_fmadd_pd(_mm256_broadcast_sd(&src[0]), c0, r);
+        if (divide)
+            r = _mm256_div_pd(r, _mm256_permute4x64_pd(r, 0xFF));
+        _mm256_maskstore_pd(dst, mask, r);
+    }
+#elif simdSSE2
+    __m128d c0Lo = _mm_set_pd(batch->m[1][0], batch->m[0][0]);
+    __m128d c0Hi = _mm_set_pd(batch->m[3][0], batch->m[2][0]);
+    __m128d c1Lo = _mm_set_pd(batch->m[1][1], batch->m[0][1]);
+    __m128d c1Hi = _mm_set_pd(batch->m[3][1], batch->m[2][1]);
+    __m128d c2Lo = _mm_set_pd(batch->m[1][2], batch->m[0][2]);
+    __m128d c2Hi = _mm_set_pd(batch->m[3][2], batch->m[2][2]);
+    __m128d c3Lo = _mm_set_pd(batch->m[1][3], batch->m[0][3]);
+    __m128d c3Hi = _mm_set_pd(batch->m[3][3], batch->m[2][3]);
+    __m128d x, y, z, lo, hi, w;
+    for (i = first; i < last; i += 1) {
+        src = &(batch->src[(size_t)i * batch->srcStride]);
+        dst = &(batch->dst[(size_t)i * batch->dstStride]);
+        x = _mm_set1_pd(src[0]);
+        y = _mm_set1_pd(src[1]);
+        z = _mm_set1_pd(src[2]);
+        lo = _mm_add_pd(_mm_add_pd(_mm_mul_pd(x, c0Lo), _mm_mul_pd(y, c1Lo)),
+            _mm_add_pd(_mm_mul_pd(z, c2Lo), c3Lo));
+        hi = _mm_add_pd(_mm_add_pd(_mm_mul_pd(x, c0Hi), _mm_mul_pd(y, c1Hi)),
+            _mm_add_pd(_mm_mul_pd(z, c2Hi), c3Hi));
+        if (divide) {
+            w = _mm_unpackhi_pd(hi, hi);
+            lo = _mm_div_pd(lo, w);
+            hi = _mm_div_pd(hi, w);
+        }
+        _mm_storeu_pd(dst, lo);
+        _mm_store_sd(&dst[2], hi);
+    }
+#else
+    const GLdouble (*m)[4] = batch->m;
+    GLdouble x, y, z, w;
+    for (i = first; i < last; i += 1) {
+        src = &(batch->src[(size_t)i * batch->srcStride]);
+        dst = &(batch->dst[(size_t)i * batch->dstStride]);
+        x = src[0];
+        y = src[1];
+        z = src[2];
+        w = divide ? 1.0 / (m[3][0] * x + m[3][1] * y + m[3][2] * z +
+            m[3][3]) : 1.0;
+        dst[0] = (m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3]) * w;
+        dst[1] = (m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3]) * w;
+        dst[2] = (m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3]) * w;
+    }
+#endif
+}
+
+/* Helper function for simdTransformStreams. Transforms points first, ...,
+last - 1, several at a time. */
+void simdBatchStreams(const simdBatch *batch, GLuint first, GLuint last) {
+    const GLdouble (*m)[4] = batch->m;
+    const GLdouble *xs = batch->ins[0], *ys = batch->ins[1];
+    const GLdouble *zs = batch->ins[2];
+    GLdouble *xOut = batch->outs[0], *yOut = batch->outs[1];
+    GLdouble *zOut = batch->outs[2];
+    GLdouble x, y, z, w;
+    GLuint i = first;
+    int divide = (batch->flags == simdDIVIDE);
+#if simdAVX2
+    __m256d ms[4][4], xv, yv, zv, wv, out[3];
+    GLuint r;
+    for (r = 0; r < 4; r += 1)
+        for (i = 0; i < 4; i += 1)
+            ms[r][i] = _mm256_set1_pd(m[r][i]);
+    for (i = first; i + 4 <= last; i += 4) {
+        xv = _mm256_loadu_pd(&xs[i]);
+        yv = _mm256_loadu_pd(&ys[i]);
+        zv = _mm256_loadu_pd(&zs[i]);
+        for (r = 0; r < 3; r += 1)
+            out[r] = _mm256_fmadd_pd(ms[r][0], xv, _mm256_fmadd_pd(ms[r][1],
+                yv, _mm256_fmadd_pd(ms[r][2], zv, ms[r][3])));
+        if (divide) {
+            wv = _mm256_fmadd_pd(ms[3][0], xv, _mm256_fmadd_pd(ms[3][1], yv,
+                _mm256_fmadd_pd(ms[3][2], zv, ms[3][3])));
+            for (r = 0; r < 3; r += 1)
+                out[r] = _mm256_div_pd(out[r], wv);
+        }
+        _mm256_storeu_pd(&xOut[i], out[0]);
+        _mm256_storeu_pd(&yOut[i], out[1]);
+        _mm256_storeu_pd(&zOut[i], out[2]);
+    }
+#elif simdSSE2
+    __m128d ms[4][4], xv, yv, zv, wv, out[3];
+    GLuint r;
+    for (r = 0; r < 4; r += 1)
+        for (i = 0; i < 4; i += 1)
+            ms[r][i] = _mm_set1_pd(m[r][i]);
+    for (i = first; i + 2 <= last; i += 2) {
+        xv = _mm_loadu_pd(&xs[i]);
+        yv = _mm_loadu_pd(&ys[i]);
+        zv = _mm_loadu_pd(&zs[i]);
+        for (r = 0; r < 3; r += 1)
+            out[r] = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ms[r][0], xv),
+                _mm_mul_pd(ms[r][1], yv)), _mm_add_pd(_mm_mul_pd(ms[r][2],
+                zv), ms[r][3]));
+        if (divide) {
+            wv = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ms[3][0], xv),
+                _mm_mul_pd(ms[3][1], yv)), _mm_add_pd(_mm_mul_pd(ms[3][2],
+                zv), ms[3][3]));
+            for (r = 0; r < 3; r += 1)
+                out[r] = _mm_div_pd(out[r], wv);
+        }
+        _mm_storeu_pd(&xOut[i], out[0]);
+        _mm_storeu_pd(&yOut[i], out[1]);
+        _mm_storeu_pd(&zOut[i], out[2]);
+    }
+#endif
+    /* The leftovers, or everything without SIMD. */
+    for (; i < last; i += 1) {
+        x = xs[i];
+        y = ys[i];
+        z = zs[i];
+        w = divide ? 1.0 / (m[3][0] * x + m[3][1] * y + m[3][2] * z +
+            m[3][3]) : 1.0;
+        xOut[i] = (m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3]) * w;
+        yOut[i] = (m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3]) * w;
+        zOut[i] = (m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3]) * w;
+    }
+}
+
+/* Transforms the n strided points (or directions; see the flags above) by m.
+Point i is read from src[i * srcStride], and written to dst[i * dstStride];
+both strides are counted in GLdoubles, and must be at least 3 unless they are
+equal and the transform is in place. Only the three numbers of each point are
+written. */
+void simdTransformPoints(
+        const GLdouble m[4][4], int flags, GLuint n, const GLdouble *src,
+        GLuint srcStride, GLdouble *dst, GLuint dstStride) {
+    simdBatch batch;
+    simdBatchInitialize(&batch, m, flags);
+    batch.src = src;
+    batch.srcStride = srcStride;
+    batch.dst = dst;
+    batch.dstStride = dstStride;
+    simdBatchStrided(&batch, 0, n);
+}
+
+/* Like simdTransformPoints, but for points in structure-of-arrays layout. The
+outputs may be the inputs, stream for stream. */
+void simdTransformStreams(
+        const GLdouble m[4][4], int flags, GLuint n, const GLdouble *xs,
+        const GLdouble *ys, const GLdouble *zs, GLdouble *xOut, GLdouble *yOut,
+        GLdouble *zOut) {
+    simdBatch batch;
+    simdBatchInitialize(&batch, m, flags);
+    batch.ins[0] = xs;
+    batch.ins[1] = ys;
+    batch.ins[2] = zs;
+    batch.outs[0] = xOut;
+    batch.outs[1] = yOut;
+    batch.outs[2] = zOut;
+    simdBatchStreams(&batch, 0, n);
+}
+
+
+
+/*** Batched compositions ***/
+
+/* An isometry in structure-of-arrays form is 12 streams: the 3x3 rotation,
+row by row, and then the translation. Component c of isometry i is
+streams[c][i]. */
+
+#if simdAVX2 || simdDISPATCH
+/* The AVX2 version of simdComposeIsometryStreams, four isometries at a time.
+Returns how many it did. */
+simdTARGET GLuint simdComposeIsometryStreamsAVX2(
+        GLuint n, const GLdouble *const as[12], const GLdouble *const bs[12],
+        GLdouble *const outs[12]) {
+    __m256d a[12], b[12], sum;
+    GLuint i, r, c;
+    for (i = 0; i + 4 <= n; i += 4) {
+        for (c = 0; c < 12; c += 1) {
+            a[c] = _mm256_loadu_pd(&as[c][i]);
+            b[c] = _mm256_loadu_pd(&bs[c][i]);
+        }
+        for (r = 0; r < 3; r += 1) {
+            for (c = 0; c < 3; c += 1) {
+                sum = _mm256_mul_pd(a[r * 3 + 2], b[6 + c]);
+                sum = _mm256_fmadd_pd(a[r * 3 + 1], b[3 + c], sum);
+                sum = _mm256_fmadd_pd(a[r * 3], b[c], sum);
+                _mm256_storeu_pd(&outs[r * 3 + c][i], sum);
+            }
+            sum = _mm256_fmadd_pd(a[r * 3 + 2], b[11], a[9 + r]);
+            sum = _mm256_fmadd_pd(a[r * 3 + 1], b[10], sum);
+            sum = _mm256_fmadd_pd(a[r * 3], b[9], sum);
+            _mm256_storeu_pd(&outs[9 + r][i], sum);
+        }
+    }
+    return i;
+}
+#endif
+
+/* Composes n pairs of isometries in structure-of-arrays form, so that
+isometry i of the output is isometry i of b followed by isometry i of a, as in
+the matrix product a b: the rotation is the product of the rotations, and the
+translation is a's rotation applied to b's translation, plus a's translation.
+The output must not overlap the inputs. */
+void simdComposeIsometryStreams(
+        GLuint n, const GLdouble *const as[12], const GLdouble *const bs[12],
+        GLdouble *const outs[12]) {
+    GLuint i = 0, r, c;
+#if simdAVX2
+    i = simdComposeIsometryStreamsAVX2(n, as, bs, outs);
+#elif simdDISPATCH
+    if (simdUseAVX2 > 0 || (simdUseAVX2 < 0 && simdHasAVX2()))
+        i = simdComposeIsometryStreamsAVX2(n, as, bs, outs);
+#endif
+    /* The leftovers, or everything without AVX2. Each loop runs along
+    contiguous streams, so that the compiler can vectorize it. */
+    GLuint first = i;
+    for (r = 0; r < 3; r += 1) {
+        const GLdouble *a0 = as[r * 3], *a1 = as[r * 3 + 1];
+        const GLdouble *a2 = as[r * 3 + 2];
+        for (c = 0; c < 3; c += 1) {
+            const GLdouble *b0 = bs[c], *b1 = bs[3 + c], *b2 = bs[6 + c];
+            GLdouble *out = outs[r * 3 + c];
+            for (i = first; i < n; i += 1)
+                out[i] = a0[i] * b0[i] + a1[i] * b1[i] + a2[i] * b2[i];
+        }
+        const GLdouble *t0 = bs[9], *t1 = bs[10], *t2 = bs[11];
+        const GLdouble *aT = as[9 + r];
+        GLdouble *out = outs[9 + r];
+        for (i = first; i < n; i += 1)
+            out[i] = a0[i] * t0[i] + a1[i] * t1[i] + a2[i] * t2[i] + aT[i];
+    }
+}
@@ -39,6 +39,76 @@ void vecScale(int dim, GLdouble c, const GLdouble w[], GLdouble cTimesW[]) {
 
 
 
+/*** In fixed dimensions ***/
+
+/* The functions above loop over a dimension known only at run time, so the
+compiler can't unroll them at their call sites unless it happens to inline
+them. For dimensions 2, 3, 4, and 8, the same operations come in fixed-size
+versions, generated by the macros below: vec3Add(v, w, vPlusW) is
+vecAdd(3, v, w, vPlusW), and so on for Copy, Add, Subtract, Scale, Dot,
+Length, and Unit. Each is written out element by element, with no loop and no
+conditional, and gives bit-for-bit the same results as its general version.
+The exception is vecNUnit of the zero vector, which writes the zero vector
+into unit instead of leaving unit alone; the two agree whenever unit aliases
+v. (The sqrt in vecNLength and vecNUnit is branch-free only under
+-fno-math-errno, which -ffast-math implies. Otherwise the compiler follows it
+with a check, never taken here, for setting errno on negative input.) */
+
+/* vecFIXEDn(E) expands to E(0) E(1) ... E(n - 1). */
+#define vecFIXED2(E) E(0) E(1)
+#define vecFIXED3(E) vecFIXED2(E) E(2)
+#define vecFIXED4(E) vecFIXED3(E) E(3)
+#define vecFIXED8(E) vecFIXED4(E) E(4) E(5) E(6) E(7)
+
+#define vecCOPYELEMENT(i) copy[i] = v[i];
+#define vecADDELEMENT(i) vPlusW[i] = v[i] + w[i];
+#define vecSUBTRACTELEMENT(i) vMinusW[i] = v[i] - w[i];
+#define vecSCALEELEMENT(i) cTimesW[i] = w[i] * c;
+#define vecDOTTERM(i) + v[i] * w[i]
+#define vecSELFDOTTERM(i) + v[i] * v[i]
+#define vecUNITELEMENT(i) unit[i] = v[i] / divisor;
+#define vecTINY 4.9406564584124654e-324
+
+/* Defines vecNCopy, vecNAdd, etc. for N = dim, which must be 2, 3, 4, or 8.
+In vecNUnit, a non-zero length is at least the smallest positive double,
+vecTINY, so taking the maximum with vecTINY avoids dividing by zero without
+changing any other quotient, and compiles to a single max instruction. */
+#define vecDEFINEFIXED(dim) \
+void vec##dim##Copy(const GLdouble v[dim], GLdouble copy[dim]) { \
+    vecFIXED##dim(vecCOPYELEMENT) \
+} \
+void vec##dim##Add( \
+        const GLdouble v[dim], const GLdouble w[dim], GLdouble vPlusW[dim]) { \
+    vecFIXED##dim(vecADDELEMENT) \
+} \
+void vec##dim##Subtract( \
+        const GLdouble v[dim], const GLdouble w[dim], GLdouble vMinusW[dim]) { \
+    vecFIXED##dim(vecSUBTRACTELEMENT) \
+} \
+void vec##dim##Scale( \
+        GLdouble c, const GLdouble w[dim], GLdouble cTimesW[dim]) { \
+    vecFIXED##dim(vecSCALEELEMENT) \
+} \
+GLdouble vec##dim##Dot(const GLdouble v[dim], const GLdouble w[dim]) { \
+    return 0.0 vecFIXED##dim(vecDOTTERM); \
+} \
+GLdouble vec##dim##Length(const GLdouble v[dim]) { \
+    return sqrt(0.0 vecFIXED##dim(vecSELFDOTTERM)); \
+} \
+GLdouble vec##dim##Unit(const GLdouble v[dim], GLdouble unit[dim]) { \
+    GLdouble length = sqrt(0.0 vecFIXED##dim(vecSELFDOTTERM)); \
+    GLdouble divisor = (length > vecTINY) ? length : vecTINY; \
+    vecFIXED##dim(vecUNITELEMENT) \
+    return length; \
+}
+
+vecDEFINEFIXED(2)
+vecDEFINEFIXED(3)
+vecDEFINEFIXED(4)
+vecDEFINEFIXED(8)
+
+
+
 /*** In specific dimensions ***/
 
 /* By the way, there is a way to write a single vecSet function that works in
@@ -82,7 +152,7 @@ void vec8Set(
 /* Returns the dot product of the vectors v and w. */
 GLdouble vecDot(int dim, const GLdouble v[], const GLdouble w[]){
     int i;
-    GLdouble dotProduct;
+    GLdouble dotProduct = 0.0;
     for (i=0; i<dim; i++){
         dotProduct += v[i]*w[i];
     }
@@ -103,6 +173,8 @@ alias the input. */
 GLdouble vecUnit(int dim, const GLdouble v[], GLdouble unit[]){
     int i;
     GLdouble length = vecLength(dim, v);
+    if (length == 0.0)
+        return length;
     for (i=0; i<dim; i++) {
         unit[i] = v[i]/length;
     }
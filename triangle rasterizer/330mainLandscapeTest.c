@@ -0,0 +1,212 @@
+/* Checks that editing a meshGLLandscape gives exactly what building it afresh
+from the edited heights would. First, edits that change nothing (setting
+samples to their own heights, and a brush stroke of amount 0) must leave the
+vertices, normals included, and the vertex buffer bit-identical. Then real
+edits, once updated, must match a new landscape made from the new heights, in
+memory and in the buffers. It needs only OpenGL 3.3 core, and runs without a
+display on Mesa's software renderer. On Linux, compile with...
+    clang 330mainLandscapeTest.c /usr/local/gl3w/src/gl3w.o -lglfw -lGL -lm -lpthread -ldl
+...and run with...
+    LIBGL_ALWAYS_SOFTWARE=1 xvfb-run -a ./a.out
+It prints PASS or FAIL for each check, and exits with 0 only if all pass. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <GL/gl3w.h>
+#include <GLFW/glfw3.h>
+
+#include "310vector.c"
+#include "310matrix.c"
+#include "310simd.c"
+#include "310parallel.c"
+#include "310simdBatch.c"
+#include "310shading.c"
+#include "330mesh.c"
+#include "330meshWeld.c"
+#include "330mesh3D.c"
+#include "330meshGL.c"
+#include "330meshGLFormat.c"
+#include "330meshGLLandscape.c"
+
+#define SIZE 64
+#define SPACING 1.0
+/* Steep enough that the weighting of the normals matters. */
+#define SCALE 20.0
+
+GLdouble heights[SIZE * SIZE];
+meshGLAttribute attrs[3] = {
+    {0, 0, 3, meshGLFLOAT}, {1, 3, 2, meshGLFLOAT}, {2, 5, 3, meshGLFLOAT}};
+
+/* Copies the landscape's vertex and index buffers into memory, which has room
+for both. */
+void readBuffers(meshGLLandscape *land, GLubyte *memory) {
+    GLsizeiptr vertBytes = (GLsizeiptr)land->mesh.vertNum * land->stride;
+    GLsizeiptr triBytes = (GLsizeiptr)land->mesh.triNum * 3 *
+        ((land->glMesh.indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) :
+        sizeof(GLuint));
+    shaBindVertexArray(land->glMesh.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, land->glMesh.vbos[0]);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, vertBytes, memory);
+    glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, triBytes,
+        &memory[vertBytes]);
+}
+
+/* Returns the number of bytes that the landscape's buffers occupy. */
+size_t getBufferSize(const meshGLLandscape *land) {
+    return (size_t)land->mesh.vertNum * land->stride +
+        (size_t)land->mesh.triNum * 3 * sizeof(GLuint);
+}
+
+/* Compares the vertices, the triangles, and the buffers of two landscapes, and
+prints the outcome. Returns 0 if they are bit-identical, 1 if not. */
+int compareLandscapes(
+        const char *name, meshGLLandscape *land, meshGLLandscape *other,
+        GLubyte *memory, GLubyte *otherMemory) {
+    size_t vertBytes = (size_t)land->mesh.vertNum * land->mesh.attrDim *
+        sizeof(GLdouble);
+    size_t triBytes = (size_t)land->mesh.triNum * 3 * sizeof(GLuint);
+    size_t bufferBytes = getBufferSize(land);
+    int vertSame, triSame, bufferSame;
+    memset(memory, 0, bufferBytes);
+    memset(otherMemory, 0, bufferBytes);
+    readBuffers(land, memory);
+    readBuffers(other, otherMemory);
+    vertSame = (memcmp(land->mesh.vert, other->mesh.vert, vertBytes) == 0);
+    triSame = (memcmp(land->mesh.tri, other->mesh.tri, triBytes) == 0);
+    bufferSame = (memcmp(memory, otherMemory, bufferBytes) == 0);
+    printf("%s: %s (vertices %s, triangles %s, buffers %s)\n",
+        (vertSame && triSame && bufferSame) ? "PASS" : "FAIL", name,
+        vertSame ? "same" : "differ", triSame ? "same" : "differ",
+        bufferSame ? "same" : "differ");
+    return (vertSame && triSame && bufferSame) ? 0 : 1;
+}
+
+/* Edits that leave every height as it was. */
+void editNothing(meshGLLandscape *land) {
+    GLuint i, j;
+    for (i = 10; i < 20; i += 1)
+        for (j = 30; j < 45; j += 1)
+            meshGLLandscapeSetHeight(land, i, j, heights[i * SIZE + j]);
+    meshGLLandscapeSetHeight(land, 0, 0, heights[0]);
+    meshGLLandscapeSetHeight(land, SIZE - 1, SIZE - 1,
+        heights[SIZE * SIZE - 1]);
+    meshGLLandscapeBrush(land, 40.0 * SPACING, 12.0 * SPACING, 6.0 * SPACING,
+        0.0);
+}
+
+/* Edits that change heights, both in the landscape and in heights. */
+void editSomething(meshGLLandscape *land) {
+    GLuint i, j;
+    for (i = 5; i < 12; i += 1)
+        for (j = 50; j < SIZE; j += 1) {
+            heights[i * SIZE + j] += SCALE * sin(0.7 * i + 0.3 * j);
+            meshGLLandscapeSetHeight(land, i, j, heights[i * SIZE + j]);
+        }
+    heights[(SIZE / 2) * SIZE + SIZE / 2] -= 2.0 * SCALE;
+    meshGLLandscapeSetHeight(land, SIZE / 2, SIZE / 2,
+        heights[(SIZE / 2) * SIZE + SIZE / 2]);
+}
+
+void handleError(int error, const char *description) {
+    fprintf(stderr, "handleError: %d\n%s\n", error, description);
+}
+
+GLFWwindow *initializeWindow(int width, int height, const char *name) {
+    glfwSetErrorCallback(handleError);
+    if (glfwInit() == 0) {
+        fprintf(stderr, "initializeWindow: glfwInit failed.\n");
+        return NULL;
+    }
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *window;
+    window = glfwCreateWindow(width, height, name, NULL, NULL);
+    if (window == NULL) {
+        fprintf(stderr, "initializeWindow: glfwCreateWindow failed.\n");
+        glfwTerminate();
+        return NULL;
+    }
+    glfwMakeContextCurrent(window);
+    if (gl3wInit() != 0) {
+        fprintf(stderr, "initializeWindow: gl3wInit failed.\n");
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return NULL;
+    }
+    fprintf(stderr, "initializeWindow: using OpenGL %s on %s.\n",
+        glGetString(GL_VERSION), glGetString(GL_RENDERER));
+    return window;
+}
+
+void destroyWindow(GLFWwindow *window) {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+}
+
+int main(void) {
+    meshGLLandscape land, other;
+    GLuint i;
+    int failed = 0;
+    GLFWwindow *window = initializeWindow(64, 64, "330mainLandscapeTest");
+    if (window == NULL)
+        return 1;
+    srand(1);
+    for (i = 0; i < SIZE * SIZE; i += 1)
+        heights[i] = SCALE * (rand() / (GLdouble)RAND_MAX - 0.5);
+    if (meshGLLandscapeInitialize(&land, SIZE, SPACING, heights, 3,
+            attrs) != 0) {
+        destroyWindow(window);
+        return 2;
+    }
+    if (meshGLLandscapeInitialize(&other, SIZE, SPACING, heights, 3,
+            attrs) != 0) {
+        meshGLLandscapeDestroy(&land);
+        destroyWindow(window);
+        return 3;
+    }
+    GLubyte *memory = (GLubyte *)malloc(2 * getBufferSize(&land));
+    if (memory == NULL) {
+        meshGLLandscapeDestroy(&other);
+        meshGLLandscapeDestroy(&land);
+        destroyWindow(window);
+        return 4;
+    }
+    GLubyte *otherMemory = &memory[getBufferSize(&land)];
+    editNothing(&land);
+    meshGLLandscapeUpdate(&land);
+    failed |= compareLandscapes("edits that change nothing", &land, &other,
+        memory, otherMemory);
+    editSomething(&land);
+    meshGLLandscapeUpdate(&land);
+    meshGLLandscapeDestroy(&other);
+    if (meshGLLandscapeInitialize(&other, SIZE, SPACING, heights, 3,
+            attrs) != 0) {
+        free(memory);
+        meshGLLandscapeDestroy(&land);
+        destroyWindow(window);
+        return 5;
+    }
+    failed |= compareLandscapes("edits against a fresh build", &land, &other,
+        memory, otherMemory);
+    if (glGetError() != GL_NO_ERROR) {
+        printf("FAIL: OpenGL error\n");
+        failed = 1;
+    }
+    free(memory);
+    meshGLLandscapeDestroy(&other);
+    meshGLLandscapeDestroy(&land);
+    destroyWindow(window);
+    return failed;
+}
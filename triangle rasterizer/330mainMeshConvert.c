@@ -0,0 +1,52 @@
+/* Converts mesh files between the text format of meshSaveFile and the binary
+format of meshSaveBinaryFile. The direction is detected from the input file.
+On macOS, compile with...
+    clang 330mainMeshConvert.c -I/usr/local/gl3w/include
+...and run with...
+    ./a.out input.mesh output.meshb
+Converting a large text mesh once, and then loading the binary version with
+meshInitializeBinaryFile, avoids parsing it on every launch. Along the way, the
+mesh is reordered for the GPU with meshOptimize, which prints the ACMR and ATVR
+before and after. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <GL/gl3w.h>
+
+#include "310vector.c"
+#include "330mesh.c"
+#include "330meshBinary.c"
+#include "330meshOptimize.c"
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s input output\n", argv[0]);
+        return 1;
+    }
+    meshMesh mesh;
+    GLuint error;
+    int binary = meshIsBinaryFile(argv[1]);
+    if (binary)
+        error = meshInitializeBinaryFile(&mesh, argv[1], 1);
+    else
+        error = meshInitializeFile(&mesh, argv[1]);
+    if (error != 0)
+        return 2;
+    if (meshOptimize(&mesh, 1.05, 1) != 0) {
+        meshDestroy(&mesh);
+        return 3;
+    }
+    if (binary)
+        error = meshSaveFile(&mesh, argv[2]);
+    else
+        error = meshSaveBinaryFile(&mesh, argv[2]);
+    meshDestroy(&mesh);
+    return (error == 0) ? 0 : 4;
+}
@@ -10,6 +10,10 @@ struct meshMesh {
     GLuint triNum, vertNum, attrDim;
     GLuint *tri;                       /* triNum * 3 GLuints */
     GLdouble *vert;                    /* vertNum * attrDim GLdoubles */
+    void *mapping;                     /* non-NULL if tri, vert are mmapped */
+    size_t mappingSize;
+    GLdouble *streams;                 /* non-NULL in structure-of-arrays */
+    GLuint streamStride;               /* GLdoubles from stream to stream */
 };
 
 /* Initializes a mesh with enough memory to hold its triangles and vertices.
@@ -25,6 +29,10 @@ GLuint meshInitialize(meshMesh *mesh, GLuint triNum, GLuint vertNum,
         mesh->triNum = triNum;
         mesh->vertNum = vertNum;
         mesh->attrDim = attrDim;
+        mesh->mapping = NULL;
+        mesh->mappingSize = 0;
+        mesh->streams = NULL;
+        mesh->streamStride = 0;
     }
     return (mesh->tri == NULL);
 }
@@ -48,28 +56,281 @@ GLuint *meshGetTrianglePointer(const meshMesh *mesh, GLuint tri) {
         return NULL;
 }
 
-/* Sets the vertth vertex to have attributes attr. */
+/* Sets the vertth vertex to have attributes attr. Works in either layout (see
+meshToStreams). */
 void meshSetVertex(meshMesh *mesh, GLuint vert, const GLdouble attr[]) {
     GLuint k;
-    if (vert < mesh->vertNum)
+    if (vert < mesh->vertNum && mesh->streams != NULL)
+        for (k = 0; k < mesh->attrDim; k += 1)
+            mesh->streams[(size_t)k * mesh->streamStride + vert] = attr[k];
+    else if (vert < mesh->vertNum)
         for (k = 0; k < mesh->attrDim; k += 1)
             mesh->vert[mesh->attrDim * vert + k] = attr[k];
 }
 
 /* Returns a pointer to the vertth vertex. For example:
     GLdouble *vertex13 = meshGetVertexPointer(&mesh, 13);
-    prGLuintf("x = %f, y = %f\n", vertex13[0], vertex13[1]); */
+    prGLuintf("x = %f, y = %f\n", vertex13[0], vertex13[1]);
+Returns NULL if the mesh is in structure-of-arrays layout (see meshToStreams),
+because then the vertex's attributes are not next to each other in memory. */
 GLdouble *meshGetVertexPointer(const meshMesh *mesh, GLuint vert) {
-    if (vert < mesh->vertNum)
+    if (vert < mesh->vertNum && mesh->streams == NULL)
         return &mesh->vert[vert * mesh->attrDim];
     else
         return NULL;
 }
 
 /* Deallocates the resources backing the mesh. This function must be called
-when you are finished using a mesh. */
+when you are finished using a mesh. Works both for meshes allocated by
+meshInitialize and for meshes mapped from a binary file (see
+meshInitializeBinaryFile). */
 void meshDestroy(meshMesh *mesh) {
-    free(mesh->tri);
+    if (mesh->mapping != NULL) {
+        munmap(mesh->mapping, mesh->mappingSize);
+        mesh->mapping = NULL;
+    } else
+        free(mesh->tri);
+    free(mesh->streams);
+    mesh->streams = NULL;
+}
+
+
+
+/*** Structure-of-arrays layout ***/
+
+/* Normally a mesh stores its vertices interleaved: all attrDim attributes of
+vertex 0, then all of vertex 1, and so on. That is the layout that OpenGL
+wants, but it is wasteful for CPU passes that touch only some attributes, such
+as positions: a pass over XYZ drags all of the other attributes through the
+cache too, and the strided loads defeat the compiler's vectorizer. So a mesh
+can be switched to a structure-of-arrays (SoA) layout, in which each attribute
+has its own stream: attribute k of vertex v is streams[k * streamStride + v].
+Each stream is 64-byte aligned and padded to a multiple of 8 GLdoubles.
+
+In SoA layout mesh->vert is NULL and meshGetVertexPointer returns NULL. Use
+meshGetAttributes, meshSetAttributes, meshSetVertex, and meshGetStream instead,
+or switch back with meshToInterleaved. Functions that accept either layout say
+so; the others expect interleaved layout. meshGLInitialize and
+meshGLInitializeFormatted interleave the data as they upload them. */
+
+#define meshSTREAMALIGNMENT 64
+
+/* Switches the mesh to SoA layout, if it isn't already. Returns 0 on success.
+On failure, returns non-zero and leaves the mesh unchanged. */
+int meshToStreams(meshMesh *mesh) {
+    if (mesh->streams != NULL)
+        return 0;
+    GLuint vertNum = mesh->vertNum, attrDim = mesh->attrDim, v, k;
+    GLuint stride = (vertNum + 7) & ~7u;
+    size_t size = (size_t)stride * attrDim * sizeof(GLdouble);
+    void *streams;
+    if (posix_memalign(&streams, meshSTREAMALIGNMENT,
+            (size == 0) ? meshSTREAMALIGNMENT : size) != 0)
+        return 1;
+    mesh->streams = (GLdouble *)streams;
+    mesh->streamStride = stride;
+    for (k = 0; k < attrDim; k += 1) {
+        GLdouble *stream = &(mesh->streams[(size_t)k * stride]);
+        for (v = 0; v < vertNum; v += 1)
+            stream[v] = mesh->vert[(size_t)v * attrDim + k];
+        for (; v < stride; v += 1)
+            stream[v] = 0.0;
+    }
+    /* The interleaved vertices follow the triangles in one allocation, so
+    shrink it to just the triangles. If realloc fails, the old block remains
+    valid. A mapped mesh keeps its mapping until meshDestroy. */
+    mesh->vert = NULL;
+    if (mesh->mapping == NULL && mesh->triNum > 0) {
+        GLuint *tri = (GLuint *)realloc(mesh->tri,
+            (size_t)mesh->triNum * 3 * sizeof(GLuint));
+        if (tri != NULL)
+            mesh->tri = tri;
+    }
+    return 0;
+}
+
+/* Switches the mesh to interleaved layout, if it isn't already. Afterward, the
+mesh is an ordinary, malloced mesh, even if it was mapped from a file. Returns
+0 on success. On failure, returns non-zero and leaves the mesh unchanged. */
+int meshToInterleaved(meshMesh *mesh) {
+    if (mesh->streams == NULL)
+        return 0;
+    GLuint vertNum = mesh->vertNum, attrDim = mesh->attrDim, v, k;
+    GLuint *tri = (GLuint *)malloc((size_t)mesh->triNum * 3 * sizeof(GLuint) +
+        (size_t)vertNum * attrDim * sizeof(GLdouble));
+    if (tri == NULL)
+        return 1;
+    memcpy(tri, mesh->tri, (size_t)mesh->triNum * 3 * sizeof(GLuint));
+    GLdouble *vert = (GLdouble *)&(tri[mesh->triNum * 3]);
+    for (k = 0; k < attrDim; k += 1) {
+        const GLdouble *stream = &(mesh->streams[(size_t)k *
+            mesh->streamStride]);
+        for (v = 0; v < vertNum; v += 1)
+            vert[(size_t)v * attrDim + k] = stream[v];
+    }
+    if (mesh->mapping != NULL) {
+        munmap(mesh->mapping, mesh->mappingSize);
+        mesh->mapping = NULL;
+        mesh->mappingSize = 0;
+    } else
+        free(mesh->tri);
+    free(mesh->streams);
+    mesh->streams = NULL;
+    mesh->streamStride = 0;
+    mesh->tri = tri;
+    mesh->vert = vert;
+    return 0;
+}
+
+/* Returns a pointer to the stream of attribute k, which holds that attribute
+for all vertices in order. Returns NULL if the mesh is not in SoA layout. */
+GLdouble *meshGetStream(const meshMesh *mesh, GLuint k) {
+    if (mesh->streams == NULL || k >= mesh->attrDim)
+        return NULL;
+    return &(mesh->streams[(size_t)k * mesh->streamStride]);
+}
+
+/* Copies attributes first, ..., first + dim - 1 of the vertth vertex into
+attr. Works in either layout. */
+void meshGetAttributes(
+        const meshMesh *mesh, GLuint vert, GLuint first, GLuint dim,
+        GLdouble attr[]) {
+    GLuint k;
+    if (mesh->streams != NULL)
+        for (k = 0; k < dim; k += 1)
+            attr[k] = mesh->streams[(size_t)(first + k) * mesh->streamStride +
+                vert];
+    else
+        for (k = 0; k < dim; k += 1)
+            attr[k] = mesh->vert[(size_t)vert * mesh->attrDim + first + k];
+}
+
+/* Sets attributes first, ..., first + dim - 1 of the vertth vertex from attr.
+Works in either layout. */
+void meshSetAttributes(
+        meshMesh *mesh, GLuint vert, GLuint first, GLuint dim,
+        const GLdouble attr[]) {
+    GLuint k;
+    if (mesh->streams != NULL)
+        for (k = 0; k < dim; k += 1)
+            mesh->streams[(size_t)(first + k) * mesh->streamStride + vert] =
+                attr[k];
+    else
+        for (k = 0; k < dim; k += 1)
+            mesh->vert[(size_t)vert * mesh->attrDim + first + k] = attr[k];
+}
+
+/* Copies vertices first, ..., first + count - 1 into dest, interleaved, as
+OpenGL wants them. Works in either layout. */
+void meshGetInterleaved(
+        const meshMesh *mesh, GLuint first, GLuint count, GLdouble *dest) {
+    GLuint attrDim = mesh->attrDim, v, k;
+    if (mesh->streams == NULL) {
+        memcpy(dest, &(mesh->vert[(size_t)first * attrDim]),
+            (size_t)count * attrDim * sizeof(GLdouble));
+        return;
+    }
+    for (k = 0; k < attrDim; k += 1) {
+        const GLdouble *stream = &(mesh->streams[(size_t)k *
+            mesh->streamStride + first]);
+        for (v = 0; v < count; v += 1)
+            dest[(size_t)v * attrDim + k] = stream[v];
+    }
+}
+
+/* Computes the smallest box containing attributes first, ..., first + dim - 1
+(typically the XYZ position) of all vertices. Works in either layout; in SoA
+layout, each stream is scanned in four independent lanes, which the compiler
+can turn into packed min/max instructions. If the mesh has no vertices, then
+lower and upper are set to 0.0. */
+void meshGetBounds(
+        const meshMesh *mesh, GLuint first, GLuint dim, GLdouble lower[],
+        GLdouble upper[]) {
+    GLuint vertNum = mesh->vertNum, v, k, l;
+    if (vertNum == 0) {
+        for (k = 0; k < dim; k += 1)
+            lower[k] = upper[k] = 0.0;
+        return;
+    }
+    meshGetAttributes(mesh, 0, first, dim, lower);
+    meshGetAttributes(mesh, 0, first, dim, upper);
+    if (mesh->streams == NULL) {
+        const GLdouble *vert;
+        for (v = 1; v < vertNum; v += 1) {
+            vert = &(mesh->vert[(size_t)v * mesh->attrDim + first]);
+            for (k = 0; k < dim; k += 1) {
+                lower[k] = (vert[k] < lower[k]) ? vert[k] : lower[k];
+                upper[k] = (vert[k] > upper[k]) ? vert[k] : upper[k];
+            }
+        }
+        return;
+    }
+    GLuint blocked = vertNum & ~3u;
+    for (k = 0; k < dim; k += 1) {
+        const GLdouble *stream = meshGetStream(mesh, first + k);
+        GLdouble lo[4], hi[4];
+        for (l = 0; l < 4; l += 1)
+            lo[l] = hi[l] = lower[k];
+        for (v = 0; v < blocked; v += 4)
+            for (l = 0; l < 4; l += 1) {
+                lo[l] = (stream[v + l] < lo[l]) ? stream[v + l] : lo[l];
+                hi[l] = (stream[v + l] > hi[l]) ? stream[v + l] : hi[l];
+            }
+        for (; v < vertNum; v += 1) {
+            lo[0] = (stream[v] < lo[0]) ? stream[v] : lo[0];
+            hi[0] = (stream[v] > hi[0]) ? stream[v] : hi[0];
+        }
+        for (l = 0; l < 4; l += 1) {
+            lower[k] = (lo[l] < lower[k]) ? lo[l] : lower[k];
+            upper[k] = (hi[l] > upper[k]) ? hi[l] : upper[k];
+        }
+    }
+}
+
+/* Computes a sphere containing attributes first, ..., first + dim - 1
+(dim <= 3) of all vertices, as points in 3D with any missing coordinates 0.0.
+The center is the center of the bounding box, so the sphere is not the smallest
+possible, but it is never more than about 1.7 times too big, and it costs only
+two passes. Works in either layout; in SoA layout, the second pass runs down
+the streams in four independent lanes, as meshGetBounds does. */
+void meshGetBoundingSphere(
+        const meshMesh *mesh, GLuint first, GLuint dim, GLdouble center[3],
+        GLdouble *radius) {
+    GLdouble lower[3] = {0.0, 0.0, 0.0}, upper[3] = {0.0, 0.0, 0.0};
+    GLdouble p[3] = {0.0, 0.0, 0.0}, distSq, maxSq = 0.0;
+    GLuint v, k, l;
+    meshGetBounds(mesh, first, dim, lower, upper);
+    for (k = 0; k < 3; k += 1)
+        center[k] = 0.5 * (lower[k] + upper[k]);
+    v = 0;
+    if (mesh->streams != NULL) {
+        /* Missing coordinates are 0.0 in both the points and the center, so
+        only the dim streams matter. The tail is left to the loop below. */
+        GLuint blocked = mesh->vertNum & ~3u;
+        GLdouble lane[4] = {0.0, 0.0, 0.0, 0.0}, diff;
+        const GLdouble *streams[3];
+        for (k = 0; k < dim; k += 1)
+            streams[k] = meshGetStream(mesh, first + k);
+        for (; v < blocked; v += 4)
+            for (l = 0; l < 4; l += 1) {
+                distSq = 0.0;
+                for (k = 0; k < dim; k += 1) {
+                    diff = streams[k][v + l] - center[k];
+                    distSq += diff * diff;
+                }
+                lane[l] = (distSq > lane[l]) ? distSq : lane[l];
+            }
+        for (l = 0; l < 4; l += 1)
+            maxSq = (lane[l] > maxSq) ? lane[l] : maxSq;
+    }
+    for (; v < mesh->vertNum; v += 1) {
+        meshGetAttributes(mesh, v, first, dim, p);
+        distSq = 0.0;
+        for (k = 0; k < 3; k += 1)
+            distSq += (p[k] - center[k]) * (p[k] - center[k]);
+        maxSq = (distSq > maxSq) ? distSq : maxSq;
+    }
+    *radius = sqrt(maxSq);
 }
 
 
@@ -161,7 +422,9 @@ for vertNum and attrDim. The fifth line says '[triNum] Triangles:'. Then there
 are triNum lines, each holding three GLuintegers between 0 and vertNum - 1
 (separated by a space). Then there is a line that says '[vertNum] Vertices:'.
 Then there are vertNum lines, each holding attrDim floating-poGLuint numbers
-(terminated by a space). */
+(terminated by a space). The numbers are written with 17 significant digits, so
+that reading them back recovers the GLdoubles exactly. For large meshes, prefer
+the binary format of meshSaveBinaryFile. */
 GLuint meshSaveFile(const meshMesh *mesh, const char *path) {
     FILE *file = fopen(path, "w");
     if (file == NULL) {
@@ -180,11 +443,12 @@ GLuint meshSaveFile(const meshMesh *mesh, const char *path) {
         fprintf(file, "%d %d %d\n", tri[0], tri[1], tri[2]);
     }
     fprintf(file, "%d Vertices:\n", mesh->vertNum);
-    GLdouble *vert;
+    GLdouble attr;
     for (i = 0; i < mesh->vertNum; i += 1) {
-        vert = meshGetVertexPointer(mesh, i);
-        for (j = 0; j < mesh->attrDim; j += 1)
-            fprintf(file, "%f ", vert[j]);
+        for (j = 0; j < mesh->attrDim; j += 1) {
+            meshGetAttributes(mesh, i, j, 1, &attr);
+            fprintf(file, "%.17g ", attr);
+        }
         fprintf(file, "\n");
     }
     fclose(file);
@@ -10,59 +10,397 @@ void mesh3DTrueNormal(
         const GLdouble a[], const GLdouble b[], const GLdouble c[],
         GLdouble normal[3]) {
     GLdouble bMinusA[3], cMinusA[3];
-    vecSubtract(3, b, a, bMinusA);
-    vecSubtract(3, c, a, cMinusA);
+    vec3Subtract(b, a, bMinusA);
+    vec3Subtract(c, a, cMinusA);
     vec3Cross(bMinusA, cMinusA, normal);
-    vecUnit(3, normal, normal);
+    vec3Unit(normal, normal);
+}
+
+/* The per-triangle kernels below work on blocks of this many triangles. */
+#define mesh3DBLOCK 8
+
+/* Helper function for the per-triangle kernels. For each of the triangles
+first, ..., first + count - 1 (count <= mesh3DBLOCK), with corners a, b, c,
+puts (b - a) x (c - a) into lane l = t - first of cross[0], cross[1], cross[2],
+and its length into length[l]. The corners are gathered into lanes first, from
+the position streams in SoA layout, so that the arithmetic runs down whole
+lanes, which the compiler can vectorize. Unused lanes hold zeros. Works in
+either layout, and matches mesh3DTrueNormal bit for bit. */
+void mesh3DGetCrosses(
+        const meshMesh *mesh, GLuint first, GLuint count,
+        GLdouble cross[3][mesh3DBLOCK], GLdouble length[mesh3DBLOCK]) {
+    GLdouble p[3][3][mesh3DBLOCK], u[3][mesh3DBLOCK], w[3][mesh3DBLOCK];
+    const GLuint *tri = &(mesh->tri[(size_t)first * 3]);
+    GLuint l, k, j;
+    for (k = 0; k < 3; k += 1)
+        for (j = 0; j < 3; j += 1) {
+            const GLdouble *stream = meshGetStream(mesh, j);
+            for (l = 0; l < count; l += 1)
+                p[k][j][l] = (stream != NULL) ? stream[tri[l * 3 + k]] :
+                    mesh->vert[(size_t)tri[l * 3 + k] * mesh->attrDim + j];
+            for (; l < mesh3DBLOCK; l += 1)
+                p[k][j][l] = 0.0;
+        }
+    for (j = 0; j < 3; j += 1)
+        for (l = 0; l < mesh3DBLOCK; l += 1) {
+            u[j][l] = p[1][j][l] - p[0][j][l];
+            w[j][l] = p[2][j][l] - p[0][j][l];
+        }
+    for (l = 0; l < mesh3DBLOCK; l += 1) {
+        cross[0][l] = u[1][l] * w[2][l] - u[2][l] * w[1][l];
+        cross[1][l] = u[2][l] * w[0][l] - u[0][l] * w[2][l];
+        cross[2][l] = u[0][l] * w[1][l] - u[1][l] * w[0][l];
+        length[l] = sqrt(0.0 + cross[0][l] * cross[0][l] +
+            cross[1][l] * cross[1][l] + cross[2][l] * cross[2][l]);
+    }
+}
+
+/* A normalizer computes vertex normals for a mesh in parallel. It records,
+once, which triangles touch each vertex (in compressed-row form), so that each
+thread can gather the normal of its own vertices without writing anywhere that
+another thread writes. It can also weld vertices by position, so that vertices
+that share XYZ but differ in other attributes (as along the texture seam of a
+landscape or a surface of revolution) get the same smooth normal, instead of
+cracked shading. A normalizer stays valid while the mesh's triangles and the
+grouping of its vertices by position stay the same; the positions themselves
+can move, as when a landscape is edited. */
+
+#define mesh3DAREAWEIGHTED 0
+#define mesh3DANGLEWEIGHTED 1
+#define mesh3DUNWEIGHTED 2
+
+/* Meshes with fewer triangles than this, per thread, aren't worth starting a
+thread for. */
+#define mesh3DNORMALSPERTHREAD 4096
+
+/* Feel free to read from this struct's members, but don't write to them.
+groups[v] is the lowest-numbered vertex at v's position. The triangles touching
+group g are triangles[offsets[g]], ..., triangles[offsets[g + 1] - 1], in
+increasing order. faces holds each triangle's unit normal and area. */
+typedef struct mesh3DNormalizer mesh3DNormalizer;
+struct mesh3DNormalizer {
+    GLuint vertNum, triNum;
+    GLuint *groups, *offsets, *triangles;
+    GLdouble *faces;
+};
+
+/* Initializes a normalizer for the mesh. If weld is zero, each vertex is its
+own group. Otherwise vertices are grouped by XYZ, exactly if epsilon is 0.0 or
+within epsilon if epsilon > 0.0, as in meshCompact. Returns 0 on success,
+non-zero on failure. Don't forget to call mesh3DNormalizerDestroy. */
+int mesh3DNormalizerInitialize(
+        mesh3DNormalizer *nor, const meshMesh *mesh, int weld,
+        GLdouble epsilon) {
+    GLuint vertNum = mesh->vertNum, triNum = mesh->triNum, tableSize = 1;
+    GLuint i, v, g;
+    while (weld && tableSize < 2 * vertNum)
+        tableSize *= 2;
+    nor->groups = (GLuint *)malloc(((GLsizeiptr)vertNum * 2 + 1 +
+        (GLsizeiptr)triNum * 3 + (weld ? tableSize : 0)) * sizeof(GLuint));
+    if (nor->groups == NULL)
+        return 1;
+    nor->faces = (GLdouble *)malloc((GLsizeiptr)triNum * 4 *
+        sizeof(GLdouble));
+    if (nor->faces == NULL) {
+        free(nor->groups);
+        return 2;
+    }
+    nor->offsets = &(nor->groups[vertNum]);
+    nor->triangles = &(nor->offsets[vertNum + 1]);
+    nor->vertNum = vertNum;
+    nor->triNum = triNum;
+    /* The hash table of group representatives lives past the triangles, and
+    is only needed here. vertNum marks empty slots. */
+    GLuint *table = &(nor->triangles[triNum * 3]);
+    GLdouble vert[3], other[3];
+    int shift[3], noShift[3] = {0, 0, 0};
+    int p, probeNum = (epsilon > 0.0) ? 27 : 1;
+    uint64_t hash;
+    for (i = 0; weld && i < tableSize; i += 1)
+        table[i] = vertNum;
+    for (v = 0; v < vertNum; v += 1) {
+        nor->groups[v] = v;
+        if (!weld)
+            continue;
+        meshGetAttributes(mesh, v, 0, 3, vert);
+        for (p = 0; p < probeNum && nor->groups[v] == v; p += 1) {
+            shift[0] = (epsilon > 0.0) ? p % 3 - 1 : 0;
+            shift[1] = (epsilon > 0.0) ? (p / 3) % 3 - 1 : 0;
+            shift[2] = (epsilon > 0.0) ? p / 9 - 1 : 0;
+            hash = meshWeldHash(vert, 3, epsilon, shift);
+            for (i = hash & (tableSize - 1); table[i] != vertNum;
+                    i = (i + 1) & (tableSize - 1)) {
+                meshGetAttributes(mesh, table[i], 0, 3, other);
+                if (meshWeldMatch(vert, other, 3, epsilon)) {
+                    nor->groups[v] = table[i];
+                    break;
+                }
+            }
+        }
+        if (nor->groups[v] == v) {
+            hash = meshWeldHash(vert, 3, epsilon, noShift);
+            for (i = hash & (tableSize - 1); table[i] != vertNum;
+                    i = (i + 1) & (tableSize - 1));
+            table[i] = v;
+        }
+    }
+    /* Count, prefix-sum, and fill, as in meshGetAdjacency, but by group. */
+    for (g = 0; g <= vertNum; g += 1)
+        nor->offsets[g] = 0;
+    for (i = 0; i < triNum * 3; i += 1)
+        nor->offsets[nor->groups[mesh->tri[i]] + 1] += 1;
+    for (g = 0; g < vertNum; g += 1)
+        nor->offsets[g + 1] += nor->offsets[g];
+    for (i = 0; i < triNum * 3; i += 1) {
+        g = nor->groups[mesh->tri[i]];
+        nor->triangles[nor->offsets[g]] = i / 3;
+        nor->offsets[g] += 1;
+    }
+    for (g = vertNum; g > 0; g -= 1)
+        nor->offsets[g] = nor->offsets[g - 1];
+    nor->offsets[0] = 0;
+    return 0;
+}
+
+/* Releases the resources backing the normalizer. */
+void mesh3DNormalizerDestroy(mesh3DNormalizer *nor) {
+    free(nor->groups);
+    free(nor->faces);
+}
+
+typedef struct mesh3DNormalTask mesh3DNormalTask;
+struct mesh3DNormalTask {
+    const mesh3DNormalizer *nor;
+    meshMesh *mesh;
+    GLuint n;
+    int weighting, smooth;
+    GLdouble cosCrease;
+};
+
+/* Helper function for the normalizer. Computes the unit normal and area of
+each of this thread's triangles, a block at a time. */
+void mesh3DNormalFaces(void *data, int thread, int threadNum) {
+    mesh3DNormalTask *task = (mesh3DNormalTask *)data;
+    GLuint t, last, count, l, j;
+    GLdouble cross[3][mesh3DBLOCK], length[mesh3DBLOCK], divisor, *face;
+    parGetRange(task->nor->triNum, thread, threadNum, &t, &last);
+    for (; t < last; t += count) {
+        count = (last - t < mesh3DBLOCK) ? last - t : mesh3DBLOCK;
+        mesh3DGetCrosses(task->mesh, t, count, cross, length);
+        for (l = 0; l < count; l += 1) {
+            face = &(task->nor->faces[(size_t)(t + l) * 4]);
+            divisor = (length[l] > vecTINY) ? length[l] : vecTINY;
+            for (j = 0; j < 3; j += 1)
+                face[j] = cross[j][l] / divisor;
+            face[3] = 0.5 * length[l];
+        }
+    }
+}
+
+/* Helper function for the normalizer. Returns 1 if triangle t uses vertex v. */
+int mesh3DNormalUses(const meshMesh *mesh, GLuint t, GLuint v) {
+    const GLuint *tri = meshGetTrianglePointer(mesh, t);
+    return (tri[0] == v || tri[1] == v || tri[2] == v);
+}
+
+/* Helper function for the normalizer. Returns the angle of triangle t at its
+corner in group g. */
+GLdouble mesh3DNormalAngle(
+        const mesh3DNormalizer *nor, const meshMesh *mesh, GLuint t, GLuint g) {
+    const GLuint *tri = meshGetTrianglePointer(mesh, t);
+    GLuint k = 0;
+    while (k < 2 && nor->groups[tri[k]] != g)
+        k += 1;
+    GLdouble a[3], b[3], c[3], bMinusA[3], cMinusA[3];
+    meshGetAttributes(mesh, tri[k], 0, 3, a);
+    meshGetAttributes(mesh, tri[(k + 1) % 3], 0, 3, b);
+    meshGetAttributes(mesh, tri[(k + 2) % 3], 0, 3, c);
+    vec3Subtract(b, a, bMinusA);
+    vec3Subtract(c, a, cMinusA);
+    if (vec3Unit(bMinusA, bMinusA) == 0.0 ||
+            vec3Unit(cMinusA, cMinusA) == 0.0)
+        return 0.0;
+    return acos(fmax(-1.0, fmin(1.0, vec3Dot(bMinusA, cMinusA))));
+}
+
+/* Helper function for the normalizer. Gathers the normal of each of this
+thread's vertices from the triangles around it. A smooth normal averages the
+triangles touching the vertex's group, leaving out any triangle that is more
+than the crease angle away from every triangle touching the vertex itself. A
+flat normal is that of the last triangle touching the vertex itself. Vertices
+that no triangle uses are left alone. */
+void mesh3DNormalVertices(void *data, int thread, int threadNum) {
+    mesh3DNormalTask *task = (mesh3DNormalTask *)data;
+    const mesh3DNormalizer *nor = task->nor;
+    GLuint v, last, g, i, j, t, u;
+    GLdouble normal[3], weight;
+    int uses, used;
+    parGetRange(nor->vertNum, thread, threadNum, &v, &last);
+    for (; v < last; v += 1) {
+        g = nor->groups[v];
+        vec3Set(0.0, 0.0, 0.0, normal);
+        used = 0;
+        for (i = nor->offsets[g]; i < nor->offsets[g + 1]; i += 1) {
+            t = nor->triangles[i];
+            /* A triangle with two corners in the group is listed twice. */
+            if (i > nor->offsets[g] && nor->triangles[i - 1] == t)
+                continue;
+            uses = mesh3DNormalUses(task->mesh, t, v);
+            used = used || uses;
+            if (!task->smooth) {
+                if (uses)
+                    vec3Copy(&(nor->faces[t * 4]), normal);
+                continue;
+            }
+            if (task->cosCrease > -1.0 && !uses) {
+                for (j = nor->offsets[g]; j < nor->offsets[g + 1]; j += 1) {
+                    u = nor->triangles[j];
+                    if (mesh3DNormalUses(task->mesh, u, v) &&
+                            vec3Dot(&(nor->faces[t * 4]),
+                                &(nor->faces[u * 4])) >= task->cosCrease)
+                        break;
+                }
+                if (j == nor->offsets[g + 1])
+                    continue;
+            }
+            if (task->weighting == mesh3DANGLEWEIGHTED)
+                weight = mesh3DNormalAngle(nor, task->mesh, t, g);
+            else if (task->weighting == mesh3DAREAWEIGHTED)
+                weight = nor->faces[t * 4 + 3];
+            else
+                weight = 1.0;
+            for (j = 0; j < 3; j += 1)
+                normal[j] += weight * nor->faces[t * 4 + j];
+        }
+        if (!used)
+            continue;
+        vec3Unit(normal, normal);
+        meshSetAttributes(task->mesh, v, task->n, 3, normal);
+    }
+}
+
+/* Helper function for the normalizer. Returns how many threads to use, given
+the user's request (0 for the default). */
+int mesh3DNormalGetThreadNum(const mesh3DNormalizer *nor, int threadNum) {
+    int most = (int)(nor->triNum / mesh3DNORMALSPERTHREAD);
+    if (threadNum <= 0)
+        threadNum = parGetDefaultThreadNum();
+    if (threadNum > most)
+        threadNum = most;
+    return (threadNum < 1) ? 1 : threadNum;
+}
+
+/* Assumes that attributes 0, 1, 2 are XYZ and that n >= 3. Sets attributes n,
+n + 1, n + 2 to smooth-shaded normals, using up to threadNum threads (or
+parGetDefaultThreadNum() threads if threadNum is 0); small meshes use fewer.
+Each triangle contributes to the normals of the vertices at its corners'
+positions, weighted by its area (mesh3DAREAWEIGHTED), by its angle at that
+corner (mesh3DANGLEWEIGHTED), or equally (mesh3DUNWEIGHTED). A
+triangle meeting all of a vertex's own triangles at more than creaseAngle
+radians is left out of that vertex's normal; pass M_PI for no creases. The
+normalizer must have been initialized on this mesh. Works in either layout (see
+meshToStreams), touching only the positions and normals. */
+void mesh3DNormalizerSmooth(
+        const mesh3DNormalizer *nor, meshMesh *mesh, GLuint n, int weighting,
+        GLdouble creaseAngle, int threadNum) {
+    mesh3DNormalTask task = {nor, mesh, n, weighting, 1, cos(creaseAngle)};
+    if (creaseAngle >= M_PI)
+        task.cosCrease = -1.0;
+    threadNum = mesh3DNormalGetThreadNum(nor, threadNum);
+    parRun(threadNum, mesh3DNormalFaces, &task);
+    parRun(threadNum, mesh3DNormalVertices, &task);
+}
+
+/* Like mesh3DNormalizerSmooth, but sets flat-shaded normals, as
+mesh3DFlatNormals does. If a vertex belongs to more than one triangle, then the
+highest-numbered triangle's normal wins. */
+void mesh3DNormalizerFlat(
+        const mesh3DNormalizer *nor, meshMesh *mesh, GLuint n, int threadNum) {
+    mesh3DNormalTask task = {nor, mesh, n, mesh3DAREAWEIGHTED, 0, -1.0};
+    threadNum = mesh3DNormalGetThreadNum(nor, threadNum);
+    parRun(threadNum, mesh3DNormalFaces, &task);
+    parRun(threadNum, mesh3DNormalVertices, &task);
 }
 
 /* Assumes that attributes 0, 1, 2 are XYZ. Sets attributes n, n + 1, n + 2 to
 flat-shaded normals. If a vertex belongs to more than triangle, then some
-unspecified triangle's normal wins. */
+unspecified triangle's normal wins. Works in either layout. For large meshes,
+or meshes whose normals are recomputed often, see mesh3DNormalizerFlat. */
 void mesh3DFlatNormals(meshMesh *mesh, GLuint n) {
-    GLuint i, *tri;
-    GLdouble *a, *b, *c, normal[3];
-    for (i = 0; i < mesh->triNum; i += 1) {
-        tri = meshGetTrianglePointer(mesh, i);
-        a = meshGetVertexPointer(mesh, tri[0]);
-        b = meshGetVertexPointer(mesh, tri[1]);
-        c = meshGetVertexPointer(mesh, tri[2]);
-        mesh3DTrueNormal(a, b, c, normal);
-        vecCopy(3, normal, &a[n]);
-        vecCopy(3, normal, &b[n]);
-        vecCopy(3, normal, &c[n]);
+    GLuint i, count, l, k, *tri;
+    GLdouble cross[3][mesh3DBLOCK], length[mesh3DBLOCK], divisor, normal[3];
+    for (i = 0; i < mesh->triNum; i += count) {
+        count = (mesh->triNum - i < mesh3DBLOCK) ? mesh->triNum - i :
+            mesh3DBLOCK;
+        mesh3DGetCrosses(mesh, i, count, cross, length);
+        for (l = 0; l < count; l += 1) {
+            tri = meshGetTrianglePointer(mesh, i + l);
+            divisor = (length[l] > vecTINY) ? length[l] : vecTINY;
+            for (k = 0; k < 3; k += 1)
+                normal[k] = cross[k][l] / divisor;
+            for (k = 0; k < 3; k += 1)
+                meshSetAttributes(mesh, tri[k], n, 3, normal);
+        }
     }
 }
 
 /* Assumes that attributes 0, 1, 2 are XYZ. Sets attributes n, n + 1, n + 2 to
 smooth-shaded normals. Does not do anything special to handle multiple vertices
-with the same coordinates. */
+with the same coordinates; for that, see mesh3DWeldedNormals. Large meshes are
+done in parallel. Works in either layout. */
 void mesh3DSmoothNormals(meshMesh *mesh, GLuint n) {
-    GLuint i, *tri;
-    GLdouble *a, *b, *c, normal[3] = {0.0, 0.0, 0.0};
-    /* Zero the normals. */
-    for (i = 0; i < mesh->vertNum; i += 1) {
-        a = meshGetVertexPointer(mesh, i);
-        vecCopy(3, normal, &a[n]);
+    mesh3DNormalizer nor;
+    if (mesh3DNormalizerInitialize(&nor, mesh, 0, 0.0) == 0) {
+        mesh3DNormalizerSmooth(&nor, mesh, n, mesh3DUNWEIGHTED, M_PI, 0);
+        mesh3DNormalizerDestroy(&nor);
+        return;
     }
+    /* Without memory for the normalizer, scatter each triangle's normal onto
+    its vertices instead. */
+    GLuint i, k, *tri;
+    GLdouble a[3], b[3], c[3], normal[3] = {0.0, 0.0, 0.0}, sum[3];
+    /* Zero the normals. */
+    for (i = 0; i < mesh->vertNum; i += 1)
+        meshSetAttributes(mesh, i, n, 3, normal);
     /* For each triangle, add onto the normal at each of its vertices. */
     for (i = 0; i < mesh->triNum; i += 1) {
         tri = meshGetTrianglePointer(mesh, i);
-        a = meshGetVertexPointer(mesh, tri[0]);
-        b = meshGetVertexPointer(mesh, tri[1]);
-        c = meshGetVertexPointer(mesh, tri[2]);
+        meshGetAttributes(mesh, tri[0], 0, 3, a);
+        meshGetAttributes(mesh, tri[1], 0, 3, b);
+        meshGetAttributes(mesh, tri[2], 0, 3, c);
         mesh3DTrueNormal(a, b, c, normal);
-        vecAdd(3, normal, &a[n], &a[n]);
-        vecAdd(3, normal, &b[n], &b[n]);
-        vecAdd(3, normal, &c[n], &c[n]);
+        for (k = 0; k < 3; k += 1) {
+            meshGetAttributes(mesh, tri[k], n, 3, sum);
+            vec3Add(normal, sum, sum);
+            meshSetAttributes(mesh, tri[k], n, 3, sum);
+        }
     }
     /* Normalize the normals. */
     for (i = 0; i < mesh->vertNum; i += 1) {
-        a = meshGetVertexPointer(mesh, i);
-        vecUnit(3, &a[n], &a[n]);
+        meshGetAttributes(mesh, i, n, 3, sum);
+        vec3Unit(sum, sum);
+        meshSetAttributes(mesh, i, n, 3, sum);
     }
 }
 
+/* Assumes that attributes 0, 1, 2 are XYZ and that n >= 3. Sets attributes n,
+n + 1, n + 2 to smooth-shaded normals, weighted by area or angle (see
+mesh3DNormalizerSmooth). Unlike mesh3DSmoothNormals, vertices with the same
+coordinates get the same normal, so seams in the other attributes don't show
+in the shading. Vertices that no triangle uses are left alone. To recompute
+the normals of a mesh often, keep a mesh3DNormalizer instead of calling this
+function each time. Returns 0 on success, non-zero on failure. */
+int mesh3DWeldedNormals(meshMesh *mesh, GLuint n, int weighting) {
+    mesh3DNormalizer nor;
+    if (mesh3DNormalizerInitialize(&nor, mesh, 1, 0.0) != 0) {
+        fprintf(stderr, "error: mesh3DWeldedNormals: malloc failed\n");
+        return 1;
+    }
+    mesh3DNormalizerSmooth(&nor, mesh, n, weighting, M_PI, 0);
+    mesh3DNormalizerDestroy(&nor);
+    return 0;
+}
+
 /* Builds a mesh for a parallelepiped (box) of the given size. The attributes
 are XYZ position, ST texture, and NOP unit normal vector. The normals are
 discontinuous at the edges (flat shading, not smooth). To facilitate this, some
@@ -140,6 +478,25 @@ GLuint mesh3DInitializeBox(
     return error;
 }
 
+/* Transforms attributes first, first + 1, first + 2 of every vertex (typically
+the XYZ position, or with simdDIRECTIONS a normal) by m, in place, as
+simdTransformPoints does. Works in either layout. Normals stay unit length only
+if m is an isometry. */
+void mesh3DTransform(
+        meshMesh *mesh, GLuint first, const GLdouble m[4][4], int flags) {
+    if (first + 3 > mesh->attrDim)
+        return;
+    if (mesh->streams == NULL)
+        simdTransformPoints(m, flags, mesh->vertNum, &(mesh->vert[first]),
+            mesh->attrDim, &(mesh->vert[first]), mesh->attrDim);
+    else {
+        GLdouble *xs = meshGetStream(mesh, first);
+        GLdouble *ys = meshGetStream(mesh, first + 1);
+        GLdouble *zs = meshGetStream(mesh, first + 2);
+        simdTransformStreams(m, flags, mesh->vertNum, xs, ys, zs, xs, ys, zs);
+    }
+}
+
 /* Rotates a 2-dimensional vector through an angle. The output can safely alias
 the input. */
 void mesh3DRotateVector(GLdouble theta, const GLdouble v[2], GLdouble vRot[2]) {
@@ -191,11 +548,11 @@ GLuint mesh3DInitializeRevolution(
         for (j = 1; j <= zNum - 2; j += 1) {
             // Form the sideNum + 1 vertices in the jth layer.
             vec3Set(z[j + 1] - z[j], 0.0, r[j] - r[j + 1], p);
-            vecUnit(3, p, p);
+            vec3Unit(p, p);
             vec3Set(z[j] - z[j - 1], 0.0, r[j - 1] - r[j], q);
-            vecUnit(3, q, q);
-            vecAdd(3, p, q, o);
-            vecUnit(3, o, o);
+            vec3Unit(q, q);
+            vec3Add(p, q, o);
+            vec3Unit(o, o);
             vec8Set(r[j], 0.0, z[j], 1.0, t[j], o[0], o[1], o[2], v);
             meshSetVertex(mesh, j * (sideNum + 1), v);
             v[3] = 0.0;
@@ -301,7 +658,7 @@ GLuint mesh3DInitializeCylinder(
         fraction = (GLdouble)i / sideNum;
         attr[5] = cos(2.0 * M_PI * fraction);
         attr[6] = sin(2.0 * M_PI * fraction);
-        vecScale(2, r, &(attr[5]), attr);
+        vec2Scale(r, &(attr[5]), attr);
         attr[2] = -0.5 * l;
         attr[3] = fraction;
         attr[4] = 0.0;
@@ -312,7 +669,7 @@ GLuint mesh3DInitializeCylinder(
     }
     attr[5] = cos(0.0);
     attr[6] = sin(0.0);
-    vecScale(2, r, &(attr[5]), attr);
+    vec2Scale(r, &(attr[5]), attr);
     attr[2] = -0.5 * l;
     attr[3] = 1.0;
     attr[4] = 0.0;
@@ -366,12 +723,46 @@ GLuint mesh3DInitializeCylinder(
     return 0;
 }
 
+/* Helper function for mesh3DInitializeLandscape and meshGLLandscapeUpdate.
+Sets the normal of sample (i, j) of a size x size landscape to the sum of the
+cross products of the triangles around it, which weights them by area, as
+mesh3DWeldedNormals does with mesh3DAREAWEIGHTED. Both functions use this one,
+so that an edited sample gets exactly the normal that a fresh build would give
+it. */
+void mesh3DSetLandscapeNormal(meshMesh *mesh, GLuint size, GLint i, GLint j) {
+    GLint last = (GLint)size - 1, si, sj;
+    GLuint v = i * size + j, t, k, *tri;
+    GLdouble normal[3] = {0.0, 0.0, 0.0}, bMinusA[3], cMinusA[3], cross[3];
+    GLdouble *a, *b, *c;
+    for (si = i - 1; si <= i; si += 1)
+        for (sj = j - 1; sj <= j; sj += 1) {
+            if (si < 0 || sj < 0 || si >= last || sj >= last)
+                continue;
+            for (k = 0; k < 2; k += 1) {
+                t = 2 * (si * last + sj) + k;
+                tri = meshGetTrianglePointer(mesh, t);
+                if (tri[0] != v && tri[1] != v && tri[2] != v)
+                    continue;
+                a = meshGetVertexPointer(mesh, tri[0]);
+                b = meshGetVertexPointer(mesh, tri[1]);
+                c = meshGetVertexPointer(mesh, tri[2]);
+                vec3Subtract(b, a, bMinusA);
+                vec3Subtract(c, a, cMinusA);
+                vec3Cross(bMinusA, cMinusA, cross);
+                vec3Add(normal, cross, normal);
+            }
+        }
+    vec3Unit(normal, normal);
+    vec3Copy(normal, &meshGetVertexPointer(mesh, v)[5]);
+}
+
 /* Builds a non-closed 'landscape' mesh based on a grid of Z-values. There are
 width * height Z-values, which arrive in the data parameter. The mesh is made
 of (width - 1) * (height - 1) squares, each made of two triangles. The spacing
 parameter controls the spacing of the X- and Y-coordinates of the vertices. The
-attributes are XYZ position, ST texture, and NOP unit normal vector. Don't
-forget to call meshDestroy when finished with the mesh. To understand the exact
+attributes are XYZ position, ST texture, and NOP unit normal vector. The
+normals are smooth, with each triangle weighted by its area. Don't forget to
+call meshDestroy when finished with the mesh. To understand the exact
 layout of the data, try this example code:
 GLdouble zs[3][4] = {
     {10.0, 9.0, 7.0, 6.0},
@@ -413,8 +804,10 @@ GLuint mesh3DInitializeLandscape(
                     meshSetTriangle(mesh, index + 1, a, c, d);
                 }
             }
-        /* Set the normals. */
-        mesh3DSmoothNormals(mesh, 5);
+        /* Set the normals, weighted by area. */
+        for (i = 0; i < size; i += 1)
+            for (j = 0; j < size; j += 1)
+                mesh3DSetLandscapeNormal(mesh, size, i, j);
     }
     return error;
 }
@@ -423,35 +816,40 @@ GLuint mesh3DInitializeLandscape(
 new landscape mesh by extracting triangles based on how horizontal they are. If
 noMoreThan is true, then triangles are kept that deviate from horizontal by no more than angle. If noMoreThan is false, then triangles are kept that deviate
 from horizontal by more than angle. Don't forget to call meshDestroy when
-finished. Warning: May contain extraneous vertices not used by any triangle. */
+finished. Vertices not used by any of the extracted triangles are removed, so
+the vertex indices generally differ from those of land. The land can be in
+either layout (see meshToStreams); the new mesh is interleaved. */
 GLuint mesh3DInitializeDissectedLandscape(
         meshMesh *mesh, const meshMesh *land, GLdouble angle,
         GLuint noMoreThan) {
-    GLuint error, i, j = 0, triNum = 0;
+    GLuint error, i, j = 0, triNum = 0, count, l;
     GLuint *tri, *newTri;
-    GLdouble normal[3];
-    /* Count the triangles that are nearly horizontal. */
-    for (i = 0; i < land->triNum; i += 1) {
-        tri = meshGetTrianglePointer(land, i);
-        mesh3DTrueNormal(meshGetVertexPointer(land, tri[0]),
-            meshGetVertexPointer(land, tri[1]),
-            meshGetVertexPointer(land, tri[2]), normal);
-        if ((noMoreThan && normal[2] >= cos(angle)) ||
-                (!noMoreThan && normal[2] < cos(angle)))
-            triNum += 1;
+    GLdouble cross[3][mesh3DBLOCK], length[mesh3DBLOCK], cosAngle = cos(angle);
+    /* Count the triangles that are nearly horizontal. A triangle's unit
+    normal has Z-component cross[2][l] / length[l]. */
+    for (i = 0; i < land->triNum; i += count) {
+        count = (land->triNum - i < mesh3DBLOCK) ? land->triNum - i :
+            mesh3DBLOCK;
+        mesh3DGetCrosses(land, i, count, cross, length);
+        for (l = 0; l < count; l += 1)
+            if ((cross[2][l] / ((length[l] > vecTINY) ? length[l] :
+                    vecTINY) >= cosAngle) == (noMoreThan != 0))
+                triNum += 1;
     }
     error = meshInitialize(mesh, triNum, land->vertNum, 3 + 2 + 3);
     if (error == 0) {
         /* Copy all of the vertices. */
-        vecCopy(land->vertNum * (3 + 2 + 3), land->vert, mesh->vert);
+        meshGetInterleaved(land, 0, land->vertNum, mesh->vert);
         /* Copy just the horizontal triangles. */
-        for (i = 0; i < land->triNum; i += 1) {
-            tri = meshGetTrianglePointer(land, i);
-            mesh3DTrueNormal(meshGetVertexPointer(land, tri[0]),
-                meshGetVertexPointer(land, tri[1]),
-                meshGetVertexPointer(land, tri[2]), normal);
-            if ((noMoreThan && normal[2] >= cos(angle)) ||
-                    (!noMoreThan && normal[2] < cos(angle))) {
+        for (i = 0; i < land->triNum; i += count) {
+            count = (land->triNum - i < mesh3DBLOCK) ? land->triNum - i :
+                mesh3DBLOCK;
+            mesh3DGetCrosses(land, i, count, cross, length);
+            for (l = 0; l < count; l += 1) {
+                if ((cross[2][l] / ((length[l] > vecTINY) ? length[l] :
+                        vecTINY) >= cosAngle) != (noMoreThan != 0))
+                    continue;
+                tri = meshGetTrianglePointer(land, i + l);
                 newTri = meshGetTrianglePointer(mesh, j);
                 newTri[0] = tri[0];
                 newTri[1] = tri[1];
@@ -459,6 +857,9 @@ GLuint mesh3DInitializeDissectedLandscape(
                 j += 1;
             }
         }
+        /* Drop the vertices of the discarded triangles. If that fails for
+        lack of memory, the mesh is still valid, just not compact. */
+        meshCompact(mesh, 0, 0.0);
         /* Reset the normals, to make the cliff edges appear sharper. */
         mesh3DSmoothNormals(mesh, 5);
     }
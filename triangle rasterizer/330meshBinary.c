@@ -0,0 +1,237 @@
+/*** Binary mesh files ***/
+
+/* This file offers a binary alternative to the text format of meshSaveFile.
+A binary mesh file is laid out so that it can be memory-mapped and used in
+place: the triangles and vertices are stored exactly as meshMesh stores them in
+memory, so loading involves no parsing at all. The file consists of three
+sections, each starting at a multiple of meshBinaryALIGNMENT bytes:
+    header     a meshBinaryHeader (64 bytes)
+    triangles  triNum * 3 GLuints
+    vertices   vertNum * attrDim GLdoubles
+Numbers are stored in the byte order of the machine that wrote the file. The
+byteOrder field lets a reader detect a file from a machine of the other byte
+order, which it rejects rather than silently misreading. */
+
+#define meshBinaryVERSION 1
+#define meshBinaryALIGNMENT 64
+#define meshBinaryBYTEORDER 0x01020304
+
+/* The magic string is 8 bytes including the terminating null. */
+static const char meshBinaryMAGIC[8] = "CS311MB";
+
+typedef struct meshBinaryHeader meshBinaryHeader;
+struct meshBinaryHeader {
+    char magic[8];
+    uint32_t version, byteOrder, headerSize;
+    uint32_t triNum, vertNum, attrDim;
+    uint64_t triOffset, vertOffset, fileSize;
+    uint64_t checksum;
+};
+
+/* Rounds offset up to the next multiple of meshBinaryALIGNMENT. */
+uint64_t meshBinaryAlign(uint64_t offset) {
+    return (offset + meshBinaryALIGNMENT - 1) &
+        ~(uint64_t)(meshBinaryALIGNMENT - 1);
+}
+
+/* Continues the running checksum hash over byteNum bytes of data. The data are
+consumed as 64-bit words, so that the checksum runs at memory speed; a trailing
+partial word is padded with zeros. Start a new checksum with hash equal to
+meshBinaryChecksumStart(). */
+#define meshBinaryChecksumStart() ((uint64_t)0xcbf29ce484222325ULL)
+uint64_t meshBinaryChecksum(uint64_t hash, const void *data, uint64_t byteNum) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t i, word, wordNum = byteNum / 8;
+    for (i = 0; i < wordNum; i += 1) {
+        memcpy(&word, &bytes[i * 8], 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    if (byteNum % 8 != 0) {
+        word = 0;
+        memcpy(&word, &bytes[wordNum * 8], byteNum % 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* Computes the checksum stored in the header of a binary mesh file. */
+uint64_t meshBinaryMeshChecksum(const meshMesh *mesh) {
+    uint64_t hash = meshBinaryChecksumStart();
+    hash = meshBinaryChecksum(hash, mesh->tri,
+        (uint64_t)mesh->triNum * 3 * sizeof(GLuint));
+    hash = meshBinaryChecksum(hash, mesh->vert,
+        (uint64_t)mesh->vertNum * mesh->attrDim * sizeof(GLdouble));
+    return hash;
+}
+
+/* Saves a mesh to a binary file, in the format described at the top of this
+file. The mesh must be in interleaved layout. Returns 0 on success, non-zero on
+failure. */
+GLuint meshSaveBinaryFile(const meshMesh *mesh, const char *path) {
+    static const char zeros[meshBinaryALIGNMENT] = {0};
+    meshBinaryHeader header;
+    if (mesh->streams != NULL) {
+        fprintf(stderr, "error: meshSaveBinaryFile: mesh is not "
+            "interleaved\n");
+        return 3;
+    }
+    uint64_t triBytes = (uint64_t)mesh->triNum * 3 * sizeof(GLuint);
+    uint64_t vertBytes = (uint64_t)mesh->vertNum * mesh->attrDim *
+        sizeof(GLdouble);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, meshBinaryMAGIC, 8);
+    header.version = meshBinaryVERSION;
+    header.byteOrder = meshBinaryBYTEORDER;
+    header.headerSize = sizeof(meshBinaryHeader);
+    header.triNum = mesh->triNum;
+    header.vertNum = mesh->vertNum;
+    header.attrDim = mesh->attrDim;
+    header.triOffset = meshBinaryAlign(sizeof(meshBinaryHeader));
+    header.vertOffset = meshBinaryAlign(header.triOffset + triBytes);
+    header.fileSize = header.vertOffset + vertBytes;
+    header.checksum = meshBinaryMeshChecksum(mesh);
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "error: meshSaveBinaryFile: fopen failed\n");
+        return 1;
+    }
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+            fwrite(zeros, 1, header.triOffset - sizeof(header), file) !=
+                header.triOffset - sizeof(header) ||
+            fwrite(mesh->tri, 1, triBytes, file) != triBytes ||
+            fwrite(zeros, 1, header.vertOffset - header.triOffset - triBytes,
+                file) != header.vertOffset - header.triOffset - triBytes ||
+            fwrite(mesh->vert, 1, vertBytes, file) != vertBytes) {
+        fprintf(stderr, "error: meshSaveBinaryFile: fwrite failed\n");
+        fclose(file);
+        return 2;
+    }
+    if (fclose(file) != 0) {
+        fprintf(stderr, "error: meshSaveBinaryFile: fclose failed\n");
+        return 3;
+    }
+    return 0;
+}
+
+/* Helper function for meshInitializeBinaryFile. */
+GLuint meshBinaryFileError(void *mapping, size_t size, const char *cause) {
+    fprintf(stderr, "error: meshInitializeBinaryFile: %s\n", cause);
+    munmap(mapping, size);
+    return 3;
+}
+
+/* Initializes a mesh by memory-mapping a binary mesh file, as written by
+meshSaveBinaryFile. The mesh's tri and vert point directly into the mapping, so
+nothing is parsed or copied; pages are read from disk on first touch. The
+mapping is private, so the mesh can still be edited with meshSetTriangle, etc.,
+without altering the file. If verify is non-zero, then the checksum and the
+vertex indices are checked, which touches the whole file; if verify is zero,
+then only the header is checked, so use that only on trusted files. Returns 0
+on success, non-zero on failure. Don't forget to invoke meshDestroy when you
+are done using the mesh. */
+GLuint meshInitializeBinaryFile(meshMesh *mesh, const char *path, int verify) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: meshInitializeBinaryFile: open failed\n");
+        return 1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 ||
+            (uint64_t)info.st_size < sizeof(meshBinaryHeader)) {
+        fprintf(stderr, "error: meshInitializeBinaryFile: file too short\n");
+        close(fd);
+        return 2;
+    }
+    size_t size = (size_t)info.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+        0);
+    /* The mapping stays valid after the descriptor is closed. */
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "error: meshInitializeBinaryFile: mmap failed\n");
+        return 2;
+    }
+    const meshBinaryHeader *header = (const meshBinaryHeader *)mapping;
+    if (memcmp(header->magic, meshBinaryMAGIC, 8) != 0)
+        return meshBinaryFileError(mapping, size, "bad magic");
+    if (header->byteOrder != meshBinaryBYTEORDER)
+        return meshBinaryFileError(mapping, size, "bad byte order");
+    if (header->version != meshBinaryVERSION)
+        return meshBinaryFileError(mapping, size, "unsupported version");
+    /* A crafted header could make sums or products of its fields wrap
+    around, so each section is compared against the room left after its
+    offset, and the vertex count is bounded by division before multiplying.
+    triNum * 3 * sizeof(GLuint) can't exceed 64 bits. */
+    uint64_t triBytes = (uint64_t)header->triNum * 3 * sizeof(GLuint);
+    if (header->headerSize != sizeof(meshBinaryHeader) ||
+            header->triOffset % meshBinaryALIGNMENT != 0 ||
+            header->vertOffset % meshBinaryALIGNMENT != 0 ||
+            header->triOffset < header->headerSize ||
+            header->triOffset > size ||
+            triBytes > size - header->triOffset ||
+            header->vertOffset < header->triOffset ||
+            header->vertOffset - header->triOffset < triBytes ||
+            header->vertOffset > size ||
+            (header->attrDim != 0 && header->vertNum >
+                (size - header->vertOffset) / sizeof(GLdouble) /
+                header->attrDim))
+        return meshBinaryFileError(mapping, size, "bad section layout");
+    uint64_t vertBytes = (uint64_t)header->vertNum * header->attrDim *
+        sizeof(GLdouble);
+    if (header->fileSize != header->vertOffset + vertBytes)
+        return meshBinaryFileError(mapping, size, "bad section layout");
+    mesh->triNum = header->triNum;
+    mesh->vertNum = header->vertNum;
+    mesh->attrDim = header->attrDim;
+    mesh->tri = (GLuint *)((char *)mapping + header->triOffset);
+    mesh->vert = (GLdouble *)((char *)mapping + header->vertOffset);
+    if (verify) {
+        if (meshBinaryMeshChecksum(mesh) != header->checksum)
+            return meshBinaryFileError(mapping, size, "bad checksum");
+        uint64_t i, indexNum = (uint64_t)mesh->triNum * 3;
+        for (i = 0; i < indexNum; i += 1)
+            if (mesh->tri[i] >= mesh->vertNum)
+                return meshBinaryFileError(mapping, size, "bad index");
+    }
+    mesh->mapping = mapping;
+    mesh->mappingSize = size;
+    mesh->streams = NULL;
+    mesh->streamStride = 0;
+    return 0;
+}
+
+/* Returns 1 if the file at path starts with the binary mesh magic string, and
+0 otherwise (including if the file cannot be read). */
+int meshIsBinaryFile(const char *path) {
+    char magic[8];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return 0;
+    int isBinary = (fread(magic, 1, 8, file) == 8 &&
+        memcmp(magic, meshBinaryMAGIC, 8) == 0);
+    fclose(file);
+    return isBinary;
+}
+
+/* Converts a text mesh file, in the 'Carleton College CS 311 mesh' format of
+meshSaveFile, to a binary mesh file. Returns 0 on success, non-zero on
+failure. */
+GLuint meshConvertFileToBinary(const char *textPath, const char *binaryPath) {
+    meshMesh mesh;
+    if (meshInitializeFile(&mesh, textPath) != 0)
+        return 1;
+    GLuint error = meshSaveBinaryFile(&mesh, binaryPath);
+    meshDestroy(&mesh);
+    return (error == 0) ? 0 : 2;
+}
+
+/* Converts a binary mesh file back to the text format of meshSaveFile. Returns
+0 on success, non-zero on failure. */
+GLuint meshConvertBinaryToFile(const char *binaryPath, const char *textPath) {
+    meshMesh mesh;
+    if (meshInitializeBinaryFile(&mesh, binaryPath, 1) != 0)
+        return 1;
+    GLuint error = meshSaveFile(&mesh, textPath);
+    meshDestroy(&mesh);
+    return (error == 0) ? 0 : 2;
+}
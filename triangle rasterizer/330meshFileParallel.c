@@ -0,0 +1,442 @@
+/*** Reading text mesh files in parallel ***/
+
+/* This file offers meshInitializeFileParallel, a faster replacement for
+meshInitializeFile that reads the same text format (documented at
+meshSaveFile). The file is memory-mapped and cut into one chunk per thread, at
+newline boundaries. In a first parallel pass, each thread counts the lines in
+its chunk, so that every thread knows the line number at which its chunk
+starts. In a second parallel pass, each thread parses its lines straight into
+the mesh. Because line numbers determine where each triangle and vertex goes,
+this reader is stricter than meshInitializeFile: each triangle and each vertex
+must occupy exactly one line, as meshSaveFile writes them. */
+
+/* Powers of ten that are exactly representable as GLdoubles. */
+static const GLdouble meshParsePOWERS[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+    1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* Helper function for meshParseDouble. Rounds value * 2^binExp to the nearest
+GLdouble, ties to even, where value is a non-zero 128-bit integer and sticky is
+non-zero if bits below value were dropped (so that value is really a little
+more than it appears). */
+#ifdef __SIZEOF_INT128__
+GLdouble meshParseRound(unsigned __int128 value, int sticky, int binExp) {
+    uint64_t high = (uint64_t)(value >> 64), mantissa;
+    int bitNum = (high != 0) ? 128 - __builtin_clzll(high) :
+        64 - __builtin_clzll((uint64_t)value);
+    int shift = bitNum - 53;
+    if (shift <= 0)
+        return ldexp((GLdouble)(uint64_t)value, binExp);
+    unsigned __int128 half = (unsigned __int128)1 << (shift - 1);
+    unsigned __int128 rest = value & ((half << 1) - 1);
+    mantissa = (uint64_t)(value >> shift);
+    if (rest > half || (rest == half && (sticky || (mantissa & 1))))
+        mantissa += 1;
+    /* A carry out to 2^53 is still exact. */
+    return ldexp((GLdouble)mantissa, binExp + shift);
+}
+
+/* Powers of five up to the largest that fits in 63 bits. */
+static const uint64_t meshParseFIVES[28] = {
+    1ULL, 5ULL, 25ULL, 125ULL, 625ULL, 3125ULL, 15625ULL, 78125ULL,
+    390625ULL, 1953125ULL, 9765625ULL, 48828125ULL, 244140625ULL,
+    1220703125ULL, 6103515625ULL, 30517578125ULL, 152587890625ULL,
+    762939453125ULL, 3814697265625ULL, 19073486328125ULL, 95367431640625ULL,
+    476837158203125ULL, 2384185791015625ULL, 11920928955078125ULL,
+    59604644775390625ULL, 298023223876953125ULL, 1490116119384765625ULL,
+    7450580596923828125ULL};
+#endif
+
+/* Helper function for meshParseDouble. Converts mantissa * 10^exponent, for a
+mantissa of at most 19 digits and -27 <= exponent <= 27, to the nearest
+GLdouble, exactly as strtod would, and returns 0. That covers everything
+written with %.17g, unless it is very large or very small. Writing 10^exponent
+as 5^exponent * 2^exponent, a positive power of five is multiplied in exactly,
+and a negative one is divided out with enough quotient bits, plus a sticky bit
+for the remainder, to round correctly. Needs 128-bit integers; without them,
+returns non-zero, and the caller falls back to strtod. */
+int meshParseExact(uint64_t mantissa, int exponent, GLdouble *value) {
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 wide = mantissa;
+    if (mantissa == 0) {
+        *value = 0.0;
+        return 0;
+    }
+    if (exponent >= 0) {
+        *value = meshParseRound(wide * meshParseFIVES[exponent], 0, exponent);
+        return 0;
+    }
+    /* Shift the mantissa up to 127 bits, so that the quotient by a power of
+    five under 2^63 keeps at least 64 bits. */
+    int shift = 127 - (64 - __builtin_clzll(mantissa));
+    wide <<= shift;
+    uint64_t five = meshParseFIVES[-exponent];
+    *value = meshParseRound(wide / five, (wide % five) != 0,
+        exponent - shift);
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+/* Advances *cursor past spaces, tabs, and carriage returns, but not past end
+or a newline. */
+void meshParseSkipSpace(const char **cursor, const char *end) {
+    while (*cursor < end && (**cursor == ' ' || **cursor == '\t' ||
+            **cursor == '\r'))
+        *cursor += 1;
+}
+
+/* Parses an unsigned decimal integer at *cursor, after optional spaces. On
+success, advances *cursor past it and returns 0. Returns non-zero if there is
+no number or it does not fit in a GLuint. */
+int meshParseUint(const char **cursor, const char *end, GLuint *value) {
+    uint64_t result = 0;
+    const char *c;
+    meshParseSkipSpace(cursor, end);
+    for (c = *cursor; c < end && *c >= '0' && *c <= '9'; c += 1) {
+        result = result * 10 + (GLuint)(*c - '0');
+        if (result > 0xFFFFFFFFULL)
+            return 1;
+    }
+    if (c == *cursor)
+        return 2;
+    *cursor = c;
+    *value = (GLuint)result;
+    return 0;
+}
+
+/* Parses a floating-point number at *cursor, after optional spaces, in the
+notation of printf's %f, %e, and %g. The parser does not consult the C locale,
+so the decimal point is always '.'. Numbers with at most 15 significant digits
+and a small exponent, such as everything written with %f, are converted with a
+single correctly rounded multiplication or division. Numbers with up to 19
+digits and a moderate exponent, such as everything meshSaveFile writes with
+%.17g, are converted exactly by meshParseExact. Anything else, and inf and nan,
+fall back to strtod; this program never calls setlocale, so strtod also uses
+'.' there. On success, advances *cursor and returns 0. */
+int meshParseDouble(const char **cursor, const char *end, GLdouble *value) {
+    const char *c, *start;
+    uint64_t mantissa = 0;
+    int digitNum = 0, exponent = 0, negative = 0, expValue = 0, expNegative = 0;
+    meshParseSkipSpace(cursor, end);
+    start = c = *cursor;
+    if (c < end && (*c == '-' || *c == '+')) {
+        negative = (*c == '-');
+        c += 1;
+    }
+    /* Skip leading zeros, which are not significant. */
+    const char *digits = c;
+    while (c < end && *c == '0')
+        c += 1;
+    for (; c < end && *c >= '0' && *c <= '9'; c += 1) {
+        if (digitNum < 19)
+            mantissa = mantissa * 10 + (uint64_t)(*c - '0');
+        else
+            exponent += 1;
+        digitNum += 1;
+    }
+    if (c < end && *c == '.') {
+        c += 1;
+        if (digitNum == 0)
+            while (c < end && *c == '0') {
+                exponent -= 1;
+                c += 1;
+            }
+        for (; c < end && *c >= '0' && *c <= '9'; c += 1) {
+            if (digitNum < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*c - '0');
+                exponent -= 1;
+            }
+            digitNum += 1;
+        }
+    }
+    if (c == digits || (c == digits + 1 && *digits == '.')) {
+        /* No digits at all, so maybe inf or nan. */
+        if (c < end && (*c == 'i' || *c == 'I' || *c == 'n' || *c == 'N'))
+            goto slowPath;
+        return 1;
+    }
+    if (c < end && (*c == 'e' || *c == 'E')) {
+        const char *e = c + 1;
+        if (e < end && (*e == '-' || *e == '+')) {
+            expNegative = (*e == '-');
+            e += 1;
+        }
+        if (e < end && *e >= '0' && *e <= '9') {
+            for (; e < end && *e >= '0' && *e <= '9'; e += 1)
+                if (expValue < 10000)
+                    expValue = expValue * 10 + (*e - '0');
+            exponent += expNegative ? -expValue : expValue;
+            c = e;
+        }
+    }
+    if (digitNum <= 15 && exponent >= -22 && exponent <= 22) {
+        GLdouble result = (GLdouble)mantissa;
+        if (exponent < 0)
+            result /= meshParsePOWERS[-exponent];
+        else
+            result *= meshParsePOWERS[exponent];
+        *value = negative ? -result : result;
+        *cursor = c;
+        return 0;
+    }
+    if (digitNum <= 19 && exponent >= -27 && exponent <= 27 &&
+            meshParseExact(mantissa, exponent, value) == 0) {
+        if (negative)
+            *value = -*value;
+        *cursor = c;
+        return 0;
+    }
+slowPath:;
+    char buffer[64];
+    const char *stop = start;
+    while (stop < end && stop - start < 63 && *stop != ' ' && *stop != '\t' &&
+            *stop != '\r' && *stop != '\n')
+        stop += 1;
+    memcpy(buffer, start, stop - start);
+    buffer[stop - start] = '\0';
+    char *parsedEnd;
+    *value = strtod(buffer, &parsedEnd);
+    if (parsedEnd == buffer)
+        return 2;
+    *cursor = start + (parsedEnd - buffer);
+    return 0;
+}
+
+/* Returns 0 if the text at *cursor matches the literal word (after optional
+spaces), advancing *cursor past it. Returns non-zero otherwise. */
+int meshParseWord(const char **cursor, const char *end, const char *word) {
+    size_t length = strlen(word);
+    meshParseSkipSpace(cursor, end);
+    if ((size_t)(end - *cursor) < length || memcmp(*cursor, word, length) != 0)
+        return 1;
+    *cursor += length;
+    return 0;
+}
+
+/* Returns 0 if only spaces remain before the end of the line, advancing
+*cursor past the newline (if any). Returns non-zero otherwise. */
+int meshParseEndOfLine(const char **cursor, const char *end) {
+    meshParseSkipSpace(cursor, end);
+    if (*cursor == end)
+        return 0;
+    if (**cursor != '\n')
+        return 1;
+    *cursor += 1;
+    return 0;
+}
+
+/* One thread's share of the body of the file. */
+typedef struct meshParseChunk meshParseChunk;
+struct meshParseChunk {
+    const char *start, *end;
+    GLuint firstLine, lineNum;
+    GLuint errorLine;
+    const char *errorCause;
+};
+
+typedef struct meshParseJob meshParseJob;
+struct meshParseJob {
+    meshMesh *mesh;
+    meshParseChunk *chunks;
+};
+
+/* Helper function for meshInitializeFileParallel. Counts the lines in one
+chunk. */
+void meshParseCountLines(void *data, int thread, int threadNum) {
+    meshParseChunk *chunk = &((meshParseJob *)data)->chunks[thread];
+    const char *c = chunk->start;
+    GLuint lineNum = 0;
+    (void)threadNum;
+    while (c < chunk->end) {
+        c = (const char *)memchr(c, '\n', chunk->end - c);
+        if (c == NULL)
+            break;
+        lineNum += 1;
+        c += 1;
+    }
+    /* A last line without a newline still counts. */
+    if (chunk->end > chunk->start && chunk->end[-1] != '\n')
+        lineNum += 1;
+    chunk->lineNum = lineNum;
+}
+
+/* Helper function for meshInitializeFileParallel. Parses the lines in one
+chunk, stopping at the first error. Line numbers are as in meshInitializeFile:
+the triangles are on lines 6 through triNum + 5, the vertex header is on line
+triNum + 6, and the vertices follow. */
+void meshParseLines(void *data, int thread, int threadNum) {
+    meshParseJob *job = (meshParseJob *)data;
+    meshParseChunk *chunk = &job->chunks[thread];
+    meshMesh *mesh = job->mesh;
+    const char *c = chunk->start, *end = chunk->end;
+    GLuint line, j, *tri, check;
+    GLdouble *vert;
+    GLuint vertHeaderLine = mesh->triNum + 6;
+    GLuint lastLine = vertHeaderLine + mesh->vertNum;
+    (void)threadNum;
+    for (line = chunk->firstLine; c < end && line <= lastLine; line += 1) {
+        if (line < vertHeaderLine) {
+            tri = &mesh->tri[(line - 6) * 3];
+            if (meshParseUint(&c, end, &tri[0]) != 0 ||
+                    meshParseUint(&c, end, &tri[1]) != 0 ||
+                    meshParseUint(&c, end, &tri[2]) != 0 ||
+                    meshParseEndOfLine(&c, end) != 0) {
+                chunk->errorCause = "bad triangle";
+                break;
+            }
+            if (tri[0] >= mesh->vertNum || tri[1] >= mesh->vertNum ||
+                    tri[2] >= mesh->vertNum) {
+                chunk->errorCause = "bad index";
+                break;
+            }
+        } else if (line == vertHeaderLine) {
+            if (meshParseUint(&c, end, &check) != 0 || check != mesh->vertNum ||
+                    meshParseWord(&c, end, "Vertices:") != 0 ||
+                    meshParseEndOfLine(&c, end) != 0) {
+                chunk->errorCause = "bad header";
+                break;
+            }
+        } else {
+            vert = &mesh->vert[(line - vertHeaderLine - 1) * mesh->attrDim];
+            for (j = 0; j < mesh->attrDim; j += 1)
+                if (meshParseDouble(&c, end, &vert[j]) != 0)
+                    break;
+            if (j < mesh->attrDim || meshParseEndOfLine(&c, end) != 0) {
+                chunk->errorCause = "bad vertex";
+                break;
+            }
+        }
+    }
+    if (chunk->errorCause != NULL)
+        chunk->errorLine = line;
+}
+
+/* Helper function for meshInitializeFileParallel. */
+GLuint meshParseFileError(
+        meshMesh *mesh, void *mapping, size_t size, const char *cause,
+        GLuint line) {
+    fprintf(stderr, "error: meshInitializeFileParallel: %s at line %d\n",
+        cause, line);
+    munmap(mapping, size);
+    if (mesh != NULL)
+        meshDestroy(mesh);
+    return 3;
+}
+
+/* Initializes a mesh from a text mesh file, exactly as meshInitializeFile
+does, but using threadNum threads (or parGetDefaultThreadNum() threads if
+threadNum is 0). Performs the same validation as meshInitializeFile, and
+reports the same line numbers on failure. Returns 0 on success, non-zero on
+failure. Don't forget to invoke meshDestroy when you are done using the mesh.
+*/
+GLuint meshInitializeFileParallel(
+        meshMesh *mesh, const char *path, int threadNum) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: meshInitializeFileParallel: open failed\n");
+        return 1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        fprintf(stderr, "error: meshInitializeFileParallel: empty file\n");
+        close(fd);
+        return 1;
+    }
+    size_t size = (size_t)info.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "error: meshInitializeFileParallel: mmap failed\n");
+        return 1;
+    }
+    /* Parse the five header lines serially. */
+    const char *c = (const char *)mapping, *end = c + size;
+    GLuint year, month, day, triNum, vertNum, attrDim, check;
+    if (meshParseWord(&c, end, "Carleton College CS 311 mesh version") != 0 ||
+            meshParseUint(&c, end, &year) != 0 ||
+            meshParseWord(&c, end, "/") != 0 ||
+            meshParseUint(&c, end, &month) != 0 ||
+            meshParseWord(&c, end, "/") != 0 ||
+            meshParseUint(&c, end, &day) != 0 ||
+            meshParseEndOfLine(&c, end) != 0) {
+        meshParseFileError(NULL, mapping, size, "bad header", 1);
+        return 1;
+    }
+    if (meshParseWord(&c, end, "triNum") != 0 ||
+            meshParseUint(&c, end, &triNum) != 0 ||
+            meshParseEndOfLine(&c, end) != 0) {
+        meshParseFileError(NULL, mapping, size, "bad triNum", 2);
+        return 2;
+    }
+    if (meshParseWord(&c, end, "vertNum") != 0 ||
+            meshParseUint(&c, end, &vertNum) != 0 ||
+            meshParseEndOfLine(&c, end) != 0) {
+        meshParseFileError(NULL, mapping, size, "bad vertNum", 3);
+        return 3;
+    }
+    if (meshParseWord(&c, end, "attrDim") != 0 ||
+            meshParseUint(&c, end, &attrDim) != 0 ||
+            meshParseEndOfLine(&c, end) != 0) {
+        meshParseFileError(NULL, mapping, size, "bad attrDim", 4);
+        return 4;
+    }
+    if (meshInitialize(mesh, triNum, vertNum, attrDim) != 0) {
+        munmap(mapping, size);
+        return 5;
+    }
+    if (meshParseUint(&c, end, &check) != 0 || check != triNum ||
+            meshParseWord(&c, end, "Triangles:") != 0 ||
+            meshParseEndOfLine(&c, end) != 0)
+        return meshParseFileError(mesh, mapping, size, "bad header", 5);
+    /* Cut the body into chunks that end just after newlines. */
+    if (threadNum <= 0)
+        threadNum = parGetDefaultThreadNum();
+    if (threadNum > parMAXTHREADS)
+        threadNum = parMAXTHREADS;
+    meshParseChunk chunks[parMAXTHREADS];
+    meshParseJob job = {mesh, chunks};
+    const char *bodyStart = c, *next;
+    int i;
+    for (i = 0; i < threadNum; i += 1) {
+        chunks[i].start = (i == 0) ? bodyStart : chunks[i - 1].end;
+        next = bodyStart + (size_t)(end - bodyStart) * (i + 1) / threadNum;
+        if (next < chunks[i].start)
+            next = chunks[i].start;
+        if (i < threadNum - 1 && next < end) {
+            next = (const char *)memchr(next, '\n', end - next);
+            next = (next == NULL) ? end : next + 1;
+        } else
+            next = end;
+        chunks[i].end = next;
+        chunks[i].errorLine = 0;
+        chunks[i].errorCause = NULL;
+    }
+    /* Count lines, then give each chunk its starting line number. */
+    parRun(threadNum, meshParseCountLines, &job);
+    GLuint line = 6;
+    for (i = 0; i < threadNum; i += 1) {
+        chunks[i].firstLine = line;
+        line += chunks[i].lineNum;
+    }
+    parRun(threadNum, meshParseLines, &job);
+    /* Report the earliest error, as a serial parser would. */
+    for (i = 0; i < threadNum; i += 1)
+        if (chunks[i].errorCause != NULL)
+            return meshParseFileError(mesh, mapping, size,
+                chunks[i].errorCause, chunks[i].errorLine);
+    /* line is now one past the last line in the file. */
+    if (line <= triNum + 6 + vertNum) {
+        if (line < triNum + 6)
+            return meshParseFileError(mesh, mapping, size, "bad triangle",
+                line);
+        else if (line == triNum + 6)
+            return meshParseFileError(mesh, mapping, size, "bad header",
+                line);
+        else
+            return meshParseFileError(mesh, mapping, size, "bad vertex", line);
+    }
+    munmap(mapping, size);
+    return 0;
+}
@@ -4,24 +4,122 @@
 #define meshGLDOUBLEOFFSET(bytes) ((GLubyte *)NULL + (bytes * sizeof(GLdouble)))
 #define meshGLUINTOFFSET(bytes) ((GLubyte *)NULL + (bytes * sizeof(GLuint)))
 
+/* See 330meshGLPool.c. */
+typedef struct meshGLPool meshGLPool;
+
 /* Feel free to read from this struct's members, but don't write to them except
 through the accessor functions. */
 typedef struct meshGLMesh meshGLMesh;
 struct meshGLMesh {
     GLuint triNum, vertNum, attrDim, vao;
     GLuint vbos[2];
+    /* GL_UNSIGNED_SHORT if the mesh has at most 65536 vertices, and
+    GL_UNSIGNED_INT otherwise. */
+    GLenum indexType;
+    /* If quantized is non-zero, then the vertex positions in GPU memory must
+    be multiplied by dequantization before the modeling isometry. See
+    meshGLInitializeFormatted. */
+    GLuint quantized;
+    GLdouble dequantization[4][4];
+    /* Bounding box lower and upper corners, and bounding sphere center and
+    radius, of the vertex positions in modeling coordinates (before any
+    dequantization). Used for culling. See meshGLSetBounds. boundsVersion
+    changes whenever they do, so that cached bounds can tell they are stale. */
+    GLdouble lower[3], upper[3], center[3], radius;
+    GLuint boundsVersion;
+    /* A mesh in a pool shares the pool's VAO and buffers with other meshes.
+    Its indices start at firstIndex in the index buffer, and are relative to
+    vertex baseVertex. For a mesh with its own buffers, pool is NULL and the
+    other two are 0. */
+    meshGLPool *pool;
+    GLuint poolIndex, firstIndex;
+    GLint baseVertex;
 };
 
+/* Returns the bytes per index of the given index type. */
+GLuint meshGLGetIndexSize(GLenum indexType) {
+    return (indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) :
+        sizeof(GLuint);
+}
+
+/* Returns the mesh's first index as the pointer argument expected by
+glDrawElements and its relatives. */
+const GLvoid *meshGLGetIndexPointer(const meshGLMesh *mesh) {
+    return (const GLvoid *)((GLubyte *)NULL +
+        (size_t)mesh->firstIndex * meshGLGetIndexSize(mesh->indexType));
+}
+
+/* Sets the mesh's bounding box and sphere from the base mesh's positions, which
+are attributes 0, ..., dim - 1 (dim <= 3) with any missing coordinates 0.0. The
+initializers call this function with dim = 3 (or attrDim, if that's smaller).
+For a 2D mesh with texture coordinates, call it again with dim = 2. */
+void meshGLSetBounds(meshGLMesh *mesh, const meshMesh *base, GLuint dim) {
+    GLuint k;
+    for (k = 0; k < 3; k += 1)
+        mesh->lower[k] = mesh->upper[k] = 0.0;
+    meshGetBounds(base, 0, dim, mesh->lower, mesh->upper);
+    meshGetBoundingSphere(base, 0, dim, mesh->center, &mesh->radius);
+    mesh->boundsVersion += 1;
+}
+
+/* Enlarges the mesh's bounding box to contain the point p, and then replaces
+the bounding sphere with the one around the box. For meshes whose vertices move
+after initialization, such as editable landscapes. */
+void meshGLGrowBounds(meshGLMesh *mesh, const GLdouble p[3]) {
+    GLdouble half[3];
+    GLuint k;
+    for (k = 0; k < 3; k += 1) {
+        mesh->lower[k] = (p[k] < mesh->lower[k]) ? p[k] : mesh->lower[k];
+        mesh->upper[k] = (p[k] > mesh->upper[k]) ? p[k] : mesh->upper[k];
+        mesh->center[k] = 0.5 * (mesh->lower[k] + mesh->upper[k]);
+        half[k] = mesh->upper[k] - mesh->center[k];
+    }
+    mesh->radius = vec3Length(half);
+    mesh->boundsVersion += 1;
+}
+
+/* Helper function for meshGLInitialize and similar functions. Fills the
+currently bound GL_ELEMENT_ARRAY_BUFFER with the base mesh's triangles, using
+16-bit indices if the vertex count allows, which halves the index memory. Sets
+mesh->indexType accordingly. */
+void meshGLBufferIndices(
+        meshGLMesh *mesh, const meshMesh *base, GLenum usage) {
+    GLuint i, indexNum = base->triNum * 3;
+    GLushort *shorts = NULL;
+    if (base->vertNum <= 65536)
+        shorts = (GLushort *)malloc(indexNum * sizeof(GLushort));
+    /* If there are too many vertices, or malloc fails, use 32-bit indices. */
+    if (shorts == NULL) {
+        mesh->indexType = GL_UNSIGNED_INT;
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexNum * sizeof(GLuint),
+            (GLvoid *)base->tri, usage);
+    } else {
+        for (i = 0; i < indexNum; i += 1)
+            shorts[i] = (GLushort)base->tri[i];
+        mesh->indexType = GL_UNSIGNED_SHORT;
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexNum * sizeof(GLushort),
+            (GLvoid *)shorts, usage);
+        free(shorts);
+    }
+}
+
 /* Initializes the OpenGL mesh from a non-OpenGL base mesh. After this function
 completes, the base mesh can be destroyed (because its data have been copied
-into GPU memory). When you are done using the OpenGL mesh, don't forget to
-deallocate its resources using meshGLDestroy. See also
-meshGLFinishInitialization. */
+into GPU memory). The base mesh can be in either layout (see meshToStreams).
+When you are done using the OpenGL mesh, don't forget to deallocate its
+resources using meshGLDestroy. See also meshGLFinishInitialization. */
 
 void meshGLInitialize(meshGLMesh *mesh, const meshMesh *base) {
     mesh->triNum = base->triNum;
     mesh->vertNum = base->vertNum;
     mesh->attrDim = base->attrDim;
+    mesh->quantized = 0;
+    mesh->pool = NULL;
+    mesh->poolIndex = 0;
+    mesh->firstIndex = 0;
+    mesh->baseVertex = 0;
+    mesh->boundsVersion = 0;
+    meshGLSetBounds(mesh, base, (base->attrDim < 3) ? base->attrDim : 3);
     /* We need a buffer in GPU memory to store the vertices of our mesh. And we need
     another buffer to store the triangles. These buffers are called vertex buffer
     objects (VBOs). */
@@ -33,14 +131,33 @@ void meshGLInitialize(meshGLMesh *mesh, const meshMesh *base) {
     performance hints help OpenGL manage GPU memory efficiently. */
     glGenBuffers(2, mesh->vbos);
     glBindBuffer(GL_ARRAY_BUFFER, mesh->vbos[0]);
-    glBufferData(GL_ARRAY_BUFFER, mesh->vertNum * mesh->attrDim * sizeof(GLdouble),
-        (GLvoid *)base->vert, GL_STATIC_DRAW);
+    if (base->streams == NULL)
+        glBufferData(GL_ARRAY_BUFFER,
+            mesh->vertNum * mesh->attrDim * sizeof(GLdouble),
+            (GLvoid *)base->vert, GL_STATIC_DRAW);
+    else {
+        /* A structure-of-arrays mesh is interleaved straight into the
+        buffer, without a copy in CPU memory. */
+        GLsizeiptr size = mesh->vertNum * mesh->attrDim * sizeof(GLdouble);
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+        GLdouble *dest = (GLdouble *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dest == NULL)
+            fprintf(stderr, "error: meshGLInitialize: glMapBufferRange "
+                "failed\n");
+        else {
+            meshGetInterleaved(base, 0, base->vertNum, dest);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+    }
+    /* The element buffer binding belongs to the bound VAO, so unbind that
+    first, lest we change some other mesh's indices. */
+    shaBindVertexArray(0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->triNum * 3 * sizeof(GLuint),
-        (GLvoid *)base->tri, GL_STATIC_DRAW);
+    meshGLBufferIndices(mesh, base, GL_STATIC_DRAW);
     /* Make the VAO. Begin to tell it about the VBOs... */
     glGenVertexArrays(1, &mesh->vao);
-    glBindVertexArray(mesh->vao);
+    shaBindVertexArray(mesh->vao);
     glBindBuffer(GL_ARRAY_BUFFER, mesh->vbos[0]);
 }
 
@@ -53,23 +170,31 @@ void meshGLFinishInitialization(meshGLMesh *mesh) {
     /* When you're done issuing commands to a VAO, unbind it by binding the
     trivial VAO. (When I first wrote this code, I forgot this step, and it cost
     me several hours of debugging.) */
-    glBindVertexArray(0);
+    shaBindVertexArray(0);
    
 }
 
 /* Renders the mesh. */
 void meshGLRender(const meshGLMesh *mesh) {
    
-    /* Draw the scene object using the VBOs and VAO in GPU memory. */
-    glBindVertexArray(mesh->vao);
-    glDrawElements(GL_TRIANGLES, mesh->triNum * 3, GL_UNSIGNED_INT, meshGLUINTOFFSET(0));
-    glBindVertexArray(0);
+    /* Draw the scene object using the VBOs and VAO in GPU memory. The VAO is
+    left bound, so that drawing the same mesh again doesn't rebind it. For a
+    pooled mesh, that VAO is the pool's, which the next pooled mesh shares. */
+    shaBindVertexArray(mesh->vao);
+    glDrawElementsBaseVertex(GL_TRIANGLES, mesh->triNum * 3, mesh->indexType,
+        meshGLGetIndexPointer(mesh), mesh->baseVertex);
 }
 
 /* Releases the resources backing the mesh. Invoke this function when you are
-done using the mesh. */
+done using the mesh. A pooled mesh must instead be released with
+meshGLPoolRemove. */
 void meshGLDestroy(meshGLMesh *mesh) {
+    if (mesh->pool != NULL) {
+        fprintf(stderr, "error: meshGLDestroy: mesh is in a pool\n");
+        return;
+    }
     glDeleteVertexArrays(1, &mesh->vao);
+    shaForgetVertexArray(mesh->vao);
     glDeleteBuffers(2, mesh->vbos);
 }
 
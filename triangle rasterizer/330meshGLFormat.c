@@ -0,0 +1,325 @@
+/*** Compact vertex formats ***/
+
+/* meshGLInitialize copies the base mesh's GLdoubles into GPU memory as they
+are, which costs 64 bytes per XYZ-ST-NOP vertex. This file offers
+meshGLInitializeFormatted, which instead encodes each attribute in a compact
+format as it uploads, and then configures the attributes itself, so that the
+user doesn't call glVertexAttribPointer or meshGLFinishInitialization. For
+example, float XYZ, half-float ST, and octahedral NOP take 20 bytes per vertex:
+    meshGLAttribute attrs[3] = {
+        {sha.attrLocs[ATTRXYZ], 0, 3, meshGLFLOAT},
+        {sha.attrLocs[ATTRST], 3, 2, meshGLHALF},
+        {sha.attrLocs[ATTRNOP], 5, 3, meshGLOCTAHEDRAL}};
+    meshGLInitializeFormatted(&glMesh, &mesh, 3, attrs); */
+
+/* The encodings. Each attribute is padded to a multiple of 4 bytes, as OpenGL
+prefers. */
+#define meshGLDOUBLE 0      /* 8 bytes per component, as meshGLInitialize */
+#define meshGLFLOAT 1       /* 4 bytes per component */
+#define meshGLHALF 2        /* 2 bytes per component; for ST, colors, etc. */
+#define meshGLSNORM16 3     /* 2 bytes per component; values in [-1, 1] */
+#define meshGLOCTAHEDRAL 4  /* 4 bytes; unit 3D vectors only; see below */
+#define meshGLQUANTIZED 5   /* 2 bytes per component; positions only */
+
+/* An octahedral attribute arrives in the vertex shader as a vec2, which the
+shader must decode into a unit vec3. Paste this GLSL function into the vertex
+shader (before main) and call it like this:
+    in vec2 nop;
+    ...
+    vec3 normal = meshOctDecode(nop); */
+#define meshGLOCTAHEDRALGLSL \
+    "vec3 meshOctDecode(vec2 e) {" \
+    "    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));" \
+    "    float t = max(-n.z, 0.0);" \
+    "    n.x += (n.x >= 0.0) ? -t : t;" \
+    "    n.y += (n.y >= 0.0) ? -t : t;" \
+    "    return normalize(n);" \
+    "}"
+
+/* Describes one vertex attribute: its shader location, which dim components
+of the base mesh's vertices (starting at offset) it consists of, and how to
+encode it. */
+typedef struct meshGLAttribute meshGLAttribute;
+struct meshGLAttribute {
+    GLint location;
+    GLuint offset, dim;
+    GLuint encoding;
+};
+
+/* Returns the number of bytes that an attribute occupies in each vertex. */
+GLuint meshGLGetAttributeSize(const meshGLAttribute *attr) {
+    switch (attr->encoding) {
+        case meshGLDOUBLE:
+            return attr->dim * sizeof(GLdouble);
+        case meshGLFLOAT:
+            return attr->dim * sizeof(GLfloat);
+        case meshGLOCTAHEDRAL:
+            return 2 * sizeof(GLshort);
+        default:
+            /* 16-bit encodings, rounded up to a multiple of 4 bytes. */
+            return ((attr->dim + 1) / 2) * 2 * sizeof(GLshort);
+    }
+}
+
+/* Converts a float to the nearest IEEE half-precision float, handling
+subnormals, overflow to infinity, and NaN. */
+GLushort meshGLFloatToHalf(GLfloat value) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    GLushort sign = (GLushort)((bits >> 16) & 0x8000);
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if (((bits >> 23) & 0xFF) == 0xFF)
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7C00;
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return sign;
+        /* Subnormal: shift in the implicit 1 and round to nearest even. */
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1)))
+            half += 1;
+        return sign | (GLushort)half;
+    }
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1FFF;
+    /* Rounding may carry into the exponent, which correctly yields the next
+    power of two or infinity. */
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half += 1;
+    return sign | (GLushort)half;
+}
+
+/* Converts a number in [-1, 1] to a normalized signed 16-bit integer. */
+GLshort meshGLToSnorm16(GLdouble value) {
+    if (value > 1.0)
+        value = 1.0;
+    else if (value < -1.0)
+        value = -1.0;
+    return (GLshort)lround(value * 32767.0);
+}
+
+/* Encodes a unit 3D vector as a point of the octahedron unfolded onto the
+square [-1, 1] x [-1, 1]. Inverse to meshOctDecode in meshGLOCTAHEDRALGLSL. */
+void meshGLOctahedralEncode(const GLdouble n[3], GLdouble e[2]) {
+    GLdouble l1 = fabs(n[0]) + fabs(n[1]) + fabs(n[2]);
+    if (l1 == 0.0) {
+        e[0] = 0.0;
+        e[1] = 0.0;
+        return;
+    }
+    GLdouble x = n[0] / l1, y = n[1] / l1;
+    if (n[2] < 0.0) {
+        GLdouble foldX = (1.0 - fabs(y)) * (x >= 0.0 ? 1.0 : -1.0);
+        GLdouble foldY = (1.0 - fabs(x)) * (y >= 0.0 ? 1.0 : -1.0);
+        x = foldX;
+        y = foldY;
+    }
+    e[0] = x;
+    e[1] = y;
+}
+
+/* Helper function for meshGLInitializeFormatted. Writes one attribute of one
+vertex. For meshGLQUANTIZED, corner and scale describe the quantization
+grid. */
+void meshGLEncodeAttribute(
+        const meshGLAttribute *attr, const GLdouble *vert, GLubyte *out,
+        const GLdouble corner[3], GLdouble scale) {
+    GLuint k;
+    GLdouble e[2];
+    switch (attr->encoding) {
+        case meshGLDOUBLE:
+            memcpy(out, &vert[attr->offset], attr->dim * sizeof(GLdouble));
+            break;
+        case meshGLFLOAT:
+            for (k = 0; k < attr->dim; k += 1)
+                ((GLfloat *)out)[k] = (GLfloat)vert[attr->offset + k];
+            break;
+        case meshGLHALF:
+            for (k = 0; k < attr->dim; k += 1)
+                ((GLushort *)out)[k] =
+                    meshGLFloatToHalf((GLfloat)vert[attr->offset + k]);
+            break;
+        case meshGLSNORM16:
+            for (k = 0; k < attr->dim; k += 1)
+                ((GLshort *)out)[k] = meshGLToSnorm16(vert[attr->offset + k]);
+            break;
+        case meshGLOCTAHEDRAL:
+            meshGLOctahedralEncode(&vert[attr->offset], e);
+            ((GLshort *)out)[0] = meshGLToSnorm16(e[0]);
+            ((GLshort *)out)[1] = meshGLToSnorm16(e[1]);
+            break;
+        case meshGLQUANTIZED:
+            for (k = 0; k < attr->dim; k += 1)
+                ((GLushort *)out)[k] = (GLushort)lround(
+                    (vert[attr->offset + k] - corner[k]) * scale);
+            break;
+    }
+}
+
+/* Helper function for meshGLInitializeFormatted. Configures one attribute in
+the currently bound VAO. */
+void meshGLSetAttributePointer(
+        const meshGLAttribute *attr, GLsizei stride, GLuint byteOffset) {
+    const GLvoid *pointer = (const GLvoid *)((GLubyte *)NULL + byteOffset);
+    glEnableVertexAttribArray(attr->location);
+    switch (attr->encoding) {
+        case meshGLDOUBLE:
+            glVertexAttribPointer(attr->location, attr->dim, GL_DOUBLE,
+                GL_FALSE, stride, pointer);
+            break;
+        case meshGLFLOAT:
+            glVertexAttribPointer(attr->location, attr->dim, GL_FLOAT,
+                GL_FALSE, stride, pointer);
+            break;
+        case meshGLHALF:
+            glVertexAttribPointer(attr->location, attr->dim, GL_HALF_FLOAT,
+                GL_FALSE, stride, pointer);
+            break;
+        case meshGLSNORM16:
+            glVertexAttribPointer(attr->location, attr->dim, GL_SHORT, GL_TRUE,
+                stride, pointer);
+            break;
+        case meshGLOCTAHEDRAL:
+            glVertexAttribPointer(attr->location, 2, GL_SHORT, GL_TRUE, stride,
+                pointer);
+            break;
+        case meshGLQUANTIZED:
+            /* Not normalized, so the shader sees grid coordinates 0...65535,
+            which the dequantization matrix maps back to positions. */
+            glVertexAttribPointer(attr->location, attr->dim,
+                GL_UNSIGNED_SHORT, GL_FALSE, stride, pointer);
+            break;
+    }
+}
+
+/* Helper function for meshGLInitializeFormattedUsage and meshGLPoolAdd.
+Validates the attributes, finds their byte offsets within a vertex and the
+stride, and encodes the base mesh's vertices into a buffer allocated with
+malloc, which the caller must free. Sets the mesh's members other than its
+OpenGL names and indexType. Returns 0 on success, non-zero on failure. */
+int meshGLEncodeVertices(
+        meshGLMesh *mesh, const meshMesh *base, GLuint attrNum,
+        const meshGLAttribute attrs[], GLuint offsets[], GLuint *strideOut,
+        GLubyte **dataOut) {
+    GLuint i, k, stride = 0, quantIndex = attrNum;
+    if (attrNum > 16)
+        return 1;
+    for (i = 0; i < attrNum; i += 1) {
+        offsets[i] = stride;
+        stride += meshGLGetAttributeSize(&attrs[i]);
+        if (attrs[i].encoding == meshGLQUANTIZED) {
+            if (quantIndex != attrNum || attrs[i].dim > 3) {
+                fprintf(stderr, "error: meshGLEncodeVertices: bad "
+                    "quantized attribute\n");
+                return 2;
+            }
+            quantIndex = i;
+        }
+    }
+    /* Find the quantization grid from the bounding box. */
+    GLdouble corner[3] = {0.0, 0.0, 0.0}, extent = 0.0, scale = 0.0;
+    if (quantIndex < attrNum && base->vertNum > 0) {
+        GLuint dim = attrs[quantIndex].dim;
+        GLdouble upper[3] = {0.0, 0.0, 0.0};
+        meshGetBounds(base, attrs[quantIndex].offset, dim, corner, upper);
+        for (k = 0; k < dim; k += 1)
+            if (upper[k] - corner[k] > extent)
+                extent = upper[k] - corner[k];
+        scale = (extent > 0.0) ? 65535.0 / extent : 0.0;
+    }
+    /* A structure-of-arrays base mesh is gathered one vertex at a time into
+    scratch space after the encoded data. */
+    size_t dataSize = ((size_t)base->vertNum * stride + 7) & ~(size_t)7;
+    GLubyte *data = (GLubyte *)malloc(dataSize + base->attrDim *
+        sizeof(GLdouble));
+    if (data == NULL)
+        return 3;
+    GLdouble *scratch = (GLdouble *)&data[dataSize];
+    const GLdouble *vert;
+    for (i = 0; i < base->vertNum; i += 1) {
+        vert = meshGetVertexPointer(base, i);
+        if (vert == NULL) {
+            meshGetAttributes(base, i, 0, base->attrDim, scratch);
+            vert = scratch;
+        }
+        for (k = 0; k < attrNum; k += 1)
+            meshGLEncodeAttribute(&attrs[k], vert,
+                &data[(size_t)i * stride + offsets[k]], corner, scale);
+    }
+    mesh->triNum = base->triNum;
+    mesh->vertNum = base->vertNum;
+    mesh->attrDim = base->attrDim;
+    mesh->quantized = (quantIndex < attrNum);
+    mesh->pool = NULL;
+    mesh->poolIndex = 0;
+    mesh->firstIndex = 0;
+    mesh->baseVertex = 0;
+    mesh->boundsVersion = 0;
+    meshGLSetBounds(mesh, base, (base->attrDim < 3) ? base->attrDim : 3);
+    if (mesh->quantized) {
+        GLdouble rot[3][3] = {{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0},
+            {0.0, 0.0, 1.0}};
+        mat44Isometry(rot, corner, mesh->dequantization);
+        for (k = 0; k < 3; k += 1)
+            mesh->dequantization[k][k] = extent / 65535.0;
+    }
+    *strideOut = stride;
+    *dataOut = data;
+    return 0;
+}
+
+/* Initializes the OpenGL mesh from a non-OpenGL base mesh, encoding the
+vertices as described by the attrNum attributes. Unlike meshGLInitialize, this
+function completes the initialization, including the attribute configuration;
+do not call meshGLFinishInitialization.
+
+At most one attribute can be meshGLQUANTIZED, and it must have dim <= 3. It is
+stored as 16-bit grid coordinates within the mesh's bounding box. The grid has
+equal spacing along all axes, so that the dequantization matrix is a uniform
+scaling followed by a translation; that keeps normals transformed by the
+modeling matrix pointing in the right directions (up to length). The mesh's
+quantized member is then set, and nodeRender folds the mesh's dequantization
+matrix into the modeling matrix. The base mesh can be in either layout (see
+meshToStreams). The buffers get the usage hint: GL_STATIC_DRAW usually, or
+GL_DYNAMIC_DRAW for meshes that will be partly rewritten with glBufferSubData.
+Returns 0 on success, non-zero on failure. When you are done using the OpenGL
+mesh, deallocate it using meshGLDestroy. */
+int meshGLInitializeFormattedUsage(
+        meshGLMesh *mesh, const meshMesh *base, GLuint attrNum,
+        const meshGLAttribute attrs[], GLenum usage) {
+    GLuint i, stride, offsets[16];
+    GLubyte *data;
+    int error = meshGLEncodeVertices(mesh, base, attrNum, attrs, offsets,
+        &stride, &data);
+    if (error != 0)
+        return error;
+    glGenBuffers(2, mesh->vbos);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vbos[0]);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)base->vertNum * stride,
+        (GLvoid *)data, usage);
+    free(data);
+    shaBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbos[1]);
+    meshGLBufferIndices(mesh, base, usage);
+    glGenVertexArrays(1, &mesh->vao);
+    shaBindVertexArray(mesh->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vbos[0]);
+    for (i = 0; i < attrNum; i += 1)
+        meshGLSetAttributePointer(&attrs[i], stride, offsets[i]);
+    meshGLFinishInitialization(mesh);
+    return 0;
+}
+
+/* Like meshGLInitializeFormattedUsage, with usage GL_STATIC_DRAW. */
+int meshGLInitializeFormatted(
+        meshGLMesh *mesh, const meshMesh *base, GLuint attrNum,
+        const meshGLAttribute attrs[]) {
+    return meshGLInitializeFormattedUsage(mesh, base, attrNum, attrs,
+        GL_STATIC_DRAW);
+}
@@ -0,0 +1,241 @@
+/*** Editable landscapes ***/
+
+/* To change a landscape built by mesh3DInitializeLandscape, one would have to
+rebuild it (including all of its normals) and upload it again, which takes
+milliseconds even for modest sizes. An editable landscape instead keeps the
+mesh in CPU memory alongside its OpenGL mesh, and remembers which rectangles of
+samples have changed since the last update. meshGLLandscapeUpdate then redoes
+the diagonal choices and normals only within those rectangles plus one ring of
+samples around them, and rewrites only those rows of the vertex and index
+buffers with glBufferSubData. So a brush stroke costs time proportional to the
+brush's area, not the landscape's. */
+
+#define meshGLLandscapeMAXRECTS 8
+
+/* Feel free to read from this struct's members, but don't write to them. Each
+dirty rectangle is {iMin, jMin, iMax, jMax}, inclusive, in sample indices. */
+typedef struct meshGLLandscape meshGLLandscape;
+struct meshGLLandscape {
+    GLuint size;
+    GLdouble spacing;
+    meshMesh mesh;
+    meshGLMesh glMesh;
+    GLuint attrNum, stride, offsets[8];
+    meshGLAttribute attrs[8];
+    GLubyte *scratch;
+    GLuint rectNum;
+    GLint rects[meshGLLandscapeMAXRECTS][4];
+};
+
+/* Initializes an editable landscape, with the same mesh as
+mesh3DInitializeLandscape(&land->mesh, size, spacing, data). The OpenGL mesh
+is encoded and configured by meshGLInitializeFormattedUsage, with
+GL_DYNAMIC_DRAW, using the attrNum (at most 8) attributes, none of which can be
+meshGLQUANTIZED. Returns 0 on success, non-zero on failure. Don't forget to
+call meshGLLandscapeDestroy when finished. */
+int meshGLLandscapeInitialize(
+        meshGLLandscape *land, GLuint size, GLdouble spacing,
+        const GLdouble *data, GLuint attrNum, const meshGLAttribute attrs[]) {
+    GLuint i;
+    if (attrNum > 8 || size < 2)
+        return 1;
+    land->attrNum = attrNum;
+    land->stride = 0;
+    for (i = 0; i < attrNum; i += 1) {
+        if (attrs[i].encoding == meshGLQUANTIZED) {
+            fprintf(stderr, "error: meshGLLandscapeInitialize: quantized "
+                "attributes can't be updated\n");
+            return 2;
+        }
+        land->attrs[i] = attrs[i];
+        land->offsets[i] = land->stride;
+        land->stride += meshGLGetAttributeSize(&attrs[i]);
+    }
+    /* The scratch space holds one row of encoded vertices or indices. */
+    GLuint vertBytes = size * land->stride;
+    GLuint triBytes = 6 * (size - 1) * sizeof(GLuint);
+    land->scratch = (GLubyte *)malloc((vertBytes > triBytes) ? vertBytes :
+        triBytes);
+    if (land->scratch == NULL)
+        return 3;
+    if (mesh3DInitializeLandscape(&land->mesh, size, spacing, data) != 0) {
+        free(land->scratch);
+        return 4;
+    }
+    if (meshGLInitializeFormattedUsage(&land->glMesh, &land->mesh, attrNum,
+            attrs, GL_DYNAMIC_DRAW) != 0) {
+        meshDestroy(&land->mesh);
+        free(land->scratch);
+        return 5;
+    }
+    land->size = size;
+    land->spacing = spacing;
+    land->rectNum = 0;
+    return 0;
+}
+
+/* Releases the resources backing the landscape. */
+void meshGLLandscapeDestroy(meshGLLandscape *land) {
+    meshGLDestroy(&land->glMesh);
+    meshDestroy(&land->mesh);
+    free(land->scratch);
+}
+
+/* Helper function for the editing functions. Marks samples iMin, ..., iMax by
+jMin, ..., jMax as changed. A rectangle that touches or overlaps a dirty one
+is merged into it; when all slots are full, the new one is merged into the
+first. */
+void meshGLLandscapeMarkDirty(
+        meshGLLandscape *land, GLint iMin, GLint jMin, GLint iMax, GLint jMax) {
+    GLuint r;
+    GLint *rect;
+    for (r = 0; r < land->rectNum; r += 1) {
+        rect = land->rects[r];
+        if (iMin <= rect[2] + 1 && iMax >= rect[0] - 1 &&
+                jMin <= rect[3] + 1 && jMax >= rect[1] - 1)
+            break;
+    }
+    if (r == land->rectNum && land->rectNum < meshGLLandscapeMAXRECTS) {
+        rect = land->rects[r];
+        rect[0] = iMin;
+        rect[1] = jMin;
+        rect[2] = iMax;
+        rect[3] = jMax;
+        land->rectNum += 1;
+        return;
+    }
+    rect = land->rects[(r == land->rectNum) ? 0 : r];
+    rect[0] = (iMin < rect[0]) ? iMin : rect[0];
+    rect[1] = (jMin < rect[1]) ? jMin : rect[1];
+    rect[2] = (iMax > rect[2]) ? iMax : rect[2];
+    rect[3] = (jMax > rect[3]) ? jMax : rect[3];
+}
+
+/* Sets the height of sample (i, j). The change reaches the GPU at the next
+meshGLLandscapeUpdate. */
+void meshGLLandscapeSetHeight(
+        meshGLLandscape *land, GLuint i, GLuint j, GLdouble z) {
+    if (i >= land->size || j >= land->size)
+        return;
+    land->mesh.vert[(size_t)(i * land->size + j) * land->mesh.attrDim + 2] = z;
+    meshGLLandscapeMarkDirty(land, i, j, i, j);
+}
+
+/* Raises the landscape by amount (or lowers it, if amount is negative) at the
+XY position (x, y), and by less around it, smoothly falling to nothing at
+distance radius. The change reaches the GPU at the next
+meshGLLandscapeUpdate. */
+void meshGLLandscapeBrush(
+        meshGLLandscape *land, GLdouble x, GLdouble y, GLdouble radius,
+        GLdouble amount) {
+    GLdouble spacing = land->spacing;
+    GLint last = (GLint)land->size - 1, i, j, iMin, jMin, iMax, jMax;
+    GLdouble *vert, dx, dy, t;
+    iMin = (GLint)ceil((x - radius) / spacing);
+    iMax = (GLint)floor((x + radius) / spacing);
+    jMin = (GLint)ceil((y - radius) / spacing);
+    jMax = (GLint)floor((y + radius) / spacing);
+    iMin = (iMin < 0) ? 0 : iMin;
+    jMin = (jMin < 0) ? 0 : jMin;
+    iMax = (iMax > last) ? last : iMax;
+    jMax = (jMax > last) ? last : jMax;
+    if (iMin > iMax || jMin > jMax)
+        return;
+    for (i = iMin; i <= iMax; i += 1)
+        for (j = jMin; j <= jMax; j += 1) {
+            vert = meshGetVertexPointer(&land->mesh, i * land->size + j);
+            dx = vert[0] - x;
+            dy = vert[1] - y;
+            t = 1.0 - (dx * dx + dy * dy) / (radius * radius);
+            if (t > 0.0)
+                vert[2] += amount * t * t;
+        }
+    meshGLLandscapeMarkDirty(land, iMin, jMin, iMax, jMax);
+}
+
+/* Helper function for meshGLLandscapeUpdate. Chooses the diagonal of the
+square whose lower corner is sample (i, j), as mesh3DInitializeLandscape
+does. */
+void meshGLLandscapeSetSquare(meshGLLandscape *land, GLuint i, GLuint j) {
+    GLuint size = land->size, index = 2 * (i * (size - 1) + j);
+    GLuint a = i * size + j, b = (i + 1) * size + j;
+    GLuint c = (i + 1) * size + (j + 1), d = i * size + (j + 1);
+    GLdouble diffSWNE = fabs(meshGetVertexPointer(&land->mesh, a)[2] -
+        meshGetVertexPointer(&land->mesh, c)[2]);
+    GLdouble diffSENW = fabs(meshGetVertexPointer(&land->mesh, b)[2] -
+        meshGetVertexPointer(&land->mesh, d)[2]);
+    if (diffSENW < diffSWNE) {
+        meshSetTriangle(&land->mesh, index, d, a, b);
+        meshSetTriangle(&land->mesh, index + 1, b, c, d);
+    } else {
+        meshSetTriangle(&land->mesh, index, a, b, c);
+        meshSetTriangle(&land->mesh, index + 1, a, c, d);
+    }
+}
+
+/* Brings the OpenGL mesh up to date with the edits since the last update.
+For each dirty rectangle, the squares touching it get new diagonals, the
+samples within one ring of it get new normals, and just those rows of the
+buffers are rewritten. */
+void meshGLLandscapeUpdate(meshGLLandscape *land) {
+    GLint last = (GLint)land->size - 1, i, j, iMin, jMin, iMax, jMax;
+    GLuint r, k, size = land->size;
+    GLdouble zero[3] = {0.0, 0.0, 0.0};
+    if (land->rectNum == 0)
+        return;
+    /* The index buffer binding belongs to the VAO, so bind ours, lest we
+    rebind some other mesh's indices. */
+    shaBindVertexArray(land->glMesh.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, land->glMesh.vbos[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, land->glMesh.vbos[1]);
+    for (r = 0; r < land->rectNum; r += 1) {
+        /* The one-ring around the rectangle, clamped to the landscape. */
+        iMin = (land->rects[r][0] > 0) ? land->rects[r][0] - 1 : 0;
+        jMin = (land->rects[r][1] > 0) ? land->rects[r][1] - 1 : 0;
+        iMax = (land->rects[r][2] < last) ? land->rects[r][2] + 1 : last;
+        jMax = (land->rects[r][3] < last) ? land->rects[r][3] + 1 : last;
+        /* The squares touching the rectangle have corners in the ring. */
+        for (i = iMin; i < iMax; i += 1)
+            for (j = jMin; j < jMax; j += 1)
+                meshGLLandscapeSetSquare(land, i, j);
+        for (i = iMin; i <= iMax; i += 1)
+            for (j = jMin; j <= jMax; j += 1)
+                mesh3DSetLandscapeNormal(&land->mesh, size, i, j);
+        /* Rewrite the rows of vertices, and the rows of triangles. */
+        for (i = iMin; i <= iMax; i += 1) {
+            for (j = jMin; j <= jMax; j += 1) {
+                const GLdouble *vert = meshGetVertexPointer(&land->mesh,
+                    i * size + j);
+                /* Edits only ever grow the bounds. */
+                if (vert[2] < land->glMesh.lower[2] ||
+                        vert[2] > land->glMesh.upper[2])
+                    meshGLGrowBounds(&land->glMesh, vert);
+                for (k = 0; k < land->attrNum; k += 1)
+                    meshGLEncodeAttribute(&land->attrs[k], vert,
+                        &land->scratch[(j - jMin) * land->stride +
+                            land->offsets[k]], zero, 0.0);
+            }
+            glBufferSubData(GL_ARRAY_BUFFER,
+                (GLintptr)(i * size + jMin) * land->stride,
+                (GLsizeiptr)(jMax - jMin + 1) * land->stride, land->scratch);
+        }
+        GLuint first, count;
+        for (i = iMin; i < iMax; i += 1) {
+            first = 6 * (i * (size - 1) + jMin);
+            count = 6 * (jMax - jMin);
+            if (land->glMesh.indexType == GL_UNSIGNED_SHORT) {
+                GLushort *shorts = (GLushort *)land->scratch;
+                for (k = 0; k < count; k += 1)
+                    shorts[k] = (GLushort)land->mesh.tri[first + k];
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                    (GLintptr)first * sizeof(GLushort),
+                    count * sizeof(GLushort), shorts);
+            } else
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                    (GLintptr)first * sizeof(GLuint), count * sizeof(GLuint),
+                    &land->mesh.tri[first]);
+        }
+    }
+    shaBindVertexArray(0);
+    land->rectNum = 0;
+}
@@ -0,0 +1,400 @@
+/*** Mesh pools ***/
+
+/* Each meshGLMesh normally owns a VAO and two buffers, so drawing many small
+meshes switches VAOs at every draw, and GPU memory is cut into many small
+allocations. A mesh pool instead keeps the vertices of many meshes with the
+same vertex format in one large vertex buffer, and their triangles in one large
+index buffer, sharing one VAO. Each pooled mesh occupies a range of vertices
+and a range of indices, found by a free-list allocator. Its indices are
+relative to its first vertex, which it passes to glDrawElementsBaseVertex as
+the base vertex. So a sorted draw queue can draw a run of pooled meshes without
+changing any state, and can even draw the whole run with one multi-draw call
+(see queSubmit). Typical use:
+    meshGLPoolInitialize(&pool, 3, attrs, GL_UNSIGNED_SHORT, 65536, 196608);
+    meshGLPoolAdd(&pool, &glMeshA, &meshA);
+    meshGLPoolAdd(&pool, &glMeshB, &meshB);
+    ...
+    meshGLRender(&glMeshA);
+    ...
+    meshGLPoolRemove(&pool, &glMeshA);
+    meshGLPoolRemove(&pool, &glMeshB);
+    meshGLPoolDestroy(&pool);
+Removing meshes leaves holes, which later meshes reuse. When no hole is big
+enough, the pool defragments itself, packing its meshes together into new
+buffers, which are bigger if need be. The pool remembers the addresses of its
+meshes, to update them when they move, so a pooled mesh must not be moved or
+copied. Pools need OpenGL 3.2, for glDrawElementsBaseVertex. */
+
+/* A range of count vertices or indices, starting at first. */
+typedef struct meshGLRange meshGLRange;
+struct meshGLRange {
+    GLuint first, count;
+};
+
+/* The free ranges of a buffer, sorted by first, with no two adjacent. */
+typedef struct meshGLFreeList meshGLFreeList;
+struct meshGLFreeList {
+    GLuint rangeNum, rangeCap;
+    meshGLRange *ranges;
+};
+
+/* Feel free to read from this struct's members, but don't write to them. The
+capacities and used counts are in vertices and indices, not bytes. */
+struct meshGLPool {
+    GLuint vao, vbos[2];
+    GLuint attrNum, stride, offsets[16];
+    meshGLAttribute attrs[16];
+    GLenum indexType;
+    GLuint vertCap, indexCap, vertUsed, indexUsed;
+    meshGLFreeList vertFree, indexFree;
+    GLuint meshNum, meshCap;
+    meshGLMesh **meshes;
+};
+
+/* Makes the list hold the single range of count elements starting at first,
+or no range if count is 0. */
+void meshGLFreeListReset(meshGLFreeList *list, GLuint first, GLuint count) {
+    list->rangeNum = 0;
+    if (count > 0) {
+        list->ranges[0].first = first;
+        list->ranges[0].count = count;
+        list->rangeNum = 1;
+    }
+}
+
+/* Initializes the list with the single range [0, count). Returns 0 on success,
+non-zero on failure. Don't forget to call meshGLFreeListDestroy. */
+int meshGLFreeListInitialize(meshGLFreeList *list, GLuint count) {
+    list->rangeCap = 16;
+    list->ranges = (meshGLRange *)malloc(list->rangeCap *
+        sizeof(meshGLRange));
+    if (list->ranges == NULL)
+        return 1;
+    meshGLFreeListReset(list, 0, count);
+    return 0;
+}
+
+void meshGLFreeListDestroy(meshGLFreeList *list) {
+    free(list->ranges);
+}
+
+/* Takes count elements from the first free range big enough to hold them.
+Returns the first of them, or -1 if no range is big enough. */
+GLint64 meshGLFreeListAllocate(meshGLFreeList *list, GLuint count) {
+    GLuint i, first;
+    for (i = 0; i < list->rangeNum; i += 1)
+        if (list->ranges[i].count >= count)
+            break;
+    if (i == list->rangeNum)
+        return -1;
+    first = list->ranges[i].first;
+    list->ranges[i].first += count;
+    list->ranges[i].count -= count;
+    if (list->ranges[i].count == 0) {
+        memmove(&(list->ranges[i]), &(list->ranges[i + 1]),
+            (list->rangeNum - i - 1) * sizeof(meshGLRange));
+        list->rangeNum -= 1;
+    }
+    return first;
+}
+
+/* Returns count elements starting at first to the list, merging them with the
+free ranges on either side. Returns 0 on success, or non-zero if the list
+couldn't grow, in which case the elements are lost until the next
+meshGLFreeListReset. */
+int meshGLFreeListRelease(meshGLFreeList *list, GLuint first, GLuint count) {
+    GLuint i;
+    if (count == 0)
+        return 0;
+    for (i = 0; i < list->rangeNum; i += 1)
+        if (list->ranges[i].first > first)
+            break;
+    /* Now ranges[i - 1] is before the released elements and ranges[i] after. */
+    int before = (i > 0 &&
+        list->ranges[i - 1].first + list->ranges[i - 1].count == first);
+    int after = (i < list->rangeNum && first + count == list->ranges[i].first);
+    if (before && after) {
+        list->ranges[i - 1].count += count + list->ranges[i].count;
+        memmove(&(list->ranges[i]), &(list->ranges[i + 1]),
+            (list->rangeNum - i - 1) * sizeof(meshGLRange));
+        list->rangeNum -= 1;
+    } else if (before)
+        list->ranges[i - 1].count += count;
+    else if (after) {
+        list->ranges[i].first = first;
+        list->ranges[i].count += count;
+    } else {
+        if (list->rangeNum == list->rangeCap) {
+            meshGLRange *ranges = (meshGLRange *)realloc(list->ranges,
+                2 * list->rangeCap * sizeof(meshGLRange));
+            if (ranges == NULL)
+                return 1;
+            list->ranges = ranges;
+            list->rangeCap *= 2;
+        }
+        memmove(&(list->ranges[i + 1]), &(list->ranges[i]),
+            (list->rangeNum - i) * sizeof(meshGLRange));
+        list->ranges[i].first = first;
+        list->ranges[i].count = count;
+        list->rangeNum += 1;
+    }
+    return 0;
+}
+
+/* Helper function for meshGLPoolInitialize and meshGLPoolDefragment. Points
+the pool's VAO at its current buffers. */
+void meshGLPoolConfigure(meshGLPool *pool) {
+    GLuint i;
+    shaBindVertexArray(pool->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, pool->vbos[0]);
+    for (i = 0; i < pool->attrNum; i += 1)
+        meshGLSetAttributePointer(&(pool->attrs[i]), pool->stride,
+            pool->offsets[i]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->vbos[1]);
+    shaBindVertexArray(0);
+}
+
+/* Initializes an empty pool for meshes whose vertices are encoded as described
+by the attrNum (at most 16) attributes, as in meshGLInitializeFormatted. The
+index type is GL_UNSIGNED_SHORT, which limits each mesh (not the pool) to 65536
+vertices, or GL_UNSIGNED_INT. The buffers start with room for vertCap vertices
+and indexCap indices, and grow as needed. Returns 0 on success, non-zero on
+failure. Don't forget to call meshGLPoolDestroy when finished. */
+int meshGLPoolInitialize(
+        meshGLPool *pool, GLuint attrNum, const meshGLAttribute attrs[],
+        GLenum indexType, GLuint vertCap, GLuint indexCap) {
+    GLuint i;
+    if (attrNum > 16 || (indexType != GL_UNSIGNED_SHORT &&
+            indexType != GL_UNSIGNED_INT))
+        return 1;
+    pool->attrNum = attrNum;
+    pool->stride = 0;
+    for (i = 0; i < attrNum; i += 1) {
+        pool->attrs[i] = attrs[i];
+        pool->offsets[i] = pool->stride;
+        pool->stride += meshGLGetAttributeSize(&attrs[i]);
+    }
+    pool->indexType = indexType;
+    pool->vertCap = (vertCap < 1024) ? 1024 : vertCap;
+    pool->indexCap = (indexCap < 3072) ? 3072 : indexCap;
+    pool->vertUsed = 0;
+    pool->indexUsed = 0;
+    pool->meshNum = 0;
+    pool->meshCap = 64;
+    pool->meshes = (meshGLMesh **)malloc(pool->meshCap *
+        sizeof(meshGLMesh *));
+    if (pool->meshes == NULL)
+        return 2;
+    if (meshGLFreeListInitialize(&(pool->vertFree), pool->vertCap) != 0) {
+        free(pool->meshes);
+        return 3;
+    }
+    if (meshGLFreeListInitialize(&(pool->indexFree), pool->indexCap) != 0) {
+        meshGLFreeListDestroy(&(pool->vertFree));
+        free(pool->meshes);
+        return 4;
+    }
+    glGenBuffers(2, pool->vbos);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool->vbos[0]);
+    glBufferData(GL_COPY_WRITE_BUFFER,
+        (GLsizeiptr)pool->vertCap * pool->stride, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool->vbos[1]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)pool->indexCap *
+        meshGLGetIndexSize(indexType), NULL, GL_DYNAMIC_DRAW);
+    glGenVertexArrays(1, &(pool->vao));
+    meshGLPoolConfigure(pool);
+    return 0;
+}
+
+/* Releases the pool's resources. All of its meshes must have been removed. */
+void meshGLPoolDestroy(meshGLPool *pool) {
+    if (pool->meshNum > 0)
+        fprintf(stderr, "error: meshGLPoolDestroy: %u meshes still pooled\n",
+            pool->meshNum);
+    glDeleteVertexArrays(1, &(pool->vao));
+    shaForgetVertexArray(pool->vao);
+    glDeleteBuffers(2, pool->vbos);
+    meshGLFreeListDestroy(&(pool->vertFree));
+    meshGLFreeListDestroy(&(pool->indexFree));
+    free(pool->meshes);
+}
+
+/* Packs the pool's meshes together at the start of new buffers, with room for
+vertCap vertices and indexCap indices (which are raised to what the meshes
+use), copying within GPU memory. Afterward, all free space is one range at the
+end of each buffer. The pool calls this function itself when it runs out of
+room; call it after removing many meshes to shrink the buffers. Returns 0 on
+success, non-zero on failure. */
+int meshGLPoolDefragment(meshGLPool *pool, GLuint vertCap, GLuint indexCap) {
+    GLuint i, vertAt = 0, indexAt = 0, vbos[2];
+    GLuint indexSize = meshGLGetIndexSize(pool->indexType);
+    vertCap = (vertCap < pool->vertUsed) ? pool->vertUsed : vertCap;
+    indexCap = (indexCap < pool->indexUsed) ? pool->indexUsed : indexCap;
+    glGenBuffers(2, vbos);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbos[0]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)vertCap * pool->stride,
+        NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbos[1]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)indexCap * indexSize, NULL,
+        GL_DYNAMIC_DRAW);
+    if (glGetError() != GL_NO_ERROR) {
+        fprintf(stderr, "error: meshGLPoolDefragment: OpenGL error\n");
+        glDeleteBuffers(2, vbos);
+        return 1;
+    }
+    /* Copying from the old buffers into new ones, rather than within one
+    buffer, avoids overlapping copies, which OpenGL forbids. */
+    for (i = 0; i < pool->meshNum; i += 1) {
+        meshGLMesh *mesh = pool->meshes[i];
+        glBindBuffer(GL_COPY_READ_BUFFER, pool->vbos[0]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbos[0]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+            (GLintptr)mesh->baseVertex * pool->stride,
+            (GLintptr)vertAt * pool->stride,
+            (GLsizeiptr)mesh->vertNum * pool->stride);
+        glBindBuffer(GL_COPY_READ_BUFFER, pool->vbos[1]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbos[1]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+            (GLintptr)mesh->firstIndex * indexSize,
+            (GLintptr)indexAt * indexSize,
+            (GLsizeiptr)mesh->triNum * 3 * indexSize);
+        mesh->baseVertex = (GLint)vertAt;
+        mesh->firstIndex = indexAt;
+        vertAt += mesh->vertNum;
+        indexAt += mesh->triNum * 3;
+    }
+    glDeleteBuffers(2, pool->vbos);
+    pool->vbos[0] = vbos[0];
+    pool->vbos[1] = vbos[1];
+    for (i = 0; i < pool->meshNum; i += 1) {
+        pool->meshes[i]->vbos[0] = vbos[0];
+        pool->meshes[i]->vbos[1] = vbos[1];
+    }
+    pool->vertCap = vertCap;
+    pool->indexCap = indexCap;
+    meshGLFreeListReset(&(pool->vertFree), vertAt, vertCap - vertAt);
+    meshGLFreeListReset(&(pool->indexFree), indexAt, indexCap - indexAt);
+    meshGLPoolConfigure(pool);
+    return 0;
+}
+
+/* Helper function for meshGLPoolAdd. Allocates vertNum vertices and indexNum
+indices, defragmenting and growing the buffers if need be. Returns 0 on
+success, non-zero on failure. */
+int meshGLPoolAllocate(
+        meshGLPool *pool, GLuint vertNum, GLuint indexNum, GLint64 *vertFirst,
+        GLint64 *indexFirst) {
+    GLuint vertCap = pool->vertCap, indexCap = pool->indexCap;
+    *vertFirst = meshGLFreeListAllocate(&(pool->vertFree), vertNum);
+    *indexFirst = meshGLFreeListAllocate(&(pool->indexFree), indexNum);
+    if (*vertFirst >= 0 && *indexFirst >= 0)
+        return 0;
+    if (*vertFirst >= 0)
+        meshGLFreeListRelease(&(pool->vertFree), *vertFirst, vertNum);
+    if (*indexFirst >= 0)
+        meshGLFreeListRelease(&(pool->indexFree), *indexFirst, indexNum);
+    /* Defragmenting alone suffices if the holes add up to enough room.
+    Otherwise at least double, so that filling a pool costs amortized constant
+    copying per element. */
+    if (pool->vertUsed + vertNum > vertCap)
+        vertCap = (2 * vertCap > pool->vertUsed + vertNum) ? 2 * vertCap :
+            pool->vertUsed + vertNum;
+    if (pool->indexUsed + indexNum > indexCap)
+        indexCap = (2 * indexCap > pool->indexUsed + indexNum) ?
+            2 * indexCap : pool->indexUsed + indexNum;
+    if (meshGLPoolDefragment(pool, vertCap, indexCap) != 0)
+        return 1;
+    *vertFirst = meshGLFreeListAllocate(&(pool->vertFree), vertNum);
+    *indexFirst = meshGLFreeListAllocate(&(pool->indexFree), indexNum);
+    return (*vertFirst < 0 || *indexFirst < 0);
+}
+
+/* Initializes the OpenGL mesh from the base mesh, as meshGLInitializeFormatted
+would with the pool's attributes, but in the pool's buffers. After this
+function completes, the base mesh can be destroyed. The mesh must stay at its
+address until it is released with meshGLPoolRemove (not meshGLDestroy). Returns
+0 on success, non-zero on failure. */
+int meshGLPoolAdd(meshGLPool *pool, meshGLMesh *mesh, const meshMesh *base) {
+    GLuint i, stride, offsets[16], indexNum = base->triNum * 3;
+    GLuint indexSize = meshGLGetIndexSize(pool->indexType);
+    GLubyte *data;
+    GLint64 vertFirst, indexFirst;
+    if (pool->indexType == GL_UNSIGNED_SHORT && base->vertNum > 65536) {
+        fprintf(stderr, "error: meshGLPoolAdd: too many vertices for 16-bit "
+            "indices\n");
+        return 1;
+    }
+    if (pool->meshNum == pool->meshCap) {
+        meshGLMesh **meshes = (meshGLMesh **)realloc(pool->meshes,
+            2 * pool->meshCap * sizeof(meshGLMesh *));
+        if (meshes == NULL)
+            return 2;
+        pool->meshes = meshes;
+        pool->meshCap *= 2;
+    }
+    if (meshGLEncodeVertices(mesh, base, pool->attrNum, pool->attrs, offsets,
+            &stride, &data) != 0)
+        return 3;
+    /* The indices are relative to the mesh's first vertex, as they are in
+    the base mesh, but converted to the pool's type. */
+    GLubyte *indices = (GLubyte *)malloc((size_t)indexNum * indexSize);
+    if (indices == NULL ||
+            meshGLPoolAllocate(pool, base->vertNum, indexNum, &vertFirst,
+                &indexFirst) != 0) {
+        free(data);
+        free(indices);
+        return 4;
+    }
+    for (i = 0; i < indexNum; i += 1)
+        if (pool->indexType == GL_UNSIGNED_SHORT)
+            ((GLushort *)indices)[i] = (GLushort)base->tri[i];
+        else
+            ((GLuint *)indices)[i] = base->tri[i];
+    /* Write through the copy targets, so as not to disturb the bound VAO's
+    element buffer. */
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool->vbos[0]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)vertFirst * stride,
+        (GLsizeiptr)base->vertNum * stride, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool->vbos[1]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)indexFirst * indexSize,
+        (GLsizeiptr)indexNum * indexSize, indices);
+    free(data);
+    free(indices);
+    mesh->vao = pool->vao;
+    mesh->vbos[0] = pool->vbos[0];
+    mesh->vbos[1] = pool->vbos[1];
+    mesh->indexType = pool->indexType;
+    mesh->pool = pool;
+    mesh->poolIndex = pool->meshNum;
+    mesh->baseVertex = (GLint)vertFirst;
+    mesh->firstIndex = (GLuint)indexFirst;
+    pool->meshes[pool->meshNum] = mesh;
+    pool->meshNum += 1;
+    pool->vertUsed += base->vertNum;
+    pool->indexUsed += indexNum;
+    return 0;
+}
+
+/* Removes the mesh from the pool, freeing its ranges for other meshes. The
+mesh can then be discarded; don't call meshGLDestroy on it. */
+void meshGLPoolRemove(meshGLPool *pool, meshGLMesh *mesh) {
+    if (mesh->pool != pool) {
+        fprintf(stderr, "error: meshGLPoolRemove: mesh is not in pool\n");
+        return;
+    }
+    /* If the list can't grow, the ranges are recovered at the next
+    defragmentation, which packs only the meshes. */
+    meshGLFreeListRelease(&(pool->vertFree), (GLuint)mesh->baseVertex,
+        mesh->vertNum);
+    meshGLFreeListRelease(&(pool->indexFree), mesh->firstIndex,
+        mesh->triNum * 3);
+    pool->vertUsed -= mesh->vertNum;
+    pool->indexUsed -= mesh->triNum * 3;
+    pool->meshNum -= 1;
+    pool->meshes[mesh->poolIndex] = pool->meshes[pool->meshNum];
+    pool->meshes[mesh->poolIndex]->poolIndex = mesh->poolIndex;
+    mesh->pool = NULL;
+    mesh->vao = 0;
+    mesh->vbos[0] = 0;
+    mesh->vbos[1] = 0;
+}
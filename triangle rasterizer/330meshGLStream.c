@@ -0,0 +1,244 @@
+/*** Streaming meshes ***/
+
+/* meshGLInitialize and its relatives upload a mesh once, for drawing many
+times. Geometry that changes every frame, such as water, deforming terrain, or
+particles, would have to be destroyed and re-created, or rewritten with
+glBufferSubData, which stalls if the GPU is still drawing from the old data. A
+streaming mesh instead keeps meshGLSTREAMREGIONS copies of its vertices in one
+vertex buffer, used in rotation: while the GPU draws from one region, the CPU
+writes the next frame's vertices into another. Its base vertex (see
+meshGLMesh) selects the current region, so the VAO never changes, and the mesh
+is drawn like any other. The triangles are fixed.
+
+A fence is placed after the last draws from each region. Before a region is
+rewritten, its fence is checked. Usually the GPU finished with the region long
+ago, and there is no wait. With OpenGL 4.4, the buffer is mapped once,
+persistently, and written in place. Otherwise each region is mapped with
+glMapBufferRange for each update; if the GPU is still reading it, the whole
+buffer is orphaned (replaced with fresh storage, while the GPU keeps the old)
+rather than waited for. Typical use, each frame:
+    (animate the base mesh's vertices)
+    meshGLStreamUpdate(&stream, &base);
+    ...
+    meshGLRender(&stream.mesh); */
+
+#define meshGLSTREAMREGIONS 3
+
+/* Feel free to read from this struct's members, but don't write to them. The
+mesh can be drawn and queued like any other, but must not be destroyed except
+through meshGLStreamDestroy. */
+typedef struct meshGLStream meshGLStream;
+struct meshGLStream {
+    meshGLMesh mesh;
+    GLuint attrNum, stride, offsets[16];
+    meshGLAttribute attrs[16];
+    GLuint persistent, region;
+    GLsizeiptr regionSize;
+    GLubyte *mapping;
+    GLdouble *scratch;
+    GLsync fences[meshGLSTREAMREGIONS];
+};
+
+/* Counts of the bytes written by meshGLStreamUpdate, the seconds it spent
+waiting for the GPU or the driver, and the buffers it orphaned, since the last
+call to meshGLStreamResetCounters. Feel free to read them. */
+GLuint64 meshGLStreamByteNum = 0;
+GLdouble meshGLStreamStallTime = 0.0;
+GLuint meshGLStreamOrphanNum = 0;
+
+/* Zeroes the counters above. Call this once per frame to get per-frame counts.
+*/
+void meshGLStreamResetCounters(void) {
+    meshGLStreamByteNum = 0;
+    meshGLStreamStallTime = 0.0;
+    meshGLStreamOrphanNum = 0;
+}
+
+/* Helper function for meshGLStreamUpdate. Returns the current time in seconds.
+*/
+GLdouble meshGLStreamGetTime(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 0.000001;
+}
+
+/* Helper function for meshGLStreamInitialize and meshGLStreamUpdate. Encodes
+the base mesh's vertices into dest. */
+void meshGLStreamEncode(
+        meshGLStream *stream, const meshMesh *base, GLubyte *dest) {
+    GLdouble corner[3] = {0.0, 0.0, 0.0};
+    const GLdouble *vert;
+    GLuint i, k;
+    for (i = 0; i < stream->mesh.vertNum; i += 1) {
+        vert = meshGetVertexPointer(base, i);
+        if (vert == NULL) {
+            meshGetAttributes(base, i, 0, base->attrDim, stream->scratch);
+            vert = stream->scratch;
+        }
+        for (k = 0; k < stream->attrNum; k += 1)
+            meshGLEncodeAttribute(&(stream->attrs[k]), vert,
+                &dest[(size_t)i * stream->stride + stream->offsets[k]],
+                corner, 0.0);
+    }
+}
+
+/* Helper function for meshGLStreamUpdate. Deletes the fence, if any. */
+void meshGLStreamClearFence(meshGLStream *stream, GLuint region) {
+    if (stream->fences[region] != 0) {
+        glDeleteSync(stream->fences[region]);
+        stream->fences[region] = 0;
+    }
+}
+
+/* Initializes a streaming mesh from the base mesh, encoding the vertices as
+described by the attrNum (at most 16) attributes, none of which can be
+meshGLQUANTIZED, as in meshGLInitializeFormatted. Returns 0 on success,
+non-zero on failure. Don't forget to call meshGLStreamDestroy when finished. */
+int meshGLStreamInitialize(
+        meshGLStream *stream, const meshMesh *base, GLuint attrNum,
+        const meshGLAttribute attrs[]) {
+    GLuint i;
+    GLubyte *data;
+    for (i = 0; i < attrNum; i += 1)
+        if (attrs[i].encoding == meshGLQUANTIZED) {
+            fprintf(stderr, "error: meshGLStreamInitialize: quantized "
+                "attributes can't be streamed\n");
+            return 1;
+        }
+    if (meshGLEncodeVertices(&(stream->mesh), base, attrNum, attrs,
+            stream->offsets, &(stream->stride), &data) != 0)
+        return 2;
+    stream->scratch = (GLdouble *)malloc(base->attrDim * sizeof(GLdouble));
+    if (stream->scratch == NULL) {
+        free(data);
+        return 3;
+    }
+    stream->attrNum = attrNum;
+    for (i = 0; i < attrNum; i += 1)
+        stream->attrs[i] = attrs[i];
+    stream->regionSize = (GLsizeiptr)base->vertNum * stream->stride;
+    stream->region = 0;
+    stream->mapping = NULL;
+    for (i = 0; i < meshGLSTREAMREGIONS; i += 1)
+        stream->fences[i] = 0;
+    /* Persistent mapping is core in OpenGL 4.4. */
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    stream->persistent = (major > 4 || (major == 4 && minor >= 4));
+    GLsizeiptr size = meshGLSTREAMREGIONS * stream->regionSize;
+    glGenBuffers(2, stream->mesh.vbos);
+    glBindBuffer(GL_ARRAY_BUFFER, stream->mesh.vbos[0]);
+    if (stream->persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+            GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+        stream->mapping = (GLubyte *)glMapBufferRange(GL_ARRAY_BUFFER, 0,
+            size, flags);
+        if (stream->mapping == NULL) {
+            fprintf(stderr, "error: meshGLStreamInitialize: persistent "
+                "mapping failed\n");
+            glDeleteBuffers(2, stream->mesh.vbos);
+            free(stream->scratch);
+            free(data);
+            return 4;
+        }
+        memcpy(stream->mapping, data, stream->regionSize);
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, stream->regionSize, data);
+    }
+    free(data);
+    shaBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stream->mesh.vbos[1]);
+    meshGLBufferIndices(&(stream->mesh), base, GL_STATIC_DRAW);
+    glGenVertexArrays(1, &(stream->mesh.vao));
+    shaBindVertexArray(stream->mesh.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, stream->mesh.vbos[0]);
+    for (i = 0; i < attrNum; i += 1)
+        meshGLSetAttributePointer(&attrs[i], stream->stride,
+            stream->offsets[i]);
+    meshGLFinishInitialization(&(stream->mesh));
+    return 0;
+}
+
+/* Replaces the mesh's vertices with the base mesh's, which must have as many
+vertices as the mesh was initialized with. The new vertices are used by draws
+issued after this call, and the mesh's bounds are recomputed, which nodes
+drawing the mesh notice (see meshGLMesh's boundsVersion) at their next render.
+Call this at most once per frame, before drawing the mesh. Returns 0 on
+success, non-zero on failure, in which case the mesh keeps its old vertices. */
+int meshGLStreamUpdate(meshGLStream *stream, const meshMesh *base) {
+    GLuint last = stream->region, i;
+    GLuint region = (last + 1) % meshGLSTREAMREGIONS;
+    GLintptr offset = region * stream->regionSize;
+    GLubyte *dest;
+    if (base->vertNum != stream->mesh.vertNum) {
+        fprintf(stderr, "error: meshGLStreamUpdate: %u vertices, not %u\n",
+            base->vertNum, stream->mesh.vertNum);
+        return 1;
+    }
+    /* All draws from the last region were issued before this call, so a
+    fence now marks their completion. */
+    meshGLStreamClearFence(stream, last);
+    stream->fences[last] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GLdouble start = meshGLStreamGetTime();
+    glBindBuffer(GL_ARRAY_BUFFER, stream->mesh.vbos[0]);
+    if (stream->persistent) {
+        /* The mapping can't be orphaned, so wait, flushing the commands that
+        the fence follows, lest we wait forever. */
+        if (stream->fences[region] != 0)
+            while (glClientWaitSync(stream->fences[region],
+                    GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) ==
+                    GL_TIMEOUT_EXPIRED)
+                ;
+        dest = &(stream->mapping[offset]);
+    } else if (stream->fences[region] != 0 &&
+            glClientWaitSync(stream->fences[region], 0, 0) ==
+            GL_TIMEOUT_EXPIRED) {
+        /* Rather than wait, give the GPU's copy to the driver, and write the
+        region into fresh storage. The other regions' contents are lost, but
+        only the new region will be drawn. */
+        glBufferData(GL_ARRAY_BUFFER,
+            meshGLSTREAMREGIONS * stream->regionSize, NULL, GL_STREAM_DRAW);
+        for (i = 0; i < meshGLSTREAMREGIONS; i += 1)
+            meshGLStreamClearFence(stream, i);
+        meshGLStreamOrphanNum += 1;
+        dest = (GLubyte *)glMapBufferRange(GL_ARRAY_BUFFER, offset,
+            stream->regionSize, GL_MAP_WRITE_BIT |
+            GL_MAP_INVALIDATE_RANGE_BIT);
+    } else
+        /* The GPU is done with the region, so the driver needn't check. */
+        dest = (GLubyte *)glMapBufferRange(GL_ARRAY_BUFFER, offset,
+            stream->regionSize, GL_MAP_WRITE_BIT |
+            GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    meshGLStreamStallTime += meshGLStreamGetTime() - start;
+    if (dest == NULL) {
+        fprintf(stderr, "error: meshGLStreamUpdate: glMapBufferRange "
+            "failed\n");
+        return 2;
+    }
+    meshGLStreamEncode(stream, base, dest);
+    if (!stream->persistent)
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    meshGLStreamClearFence(stream, region);
+    stream->region = region;
+    stream->mesh.baseVertex = (GLint)(region * stream->mesh.vertNum);
+    meshGLSetBounds(&(stream->mesh), base,
+        (base->attrDim < 3) ? base->attrDim : 3);
+    meshGLStreamByteNum += stream->regionSize;
+    return 0;
+}
+
+/* Releases the resources backing the streaming mesh. */
+void meshGLStreamDestroy(meshGLStream *stream) {
+    GLuint i;
+    for (i = 0; i < meshGLSTREAMREGIONS; i += 1)
+        meshGLStreamClearFence(stream, i);
+    if (stream->persistent) {
+        glBindBuffer(GL_ARRAY_BUFFER, stream->mesh.vbos[0]);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    meshGLDestroy(&(stream->mesh));
+    free(stream->scratch);
+}
@@ -0,0 +1,387 @@
+/*** Optimizing meshes for the GPU ***/
+
+/* The mesh builders emit triangles in whatever order is convenient to
+construct them. The GPU prefers a different order. After transforming a
+vertex, it keeps the result in a small post-transform cache, so a triangle
+order that reuses recent vertices transforms fewer of them. With depth testing,
+drawing the front-most surfaces first lets early-Z reject hidden fragments, so
+an order that draws outward-facing regions first shades fewer fragments. And
+vertices fetched in the order that the triangles use them make better use of
+memory bandwidth. The functions here reorder a mesh's triangles and vertices
+for those three purposes, without changing what the mesh looks like. They
+assume that attributes 0, 1, 2 are XYZ.
+
+The quality of an order is measured by simulating a FIFO cache. ACMR (average
+cache miss ratio) is the number of vertex transformations per triangle; it is
+at most 3, and near 0.5 for an ideal order of a large regular grid. ATVR
+(average transformed vertex ratio) is the number of vertex transformations per
+referenced vertex; it is at least 1, which is ideal. */
+
+/* A typical post-transform cache size. Real caches vary between about 16 and
+32 entries; an order optimized for 16 also does well on larger caches. */
+#define meshCACHESIZE 16
+
+/* Simulates a FIFO post-transform cache with cacheSize entries, as the GPU
+renders the mesh's triangles in order. Places the ACMR and ATVR into *acmr and
+*atvr. Returns 0 on success, non-zero on failure. */
+int meshGetCacheStatistics(
+        const meshMesh *mesh, GLuint cacheSize, GLdouble *acmr,
+        GLdouble *atvr) {
+    GLuint *stamps = (GLuint *)calloc(mesh->vertNum + 1, sizeof(GLuint));
+    if (stamps == NULL)
+        return 1;
+    /* A vertex is cached if it was transformed fewer than cacheSize misses
+    ago. Starting the clock beyond cacheSize makes untouched vertices (stamp
+    0) uncached. */
+    GLuint i, v, time = cacheSize + 1, misses = 0, usedNum = 0;
+    for (i = 0; i < mesh->triNum * 3; i += 1) {
+        v = mesh->tri[i];
+        if (stamps[v] == 0)
+            usedNum += 1;
+        if (time - stamps[v] > cacheSize) {
+            stamps[v] = time;
+            time += 1;
+            misses += 1;
+        }
+    }
+    free(stamps);
+    *acmr = (mesh->triNum == 0) ? 0.0 : (GLdouble)misses / mesh->triNum;
+    *atvr = (usedNum == 0) ? 0.0 : (GLdouble)misses / usedNum;
+    return 0;
+}
+
+/* Builds the vertex-to-triangle adjacency of the mesh in compressed form: the
+triangles using vertex v are triangles[offsets[v]], ...,
+triangles[offsets[v + 1] - 1], in increasing order. offsets must have room for
+vertNum + 1 GLuints and triangles for triNum * 3 GLuints. */
+void meshGetAdjacency(
+        const meshMesh *mesh, GLuint offsets[], GLuint triangles[]) {
+    GLuint i, v;
+    for (v = 0; v <= mesh->vertNum; v += 1)
+        offsets[v] = 0;
+    for (i = 0; i < mesh->triNum * 3; i += 1)
+        offsets[mesh->tri[i] + 1] += 1;
+    for (v = 0; v < mesh->vertNum; v += 1)
+        offsets[v + 1] += offsets[v];
+    /* Fill using offsets as cursors, then shift the cursors back. */
+    for (i = 0; i < mesh->triNum * 3; i += 1) {
+        v = mesh->tri[i];
+        triangles[offsets[v]] = i / 3;
+        offsets[v] += 1;
+    }
+    for (v = mesh->vertNum; v > 0; v -= 1)
+        offsets[v] = offsets[v - 1];
+    offsets[0] = 0;
+}
+
+/* Reorders the mesh's triangles for the post-transform cache, using the
+linear-time Tipsify algorithm (Sander, Nehab, and Barczak, 'Fast triangle
+reordering for vertex locality and reduced overdraw', 2007). The algorithm
+fans around one vertex at a time, and chooses the next fanning vertex among the
+vertices just emitted, preferring ones that are still in a cache of cacheSize
+entries and that have few triangles left. Returns 0 on success, non-zero on
+failure. */
+int meshOptimizeVertexCache(meshMesh *mesh, GLuint cacheSize) {
+    GLuint triNum = mesh->triNum, vertNum = mesh->vertNum;
+    if (triNum == 0)
+        return 0;
+    /* One allocation for the adjacency, live counts, stamps, dead-end stack,
+    candidates, emitted flags, and new triangles. */
+    GLuint *offsets = (GLuint *)malloc(((GLsizeiptr)vertNum * 3 + 1 +
+        (GLsizeiptr)triNum * 13) * sizeof(GLuint));
+    if (offsets == NULL)
+        return 1;
+    GLuint *adjacent = &offsets[vertNum + 1];
+    GLuint *live = &adjacent[triNum * 3];
+    GLuint *stamps = &live[vertNum];
+    GLuint *deadEnds = &stamps[vertNum];
+    GLuint *candidates = &deadEnds[triNum * 3];
+    GLuint *emitted = &candidates[triNum * 3];
+    GLuint *newTri = &emitted[triNum];
+    meshGetAdjacency(mesh, offsets, adjacent);
+    GLuint v, i, j, k, t;
+    for (v = 0; v < vertNum; v += 1) {
+        live[v] = offsets[v + 1] - offsets[v];
+        stamps[v] = 0;
+    }
+    for (t = 0; t < triNum; t += 1)
+        emitted[t] = 0;
+    GLuint time = cacheSize + 1, deadEndNum = 0, outNum = 0, cursor = 0;
+    GLuint candidateNum, fan = 0;
+    int found = 0;
+    /* Start at the first vertex with live triangles. */
+    for (cursor = 0; cursor < vertNum; cursor += 1)
+        if (live[cursor] > 0) {
+            fan = cursor;
+            found = 1;
+            break;
+        }
+    while (found) {
+        /* Emit all of the unemitted triangles around the fanning vertex. */
+        candidateNum = 0;
+        for (i = offsets[fan]; i < offsets[fan + 1]; i += 1) {
+            t = adjacent[i];
+            if (emitted[t])
+                continue;
+            emitted[t] = 1;
+            for (k = 0; k < 3; k += 1) {
+                v = mesh->tri[t * 3 + k];
+                newTri[outNum * 3 + k] = v;
+                deadEnds[deadEndNum] = v;
+                deadEndNum += 1;
+                candidates[candidateNum] = v;
+                candidateNum += 1;
+                live[v] -= 1;
+                if (time - stamps[v] > cacheSize) {
+                    stamps[v] = time;
+                    time += 1;
+                }
+            }
+            outNum += 1;
+        }
+        /* Choose the next fanning vertex among the candidates. A candidate
+        scores by how long ago it was cached, if all of its remaining
+        triangles would still find it in the cache. */
+        found = 0;
+        GLuint bestScore = 0, score;
+        for (j = 0; j < candidateNum; j += 1) {
+            v = candidates[j];
+            if (live[v] == 0)
+                continue;
+            score = 0;
+            if (time - stamps[v] + 2 * live[v] <= cacheSize)
+                score = time - stamps[v];
+            if (!found || score > bestScore) {
+                bestScore = score;
+                fan = v;
+                found = 1;
+            }
+        }
+        /* At a dead end, back up through recently emitted vertices, and
+        failing that, scan forward for any vertex with live triangles. */
+        while (!found && deadEndNum > 0) {
+            deadEndNum -= 1;
+            v = deadEnds[deadEndNum];
+            if (live[v] > 0) {
+                fan = v;
+                found = 1;
+            }
+        }
+        for (; !found && cursor < vertNum; cursor += 1)
+            if (live[cursor] > 0) {
+                fan = cursor;
+                found = 1;
+            }
+    }
+    memcpy(mesh->tri, newTri, (size_t)triNum * 3 * sizeof(GLuint));
+    free(offsets);
+    return 0;
+}
+
+/* A cluster of consecutive triangles, for meshOptimizeOverdraw. */
+typedef struct meshCluster meshCluster;
+struct meshCluster {
+    GLuint first, triNum;
+    GLdouble sortKey;
+};
+
+/* Helper function for meshOptimizeOverdraw. Sorts clusters in decreasing
+order of sortKey, breaking ties by original position, so the sort is stable. */
+int meshCompareClusters(const void *a, const void *b) {
+    const meshCluster *c = (const meshCluster *)a, *d = (const meshCluster *)b;
+    if (c->sortKey > d->sortKey)
+        return -1;
+    if (c->sortKey < d->sortKey)
+        return 1;
+    return (c->first < d->first) ? -1 : (c->first > d->first);
+}
+
+/* Reorders the mesh's triangles to reduce overdraw, while keeping most of the
+cache locality of the current order, which should already be optimized by
+meshOptimizeVertexCache. The triangles are cut into clusters. A cluster ends as
+soon as its own ACMR, simulated with an initially empty cache, is at most
+threshold times the ACMR of the whole mesh. So threshold >= 1.0 bounds how much
+worse the ACMR can get; 1.05 is a reasonable value. Then the clusters are
+sorted so that those on the outside of the mesh, facing away from its center,
+come first; from most viewpoints, those occlude the others. Works in either
+layout (see meshToStreams). Returns 0 on success, non-zero on failure. */
+int meshOptimizeOverdraw(meshMesh *mesh, GLuint cacheSize, GLdouble threshold) {
+    GLuint triNum = mesh->triNum;
+    GLdouble acmr, atvr;
+    if (triNum == 0)
+        return 0;
+    if (meshGetCacheStatistics(mesh, cacheSize, &acmr, &atvr) != 0)
+        return 1;
+    meshCluster *clusters = (meshCluster *)malloc(triNum * sizeof(meshCluster));
+    GLuint *stamps = (GLuint *)calloc(mesh->vertNum, sizeof(GLuint));
+    GLuint *newTri = (GLuint *)malloc((size_t)triNum * 3 * sizeof(GLuint));
+    if (clusters == NULL || stamps == NULL || newTri == NULL) {
+        free(clusters);
+        free(stamps);
+        free(newTri);
+        return 2;
+    }
+    /* Cut the triangles into clusters. Each cluster starts with a cold cache,
+    which is modeled by jumping the clock ahead by cacheSize. */
+    GLuint t, k, v, clusterNum = 0, misses = 0, time = cacheSize + 1;
+    clusters[0].first = 0;
+    clusters[0].triNum = 0;
+    for (t = 0; t < triNum; t += 1) {
+        for (k = 0; k < 3; k += 1) {
+            v = mesh->tri[t * 3 + k];
+            if (time - stamps[v] > cacheSize) {
+                stamps[v] = time;
+                time += 1;
+                misses += 1;
+            }
+        }
+        clusters[clusterNum].triNum += 1;
+        if (t + 1 < triNum && misses <= threshold * acmr *
+                clusters[clusterNum].triNum) {
+            clusterNum += 1;
+            clusters[clusterNum].first = t + 1;
+            clusters[clusterNum].triNum = 0;
+            misses = 0;
+            time += cacheSize + 1;
+        }
+    }
+    clusterNum += 1;
+    /* Find the mesh's area-weighted centroid, and each cluster's centroid and
+    area-weighted normal. */
+    GLdouble meshCentroid[3] = {0.0, 0.0, 0.0}, meshArea = 0.0;
+    GLdouble a[3], b[3], c[3], ab[3], ac[3], cross[3], area;
+    GLuint i;
+    for (t = 0; t < triNum; t += 1) {
+        meshGetAttributes(mesh, mesh->tri[t * 3], 0, 3, a);
+        meshGetAttributes(mesh, mesh->tri[t * 3 + 1], 0, 3, b);
+        meshGetAttributes(mesh, mesh->tri[t * 3 + 2], 0, 3, c);
+        vec3Subtract(b, a, ab);
+        vec3Subtract(c, a, ac);
+        vec3Cross(ab, ac, cross);
+        area = sqrt(cross[0] * cross[0] + cross[1] * cross[1] +
+            cross[2] * cross[2]);
+        for (k = 0; k < 3; k += 1)
+            meshCentroid[k] += area * (a[k] + b[k] + c[k]) / 3.0;
+        meshArea += area;
+    }
+    if (meshArea > 0.0)
+        vec3Scale(1.0 / meshArea, meshCentroid, meshCentroid);
+    for (i = 0; i < clusterNum; i += 1) {
+        GLdouble centroid[3] = {0.0, 0.0, 0.0}, normal[3] = {0.0, 0.0, 0.0};
+        GLdouble clusterArea = 0.0, length;
+        for (t = clusters[i].first; t < clusters[i].first + clusters[i].triNum;
+                t += 1) {
+            meshGetAttributes(mesh, mesh->tri[t * 3], 0, 3, a);
+            meshGetAttributes(mesh, mesh->tri[t * 3 + 1], 0, 3, b);
+            meshGetAttributes(mesh, mesh->tri[t * 3 + 2], 0, 3, c);
+            vec3Subtract(b, a, ab);
+            vec3Subtract(c, a, ac);
+            vec3Cross(ab, ac, cross);
+            area = sqrt(cross[0] * cross[0] + cross[1] * cross[1] +
+                cross[2] * cross[2]);
+            for (k = 0; k < 3; k += 1)
+                centroid[k] += area * (a[k] + b[k] + c[k]) / 3.0;
+            vec3Add(normal, cross, normal);
+            clusterArea += area;
+        }
+        if (clusterArea > 0.0)
+            vec3Scale(1.0 / clusterArea, centroid, centroid);
+        length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
+            normal[2] * normal[2]);
+        clusters[i].sortKey = 0.0;
+        if (length > 0.0)
+            for (k = 0; k < 3; k += 1)
+                clusters[i].sortKey += (centroid[k] - meshCentroid[k]) *
+                    normal[k] / length;
+    }
+    qsort(clusters, clusterNum, sizeof(meshCluster), meshCompareClusters);
+    GLuint outNum = 0;
+    for (i = 0; i < clusterNum; i += 1) {
+        memcpy(&newTri[outNum * 3], &mesh->tri[clusters[i].first * 3],
+            (size_t)clusters[i].triNum * 3 * sizeof(GLuint));
+        outNum += clusters[i].triNum;
+    }
+    memcpy(mesh->tri, newTri, (size_t)triNum * 3 * sizeof(GLuint));
+    free(clusters);
+    free(stamps);
+    free(newTri);
+    return 0;
+}
+
+/* Renumbers the mesh's vertices in the order in which the triangles first use
+them, so that the GPU fetches vertex data nearly sequentially. Vertices not
+used by any triangle are moved to the end, in their original order. The mesh
+must be in interleaved layout. Returns 0 on success, non-zero on failure. */
+int meshOptimizeVertexFetch(meshMesh *mesh) {
+    GLuint vertNum = mesh->vertNum, attrDim = mesh->attrDim;
+    if (mesh->streams != NULL) {
+        fprintf(stderr, "error: meshOptimizeVertexFetch: mesh is not "
+            "interleaved\n");
+        return 2;
+    }
+    GLuint *remap = (GLuint *)malloc(vertNum * sizeof(GLuint));
+    GLdouble *newVert = (GLdouble *)malloc((size_t)vertNum * attrDim *
+        sizeof(GLdouble));
+    if (remap == NULL || newVert == NULL) {
+        free(remap);
+        free(newVert);
+        return 1;
+    }
+    GLuint i, v, next = 0;
+    for (v = 0; v < vertNum; v += 1)
+        remap[v] = vertNum;
+    for (i = 0; i < mesh->triNum * 3; i += 1) {
+        v = mesh->tri[i];
+        if (remap[v] == vertNum) {
+            remap[v] = next;
+            next += 1;
+        }
+        mesh->tri[i] = remap[v];
+    }
+    for (v = 0; v < vertNum; v += 1) {
+        if (remap[v] == vertNum) {
+            remap[v] = next;
+            next += 1;
+        }
+        memcpy(&newVert[(size_t)remap[v] * attrDim], meshGetVertexPointer(mesh,
+            v), attrDim * sizeof(GLdouble));
+    }
+    memcpy(mesh->vert, newVert, (size_t)vertNum * attrDim * sizeof(GLdouble));
+    free(remap);
+    free(newVert);
+    return 0;
+}
+
+/* Runs the whole optimization: triangles for the cache, then (if
+overdrawThreshold >= 1.0) triangles for overdraw, then vertices for fetching.
+If verbose is non-zero, prints the ACMR and ATVR before and after, for a cache
+of meshCACHESIZE entries. The mesh must be in interleaved layout; if it isn't,
+returns 6 without changing it. Returns 0 on success, non-zero on failure. */
+int meshOptimize(meshMesh *mesh, GLdouble overdrawThreshold, int verbose) {
+    GLdouble acmrBefore, atvrBefore, acmrAfter, atvrAfter;
+    /* meshOptimizeVertexFetch needs interleaved vertices, so check before
+    reordering anything, lest the mesh be left half optimized. */
+    if (mesh->streams != NULL) {
+        fprintf(stderr, "error: meshOptimize: mesh is not interleaved\n");
+        return 6;
+    }
+    if (meshGetCacheStatistics(mesh, meshCACHESIZE, &acmrBefore,
+            &atvrBefore) != 0)
+        return 1;
+    if (meshOptimizeVertexCache(mesh, meshCACHESIZE) != 0)
+        return 2;
+    if (overdrawThreshold >= 1.0 &&
+            meshOptimizeOverdraw(mesh, meshCACHESIZE, overdrawThreshold) != 0)
+        return 3;
+    if (meshOptimizeVertexFetch(mesh) != 0)
+        return 4;
+    if (verbose) {
+        if (meshGetCacheStatistics(mesh, meshCACHESIZE, &acmrAfter,
+                &atvrAfter) != 0)
+            return 5;
+        fprintf(stderr, "meshOptimize: %u triangles: ACMR %f -> %f, "
+            "ATVR %f -> %f\n", mesh->triNum, acmrBefore, acmrAfter, atvrBefore,
+            atvrAfter);
+    }
+    return 0;
+}
@@ -0,0 +1,607 @@
+/*** Simplifying meshes ***/
+
+/* This file offers meshInitializeSimplified, which builds a version of a mesh
+with fewer triangles, for drawing far-away objects. It repeatedly collapses an
+edge (v, u) by deleting vertex v and reconnecting its triangles to u. The edge
+to collapse next is the one that moves the surface least, as measured by
+quadric error metrics (Garland and Heckbert, 'Surface simplification using
+quadric error metrics', 1997): each vertex carries the sum of the squared-
+distance functions of the planes of its triangles, and the cost of collapsing v
+onto u is that function of v, plus that of u, evaluated at u's position.
+
+Because the surviving vertex u keeps its own attributes, no attributes are ever
+interpolated, and texture coordinates and normals stay exactly as authored.
+Attribute seams are places where several vertices share a position but differ
+in ST or NOP, as along the meridian of mesh3DInitializeRevolution or the hard
+edges of a faceted model. A vertex on a seam is deleted only together with all
+of the other vertices at its place, each collapsing onto its own counterpart at
+the neighboring place, so that the seam slides along itself and stays sharp.
+That is possible only along the seam, where each vertex at the place has exactly
+one neighbor at the other place, and those neighbors are distinct; where seams
+meet, branch, or end, no collapse qualifies, and the vertices stay. The
+boundaries of open meshes (such as mesh3DInitializeLandscape) are kept as they
+are, by never deleting a vertex at a place on a boundary. Attributes 0, 1, 2
+are assumed to be XYZ. */
+
+/* A quadric is a symmetric 4x4 matrix, stored as its upper triangle in the
+order aa ab ac ad bb bc bd cc cd dd, followed by the total area of the planes
+summed into it. */
+#define meshQUADRICDIM 11
+
+/* Helper function for meshInitializeSimplified. Adds the area-weighted
+squared-distance quadric of the plane of triangle abc to q. */
+void meshQuadricAddTriangle(
+        GLdouble q[meshQUADRICDIM], const GLdouble a[], const GLdouble b[],
+        const GLdouble c[]) {
+    GLdouble ab[3], ac[3], n[3], length, area, d;
+    vec3Subtract(b, a, ab);
+    vec3Subtract(c, a, ac);
+    vec3Cross(ab, ac, n);
+    length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0.0)
+        return;
+    area = length / 2.0;
+    vec3Scale(1.0 / length, n, n);
+    d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+    q[0] += area * n[0] * n[0];
+    q[1] += area * n[0] * n[1];
+    q[2] += area * n[0] * n[2];
+    q[3] += area * n[0] * d;
+    q[4] += area * n[1] * n[1];
+    q[5] += area * n[1] * n[2];
+    q[6] += area * n[1] * d;
+    q[7] += area * n[2] * n[2];
+    q[8] += area * n[2] * d;
+    q[9] += area * d * d;
+    q[10] += area;
+}
+
+/* Helper function for meshInitializeSimplified. Evaluates the sum of quadrics
+q and r at the point p. Returns the root-mean-square distance from p to the
+planes, weighted by area, which is in the same units as the positions. */
+GLdouble meshQuadricError(
+        const GLdouble q[meshQUADRICDIM], const GLdouble r[meshQUADRICDIM],
+        const GLdouble p[3]) {
+    GLdouble s[meshQUADRICDIM];
+    vecAdd(meshQUADRICDIM, q, r, s);
+    if (s[10] == 0.0)
+        return 0.0;
+    GLdouble x = p[0], y = p[1], z = p[2];
+    GLdouble e = s[0] * x * x + 2.0 * s[1] * x * y + 2.0 * s[2] * x * z +
+        2.0 * s[3] * x + s[4] * y * y + 2.0 * s[5] * y * z + 2.0 * s[6] * y +
+        s[7] * z * z + 2.0 * s[8] * z + s[9];
+    return (e <= 0.0) ? 0.0 : sqrt(e / s[10]);
+}
+
+/* A candidate collapse, in the priority queue. It is stale if the vertex's
+version has changed since the candidate was computed. */
+typedef struct meshCollapse meshCollapse;
+struct meshCollapse {
+    GLdouble error;
+    GLuint v, u, version;
+};
+
+/* All of the working state of the simplifier. Each vertex's list of triangles
+lives in the pool, starting at lists[v], with listNums[v] entries and room for
+listCaps[v]; lists move to the end of the pool when they outgrow their room.
+Triangles in a list can be dead. places[v] is the first vertex at v's place, and
+the vertices at each place are linked in a ring by siblings. targets receives,
+for each vertex at a place being collapsed, the vertex it collapses onto. */
+typedef struct meshSimplifier meshSimplifier;
+struct meshSimplifier {
+    const meshMesh *base;
+    GLuint *tri;
+    GLubyte *triAlive, *vertLocked, *vertAlive;
+    GLdouble *quadrics;
+    GLuint *lists, *listNums, *listCaps, *pool, poolNum, poolCap;
+    GLuint *versions, *marks, mark;
+    GLuint *places, *siblings, *targets;
+    meshCollapse *heap;
+    GLuint heapNum, heapCap;
+};
+
+/* Helper function for meshInitializeSimplified. Appends triangle t to vertex
+v's list. Returns 0 on success, non-zero on failure. */
+int meshSimplifierAppend(meshSimplifier *s, GLuint v, GLuint t) {
+    if (s->listNums[v] == s->listCaps[v]) {
+        GLuint cap = 2 * s->listCaps[v] + 4;
+        if (s->poolNum + cap > s->poolCap) {
+            GLuint poolCap = 2 * s->poolCap + cap;
+            GLuint *pool = (GLuint *)realloc(s->pool, (size_t)poolCap *
+                sizeof(GLuint));
+            if (pool == NULL)
+                return 1;
+            s->pool = pool;
+            s->poolCap = poolCap;
+        }
+        memcpy(&s->pool[s->poolNum], &s->pool[s->lists[v]], s->listNums[v] *
+            sizeof(GLuint));
+        s->lists[v] = s->poolNum;
+        s->listCaps[v] = cap;
+        s->poolNum += cap;
+    }
+    s->pool[s->lists[v] + s->listNums[v]] = t;
+    s->listNums[v] += 1;
+    return 0;
+}
+
+/* Helper function for meshInitializeSimplified. Pushes a collapse onto the
+min-heap. Returns 0 on success, non-zero on failure. */
+int meshSimplifierPush(meshSimplifier *s, meshCollapse collapse) {
+    if (s->heapNum == s->heapCap) {
+        GLuint cap = 2 * s->heapCap + 64;
+        meshCollapse *heap = (meshCollapse *)realloc(s->heap, (size_t)cap *
+            sizeof(meshCollapse));
+        if (heap == NULL)
+            return 1;
+        s->heap = heap;
+        s->heapCap = cap;
+    }
+    GLuint i = s->heapNum, parent;
+    s->heapNum += 1;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (s->heap[parent].error <= collapse.error)
+            break;
+        s->heap[i] = s->heap[parent];
+        i = parent;
+    }
+    s->heap[i] = collapse;
+    return 0;
+}
+
+/* Helper function for meshInitializeSimplified. Pops the cheapest collapse
+from the min-heap, which must not be empty. */
+meshCollapse meshSimplifierPop(meshSimplifier *s) {
+    meshCollapse top = s->heap[0], last = s->heap[s->heapNum - 1];
+    GLuint i = 0, child;
+    s->heapNum -= 1;
+    while (2 * i + 1 < s->heapNum) {
+        child = 2 * i + 1;
+        if (child + 1 < s->heapNum &&
+                s->heap[child + 1].error < s->heap[child].error)
+            child += 1;
+        if (last.error <= s->heap[child].error)
+            break;
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    s->heap[i] = last;
+    return top;
+}
+
+/* Helper function for meshInitializeSimplified. Returns 1 if collapsing v
+onto u keeps the mesh manifold and flips no triangle, and 0 otherwise. */
+int meshSimplifierIsValid(meshSimplifier *s, GLuint v, GLuint u) {
+    const meshMesh *base = s->base;
+    GLuint i, k, t, w, sharedTriNum = 0, sharedVertNum = 0;
+    GLuint *list;
+    /* Link condition: the vertices adjacent to both v and u must be exactly
+    the third vertices of the triangles containing both. */
+    s->mark += 1;
+    list = &s->pool[s->lists[u]];
+    for (i = 0; i < s->listNums[u]; i += 1)
+        if (s->triAlive[list[i]])
+            for (k = 0; k < 3; k += 1)
+                s->marks[s->tri[list[i] * 3 + k]] = s->mark;
+    s->mark += 1;
+    list = &s->pool[s->lists[v]];
+    for (i = 0; i < s->listNums[v]; i += 1) {
+        t = list[i];
+        if (!s->triAlive[t])
+            continue;
+        int hasU = 0;
+        for (k = 0; k < 3; k += 1)
+            hasU |= (s->tri[t * 3 + k] == u);
+        sharedTriNum += hasU;
+        for (k = 0; k < 3; k += 1) {
+            w = s->tri[t * 3 + k];
+            if (w != u && w != v && s->marks[w] == s->mark - 1) {
+                s->marks[w] = s->mark;
+                sharedVertNum += 1;
+            }
+        }
+    }
+    if (sharedTriNum == 0 || sharedVertNum != sharedTriNum)
+        return 0;
+    /* No triangle that survives the collapse may turn over. */
+    const GLdouble *pu = meshGetVertexPointer(base, u), *p[3];
+    GLdouble ab[3], ac[3], before[3], after[3];
+    for (i = 0; i < s->listNums[v]; i += 1) {
+        t = list[i];
+        if (!s->triAlive[t] || s->tri[t * 3] == u || s->tri[t * 3 + 1] == u ||
+                s->tri[t * 3 + 2] == u)
+            continue;
+        for (k = 0; k < 3; k += 1)
+            p[k] = meshGetVertexPointer(base, s->tri[t * 3 + k]);
+        vec3Subtract(p[1], p[0], ab);
+        vec3Subtract(p[2], p[0], ac);
+        vec3Cross(ab, ac, before);
+        for (k = 0; k < 3; k += 1)
+            if (s->tri[t * 3 + k] == v)
+                p[k] = pu;
+        vec3Subtract(p[1], p[0], ab);
+        vec3Subtract(p[2], p[0], ac);
+        vec3Cross(ab, ac, after);
+        if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2]
+                <= 0.0)
+            return 0;
+    }
+    return 1;
+}
+
+/* Helper function for meshInitializeSimplified. Adds to q the quadrics of the
+living vertices at v's place. */
+void meshSimplifierAddPlace(
+        const meshSimplifier *s, GLuint v, GLdouble q[meshQUADRICDIM]) {
+    GLuint w = v;
+    do {
+        if (s->vertAlive[w])
+            vecAdd(meshQUADRICDIM, q, &s->quadrics[w * meshQUADRICDIM], q);
+        w = s->siblings[w];
+    } while (w != v);
+}
+
+/* Helper function for meshInitializeSimplified. Returns 1 if every living
+vertex at v's place can collapse together with v onto u's place, and 0
+otherwise. Each must have exactly one neighbor at u's place, distinct from the
+others' (v's being u), and each of those collapses must be valid. On success,
+targets holds the neighbors, and vertNum for the dead vertices at the place. */
+int meshSimplifierMatch(meshSimplifier *s, GLuint v, GLuint u) {
+    GLuint w = v, x, target, i, k, t, *list;
+    do {
+        if (!s->vertAlive[w]) {
+            s->targets[w] = s->base->vertNum;
+            w = s->siblings[w];
+            continue;
+        }
+        target = s->base->vertNum;
+        list = &s->pool[s->lists[w]];
+        for (i = 0; i < s->listNums[w]; i += 1) {
+            t = list[i];
+            if (!s->triAlive[t])
+                continue;
+            for (k = 0; k < 3; k += 1) {
+                x = s->tri[t * 3 + k];
+                if (s->places[x] != s->places[u] || x == target)
+                    continue;
+                if (target != s->base->vertNum)
+                    return 0;
+                target = x;
+            }
+        }
+        if (target == s->base->vertNum)
+            return 0;
+        /* The targets must be distinct, or the seam would be pinched. */
+        for (x = v; x != w; x = s->siblings[x])
+            if (s->vertAlive[x] && s->targets[x] == target)
+                return 0;
+        if (!meshSimplifierIsValid(s, w, target))
+            return 0;
+        s->targets[w] = target;
+        w = s->siblings[w];
+    } while (w != v);
+    return (s->targets[v] == u);
+}
+
+/* Helper function for meshInitializeSimplified. Finds the cheapest valid
+collapse of v's place onto a neighboring place, and pushes it as a collapse of
+v onto its neighbor there. Returns 0 on success (even if there is no valid
+collapse), non-zero on failure. */
+int meshSimplifierConsider(meshSimplifier *s, GLuint v) {
+    s->versions[v] += 1;
+    if (!s->vertAlive[v] || s->vertLocked[v])
+        return 0;
+    meshCollapse best = {0.0, v, v, s->versions[v]};
+    GLuint i, k, u, *list = &s->pool[s->lists[v]];
+    GLdouble error, place[meshQUADRICDIM], other[meshQUADRICDIM];
+    memset(place, 0, sizeof(place));
+    meshSimplifierAddPlace(s, v, place);
+    for (i = 0; i < s->listNums[v]; i += 1) {
+        if (!s->triAlive[list[i]])
+            continue;
+        for (k = 0; k < 3; k += 1) {
+            u = s->tri[list[i] * 3 + k];
+            if (u == v || s->places[u] == s->places[v])
+                continue;
+            memset(other, 0, sizeof(other));
+            meshSimplifierAddPlace(s, u, other);
+            error = meshQuadricError(place, other,
+                meshGetVertexPointer(s->base, u));
+            if ((best.u == v || error < best.error) &&
+                    meshSimplifierMatch(s, v, u)) {
+                best.error = error;
+                best.u = u;
+            }
+        }
+    }
+    if (best.u == v)
+        return 0;
+    return meshSimplifierPush(s, best);
+}
+
+/* Helper function for meshSimplifierLock, for qsort. */
+int meshCompareEdges(const void *a, const void *b) {
+    uint64_t e = *(const uint64_t *)a, f = *(const uint64_t *)b;
+    return (e < f) ? -1 : (e > f);
+}
+
+/* Helper function for meshInitializeSimplified. Groups the vertices by place,
+and finds the boundary vertices, which must not be deleted. Two vertices are at
+the same place if their XYZ are exactly equal. A vertex is on a boundary if one
+of its edges, considered between places, has only one triangle. Returns 0 on
+success, non-zero on failure. */
+int meshSimplifierLock(meshSimplifier *s) {
+    const meshMesh *base = s->base;
+    GLuint vertNum = base->vertNum, triNum = base->triNum;
+    GLuint tableSize = 1, i, k, v, *places = s->places, *table;
+    while (tableSize < 2 * vertNum)
+        tableSize *= 2;
+    table = (GLuint *)malloc((size_t)tableSize * sizeof(GLuint));
+    uint64_t *edges = (uint64_t *)malloc((size_t)triNum * 3 *
+        sizeof(uint64_t));
+    if (table == NULL || edges == NULL) {
+        free(table);
+        free(edges);
+        return 1;
+    }
+    /* Give each vertex the index of the first vertex at its place, and link
+    it into that vertex's ring. */
+    for (i = 0; i < tableSize; i += 1)
+        table[i] = vertNum;
+    int noShift[3] = {0, 0, 0};
+    for (v = 0; v < vertNum; v += 1) {
+        GLdouble *p = meshGetVertexPointer(base, v);
+        uint64_t hash = meshWeldHash(p, 3, 0.0, noShift);
+        for (i = hash & (tableSize - 1); table[i] != vertNum;
+                i = (i + 1) & (tableSize - 1))
+            if (meshWeldMatch(p, meshGetVertexPointer(base, table[i]), 3, 0.0))
+                break;
+        if (table[i] == vertNum) {
+            table[i] = v;
+            places[v] = v;
+            s->siblings[v] = v;
+        } else {
+            places[v] = table[i];
+            s->siblings[v] = s->siblings[table[i]];
+            s->siblings[table[i]] = v;
+        }
+    }
+    /* Sort the edges between places, so that shared edges are adjacent. */
+    GLuint a, b;
+    for (i = 0; i < triNum; i += 1)
+        for (k = 0; k < 3; k += 1) {
+            a = places[base->tri[i * 3 + k]];
+            b = places[base->tri[i * 3 + (k + 1) % 3]];
+            edges[i * 3 + k] = (a < b) ? ((uint64_t)a << 32 | b) :
+                ((uint64_t)b << 32 | a);
+        }
+    qsort(edges, (size_t)triNum * 3, sizeof(uint64_t), meshCompareEdges);
+    for (i = 0; i < triNum * 3; i = k) {
+        for (k = i + 1; k < triNum * 3 && edges[k] == edges[i]; k += 1);
+        if (k - i == 1) {
+            s->vertLocked[edges[i] >> 32] = 1;
+            s->vertLocked[edges[i] & 0xFFFFFFFF] = 1;
+        }
+    }
+    /* Lock every vertex at a locked place. */
+    for (v = 0; v < vertNum; v += 1)
+        if (s->vertLocked[places[v]])
+            s->vertLocked[v] = 1;
+    free(table);
+    free(edges);
+    return 0;
+}
+
+/* Helper function for meshInitializeSimplified. Collapses v onto u, updating
+the count of living triangles. Returns 0 on success, non-zero on failure. */
+int meshSimplifierCollapse(
+        meshSimplifier *s, GLuint v, GLuint u, GLuint *aliveTriNum) {
+    GLuint i, k, t;
+    /* Appending to u's list can move the pool, so index it afresh. */
+    for (i = 0; i < s->listNums[v]; i += 1) {
+        t = s->pool[s->lists[v] + i];
+        if (!s->triAlive[t])
+            continue;
+        if (s->tri[t * 3] == u || s->tri[t * 3 + 1] == u ||
+                s->tri[t * 3 + 2] == u) {
+            s->triAlive[t] = 0;
+            *aliveTriNum -= 1;
+        } else {
+            for (k = 0; k < 3; k += 1)
+                if (s->tri[t * 3 + k] == v)
+                    s->tri[t * 3 + k] = u;
+            if (meshSimplifierAppend(s, u, t) != 0)
+                return 1;
+        }
+    }
+    s->vertAlive[v] = 0;
+    vecAdd(meshQUADRICDIM, &s->quadrics[u * meshQUADRICDIM],
+        &s->quadrics[v * meshQUADRICDIM], &s->quadrics[u * meshQUADRICDIM]);
+    return 0;
+}
+
+/* Helper function for meshInitializeSimplified. Reconsiders u, its neighbors,
+and the other vertices at their places, whose costs and validity may have
+changed. Returns 0 on success, non-zero on failure. */
+int meshSimplifierReconsider(meshSimplifier *s, GLuint u) {
+    GLuint i, k, t, w, x;
+    for (i = 0; i < s->listNums[u]; i += 1) {
+        t = s->pool[s->lists[u] + i];
+        if (!s->triAlive[t])
+            continue;
+        for (k = 0; k < 3; k += 1) {
+            w = s->tri[t * 3 + k];
+            x = w;
+            do {
+                if (meshSimplifierConsider(s, x) != 0)
+                    return 1;
+                x = s->siblings[x];
+            } while (x != w);
+        }
+    }
+    return meshSimplifierConsider(s, u);
+}
+
+/* Helper function for meshInitializeSimplified. */
+void meshSimplifierDestroy(meshSimplifier *s) {
+    free(s->tri);
+    free(s->quadrics);
+    free(s->pool);
+    free(s->heap);
+}
+
+/* Initializes mesh to a simplified version of base, with at most targetTriNum
+triangles if possible. The simplification also stops before any collapse that
+would move the surface by more than maxError (in the units of the positions),
+unless maxError is 0.0, in which case there is no limit. Seam and boundary
+vertices move only along their seams, and boundary vertices are kept; see the
+top of this file. If error is not NULL, then *error
+receives the largest error of any collapse performed, which is a reasonable
+bound on how far the simplified surface strays from the original. The base
+mesh must be in interleaved layout. Returns 0 on success. On failure, the mesh
+is not initialized, and the return value says why: 4 if the base isn't
+interleaved, and otherwise memory ran out while setting up (1), locking the
+seams and boundaries (2), queuing collapses (3), making the mesh (5),
+collapsing edges (6), or dropping the deleted vertices (7). Don't forget to
+call meshDestroy when finished. */
+int meshInitializeSimplified(
+        meshMesh *mesh, const meshMesh *base, GLuint targetTriNum,
+        GLdouble maxError, GLdouble *error) {
+    GLuint vertNum = base->vertNum, triNum = base->triNum, i, k, t, v;
+    meshSimplifier s;
+    if (base->streams != NULL) {
+        fprintf(stderr, "error: meshInitializeSimplified: base is not "
+            "interleaved\n");
+        return 4;
+    }
+    memset(&s, 0, sizeof(s));
+    s.base = base;
+    /* One allocation for the triangles and the per-vertex arrays, and one each
+    for the quadrics, list pool, and heap. */
+    s.tri = (GLuint *)malloc((size_t)triNum * 3 * sizeof(GLuint) +
+        (size_t)vertNum * 8 * sizeof(GLuint) + triNum + (size_t)vertNum * 2);
+    s.quadrics = (GLdouble *)calloc((size_t)vertNum * meshQUADRICDIM,
+        sizeof(GLdouble));
+    s.poolCap = triNum * 3 + 4 * vertNum;
+    s.pool = (GLuint *)malloc((size_t)s.poolCap * sizeof(GLuint));
+    if (s.tri == NULL || s.quadrics == NULL || s.pool == NULL) {
+        meshSimplifierDestroy(&s);
+        return 1;
+    }
+    memcpy(s.tri, base->tri, (size_t)triNum * 3 * sizeof(GLuint));
+    s.lists = &s.tri[triNum * 3];
+    s.listNums = &s.lists[vertNum];
+    s.listCaps = &s.listNums[vertNum];
+    s.versions = &s.listCaps[vertNum];
+    s.marks = &s.versions[vertNum];
+    s.places = &s.marks[vertNum];
+    s.siblings = &s.places[vertNum];
+    s.targets = &s.siblings[vertNum];
+    s.triAlive = (GLubyte *)&s.targets[vertNum];
+    s.vertLocked = &s.triAlive[triNum];
+    s.vertAlive = &s.vertLocked[vertNum];
+    memset(s.triAlive, 1, triNum);
+    memset(s.vertLocked, 0, vertNum);
+    memset(s.vertAlive, 1, vertNum);
+    for (v = 0; v < vertNum; v += 1) {
+        s.listNums[v] = 0;
+        s.versions[v] = 0;
+        s.marks[v] = 0;
+    }
+    /* Lay out the lists with exactly the room that they need. */
+    for (i = 0; i < triNum * 3; i += 1)
+        s.listNums[s.tri[i]] += 1;
+    for (v = 0; v < vertNum; v += 1) {
+        s.lists[v] = s.poolNum;
+        s.listCaps[v] = s.listNums[v];
+        s.poolNum += s.listNums[v];
+        s.listNums[v] = 0;
+    }
+    for (t = 0; t < triNum; t += 1) {
+        GLdouble *a = meshGetVertexPointer(base, s.tri[t * 3]);
+        GLdouble *b = meshGetVertexPointer(base, s.tri[t * 3 + 1]);
+        GLdouble *c = meshGetVertexPointer(base, s.tri[t * 3 + 2]);
+        for (k = 0; k < 3; k += 1) {
+            v = s.tri[t * 3 + k];
+            s.pool[s.lists[v] + s.listNums[v]] = t;
+            s.listNums[v] += 1;
+            meshQuadricAddTriangle(&s.quadrics[v * meshQUADRICDIM], a, b, c);
+        }
+    }
+    if (meshSimplifierLock(&s) != 0) {
+        meshSimplifierDestroy(&s);
+        return 2;
+    }
+    for (v = 0; v < vertNum; v += 1)
+        if (meshSimplifierConsider(&s, v) != 0) {
+            meshSimplifierDestroy(&s);
+            return 3;
+        }
+    /* Collapse edges, cheapest first. */
+    GLuint aliveTriNum = triNum, u, w;
+    GLdouble maxDone = 0.0;
+    meshCollapse collapse;
+    while (aliveTriNum > targetTriNum && s.heapNum > 0) {
+        collapse = meshSimplifierPop(&s);
+        v = collapse.v;
+        if (collapse.version != s.versions[v] || !s.vertAlive[v])
+            continue;
+        if (maxError > 0.0 && collapse.error > maxError)
+            break;
+        u = collapse.u;
+        /* Collapses at the other vertices of v's place don't bump v's version,
+        so check the whole place again. */
+        if (!meshSimplifierMatch(&s, v, u)) {
+            if (meshSimplifierConsider(&s, v) != 0) {
+                meshSimplifierDestroy(&s);
+                return 3;
+            }
+            continue;
+        }
+        if (collapse.error > maxDone)
+            maxDone = collapse.error;
+        /* Collapse every living vertex at the place onto its target, and
+        only then reconsider the targets' neighborhoods. */
+        w = v;
+        do {
+            GLuint next = s.siblings[w];
+            if (s.vertAlive[w] && meshSimplifierCollapse(&s, w, s.targets[w],
+                    &aliveTriNum) != 0) {
+                meshSimplifierDestroy(&s);
+                return 6;
+            }
+            w = next;
+        } while (w != v);
+        w = v;
+        do {
+            if (s.targets[w] != vertNum &&
+                    meshSimplifierReconsider(&s, s.targets[w]) != 0) {
+                meshSimplifierDestroy(&s);
+                return 3;
+            }
+            w = s.siblings[w];
+        } while (w != v);
+    }
+    /* Copy out the surviving triangles, then drop the deleted vertices. */
+    if (meshInitialize(mesh, aliveTriNum, vertNum, base->attrDim) != 0) {
+        meshSimplifierDestroy(&s);
+        return 5;
+    }
+    memcpy(mesh->vert, base->vert, (size_t)vertNum * base->attrDim *
+        sizeof(GLdouble));
+    for (t = 0, i = 0; t < triNum; t += 1)
+        if (s.triAlive[t]) {
+            meshSetTriangle(mesh, i, s.tri[t * 3], s.tri[t * 3 + 1],
+                s.tri[t * 3 + 2]);
+            i += 1;
+        }
+    meshSimplifierDestroy(&s);
+    if (meshCompact(mesh, 0, 0.0) != 0) {
+        meshDestroy(mesh);
+        return 7;
+    }
+    if (error != NULL)
+        *error = maxDone;
+    return 0;
+}
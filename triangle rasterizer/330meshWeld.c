@@ -0,0 +1,162 @@
+/*** Compacting meshes ***/
+
+/* Some meshes carry vertices that they don't need. mesh3DInitializeBox
+duplicates vertices on purpose, to get flat shading, but other builders and
+file formats can produce exact duplicates by accident, and a mesh cut from
+another mesh (as in mesh3DInitializeDissectedLandscape) can keep vertices that
+no triangle uses. Every such vertex costs GPU memory and bandwidth. meshCompact
+removes them. */
+
+/* Helper function for meshCompact. Returns the grid cell of a coordinate, for
+welding with tolerance epsilon. */
+int64_t meshWeldCell(GLdouble x, GLdouble epsilon) {
+    return (int64_t)floor(x / epsilon);
+}
+
+/* Helper function for meshCompact. Hashes a vertex. If epsilon is 0.0, the
+hash covers the exact bits of all attrDim attributes. Otherwise, it covers the
+grid cells of the first (up to three) attributes, offset by the cell offsets
+in shift, so that nearby vertices can be found by probing neighboring cells. */
+uint64_t meshWeldHash(
+        const GLdouble *vert, GLuint attrDim, GLdouble epsilon,
+        const int shift[3]) {
+    uint64_t hash = 0xcbf29ce484222325ULL, bits;
+    GLuint k;
+    GLdouble x;
+    if (epsilon == 0.0)
+        for (k = 0; k < attrDim; k += 1) {
+            /* Adding 0.0 turns -0.0 into 0.0, which compares equal to it. */
+            x = vert[k] + 0.0;
+            memcpy(&bits, &x, 8);
+            hash = (hash ^ bits) * 0x100000001b3ULL;
+        }
+    else
+        for (k = 0; k < attrDim && k < 3; k += 1) {
+            bits = (uint64_t)(meshWeldCell(vert[k], epsilon) + shift[k]);
+            hash = (hash ^ bits) * 0x100000001b3ULL;
+        }
+    return hash ^ (hash >> 29);
+}
+
+/* Helper function for meshCompact. Returns 1 if the two vertices match
+exactly (epsilon == 0.0) or within epsilon in every attribute. */
+int meshWeldMatch(
+        const GLdouble *v, const GLdouble *w, GLuint attrDim,
+        GLdouble epsilon) {
+    GLuint k;
+    for (k = 0; k < attrDim; k += 1)
+        if (fabs(v[k] - w[k]) > epsilon)
+            return 0;
+    return 1;
+}
+
+/* Removes the vertices that no triangle uses. If weld is non-zero, then also
+merges vertices that are duplicates: equal in every attribute if epsilon is
+0.0, or within epsilon of each other in every attribute if epsilon > 0.0. (In
+the latter case, the first three attributes are assumed to be XYZ, and are used
+to find candidate duplicates quickly.) Each group of duplicates is replaced by
+its first member. Triangles that become degenerate, by using one vertex twice,
+are removed. The surviving triangles and vertices keep their relative order,
+and the indices are remapped. If the mesh was allocated by meshInitialize, its
+memory shrinks to fit. Returns 0 on success. On failure, returns non-zero and
+leaves the mesh unchanged. The mesh must be in interleaved layout. */
+int meshCompact(meshMesh *mesh, int weld, GLdouble epsilon) {
+    GLuint vertNum = mesh->vertNum, attrDim = mesh->attrDim;
+    GLuint tableSize = 1, i, v, newV, newTriNum = 0;
+    if (mesh->streams != NULL) {
+        fprintf(stderr, "error: meshCompact: mesh is not interleaved\n");
+        return 2;
+    }
+    while (tableSize < 2 * vertNum)
+        tableSize *= 2;
+    GLuint *remap = (GLuint *)malloc(((GLsizeiptr)vertNum +
+        (weld ? tableSize : 0)) * sizeof(GLuint));
+    if (remap == NULL)
+        return 1;
+    /* The hash table holds new vertex indices; vertNum marks empty slots. */
+    GLuint *table = &remap[vertNum];
+    if (weld)
+        for (i = 0; i < tableSize; i += 1)
+            table[i] = vertNum;
+    /* Mark the vertices that are used. */
+    for (v = 0; v < vertNum; v += 1)
+        remap[v] = vertNum;
+    for (i = 0; i < mesh->triNum * 3; i += 1)
+        remap[mesh->tri[i]] = 0;
+    /* Assign new indices in increasing order. Because newV <= v, each vertex
+    can be moved down in place, and each representative's data stays at its
+    new index for later comparisons. */
+    GLuint next = 0;
+    GLdouble *vert;
+    int noShift[3] = {0, 0, 0};
+    for (v = 0; v < vertNum; v += 1) {
+        if (remap[v] == vertNum)
+            continue;
+        vert = meshGetVertexPointer(mesh, v);
+        newV = vertNum;
+        if (weld) {
+            /* Probe the vertex's own cell, and with a tolerance, the 26
+            neighboring cells too. */
+            int shift[3], probeNum = (epsilon > 0.0) ? 27 : 1, p;
+            for (p = 0; p < probeNum && newV == vertNum; p += 1) {
+                shift[0] = (epsilon > 0.0) ? p % 3 - 1 : 0;
+                shift[1] = (epsilon > 0.0) ? (p / 3) % 3 - 1 : 0;
+                shift[2] = (epsilon > 0.0) ? p / 9 - 1 : 0;
+                uint64_t hash = meshWeldHash(vert, attrDim, epsilon, shift);
+                for (i = hash & (tableSize - 1); table[i] != vertNum;
+                        i = (i + 1) & (tableSize - 1))
+                    if (meshWeldMatch(vert, &mesh->vert[(size_t)table[i] *
+                            attrDim], attrDim, epsilon)) {
+                        newV = table[i];
+                        break;
+                    }
+            }
+        }
+        if (newV == vertNum) {
+            newV = next;
+            next += 1;
+            if (newV != v)
+                memmove(&mesh->vert[(size_t)newV * attrDim], vert,
+                    attrDim * sizeof(GLdouble));
+            if (weld) {
+                uint64_t hash = meshWeldHash(&mesh->vert[(size_t)newV *
+                    attrDim], attrDim, epsilon, noShift);
+                for (i = hash & (tableSize - 1); table[i] != vertNum;
+                        i = (i + 1) & (tableSize - 1));
+                table[i] = newV;
+            }
+        }
+        remap[v] = newV;
+    }
+    /* Remap the triangles, dropping degenerate ones. */
+    GLuint a, b, c;
+    for (i = 0; i < mesh->triNum; i += 1) {
+        a = remap[mesh->tri[i * 3]];
+        b = remap[mesh->tri[i * 3 + 1]];
+        c = remap[mesh->tri[i * 3 + 2]];
+        if (a == b || b == c || c == a)
+            continue;
+        mesh->tri[newTriNum * 3] = a;
+        mesh->tri[newTriNum * 3 + 1] = b;
+        mesh->tri[newTriNum * 3 + 2] = c;
+        newTriNum += 1;
+    }
+    free(remap);
+    mesh->triNum = newTriNum;
+    mesh->vertNum = next;
+    /* A mesh from meshInitialize keeps its vertices right after its
+    triangles, in one allocation, so slide them down and shrink. */
+    if (mesh->mapping == NULL) {
+        GLdouble *newVert = (GLdouble *)&(mesh->tri[newTriNum * 3]);
+        memmove(newVert, mesh->vert, (size_t)next * attrDim *
+            sizeof(GLdouble));
+        size_t size = newTriNum * 3 * sizeof(GLuint) +
+            (size_t)next * attrDim * sizeof(GLdouble);
+        /* If realloc fails, the old, larger block is still valid. */
+        GLuint *tri = (size == 0) ? NULL : (GLuint *)realloc(mesh->tri, size);
+        if (tri != NULL)
+            mesh->tri = tri;
+        mesh->vert = (GLdouble *)&(mesh->tri[newTriNum * 3]);
+    }
+    return 0;
+}
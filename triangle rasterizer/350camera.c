@@ -33,8 +33,8 @@ void camLookAt(
     vec3Spherical(1.0, M_PI / 2.0 - phi, theta + M_PI, y);
     mat33BasisRotation(yStd, zStd, y, z, rot);
     isoSetRotation(&(cam->isometry), rot);
-    vecScale(3, rho, z, trans);
-    vecAdd(3, target, trans, trans);
+    vec3Scale(rho, z, trans);
+    vec3Add(target, trans, trans);
     isoSetTranslation(&(cam->isometry), trans);
     /*debug("camLookAt end");*/
 }
@@ -57,6 +57,13 @@ void camLookFrom(
     
 }
 
+/* Sets the camera's isometry from a quaternion isometry, such as one
+interpolated between keyframes with quatSlerpIsometry, for a camera that flies
+along a path. */
+void camSetQuatIsometry(camCamera *cam, const quatIsometry *qIso) {
+    quatGetIsometry(qIso, &(cam->isometry));
+}
+
 
 
 /*** Projections ***/
@@ -229,11 +236,47 @@ void camGetProjectionInverseIsometry(camCamera *cam, GLdouble homog[4][4]) {
     }
     GLdouble camInverseIsom[4][4];
     isoGetInverseHomogeneous(&(cam->isometry), camInverseIsom);
-    mat444Multiply(camProjection,camInverseIsom,homog);
+    simdMat444Multiply(camProjection, camInverseIsom, homog);
     /*debug("camGetProjectionInverseIsometryEnd ");*/
     
 }
 
+#define camPLANEL 0
+#define camPLANER 1
+#define camPLANEB 2
+#define camPLANET 3
+#define camPLANEN 4
+#define camPLANEF 5
+
+/* Fills planes with the six planes bounding the camera's viewing volume, in
+world coordinates, in the order given by the camPLANE constants. Each plane is
+(a, b, c, d), with (a, b, c) a unit vector pointing into the viewing volume, so
+that a * x + b * y + c * z + d is the signed distance from the plane to the
+point (x, y, z), positive inside. Works for both projection types. */
+void camGetFrustumPlanes(const camCamera *cam, GLdouble planes[6][4]) {
+    GLdouble proj[4][4], inverse[4][4], m[4][4], length;
+    GLuint i, k;
+    if (cam->projectionType == camORTHOGRAPHIC)
+        camGetOrthographic(cam, proj);
+    else
+        camGetPerspective(cam, proj);
+    isoGetInverseHomogeneous(&(cam->isometry), inverse);
+    simdMat444Multiply(proj, inverse, m);
+    /* A point is inside when -w <= x, y, z <= w in clip coordinates. Each of
+    those six inequalities is a plane in world coordinates, whose coefficients
+    are sums and differences of rows of m. */
+    for (i = 0; i < 3; i += 1)
+        for (k = 0; k < 4; k += 1) {
+            planes[2 * i][k] = m[3][k] + m[i][k];
+            planes[2 * i + 1][k] = m[3][k] - m[i][k];
+        }
+    for (i = 0; i < 6; i += 1) {
+        length = vec3Length(planes[i]);
+        if (length > 0.0)
+            vec4Scale(1.0 / length, planes[i], planes[i]);
+    }
+}
+
 
 /* Inverse to the matrix produced by camGetPerspective. */
 void camGetInversePerspective(const camCamera *cam, GLdouble proj[4][4]){
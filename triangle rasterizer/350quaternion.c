@@ -0,0 +1,253 @@
+/* This file offers quaternions, and isometries made of a unit quaternion and a
+translation. A quaternion is stored as four numbers q = (x, y, z, w), with the
+vector part first, so that q[0], q[1], q[2] can be passed to the vec3
+functions. A unit quaternion rotates through angle theta about the length-1
+axis u when it is (sin(theta / 2) u, cos(theta / 2)). q and -q are the same
+rotation.
+
+Compared to isoIsometry, a quatIsometry takes 7 numbers instead of 12.
+Composing two of them (quatCompose) takes about 60 flops, against about 110 for
+building two 4x4 matrices and multiplying them, and interpolating between two
+of them (quatSlerp, quatNlerp) is simple and well behaved, whereas
+interpolating rotation matrices isn't. So keep animations, such as keyframes,
+in this form, and hand the result to a node or camera with nodeSetQuatIsometry
+or camSetQuatIsometry. Those convert the rotation to a matrix once, and the
+scene graph then composes each node with its parent as a 3x3 rotation plus a
+translation (isoComposeHomogeneous), which costs about as much as quatCompose;
+only the final world isometry is built as a 4x4 matrix for the shader. */
+
+/* Feel free to read from and write to this struct's members. The rotation
+should have length 1. */
+typedef struct quatIsometry quatIsometry;
+struct quatIsometry {
+    GLdouble rotation[4];
+    GLdouble translation[3];
+};
+
+
+
+/*** Quaternions ***/
+
+/* Multiplies the quaternions q and r. As rotations, qr is r followed by q. The
+output can safely alias the input. */
+void quatMultiply(const GLdouble q[4], const GLdouble r[4], GLdouble qr[4]) {
+    GLdouble x, y, z, w;
+    x = q[3] * r[0] + q[0] * r[3] + q[1] * r[2] - q[2] * r[1];
+    y = q[3] * r[1] - q[0] * r[2] + q[1] * r[3] + q[2] * r[0];
+    z = q[3] * r[2] + q[0] * r[1] - q[1] * r[0] + q[2] * r[3];
+    w = q[3] * r[3] - q[0] * r[0] - q[1] * r[1] - q[2] * r[2];
+    vec4Set(x, y, z, w, qr);
+}
+
+/* Conjugates the quaternion q. For a unit quaternion, the conjugate is the
+inverse rotation. The output can safely alias the input. */
+void quatConjugate(const GLdouble q[4], GLdouble qStar[4]) {
+    vec4Set(-q[0], -q[1], -q[2], q[3], qStar);
+}
+
+/* Given a length-1 3D vector axis and an angle theta (in radians), builds the
+unit quaternion for the rotation about that axis through that angle, as
+mat33AngleAxisRotation does for matrices. */
+void quatAngleAxisRotation(
+        GLdouble theta, const GLdouble axis[3], GLdouble q[4]) {
+    GLdouble s = sin(theta * 0.5);
+    vec4Set(s * axis[0], s * axis[1], s * axis[2], cos(theta * 0.5), q);
+}
+
+/* Rotates the vector v by the unit quaternion q. Computes q v q* as
+v + w t + u x t, where u is q's vector part, w its scalar part, and t = 2 u x v.
+The output can safely alias the input. */
+void quatRotateVector(
+        const GLdouble q[4], const GLdouble v[3], GLdouble qV[3]) {
+    GLdouble t[3], uCrossT[3];
+    vec3Cross(q, v, t);
+    vec3Scale(2.0, t, t);
+    vec3Cross(q, t, uCrossT);
+    qV[0] = v[0] + q[3] * t[0] + uCrossT[0];
+    qV[1] = v[1] + q[3] * t[1] + uCrossT[1];
+    qV[2] = v[2] + q[3] * t[2] + uCrossT[2];
+}
+
+/* Builds the rotation matrix equivalent to the unit quaternion q. */
+void quatGetRotation(const GLdouble q[4], GLdouble rot[3][3]) {
+    GLdouble xx = q[0] * q[0], yy = q[1] * q[1], zz = q[2] * q[2];
+    GLdouble xy = q[0] * q[1], xz = q[0] * q[2], yz = q[1] * q[2];
+    GLdouble wx = q[3] * q[0], wy = q[3] * q[1], wz = q[3] * q[2];
+    rot[0][0] = 1.0 - 2.0 * (yy + zz);
+    rot[0][1] = 2.0 * (xy - wz);
+    rot[0][2] = 2.0 * (xz + wy);
+    rot[1][0] = 2.0 * (xy + wz);
+    rot[1][1] = 1.0 - 2.0 * (xx + zz);
+    rot[1][2] = 2.0 * (yz - wx);
+    rot[2][0] = 2.0 * (xz - wy);
+    rot[2][1] = 2.0 * (yz + wx);
+    rot[2][2] = 1.0 - 2.0 * (xx + yy);
+}
+
+/* Builds the unit quaternion equivalent to the rotation matrix rot. Of the
+four ways to recover it, uses the one that divides by the largest number, so
+that it is accurate for every rotation. */
+void quatSetRotation(const GLdouble rot[3][3], GLdouble q[4]) {
+    GLdouble trace = rot[0][0] + rot[1][1] + rot[2][2], s;
+    if (trace > 0.0) {
+        s = 2.0 * sqrt(1.0 + trace);
+        vec4Set((rot[2][1] - rot[1][2]) / s, (rot[0][2] - rot[2][0]) / s,
+            (rot[1][0] - rot[0][1]) / s, 0.25 * s, q);
+    } else if (rot[0][0] > rot[1][1] && rot[0][0] > rot[2][2]) {
+        s = 2.0 * sqrt(1.0 + rot[0][0] - rot[1][1] - rot[2][2]);
+        vec4Set(0.25 * s, (rot[0][1] + rot[1][0]) / s,
+            (rot[0][2] + rot[2][0]) / s, (rot[2][1] - rot[1][2]) / s, q);
+    } else if (rot[1][1] > rot[2][2]) {
+        s = 2.0 * sqrt(1.0 + rot[1][1] - rot[0][0] - rot[2][2]);
+        vec4Set((rot[0][1] + rot[1][0]) / s, 0.25 * s,
+            (rot[1][2] + rot[2][1]) / s, (rot[0][2] - rot[2][0]) / s, q);
+    } else {
+        s = 2.0 * sqrt(1.0 + rot[2][2] - rot[0][0] - rot[1][1]);
+        vec4Set((rot[0][2] + rot[2][0]) / s, (rot[1][2] + rot[2][1]) / s,
+            0.25 * s, (rot[1][0] - rot[0][1]) / s, q);
+    }
+    vec4Unit(q, q);
+}
+
+/* Helper function for quatNlerp and quatSlerp. Returns the cosine of the angle
+between q and r, and puts into rNear whichever of r and -r is closer to q, so
+that the interpolation takes the shorter way around. */
+GLdouble quatGetNearer(
+        const GLdouble q[4], const GLdouble r[4], GLdouble rNear[4]) {
+    GLdouble dot = vec4Dot(q, r);
+    if (dot < 0.0) {
+        vec4Scale(-1.0, r, rNear);
+        return -dot;
+    }
+    vec4Copy(r, rNear);
+    return dot;
+}
+
+/* Interpolates between the unit quaternions q (at t = 0) and r (at t = 1) by
+blending them linearly and normalizing. Cheaper than quatSlerp, and the same
+path, but not at constant speed; the difference is slight when q and r are
+within a few tens of degrees, as keyframes usually are. The output can safely
+alias the input. */
+void quatNlerp(
+        const GLdouble q[4], const GLdouble r[4], GLdouble t,
+        GLdouble qr[4]) {
+    GLdouble rNear[4];
+    quatGetNearer(q, r, rNear);
+    qr[0] = q[0] + t * (rNear[0] - q[0]);
+    qr[1] = q[1] + t * (rNear[1] - q[1]);
+    qr[2] = q[2] + t * (rNear[2] - q[2]);
+    qr[3] = q[3] + t * (rNear[3] - q[3]);
+    vec4Unit(qr, qr);
+}
+
+/* Interpolates between the unit quaternions q (at t = 0) and r (at t = 1)
+along the shorter great arc, at constant angular speed. When q and r are very
+close, falls back to quatNlerp, which agrees with it there and doesn't divide
+by a tiny sine. The output can safely alias the input. */
+void quatSlerp(
+        const GLdouble q[4], const GLdouble r[4], GLdouble t,
+        GLdouble qr[4]) {
+    GLdouble rNear[4], angle, sine, a, b;
+    GLdouble dot = quatGetNearer(q, r, rNear);
+    if (dot > 0.9995) {
+        quatNlerp(q, rNear, t, qr);
+        return;
+    }
+    angle = acos(dot);
+    sine = sin(angle);
+    a = sin((1.0 - t) * angle) / sine;
+    b = sin(t * angle) / sine;
+    qr[0] = a * q[0] + b * rNear[0];
+    qr[1] = a * q[1] + b * rNear[1];
+    qr[2] = a * q[2] + b * rNear[2];
+    qr[3] = a * q[3] + b * rNear[3];
+}
+
+
+
+/*** Isometries ***/
+
+/* Sets the quaternion isometry to the rotation and translation of iso. */
+void quatSetIsometry(quatIsometry *qIso, const isoIsometry *iso) {
+    quatSetRotation(iso->rotation, qIso->rotation);
+    vec3Copy(iso->translation, qIso->translation);
+}
+
+/* Sets iso to the rotation and translation of the quaternion isometry, through
+its setters, so that its version is bumped. */
+void quatGetIsometry(const quatIsometry *qIso, isoIsometry *iso) {
+    GLdouble rot[3][3];
+    quatGetRotation(qIso->rotation, rot);
+    isoSetRotation(iso, rot);
+    isoSetTranslation(iso, qIso->translation);
+}
+
+/* Fills homog with the homogeneous version of the isometry, as
+isoGetHomogeneous does. */
+void quatGetHomogeneous(const quatIsometry *qIso, GLdouble homog[4][4]) {
+    GLdouble rot[3][3];
+    quatGetRotation(qIso->rotation, rot);
+    mat44Isometry(rot, qIso->translation, homog);
+}
+
+/* Composes the isometries, so that ab is b followed by a, just as the matrix
+product of their homogeneous versions is. The output can safely alias the
+input. */
+void quatCompose(
+        const quatIsometry *a, const quatIsometry *b, quatIsometry *ab) {
+    GLdouble transl[3];
+    quatRotateVector(a->rotation, b->translation, transl);
+    vec3Add(transl, a->translation, ab->translation);
+    quatMultiply(a->rotation, b->rotation, ab->rotation);
+}
+
+/* Inverts the isometry, so that composing it with its inverse in either order
+gives the identity. The output can safely alias the input. */
+void quatInvert(const quatIsometry *qIso, quatIsometry *qIsoInv) {
+    quatConjugate(qIso->rotation, qIsoInv->rotation);
+    quatRotateVector(qIsoInv->rotation, qIso->translation,
+        qIsoInv->translation);
+    vec3Scale(-1.0, qIsoInv->translation, qIsoInv->translation);
+}
+
+/* Applies the rotation and translation to a point. The output can safely alias
+the input. */
+void quatTransformPoint(
+        const quatIsometry *qIso, const GLdouble p[3], GLdouble qIsoP[3]) {
+    quatRotateVector(qIso->rotation, p, qIsoP);
+    vec3Add(qIsoP, qIso->translation, qIsoP);
+}
+
+/* Applies the inverse of the isometry to a point. The output can safely alias
+the input. */
+void quatUntransformPoint(
+        const quatIsometry *qIso, const GLdouble qIsoP[3], GLdouble p[3]) {
+    GLdouble qStar[4];
+    quatConjugate(qIso->rotation, qStar);
+    vec3Subtract(qIsoP, qIso->translation, p);
+    quatRotateVector(qStar, p, p);
+}
+
+/* Interpolates between the isometries a (at t = 0) and b (at t = 1), blending
+the translations linearly and the rotations with quatSlerp. The output can
+safely alias the input. */
+void quatSlerpIsometry(
+        const quatIsometry *a, const quatIsometry *b, GLdouble t,
+        quatIsometry *ab) {
+    GLuint i;
+    for (i = 0; i < 3; i += 1)
+        ab->translation[i] = a->translation[i] + t * (b->translation[i] -
+            a->translation[i]);
+    quatSlerp(a->rotation, b->rotation, t, ab->rotation);
+}
+
+/* Like quatSlerpIsometry, but with quatNlerp for the rotations. */
+void quatNlerpIsometry(
+        const quatIsometry *a, const quatIsometry *b, GLdouble t,
+        quatIsometry *ab) {
+    GLuint i;
+    for (i = 0; i < 3; i += 1)
+        ab->translation[i] = a->translation[i] + t * (b->translation[i] -
+            a->translation[i]);
+    quatNlerp(a->rotation, b->rotation, t, ab->rotation);
+}
@@ -19,7 +19,7 @@ and bottomTop should be one of GL_CLAMP_TO_EDGE, GL_REPEAT, etc. */
 void texSetFilteringBorder(
         texTexture *tex, GLint minification, GLint magnification,
         GLint leftRight, GLint bottomTop) {
-    glBindTexture(GL_TEXTURE_2D, tex->texture);
+    shaBindTexture(0, tex->texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minification);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magnification);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, leftRight);
@@ -50,9 +50,10 @@ int texInitializeSolid(
     if (glGetError() != GL_NO_ERROR) {
         fprintf(stderr, "error: texInitializeSolid: OpenGL error.\n");
         glDeleteTextures(1, &(tex->texture));
+        shaForgetTexture(tex->texture);
         return 3;
     }
-    glBindTexture(GL_TEXTURE_2D, 0);
+    shaBindTexture(0, 0);
     tex->width = 1;
     tex->height = 1;
     tex->texelDim = texelDim;
@@ -92,9 +93,10 @@ int texInitializeFile(
     if (glGetError() != GL_NO_ERROR) {
         fprintf(stderr, "error: texInitializeFile: OpenGL error.\n");
         glDeleteTextures(1, &(tex->texture));
+        shaForgetTexture(tex->texture);
         return 3;
     }
-    glBindTexture(GL_TEXTURE_2D, 0);
+    shaBindTexture(0, 0);
     tex->width = width;
     tex->height = height;
     tex->texelDim = texelDim;
@@ -104,25 +106,25 @@ int texInitializeFile(
 /* Deallocates the resources backing the texture. */
 void texDestroy(texTexture *tex) {
     glDeleteTextures(1, &(tex->texture));
+    shaForgetTexture(tex->texture);
 }
 
 /* At the start of rendering a frame, the renderer calls this function, to hook
 the texture into a certain texture unit. textureUnit is something like
-GL_TEXTURE0. textureUnitIndex would then be 0. */
+GL_TEXTURE0. textureUnitIndex would then be 0. (There is no glEnable of
+GL_TEXTURE_2D, which is fixed-function state and an error in the core profile.)
+The bind and the uniform are skipped if they would change nothing. To avoid
+redundant binds across many meshes, see queSubmit. */
 void texRender(
         const texTexture *tex, GLenum textureUnit, GLint textureUnitIndex,
         GLint textureLoc) {
-    glActiveTexture(textureUnit);
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, tex->texture);
-    glUniform1i(textureLoc, textureUnitIndex);
+    shaBindTexture(textureUnit - GL_TEXTURE0, tex->texture);
+    shaSetUniform1i(textureUnitIndex, textureLoc);
 }
 
 /* At the end of rendering a frame, the renderer calls this function, to unhook
 the texture from a certain texture unit. textureUnit is something like
 GL_TEXTURE0. */
 void texUnrender(const texTexture *tex, GLenum textureUnit) {
-    glActiveTexture(textureUnit);
-    glDisable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    shaBindTexture(textureUnit - GL_TEXTURE0, 0);
 }
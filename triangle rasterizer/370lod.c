@@ -0,0 +1,119 @@
+/*** Levels of detail ***/
+
+/* A LOD chain holds several OpenGL versions of one mesh, from the full mesh
+(level 0) down to coarse simplifications of it. Each level records how far its
+surface may stray from the original, in modeling units. When the chain is drawn,
+that geometric error is projected onto the screen, and the coarsest level whose
+error covers no more than a given number of pixels is used. So distant objects
+are drawn with far fewer triangles, with no visible difference. */
+
+#define lodMAXLEVELS 8
+
+/* Feel free to read from this struct's members, but don't write to them. */
+typedef struct lodChain lodChain;
+struct lodChain {
+    GLuint levelNum;
+    meshGLMesh levels[lodMAXLEVELS];
+    GLdouble errors[lodMAXLEVELS];
+    GLdouble center[3];
+};
+
+/* Initializes a LOD chain from a base mesh. Level 0 is the base mesh itself.
+Each further level is simplified from the one before it, to about ratio
+(e.g. 0.25) times as many triangles, until levelNum levels are made or
+simplification stops making progress. The attributes are encoded and configured
+as in meshGLInitializeFormatted. The base mesh must be in interleaved layout.
+Returns 0 on success, non-zero on failure. Don't forget to call lodDestroy when
+finished. */
+int lodInitialize(
+        lodChain *lod, const meshMesh *base, GLuint levelNum, GLdouble ratio,
+        GLuint attrNum, const meshGLAttribute attrs[]) {
+    GLuint i;
+    GLdouble lower[3], upper[3], error;
+    if (levelNum > lodMAXLEVELS)
+        levelNum = lodMAXLEVELS;
+    /* The center of the bounding box stands for the whole mesh when measuring
+    distance from the camera. */
+    meshGetBounds(base, 0, 3, lower, upper);
+    vec3Add(lower, upper, lod->center);
+    vec3Scale(0.5, lod->center, lod->center);
+    if (meshGLInitializeFormatted(&lod->levels[0], base, attrNum, attrs) != 0)
+        return 1;
+    lod->errors[0] = 0.0;
+    lod->levelNum = 1;
+    /* finer is the last level made. Only after the first step do we own it. */
+    meshMesh coarser, finer = *base;
+    for (i = 1; i < levelNum; i += 1) {
+        if (meshInitializeSimplified(&coarser, &finer,
+                (GLuint)(finer.triNum * ratio), 0.0, &error) != 0)
+            break;
+        if (i > 1)
+            meshDestroy(&finer);
+        finer = coarser;
+        /* Stop once seams and boundaries keep the mesh from shrinking. */
+        if (coarser.triNum > 0.9 * lod->levels[i - 1].triNum ||
+                meshGLInitializeFormatted(&lod->levels[i], &coarser, attrNum,
+                    attrs) != 0) {
+            i += 1;
+            break;
+        }
+        /* Errors accumulate, because each level approximates the last. */
+        lod->errors[i] = lod->errors[i - 1] + error;
+        lod->levelNum += 1;
+    }
+    if (i > 1)
+        meshDestroy(&finer);
+    return 0;
+}
+
+/* Releases the resources backing the chain's OpenGL meshes. */
+void lodDestroy(lodChain *lod) {
+    GLuint i;
+    for (i = 0; i < lod->levelNum; i += 1)
+        meshGLDestroy(&lod->levels[i]);
+}
+
+/* What the renderer needs to know to choose levels of detail: the camera, the
+height of its viewport in pixels, and how many pixels of error to tolerate (1.0
+is a good default). Build one per frame, and pass it to nodeRender and its
+relatives. The camera is not copied. */
+typedef struct lodView lodView;
+struct lodView {
+    const camCamera *camera;
+    GLdouble viewportHeight, pixelError;
+};
+
+/* Returns the level to draw, for a chain placed in the world by the modeling
+isometry and viewed by the camera into a viewport viewportHeight pixels tall.
+That is the coarsest level whose error, projected onto the screen, is at most
+pixelError pixels. */
+GLuint lodSelectLevel(
+        const lodChain *lod, const camCamera *cam,
+        const GLdouble modeling[4][4], GLdouble viewportHeight,
+        GLdouble pixelError) {
+    GLdouble height = cam->projection[camPROJT] - cam->projection[camPROJB];
+    GLdouble pixelsPerUnit, world[3], toCenter[3], depth;
+    GLuint i, k;
+    if (cam->projectionType == camPERSPECTIVE) {
+        /* The depth of the center along the camera's sight direction, which
+        is its negative local Z-axis. */
+        for (k = 0; k < 3; k += 1)
+            world[k] = modeling[k][0] * lod->center[0] + modeling[k][1] *
+                lod->center[1] + modeling[k][2] * lod->center[2] +
+                modeling[k][3];
+        vec3Subtract(world, cam->isometry.translation, toCenter);
+        depth = -(toCenter[0] * cam->isometry.rotation[0][2] + toCenter[1] *
+            cam->isometry.rotation[1][2] + toCenter[2] *
+            cam->isometry.rotation[2][2]);
+        if (depth <= -cam->projection[camPROJN])
+            return 0;
+        /* At depth, the viewing frustum is height * depth / -near tall. */
+        pixelsPerUnit = viewportHeight * -cam->projection[camPROJN] /
+            (height * depth);
+    } else
+        pixelsPerUnit = viewportHeight / height;
+    for (i = lod->levelNum - 1; i > 0; i -= 1)
+        if (lod->errors[i] * pixelsPerUnit <= pixelError)
+            return i;
+    return 0;
+}
@@ -0,0 +1,349 @@
+/* Checks that meshes drawn from a mesh pool through a draw queue look exactly
+like the same meshes drawn one by one from their own buffers. It renders a
+grid of boxes, each its own mesh and each drawn twice, once directly, and then
+from a pool with a plain program (one glMultiDrawElementsBaseVertex per run)
+and an instanced program (glMultiDrawElementsIndirect if OpenGL 4.3 is
+available, and one glDrawElementsInstancedBaseVertex per mesh regardless), and
+compares the pixels. It needs only OpenGL 3.3 core, and runs without a display
+on Mesa's software renderer. On Linux, compile with...
+    clang 370mainPoolTest.c /usr/local/gl3w/src/gl3w.o -lglfw -lGL -lm -lpthread -ldl
+...and run with...
+    LIBGL_ALWAYS_SOFTWARE=1 xvfb-run -a ./a.out
+It prints PASS or FAIL for each path, and exits with 0 only if all pass. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <GL/gl3w.h>
+#include <GLFW/glfw3.h>
+
+#include "310vector.c"
+#include "310matrix.c"
+#include "310simd.c"
+#include "310parallel.c"
+#include "310simdBatch.c"
+#include "310shading.c"
+#include "330mesh.c"
+#include "330meshWeld.c"
+#include "330mesh3D.c"
+#include "330meshGL.c"
+#include "330meshGLFormat.c"
+#include "330meshGLPool.c"
+#include "360texture.c"
+#include "350isometry.c"
+#include "350quaternion.c"
+#include "350camera.c"
+#include "370queue.c"
+
+#define WIDTH 128
+#define HEIGHT 128
+#define GRID 4
+#define MESHNUM (GRID * GRID)
+
+/* The color is a function of the world position, so that a box drawn with the
+wrong mesh or the wrong modeling matrix shows up in the pixels. */
+const GLchar vertexCode[] =
+    "#version 330\n"
+    "uniform mat4 modeling;"
+    "layout(location = 0) in vec3 xyz;"
+    "out vec3 world;"
+    "void main() {"
+    "    vec4 position = modeling * vec4(xyz, 1.0);"
+    "    gl_Position = position;"
+    "    world = position.xyz;"
+    "}";
+const GLchar fragmentCode[] =
+    "#version 330\n"
+    "in vec3 world;"
+    "out vec4 fragColor;"
+    "void main() {"
+    "    fragColor = vec4(0.5 + 0.5 * world, 1.0);"
+    "}";
+
+GLuint plainProgram, instancedProgram;
+GLint modelingLoc;
+meshGLMesh ownMeshes[MESHNUM], pooledMeshes[MESHNUM];
+meshGLPool pool;
+queQueue queue;
+
+/* Each mesh is drawn at identity in the left half of the window, and shifted
+into the right half. */
+GLdouble modelings[2][4][4] = {
+    {{1.0, 0.0, 0.0, 0.0}, {0.0, 1.0, 0.0, 0.0}, {0.0, 0.0, 1.0, 0.0},
+        {0.0, 0.0, 0.0, 1.0}},
+    {{1.0, 0.0, 0.0, 1.0}, {0.0, 1.0, 0.0, 0.0}, {0.0, 0.0, 1.0, 0.0},
+        {0.0, 0.0, 0.0, 1.0}}};
+
+int initializeShaders(void) {
+    plainProgram = shaMakeProgram(vertexCode, fragmentCode);
+    if (plainProgram == 0)
+        return 1;
+    modelingLoc = glGetUniformLocation(plainProgram, "modeling");
+    GLchar *instancedCode = queMakeInstancedCode(vertexCode, "modeling", 0,
+        NULL);
+    if (instancedCode == NULL) {
+        glDeleteProgram(plainProgram);
+        return 2;
+    }
+    instancedProgram = shaMakeProgram(instancedCode, fragmentCode);
+    free(instancedCode);
+    if (instancedProgram == 0) {
+        glDeleteProgram(plainProgram);
+        return 3;
+    }
+    return 0;
+}
+
+void destroyShaders(void) {
+    glDeleteProgram(instancedProgram);
+    glDeleteProgram(plainProgram);
+}
+
+/* Makes each box twice, once with its own buffers and once in the pool. The
+boxes differ in size as well as place, so that no two meshes coincide. */
+int initializeMeshes(void) {
+    meshGLAttribute attr = {0, 0, 3, meshGLFLOAT};
+    meshMesh base;
+    GLuint i, j;
+    if (meshGLPoolInitialize(&pool, 1, &attr, GL_UNSIGNED_SHORT, 0, 0) != 0)
+        return 1;
+    for (i = 0; i < MESHNUM; i += 1) {
+        GLdouble left = -0.95 + 0.24 * (i % GRID);
+        GLdouble bottom = -0.95 + 0.48 * (i / GRID);
+        GLdouble size = 0.1 + 0.01 * i;
+        if (mesh3DInitializeBox(&base, left, left + size, bottom,
+                bottom + 2.0 * size, -0.5, 0.5) != 0)
+            break;
+        if (meshGLInitializeFormatted(&ownMeshes[i], &base, 1, &attr) != 0) {
+            meshDestroy(&base);
+            break;
+        }
+        if (meshGLPoolAdd(&pool, &pooledMeshes[i], &base) != 0) {
+            meshGLDestroy(&ownMeshes[i]);
+            meshDestroy(&base);
+            break;
+        }
+        meshDestroy(&base);
+    }
+    if (i == MESHNUM)
+        return 0;
+    for (j = 0; j < i; j += 1) {
+        meshGLPoolRemove(&pool, &pooledMeshes[j]);
+        meshGLDestroy(&ownMeshes[j]);
+    }
+    meshGLPoolDestroy(&pool);
+    return 2;
+}
+
+void destroyMeshes(void) {
+    GLuint i;
+    for (i = 0; i < MESHNUM; i += 1) {
+        meshGLPoolRemove(&pool, &pooledMeshes[i]);
+        meshGLDestroy(&ownMeshes[i]);
+    }
+    meshGLPoolDestroy(&pool);
+}
+
+/* Draws every mesh from its own buffers, one uniform and one draw at a time.
+*/
+void renderDirect(void) {
+    GLuint i, k;
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    shaUseProgram(plainProgram);
+    for (k = 0; k < 2; k += 1)
+        for (i = 0; i < MESHNUM; i += 1) {
+            shaSetUniform44(modelings[k], modelingLoc);
+            meshGLRender(&ownMeshes[i]);
+        }
+}
+
+/* Draws every pooled mesh through the queue, with the plain or the instanced
+program. The items are added in an order that the sort must undo. */
+void renderQueued(int instanced) {
+    GLuint i, k;
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    queClear(&queue);
+    if (instanced)
+        queSetInstancedProgram(&queue, instancedProgram, 0, NULL);
+    else
+        queSetProgram(&queue, plainProgram, modelingLoc, NULL, NULL);
+    for (i = MESHNUM; i > 0; i -= 1)
+        for (k = 0; k < 2; k += 1)
+            queAdd(&queue, &pooledMeshes[(i * 7) % MESHNUM], 0, NULL, 0, NULL,
+                modelings[k], NULL);
+    queSubmit(&queue);
+}
+
+/* The meshes are drawn offscreen, into a framebuffer of our own, because the
+pixels of an invisible window's framebuffer may not be defined. */
+GLuint framebuffer, renderbuffers[2];
+
+int initializeFramebuffer(void) {
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, WIDTH,
+        HEIGHT);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_RENDERBUFFER, renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_RENDERBUFFER, renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+            GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "initializeFramebuffer: incomplete framebuffer\n");
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(2, renderbuffers);
+        return 1;
+    }
+    glViewport(0, 0, WIDTH, HEIGHT);
+    return 0;
+}
+
+void destroyFramebuffer(void) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(2, renderbuffers);
+}
+
+/* Reads the framebuffer into pixels, which has room for WIDTH * HEIGHT RGBA
+pixels. */
+void readPixels(GLubyte *pixels) {
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
+/* Compares the pixels to the reference, allowing each channel to differ by 1
+for rounding, and prints the outcome. Returns 0 if they match, 1 if not. */
+int comparePixels(
+        const char *name, const GLubyte *pixels, const GLubyte *reference) {
+    GLuint i, bad = 0;
+    for (i = 0; i < WIDTH * HEIGHT * 4; i += 1)
+        if (abs((int)pixels[i] - (int)reference[i]) > 1)
+            bad += 1;
+    printf("%s: %s (%u bad channels, %u draws)\n", bad == 0 ? "PASS" : "FAIL",
+        name, bad, queue.drawNum);
+    return (bad == 0) ? 0 : 1;
+}
+
+void handleError(int error, const char *description) {
+    fprintf(stderr, "handleError: %d\n%s\n", error, description);
+}
+
+GLFWwindow *initializeWindow(int width, int height, const char *name) {
+    glfwSetErrorCallback(handleError);
+    if (glfwInit() == 0) {
+        fprintf(stderr, "initializeWindow: glfwInit failed.\n");
+        return NULL;
+    }
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *window;
+    window = glfwCreateWindow(width, height, name, NULL, NULL);
+    if (window == NULL) {
+        fprintf(stderr, "initializeWindow: glfwCreateWindow failed.\n");
+        glfwTerminate();
+        return NULL;
+    }
+    glfwMakeContextCurrent(window);
+    if (gl3wInit() != 0) {
+        fprintf(stderr, "initializeWindow: gl3wInit failed.\n");
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return NULL;
+    }
+    fprintf(stderr, "initializeWindow: using OpenGL %s on %s.\n",
+        glGetString(GL_VERSION), glGetString(GL_RENDERER));
+    return window;
+}
+
+void destroyWindow(GLFWwindow *window) {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+}
+
+int main(void) {
+    GLFWwindow *window = initializeWindow(WIDTH, HEIGHT, "370mainPoolTest");
+    if (window == NULL)
+        return 1;
+    if (initializeFramebuffer() != 0) {
+        destroyWindow(window);
+        return 2;
+    }
+    glEnable(GL_DEPTH_TEST);
+    if (initializeShaders() != 0) {
+        destroyFramebuffer();
+        destroyWindow(window);
+        return 3;
+    }
+    if (initializeMeshes() != 0) {
+        destroyShaders();
+        destroyFramebuffer();
+        destroyWindow(window);
+        return 4;
+    }
+    if (queInitialize(&queue, 2 * MESHNUM) != 0) {
+        destroyMeshes();
+        destroyShaders();
+        destroyFramebuffer();
+        destroyWindow(window);
+        return 5;
+    }
+    GLubyte *reference = (GLubyte *)malloc(2 * WIDTH * HEIGHT * 4);
+    if (reference == NULL) {
+        queDestroy(&queue);
+        destroyMeshes();
+        destroyShaders();
+        destroyFramebuffer();
+        destroyWindow(window);
+        return 6;
+    }
+    GLubyte *pixels = &reference[WIDTH * HEIGHT * 4];
+    int failed = 0;
+    renderDirect();
+    readPixels(reference);
+    renderQueued(0);
+    readPixels(pixels);
+    failed |= comparePixels("pooled, plain program", pixels, reference);
+    /* The queue decides once whether to draw indirectly. Overriding that is
+    fine here, to test the fallback on the same context. */
+    GLuint indirect = queue.indirect;
+    if (indirect) {
+        renderQueued(1);
+        readPixels(pixels);
+        failed |= comparePixels("pooled, instanced, indirect", pixels,
+            reference);
+    } else
+        printf("SKIP: pooled, instanced, indirect (needs OpenGL 4.3)\n");
+    queue.indirect = 0;
+    renderQueued(1);
+    readPixels(pixels);
+    failed |= comparePixels("pooled, instanced, one draw per mesh", pixels,
+        reference);
+    queue.indirect = indirect;
+    if (glGetError() != GL_NO_ERROR) {
+        printf("FAIL: OpenGL error\n");
+        failed = 1;
+    }
+    free(reference);
+    queDestroy(&queue);
+    destroyMeshes();
+    destroyShaders();
+    destroyFramebuffer();
+    destroyWindow(window);
+    return failed;
+}
@@ -1,15 +1,28 @@
 
 
 /* Feel free to read from this struct's members. Write to the isometry through
-its accessors. Write to the other members only through the accessors here. */
+its accessors. Write to the other members only through the accessors here. The
+world isometry from the last nodeRender is cached, in double form and in the
+float form sent to the shader, along with the isometry version and parent it was
+computed from. So is a bounding sphere, in world coordinates, around the meshes
+of the node and all of its descendants, along with the bounds version of the
+node's own mesh (see meshGLMesh) that it was computed from; a negative radius
+means that there are no meshes. shading is the node's own shader variant, or
+NULL to use the caller's program (see nodeSetShading). */
 typedef struct nodeNode nodeNode;
 struct nodeNode {
     const meshGLMesh *mesh;
+    const lodChain *lod;
+    const shaShading *shading;
     nodeNode *child, *sibling;
     isoIsometry isometry;
     GLuint auxNum, texNum;
     GLdouble *auxiliaries;
     const texTexture **textures;
+    GLuint cached, cachedVersion, cachedBoundsVersion;
+    GLdouble cachedParent[4][4], world[4][4];
+    GLfloat worldFloat[4][4];
+    GLdouble boundCenter[3], boundRadius;
 };
 
 /* Initializes a scene graph node with the given data. Uniforms are assumed to
@@ -24,10 +37,15 @@ int nodeInitialize(
         nodeNode *node, const meshGLMesh *mesh, GLuint auxNum, GLuint texNum,
         const nodeNode *child, const nodeNode *sibling) {
     node->mesh = mesh;
+    node->lod = NULL;
+    node->shading = NULL;
     node->child = (nodeNode *)child;
     node->sibling = (nodeNode *)sibling;
     double rotation[3][3] = {{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 1.0}};
     double translation[3] = {0.0, 0.0, 0.0};
+    node->isometry.version = 0;
+    node->cached = 0;
+    node->boundRadius = -1.0;
     isoSetRotation(&(node->isometry), rotation);
     isoSetTranslation(&(node->isometry), translation);
     if (mesh == NULL) {
@@ -60,14 +78,147 @@ void nodeDestroy(nodeNode *node) {
     node->sibling = NULL;
 }
 
+/* Helper function for nodeSetChild and nodeSetSibling. A node that moves in the
+tree gets a new parent, so its cached world isometry (and those of its younger
+siblings, which move with it) can no longer be trusted. */
+void nodeInvalidate(nodeNode *node) {
+    for (; node != NULL; node = node->sibling)
+        node->cached = 0;
+}
+
+/* Tells nodeRender to recompute the node's cached world isometry and bounds.
+Changes to the isometry, and to the bounds of the node's mesh through
+meshGLSetBounds or meshGLGrowBounds (as in meshGLLandscapeUpdate and
+meshGLStreamUpdate), are noticed automatically, so this is needed only after
+writing to the mesh's bounds directly. */
+void nodeSetDirty(nodeNode *node) {
+    node->cached = 0;
+}
+
 /* Sets the node's first-child node. Can be NULL. */
 void nodeSetChild(nodeNode *node, const nodeNode *child) {
     node->child = (nodeNode *)child;
+    nodeInvalidate(node->child);
 }
 
 /* Sets the node's next-sibling node. Can be NULL. */
 void nodeSetSibling(nodeNode *node, const nodeNode *sibling) {
     node->sibling = (nodeNode *)sibling;
+    nodeInvalidate(node->sibling);
+}
+
+/* Sets the node's isometry from a quaternion isometry, such as one interpolated
+between keyframes with quatSlerpIsometry. The rotation is converted to a matrix
+once here, so that nodeUpdate composes it with its parent's as 3x3 matrices
+plus a translation, which costs about what quatCompose does. */
+void nodeSetQuatIsometry(nodeNode *node, const quatIsometry *qIso) {
+    quatGetIsometry(qIso, &(node->isometry));
+}
+
+/* Gives the node a LOD chain, or takes it away if lod is NULL. While the node
+has a chain, it draws whichever level of the chain suits its distance from the
+camera of the lodView passed to nodeRender (or nodeEnqueue, or nodeFlatRender),
+instead of its mesh. The node must have been initialized with a non-NULL mesh,
+such as &(lod->levels[0]), which is also drawn when no view is passed. */
+void nodeSetLOD(nodeNode *node, const lodChain *lod) {
+    if (node->mesh != NULL)
+        node->lod = lod;
+}
+
+/* Where nodes with their own shading find their uniform locations: the indices,
+into the shading's unifLocs, of the modeling isometry, the first auxiliary, and
+the first texture (the others following in order). Set with
+nodeSetShadingLayout. */
+int nodeModelingIndex = -1, nodeAuxIndex = -1, nodeTexIndex = -1;
+
+/* Gives the node its own shading, typically a variant from shaVariantsGet,
+which is used instead of the caller's program to draw the node's mesh (but not
+its descendants). Pass NULL to use the caller's program again. The shading is
+not copied. For nodeRender and nodeFlatRender, the caller's program must have
+been made current with shaUseProgram, so that it can be restored after such
+nodes. With nodeEnqueue, a shading without the modeling uniform is taken to be
+instanced (see queMakeInstancedCode), with the node's auxNum auxiliaries. */
+void nodeSetShading(nodeNode *node, const shaShading *sha) {
+    node->shading = sha;
+}
+
+/* Sets the layout of uniforms shared by every shading given to nodes with
+nodeSetShading, as indices into their unifLocs. Pass -1 for uniforms that the
+shadings don't have. Variants from one shaVariants all share the layout of its
+unifNames. */
+void nodeSetShadingLayout(int modelingIndex, int auxIndex, int texIndex) {
+    nodeModelingIndex = modelingIndex;
+    nodeAuxIndex = auxIndex;
+    nodeTexIndex = texIndex;
+}
+
+/* Helper function for nodeRenderTree and nodeFlatRender. If the node has its
+own shading, then makes it current and replaces the locations with its own.
+Otherwise makes the caller's program current again, if that is known. */
+void nodeSelectShading(
+        const nodeNode *node, GLuint program, GLint *modelingLoc,
+        GLint **auxLocs, GLint **texLocs) {
+    const shaShading *sha = node->shading;
+    if (sha == NULL) {
+        if (program != shaUNKNOWN)
+            shaUseProgram(program);
+        return;
+    }
+    shaUseProgram(sha->program);
+    *modelingLoc = (nodeModelingIndex < 0) ? -1 :
+        sha->unifLocs[nodeModelingIndex];
+    *auxLocs = (nodeAuxIndex < 0) ? NULL : &(sha->unifLocs[nodeAuxIndex]);
+    *texLocs = (nodeTexIndex < 0) ? NULL : &(sha->unifLocs[nodeTexIndex]);
+}
+
+/* Helper function for nodeRenderTree. Makes the node's own shading the queue's
+current program, adding it to the queue if it hasn't been used this frame.
+Returns 0 on success, non-zero on failure. */
+int nodeSelectQueueShading(const nodeNode *node, queQueue *queue) {
+    const shaShading *sha = node->shading;
+    if (queSelectProgram(queue, sha->program) == 0)
+        return 0;
+    GLint *texLocs = (nodeTexIndex < 0) ? NULL :
+        &(sha->unifLocs[nodeTexIndex]);
+    if (nodeModelingIndex >= 0 && sha->unifLocs[nodeModelingIndex] != -1)
+        return queSetProgram(queue, sha->program,
+            sha->unifLocs[nodeModelingIndex], (nodeAuxIndex < 0) ? NULL :
+            &(sha->unifLocs[nodeAuxIndex]), texLocs);
+    return queSetInstancedProgram(queue, sha->program, node->auxNum,
+        texLocs);
+}
+
+/* The camera whose viewing volume nodeRender culls against. Set with
+nodeSetCullingCamera. */
+const camCamera *nodeCullCamera = NULL;
+
+/* Sets the camera used by nodeRender and nodeFlatRender to skip nodes whose
+meshes are outside the camera's viewing volume, according to their bounding
+volumes. The camera is not copied, so later changes to it are honored. Pass
+NULL to turn culling off. */
+void nodeSetCullingCamera(const camCamera *cam) {
+    nodeCullCamera = cam;
+}
+
+/* Counts of the nodes whose world isometries nodeRender has recomputed, and of
+those whose cached world isometries it has reused, since the last call to
+nodeResetCounters. Feel free to read them. */
+GLuint nodeRecomputedNum = 0, nodeReusedNum = 0;
+
+/* Counts of the bounding volumes tested against the culling camera, of the
+tests that found the volume outside the viewing volume (so that a whole subtree,
+or a node's own mesh, was skipped), and of the meshes drawn, since the last call
+to nodeResetCounters. Feel free to read them. */
+GLuint nodeTestedNum = 0, nodeCulledNum = 0, nodeDrawnNum = 0;
+
+/* Zeroes the counters above. Call this once per frame to get per-frame counts.
+*/
+void nodeResetCounters(void) {
+    nodeRecomputedNum = 0;
+    nodeReusedNum = 0;
+    nodeTestedNum = 0;
+    nodeCulledNum = 0;
+    nodeDrawnNum = 0;
 }
 
 /* Sets one of the node's textures. */
@@ -79,7 +230,271 @@ void nodeSetTexture(nodeNode *node, GLuint index, const texTexture *tex) {
 /* Sets one of the node's auxiliary uniforms. Each auxiliary is a 4D vector. */
 void nodeSetAuxiliary(nodeNode *node, GLuint index, const GLdouble value[4]) {
     if (index < node->auxNum)
-        vecCopy(4, value, &(node->auxiliaries[index * 4]));
+        vec4Copy(value, &(node->auxiliaries[index * 4]));
+}
+
+/* Helper function for drawing. Returns the mesh that the node should draw,
+given the view (which can be NULL) and its modeling isometry: its own, or the
+suitable level of its LOD chain. */
+const meshGLMesh *nodeSelectMesh(
+        const nodeNode *node, const lodView *view,
+        const GLdouble modeling[4][4]) {
+    if (node->lod != NULL && view != NULL)
+        return &(node->lod->levels[lodSelectLevel(node->lod, view->camera,
+            modeling, view->viewportHeight, view->pixelError)]);
+    return node->mesh;
+}
+
+/* Helper function for nodeRender and nodeFlatRender. Given a node and its
+modeling isometry, draws the node itself (but not its relatives), if it has a
+mesh. If modelingFloat is not NULL, then it must hold modeling as converted by
+shaConvertUniform44, and it is sent to the shader as is. */
+void nodeDraw(
+        const nodeNode *node, const lodView *view, GLdouble modeling[4][4],
+        const GLfloat modelingFloat[4][4], GLint modelingLoc, GLint auxLocs[],
+        GLint texLocs[]) {
+    GLenum textureUnits[8] = {GL_TEXTURE0, GL_TEXTURE1, GL_TEXTURE2,
+        GL_TEXTURE3, GL_TEXTURE4, GL_TEXTURE5, GL_TEXTURE6, GL_TEXTURE7};
+    if (node->mesh == NULL || node->texNum > 8)
+        return;
+    /* A shading layout without textures or auxiliaries gives NULL locations.
+    */
+    if ((node->texNum > 0 && texLocs == NULL) ||
+            (node->auxNum > 0 && auxLocs == NULL)) {
+        fprintf(stderr, "error: nodeDraw: no locations for the node's "
+            "textures or auxiliaries\n");
+        return;
+    }
+    const meshGLMesh *mesh = nodeSelectMesh(node, view, modeling);
+    nodeDrawnNum += 1;
+    for(GLuint i=0; i<node->texNum; i++){
+        //pass the texture, opengl texture unit code, the actual number that corresponds to the code, then the actual location where we want connected.texture unit is not data it is code, it is what operates on the texture and does the calculation. need two texture units when you have 2 textures.
+        texRender(node->textures[i], textureUnits[i], i, texLocs[i]);
+    }
+    for(GLuint k=0; k<node->auxNum; k++){
+        shaSetUniform4(&(node->auxiliaries[4*k]), auxLocs[k]);
+    }
+    //quantized meshes need their dequantization folded into modeling
+    if (mesh->quantized) {
+        GLdouble dequantized[4][4];
+        simdMat444Multiply(modeling, mesh->dequantization, dequantized);
+        shaSetUniform44(dequantized, modelingLoc);
+    } else if (modelingFloat != NULL)
+        shaSetConvertedUniform44(modelingFloat, modelingLoc);
+    else
+        shaSetUniform44(modeling, modelingLoc);
+    /* The textures are left bound, so that siblings sharing them don't rebind
+    them. */
+    meshGLRender(mesh);
+}
+
+/* Helper function for nodeUpdate. Enlarges the sphere (center, *radius) to
+contain the sphere (otherCenter, otherRadius), as little as possible. A negative
+radius means an empty sphere. */
+void nodeMergeSphere(
+        GLdouble center[3], GLdouble *radius, const GLdouble otherCenter[3],
+        GLdouble otherRadius) {
+    GLdouble diff[3], dist, newRadius;
+    if (otherRadius < 0.0)
+        return;
+    vec3Subtract(otherCenter, center, diff);
+    dist = vec3Length(diff);
+    if (*radius >= 0.0 && dist + otherRadius <= *radius)
+        return;
+    if (*radius < 0.0 || dist + *radius <= otherRadius) {
+        vec3Copy(otherCenter, center);
+        *radius = otherRadius;
+        return;
+    }
+    /* Slide the center toward the other sphere, to the middle of the span
+    covering both. */
+    newRadius = 0.5 * (dist + *radius + otherRadius);
+    vec3Scale((newRadius - *radius) / dist, diff, diff);
+    vec3Add(center, diff, center);
+    *radius = newRadius;
+}
+
+/* Helper function for culling. Fills center and *radius with the mesh's
+bounding sphere, carried into world coordinates by modeling. The radius is
+scaled by the largest column length of modeling, in case it is not a pure
+isometry. */
+void nodeGetMeshSphere(
+        const meshGLMesh *mesh, const GLdouble modeling[4][4],
+        GLdouble center[3], GLdouble *radius) {
+    GLdouble scaleSq = 0.0, colSq;
+    GLuint r, c;
+    for (r = 0; r < 3; r += 1)
+        center[r] = modeling[r][0] * mesh->center[0] + modeling[r][1] *
+            mesh->center[1] + modeling[r][2] * mesh->center[2] +
+            modeling[r][3];
+    for (c = 0; c < 3; c += 1) {
+        colSq = modeling[0][c] * modeling[0][c] + modeling[1][c] *
+            modeling[1][c] + modeling[2][c] * modeling[2][c];
+        scaleSq = (colSq > scaleSq) ? colSq : scaleSq;
+    }
+    *radius = mesh->radius * sqrt(scaleSq);
+}
+
+/* Helper function for culling. Returns -1 if the sphere is entirely outside
+one of the planes (from camGetFrustumPlanes), 1 if it is entirely inside all
+of them, and 0 otherwise. An empty sphere (negative radius) is outside. */
+int nodeClassifySphere(
+        const GLdouble planes[6][4], const GLdouble center[3],
+        GLdouble radius) {
+    GLdouble dist;
+    int inside = 1;
+    if (radius < 0.0)
+        return -1;
+    for (int i = 0; i < 6; i += 1) {
+        dist = planes[i][0] * center[0] + planes[i][1] * center[1] +
+            planes[i][2] * center[2] + planes[i][3];
+        if (dist < -radius)
+            return -1;
+        if (dist < radius)
+            inside = 0;
+    }
+    return inside;
+}
+
+/* Helper function for culling. Returns non-zero if the mesh's bounding box,
+carried into world coordinates by modeling (where it becomes an oriented box),
+is entirely outside one of the planes. */
+int nodeBoxIsOutside(
+        const meshGLMesh *mesh, const GLdouble modeling[4][4],
+        const GLdouble planes[6][4]) {
+    GLdouble center[3], half[3], worldCenter[3], dist, reach, dot;
+    GLuint i, k;
+    for (k = 0; k < 3; k += 1) {
+        center[k] = 0.5 * (mesh->lower[k] + mesh->upper[k]);
+        half[k] = 0.5 * (mesh->upper[k] - mesh->lower[k]);
+    }
+    for (k = 0; k < 3; k += 1)
+        worldCenter[k] = modeling[k][0] * center[0] + modeling[k][1] *
+            center[1] + modeling[k][2] * center[2] + modeling[k][3];
+    for (i = 0; i < 6; i += 1) {
+        dist = planes[i][3];
+        reach = 0.0;
+        for (k = 0; k < 3; k += 1) {
+            dist += planes[i][k] * worldCenter[k];
+            /* How far the box reaches toward the plane along its kth axis. */
+            dot = planes[i][0] * modeling[0][k] + planes[i][1] *
+                modeling[1][k] + planes[i][2] * modeling[2][k];
+            reach += half[k] * fabs(dot);
+        }
+        if (dist < -reach)
+            return 1;
+    }
+    return 0;
+}
+
+/* Helper function for nodeRender. Brings the cached world isometries and
+bounding spheres of the node and its descendants up to date. parentChanged is 1
+if the parent's world isometry has changed since the node was last updated, 0 if
+it hasn't, and -1 if that's unknown, because the parent isometry comes from the
+caller. Returns non-zero if the node's bounding sphere might have changed. */
+int nodeUpdate(nodeNode *node, const GLdouble parent[4][4], int parentChanged) {
+    nodeNode *child;
+    int changed = parentChanged, boundsChanged;
+    if (changed < 0)
+        changed = (memcmp(parent, node->cachedParent,
+            16 * sizeof(GLdouble)) != 0);
+    if (changed || !node->cached ||
+            node->isometry.version != node->cachedVersion) {
+        isoComposeHomogeneous(parent, &(node->isometry), node->world);
+        shaConvertUniform44(node->world, node->worldFloat);
+        if (parentChanged < 0)
+            vecCopy(16, (GLdouble *)parent, (GLdouble *)(node->cachedParent));
+        node->cachedVersion = node->isometry.version;
+        node->cached = 1;
+        changed = 1;
+        nodeRecomputedNum += 1;
+    } else
+        nodeReusedNum += 1;
+    /* Children deeper down can change even when this node hasn't, and so
+    can the bounds of the node's mesh, when its vertices are rewritten. */
+    boundsChanged = changed;
+    if (node->mesh != NULL &&
+            node->mesh->boundsVersion != node->cachedBoundsVersion)
+        boundsChanged = 1;
+    for (child = node->child; child != NULL; child = child->sibling)
+        if (nodeUpdate(child, node->world, changed) != 0)
+            boundsChanged = 1;
+    if (boundsChanged) {
+        node->boundRadius = -1.0;
+        if (node->mesh != NULL) {
+            nodeGetMeshSphere(node->mesh, node->world, node->boundCenter,
+                &node->boundRadius);
+            node->cachedBoundsVersion = node->mesh->boundsVersion;
+        }
+        for (child = node->child; child != NULL; child = child->sibling)
+            nodeMergeSphere(node->boundCenter, &node->boundRadius,
+                child->boundCenter, child->boundRadius);
+    }
+    return boundsChanged;
+}
+
+/* Helper function for nodeRender and nodeEnqueue. Draws the node and its
+descendants, using the cached world isometries, and skipping any whose bounds
+are outside the planes. If planes is NULL, then nothing is culled. If queue is
+not NULL, then the draws are added to it instead of being made, and the
+locations are ignored. program is the caller's program (see nodeSetShading).
+*/
+void nodeRenderTree(
+        const nodeNode *node, const GLdouble planes[6][4], const lodView *view,
+        queQueue *queue, GLuint program, GLint modelingLoc, GLint auxLocs[],
+        GLint texLocs[]) {
+    const nodeNode *child;
+    if (node->texNum > 8) {
+        fprintf(stderr, "nodeRender: more than 8 texture units requested.\n");
+        return;
+    }
+    if (planes != NULL) {
+        nodeTestedNum += 1;
+        int side = nodeClassifySphere(planes, node->boundCenter,
+            node->boundRadius);
+        if (side < 0) {
+            nodeCulledNum += 1;
+            return;
+        }
+        /* Everything below is inside too, so stop testing. */
+        if (side > 0)
+            planes = NULL;
+    }
+    if (node->mesh != NULL) {
+        int visible = 1;
+        if (planes != NULL) {
+            /* For a leaf, the sphere just tested is the mesh's own. */
+            nodeTestedNum += 1;
+            if (node->child != NULL) {
+                GLdouble center[3], radius;
+                nodeGetMeshSphere(node->mesh, node->world, center, &radius);
+                visible = (nodeClassifySphere(planes, center, radius) >= 0);
+            }
+            if (visible)
+                visible = !nodeBoxIsOutside(node->mesh, node->world, planes);
+            if (!visible)
+                nodeCulledNum += 1;
+        }
+        if (visible && queue != NULL) {
+            GLuint handle = queGetProgram(queue);
+            if ((node->shading == NULL ||
+                    nodeSelectQueueShading(node, queue) == 0) &&
+                    queAdd(queue, nodeSelectMesh(node, view, node->world),
+                    node->texNum, node->textures, node->auxNum,
+                    node->auxiliaries, (GLdouble (*)[4])node->world,
+                    node->worldFloat) == 0)
+                nodeDrawnNum += 1;
+            queRestoreProgram(queue, handle);
+        } else if (visible) {
+            GLint loc = modelingLoc, *aux = auxLocs, *tex = texLocs;
+            nodeSelectShading(node, program, &loc, &aux, &tex);
+            nodeDraw(node, view, (GLdouble (*)[4])node->world,
+                node->worldFloat, loc, aux, tex);
+        }
+    }
+    for (child = node->child; child != NULL; child = child->sibling)
+        nodeRenderTree(child, planes, view, queue, program, modelingLoc,
+            auxLocs, texLocs);
 }
 
 /* Given a node, its parent's modeling isometry, the location for the 4x4
@@ -88,64 +503,269 @@ texture locations, renders the node. Also recursively renders its younger
 siblings and children. For the root node of the scene graph, pass the identity
 as the parent isometry. Per nodeInitialize, the mesh can be NULL, in which case
 the node does no rendering itself, but can still affect the isometries of its
-descendants. Assumes that no more than 8 textures are being used. */
+descendants. Assumes that no more than 8 textures are being used. For large
+scene graphs, see nodeFlatInitialize.
+
+Each node's world isometry is cached, and recomputed only if the node's
+isometry has been set, or its parent's world isometry has changed, since the
+last render. So a node must not appear in more than one place in the graph.
+If a culling camera has been set, then subtrees whose bounding spheres are
+outside its viewing volume are skipped, and so are meshes whose bounding boxes
+are. Nodes with their own shading (see nodeSetShading) are drawn with it. */
 void nodeRender(
-        const nodeNode *node, const GLdouble parent[4][4], GLint modelingLoc,
-        GLint auxLocs[], GLint texLocs[]) {
-    if (node->texNum > 8) {
-        fprintf(stderr, "nodeRender: more than 8 texture units requested.\n");
-        return;
+        nodeNode *node, const GLdouble parent[4][4], const lodView *view,
+        GLint modelingLoc, GLint auxLocs[], GLint texLocs[]) {
+    GLdouble planes[6][4];
+    GLuint program = shaProgramNow;
+    nodeNode *top;
+    for (top = node; top != NULL; top = top->sibling)
+        nodeUpdate(top, parent, -1);
+    if (nodeCullCamera != NULL)
+        camGetFrustumPlanes(nodeCullCamera, planes);
+    for (top = node; top != NULL; top = top->sibling)
+        nodeRenderTree(top, (nodeCullCamera != NULL) ? planes : NULL, view,
+            NULL, program, modelingLoc, auxLocs, texLocs);
+    if (program != shaUNKNOWN)
+        shaUseProgram(program);
+}
+
+/* Like nodeRender, but instead of drawing, adds the draws to the queue, using
+the queue's current program (see queSetProgram). Nothing is drawn until
+queSubmit, which orders the draws to minimize state changes. The nodes'
+textures and auxiliaries must not change until then. Nodes with their own
+shading are added with it, and sorted with the other draws by it. */
+void nodeEnqueue(
+        nodeNode *node, const GLdouble parent[4][4], const lodView *view,
+        queQueue *queue) {
+    GLdouble planes[6][4];
+    nodeNode *top;
+    for (top = node; top != NULL; top = top->sibling)
+        nodeUpdate(top, parent, -1);
+    if (nodeCullCamera != NULL)
+        camGetFrustumPlanes(nodeCullCamera, planes);
+    for (top = node; top != NULL; top = top->sibling)
+        nodeRenderTree(top, (nodeCullCamera != NULL) ? planes : NULL, view,
+            queue, shaUNKNOWN, 0, NULL, NULL);
+}
+
+
+
+/*** Flattened scene graphs ***/
+
+/* nodeRender walks the tree recursively, chasing pointers, and composes the
+isometries one node at a time. For scene graphs of tens of thousands of nodes,
+that is slow, and the recursion along long sibling chains can overflow the
+stack. A flattened scene graph lists the nodes in breadth-first order, so that
+every node comes after its parent, with each node's parent index. The nodes of
+each level of the tree (the top-level nodes, their children, their
+grandchildren, and so on) are contiguous, and depend only on the level above.
+The local isometries are copied into structure-of-arrays streams: 9 for the
+rotation (row by row) and 3 for the translation, each nodeNum long. Then the
+world isometries are composed a level at a time: the parents' world isometries
+are gathered into streams alongside the level's locals, and the whole level is
+composed at once by simdComposeIsometryStreams (3x3 rotation times rotation,
+plus rotated translation, rather than a full 4x4 multiply). A separate pass
+draws.
+
+The flattened graph records the tree's shape at nodeFlatInitialize. After
+changing any child or sibling pointer, initialize it again. After changing
+isometries, call nodeFlatUpdate, which recopies only the locals whose isometry
+versions have changed. */
+
+#define nodeFLATSTREAMS 12
+
+/* Feel free to read from this struct's members, but don't write to them.
+Component c of node i's local isometry is locals[c * nodeNum + i], and
+similarly for worlds; gathered holds the parents' worlds during updates. A
+parent of -1 means the node is at the top level (the root or one of its
+siblings). Level k is nodes levels[k], ..., levels[k + 1] - 1. versions holds
+the isometry version of each local as last copied. */
+typedef struct nodeFlat nodeFlat;
+struct nodeFlat {
+    GLuint nodeNum, levelNum;
+    const nodeNode **nodes;
+    GLint *parents;
+    GLuint *levels, *versions;
+    GLdouble *locals, *worlds, *gathered;
+};
+
+/* Helper function for nodeFlatInitialize and nodeFlatUpdate. Copies node i's
+isometry into the local streams. */
+void nodeFlatCopyLocal(nodeFlat *flat, GLuint i) {
+    GLuint n = flat->nodeNum, r, c;
+    const isoIsometry *iso = &(flat->nodes[i]->isometry);
+    for (r = 0; r < 3; r += 1) {
+        for (c = 0; c < 3; c += 1)
+            flat->locals[(r * 3 + c) * n + i] = iso->rotation[r][c];
+        flat->locals[(9 + r) * n + i] = iso->translation[r];
     }
-    GLenum textureUnits[8] = {GL_TEXTURE0, GL_TEXTURE1, GL_TEXTURE2,
-        GL_TEXTURE3, GL_TEXTURE4, GL_TEXTURE5, GL_TEXTURE6, GL_TEXTURE7};
-    /* !!Student code goes here.!! */
-   
-    //setting isometry
-   
-    
-    GLdouble newParent[4][4];
-    GLdouble isometry[4][4];
-    isoGetHomogeneous(&(node->isometry), isometry);
-    mat444Multiply(parent, isometry, newParent);
-    shaSetUniform44(newParent, modelingLoc);
-    
-    
-
-    //set texture
-    //load the auxilaries - load 4 doubles into location. shaSetUniform4
-    
-    if (node->mesh != NULL){
-        for(int i=0; i<node->texNum; i++){
-            texRender(node->textures[i], textureUnits[i], i,
-                      texLocs[i]);
-            //pass the texture, opengl texture unit code, the actual number that corresponds to the code, then the actual location where we want connected.texture unit is not data it is code, it is what operates on the texture and does the calculation. need two texture units when you have 2 textures.
-        }
-        for(int k=0; k<node->auxNum; k++){
-            shaSetUniform4(&(node->auxiliaries[4*k]), auxLocs[k]);
-        }
-        meshGLRender(node->mesh);
-        for(int j=0; j<node->texNum; j++){
-            texUnrender(node->textures[j], textureUnits[j]);
-            
-        }
+    flat->versions[i] = iso->version;
+}
+
+/* Initializes a flattened version of the scene graph rooted at root (and its
+siblings). Returns 0 on success, non-zero on failure. Don't forget to call
+nodeFlatDestroy when finished. */
+int nodeFlatInitialize(nodeFlat *flat, const nodeNode *root) {
+    GLuint nodeNum = 0, i;
+    const nodeNode *node;
+    /* List the top-level nodes. Then the list itself serves as the queue of
+    a breadth-first walk, with no recursion. */
+    for (node = root; node != NULL; node = node->sibling)
+        nodeNum += 1;
+    GLuint cap = (nodeNum > 16) ? nodeNum : 16;
+    flat->nodes = (const nodeNode **)malloc(cap * sizeof(nodeNode *));
+    flat->parents = (GLint *)malloc(cap * sizeof(GLint));
+    if (flat->nodes == NULL || flat->parents == NULL) {
+        free(flat->nodes);
+        free(flat->parents);
+        return 1;
     }
-    
-    
-    //recursive
-    if (node->child != NULL) {
-        nodeRender(node->child, newParent, modelingLoc, auxLocs, texLocs);
+    for (node = root, i = 0; node != NULL; node = node->sibling, i += 1) {
+        flat->nodes[i] = node;
+        flat->parents[i] = -1;
     }
-    if (node->sibling != NULL) {
-        nodeRender(node->sibling, parent, modelingLoc, auxLocs, texLocs);
+    /* Append the children of each listed node, in order. */
+    for (i = 0; i < nodeNum; i += 1)
+        for (node = flat->nodes[i]->child; node != NULL;
+                node = node->sibling) {
+            if (nodeNum == cap) {
+                cap *= 2;
+                const nodeNode **nodes = (const nodeNode **)realloc(
+                    flat->nodes, cap * sizeof(nodeNode *));
+                if (nodes != NULL)
+                    flat->nodes = nodes;
+                GLint *parents = (GLint *)realloc(flat->parents,
+                    cap * sizeof(GLint));
+                if (parents != NULL)
+                    flat->parents = parents;
+                if (nodes == NULL || parents == NULL) {
+                    free(flat->nodes);
+                    free(flat->parents);
+                    return 2;
+                }
+            }
+            flat->nodes[nodeNum] = node;
+            flat->parents[nodeNum] = (GLint)i;
+            nodeNum += 1;
+        }
+    flat->nodeNum = nodeNum;
+    flat->locals = (GLdouble *)malloc((size_t)nodeNum * 3 * nodeFLATSTREAMS *
+        sizeof(GLdouble) + sizeof(GLdouble));
+    flat->levels = (GLuint *)malloc((size_t)(2 * nodeNum + 1) *
+        sizeof(GLuint));
+    if (flat->locals == NULL || flat->levels == NULL) {
+        free(flat->locals);
+        free(flat->levels);
+        free(flat->nodes);
+        free(flat->parents);
+        return 3;
     }
+    flat->worlds = &(flat->locals[(size_t)nodeNum * nodeFLATSTREAMS]);
+    flat->gathered = &(flat->worlds[(size_t)nodeNum * nodeFLATSTREAMS]);
+    flat->versions = &(flat->levels[nodeNum + 1]);
+    /* In breadth-first order, a node starts a new level exactly when its
+    parent is in the current level. */
+    flat->levelNum = 0;
+    for (i = 0; i < nodeNum; i += 1)
+        if (i == 0 || flat->parents[i] >=
+                (GLint)flat->levels[flat->levelNum - 1]) {
+            flat->levels[flat->levelNum] = i;
+            flat->levelNum += 1;
+        }
+    flat->levels[flat->levelNum] = nodeNum;
+    for (i = 0; i < nodeNum; i += 1)
+        nodeFlatCopyLocal(flat, i);
+    return 0;
 }
-    
 
-       
-    //keep camera stuff in render?
-
-    
-    
+/* Releases the resources backing the flattened graph, but not the nodes. */
+void nodeFlatDestroy(nodeFlat *flat) {
+    free(flat->nodes);
+    free(flat->parents);
+    free(flat->levels);
+    free(flat->locals);
+}
 
+/* Recopies the local isometries that have been set since the last update, and
+then computes all of the world isometries, given the parent isometry of the
+top-level nodes (usually the identity), which must be an isometry in
+homogeneous form. */
+void nodeFlatUpdate(nodeFlat *flat, const GLdouble parent[4][4]) {
+    GLuint n = flat->nodeNum, i, c, k, first, last;
+    const GLdouble *ls[nodeFLATSTREAMS], *gs[nodeFLATSTREAMS];
+    GLdouble *ws[nodeFLATSTREAMS], *g;
+    const GLdouble *w;
+    for (i = 0; i < n; i += 1)
+        if (flat->nodes[i]->isometry.version != flat->versions[i])
+            nodeFlatCopyLocal(flat, i);
+    for (k = 0; k < flat->levelNum; k += 1) {
+        first = flat->levels[k];
+        last = flat->levels[k + 1];
+        /* Gather the parents' worlds, which the levels above have finished,
+        alongside the level's locals. The top-level nodes' parent is read from
+        the 4x4 matrix instead. */
+        for (c = 0; c < nodeFLATSTREAMS; c += 1) {
+            g = &(flat->gathered[c * n]);
+            if (k == 0) {
+                GLdouble entry = (c < 9) ? parent[c / 3][c % 3] :
+                    parent[c - 9][3];
+                for (i = first; i < last; i += 1)
+                    g[i] = entry;
+            } else {
+                w = &(flat->worlds[c * n]);
+                for (i = first; i < last; i += 1)
+                    g[i] = w[flat->parents[i]];
+            }
+            gs[c] = &g[first];
+            ls[c] = &(flat->locals[c * n + first]);
+            ws[c] = &(flat->worlds[c * n + first]);
+        }
+        simdComposeIsometryStreams(last - first, gs, ls, ws);
+    }
+}
 
+/* Fills modeling with node i's world isometry, in homogeneous form. */
+void nodeFlatGetWorld(const nodeFlat *flat, GLuint i, GLdouble modeling[4][4]) {
+    GLuint n = flat->nodeNum, r, c;
+    for (r = 0; r < 3; r += 1) {
+        for (c = 0; c < 3; c += 1)
+            modeling[r][c] = flat->worlds[(r * 3 + c) * n + i];
+        modeling[r][3] = flat->worlds[(9 + r) * n + i];
+    }
+    modeling[3][0] = 0.0;
+    modeling[3][1] = 0.0;
+    modeling[3][2] = 0.0;
+    modeling[3][3] = 1.0;
+}
 
+/* Draws every node that has a mesh, using the world isometries from the last
+nodeFlatUpdate. Takes the same locations as nodeRender. If a culling camera has
+been set, then each mesh is tested against it on its own, because the flattened
+graph keeps no bounds for subtrees. */
+void nodeFlatRender(
+        const nodeFlat *flat, const lodView *view, GLint modelingLoc,
+        GLint auxLocs[], GLint texLocs[]) {
+    GLdouble modeling[4][4], planes[6][4], center[3], radius;
+    GLuint i, program = shaProgramNow;
+    if (nodeCullCamera != NULL)
+        camGetFrustumPlanes(nodeCullCamera, planes);
+    for (i = 0; i < flat->nodeNum; i += 1) {
+        if (flat->nodes[i]->mesh == NULL)
+            continue;
+        nodeFlatGetWorld(flat, i, modeling);
+        if (nodeCullCamera != NULL) {
+            nodeTestedNum += 1;
+            nodeGetMeshSphere(flat->nodes[i]->mesh, modeling, center, &radius);
+            if (nodeClassifySphere(planes, center, radius) < 0 ||
+                    nodeBoxIsOutside(flat->nodes[i]->mesh, modeling, planes)) {
+                nodeCulledNum += 1;
+                continue;
+            }
+        }
+        GLint loc = modelingLoc, *aux = auxLocs, *tex = texLocs;
+        nodeSelectShading(flat->nodes[i], program, &loc, &aux, &tex);
+        nodeDraw(flat->nodes[i], view, modeling, NULL, loc, aux, tex);
+    }
+    if (program != shaUNKNOWN)
+        shaUseProgram(program);
+}
@@ -0,0 +1,1017 @@
+/*** Draw queues ***/
+
+/* Drawing a scene graph node by node binds and unbinds each node's textures
+and VAO, even when the next node uses the very same ones, and the driver
+overhead of those redundant changes can dominate the frame time. A draw queue
+instead collects the frame's draws as items, sorts them so that items sharing
+a program, texture set, and mesh are adjacent, and then submits them, changing
+only the state that actually differs from the previous item. Typical use, each
+frame:
+    queClear(&queue);
+    queSetProgram(&queue, sha.program, sha.unifLocs[UNIFMODELING], NULL,
+        &(sha.unifLocs[UNIFTEXTURE0]));
+    nodeEnqueue(&root, identity, NULL, &queue);
+    queSubmit(&queue);
+Each item is sorted by its program, and then by a 64-bit key: from the most
+significant bits down, a hash of the texture set, the mesh's VAO, and the depth
+from the camera (so that, within a state, nearer items are drawn first, and the
+depth test rejects more of the farther ones). For a pooled mesh, its position in
+the pool takes the top 20 of the 28 depth bits, leaving the depth only 8. The
+key only orders the items; state changes are decided by comparing the actual
+state, so hash collisions cost binds, never correctness.
+
+With an instanced program (see queSetInstancedProgram), each run of sorted items
+sharing a mesh and textures is drawn with one glDrawElementsInstanced, reading
+the items' modeling matrices and auxiliaries from a per-instance buffer. So
+hundreds of nodes sharing a mesh cost one draw call. Instancing requires OpenGL
+3.3, for glVertexAttribDivisor.
+
+With a block program (see queSetBlockProgram), each item's modeling matrix and
+auxiliaries are instead packed into a record in a uniform buffer ring (see
+shaRing), all sent in one buffer update, and each draw selects its record with
+glBindBufferRange, instead of making a glUniform call per value.
+
+Meshes in a pool (see meshGLPool) share one VAO, so runs of them need no state
+changes at all. With an instanced program, each run of items sharing a pool and
+textures is drawn with one glMultiDrawElementsIndirect, with one command per
+mesh, if OpenGL 4.3 is available; otherwise, with one
+glDrawElementsInstancedBaseVertex per mesh. With a plain program, each run of
+pooled items that also share their modeling matrix and auxiliaries is drawn
+with one glMultiDrawElementsBaseVertex. */
+
+#define queMAXTEXTURES 8
+#define queMAXAUXILIARIES 8
+#define queDRAWBINDING 1
+#define queRINGSIZE (4 * 1024 * 1024)
+
+/* A program with the uniform locations of its modeling matrix, auxiliary
+uniforms, and textures, as would be passed to nodeRender. For an instanced
+program, modelingLoc is -1, and instanceLoc and recordAuxLocs are the locations
+of the per-instance attributes instead. For a block program, modelingLoc and
+instanceLoc are -1, and blocked is set. Either way, each per-instance or
+per-draw record holds a modeling matrix and recordAuxNum auxiliaries. */
+typedef struct queProgram queProgram;
+struct queProgram {
+    GLuint program;
+    GLint modelingLoc;
+    GLint *auxLocs, *texLocs;
+    GLint instanceLoc;
+    GLuint blocked, recordAuxNum;
+    GLint recordAuxLocs[queMAXAUXILIARIES];
+};
+
+/* The textures and auxiliaries are not copied, so they must remain valid until
+queSubmit. The modeling matrix is stored converted by shaConvertUniform44, with
+any dequantization already folded in. */
+typedef struct queItem queItem;
+struct queItem {
+    const meshGLMesh *mesh;
+    const texTexture **textures;
+    const GLdouble *auxiliaries;
+    GLuint texNum, auxNum, program;
+    GLfloat modeling[4][4];
+    GLsizeiptr record;
+};
+
+/* The layout of an indirect draw command, as glMultiDrawElementsIndirect reads
+it. */
+typedef struct queCommand queCommand;
+struct queCommand {
+    GLuint count, instanceCount, firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+typedef struct queEntry queEntry;
+struct queEntry {
+    uint64_t key;
+    GLuint program, index;
+};
+
+/* Feel free to read from this struct's members, but don't write to them. The
+counts of binds (program, texture, and VAO changes) and draws are for the last
+queSubmit. */
+typedef struct queQueue queQueue;
+struct queQueue {
+    GLuint itemNum, itemCap, programNum, programCap, program;
+    queItem *items;
+    queEntry *entries;
+    queProgram *programs;
+    const camCamera *cam;
+    GLuint bindNum, drawNum;
+    GLuint instanceBuffer;
+    size_t instanceCap;
+    GLfloat *instanceData;
+    shaRing ring;
+    GLuint indirect, indirectBuffer, commandCap, multiCap;
+    queCommand *commands;
+    GLsizei *multiCounts;
+    const GLvoid **multiPointers;
+    GLint *multiBases;
+};
+
+/* Initializes an empty queue with room for itemCap items, which grows as
+needed. Returns 0 on success, non-zero on failure. Don't forget to call
+queDestroy when finished. */
+int queInitialize(queQueue *queue, GLuint itemCap) {
+    if (itemCap < 16)
+        itemCap = 16;
+    queue->items = (queItem *)malloc(itemCap * sizeof(queItem));
+    queue->entries = (queEntry *)malloc(itemCap * sizeof(queEntry));
+    queue->programs = (queProgram *)malloc(16 * sizeof(queProgram));
+    if (queue->items == NULL || queue->entries == NULL ||
+            queue->programs == NULL) {
+        free(queue->items);
+        free(queue->entries);
+        free(queue->programs);
+        return 1;
+    }
+    queue->itemCap = itemCap;
+    queue->itemNum = 0;
+    queue->programNum = 0;
+    queue->programCap = 16;
+    queue->program = 0;
+    queue->cam = NULL;
+    queue->bindNum = 0;
+    queue->drawNum = 0;
+    queue->instanceBuffer = 0;
+    queue->instanceCap = 0;
+    queue->instanceData = NULL;
+    queue->ring.data = NULL;
+    /* Multi-draw indirect is core in OpenGL 4.3. */
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    queue->indirect = (major > 4 || (major == 4 && minor >= 3));
+    queue->indirectBuffer = 0;
+    queue->commandCap = 0;
+    queue->commands = NULL;
+    queue->multiCap = 0;
+    queue->multiCounts = NULL;
+    queue->multiPointers = NULL;
+    queue->multiBases = NULL;
+    return 0;
+}
+
+/* Releases the resources backing the queue. */
+void queDestroy(queQueue *queue) {
+    free(queue->items);
+    free(queue->entries);
+    free(queue->programs);
+    free(queue->instanceData);
+    if (queue->instanceBuffer != 0)
+        glDeleteBuffers(1, &(queue->instanceBuffer));
+    if (queue->ring.data != NULL)
+        shaRingDestroy(&(queue->ring));
+    if (queue->indirectBuffer != 0)
+        glDeleteBuffers(1, &(queue->indirectBuffer));
+    free(queue->commands);
+    free(queue->multiCounts);
+    free(queue->multiPointers);
+    free(queue->multiBases);
+}
+
+/* Empties the queue, including its programs. Call at the start of each frame.
+*/
+void queClear(queQueue *queue) {
+    queue->itemNum = 0;
+    queue->programNum = 0;
+    queue->program = 0;
+}
+
+/* Sets the camera used to sort items by depth. The camera is not copied. If
+it is NULL, then depth plays no role. */
+void queSetCamera(queQueue *queue, const camCamera *cam) {
+    queue->cam = cam;
+}
+
+/* Helper function for queSetProgram and queSetInstancedProgram. Makes prog
+current, adding it to the queue's programs if it isn't there already. There is
+no limit on the number of programs in a frame, as they are sorted by their
+index in the queue, not by key bits. */
+int queUseProgram(queQueue *queue, const queProgram *prog) {
+    GLuint i;
+    for (i = 0; i < queue->programNum; i += 1)
+        if (queue->programs[i].program == prog->program &&
+                queue->programs[i].modelingLoc == prog->modelingLoc &&
+                queue->programs[i].auxLocs == prog->auxLocs &&
+                queue->programs[i].texLocs == prog->texLocs)
+            break;
+    if (i == queue->programNum) {
+        if (i == queue->programCap) {
+            queProgram *programs = (queProgram *)realloc(queue->programs,
+                2 * queue->programCap * sizeof(queProgram));
+            if (programs == NULL) {
+                fprintf(stderr, "error: queSetProgram: can't grow to %u "
+                    "programs\n", 2 * queue->programCap);
+                return 1;
+            }
+            queue->programs = programs;
+            queue->programCap *= 2;
+        }
+        queue->programs[i] = *prog;
+        queue->programNum += 1;
+    }
+    queue->program = i;
+    return 0;
+}
+
+/* Makes the given program, with its uniform locations, the one used by items
+added from now on. The location arrays are not copied. Returns 0 on success,
+or non-zero if the queue's programs can't grow. */
+int queSetProgram(
+        queQueue *queue, GLuint program, GLint modelingLoc, GLint auxLocs[],
+        GLint texLocs[]) {
+    queProgram prog;
+    prog.program = program;
+    prog.modelingLoc = modelingLoc;
+    prog.auxLocs = auxLocs;
+    prog.texLocs = texLocs;
+    prog.instanceLoc = -1;
+    prog.blocked = 0;
+    prog.recordAuxNum = 0;
+    return queUseProgram(queue, &prog);
+}
+
+/* Makes current again the program with the given name, as set earlier in this
+frame by queSetProgram or its relatives, with the locations it was set with.
+Returns 0 on success, or non-zero if the program hasn't been set this frame. */
+int queSelectProgram(queQueue *queue, GLuint program) {
+    GLuint i;
+    for (i = 0; i < queue->programNum; i += 1)
+        if (queue->programs[i].program == program) {
+            queue->program = i;
+            return 0;
+        }
+    return 1;
+}
+
+/* Returns a handle to the current program, for queRestoreProgram. */
+GLuint queGetProgram(const queQueue *queue) {
+    return queue->program;
+}
+
+/* Makes current again the program that queGetProgram returned, earlier in the
+same frame. */
+void queRestoreProgram(queQueue *queue, GLuint handle) {
+    if (handle < queue->programNum)
+        queue->program = handle;
+}
+
+/* Like queSetProgram, but for a program whose vertex shader was made by
+queMakeInstancedCode with auxNum auxiliaries. The per-instance attribute
+locations are looked up in the program. They are set in each mesh's VAO only
+for the duration of its instanced draws, so they must not coincide with the
+locations of the mesh's own attributes; bind them above those, with
+glBindAttribLocation, if the linker doesn't. Returns 0 on success, non-zero on
+failure. */
+int queSetInstancedProgram(
+        queQueue *queue, GLuint program, GLuint auxNum, GLint texLocs[]) {
+    queProgram prog;
+    GLchar name[32];
+    GLuint k;
+    if (auxNum > queMAXAUXILIARIES)
+        return 1;
+    prog.program = program;
+    prog.modelingLoc = -1;
+    prog.auxLocs = NULL;
+    prog.texLocs = texLocs;
+    prog.instanceLoc = glGetAttribLocation(program, "queModeling");
+    prog.blocked = 0;
+    prog.recordAuxNum = auxNum;
+    for (k = 0; k < auxNum; k += 1) {
+        sprintf(name, "queAuxiliary%u", k);
+        prog.recordAuxLocs[k] = glGetAttribLocation(program, name);
+    }
+    if (prog.instanceLoc == -1) {
+        fprintf(stderr, "error: queSetInstancedProgram: program has no "
+            "queModeling attribute\n");
+        return 2;
+    }
+    return queUseProgram(queue, &prog);
+}
+
+/* Like queSetProgram, but for a program whose shaders were made by
+queMakeBlockCode with auxNum auxiliaries. Connects the program's queDraw block
+to the binding point queDRAWBINDING. Returns 0 on success, non-zero on
+failure. */
+int queSetBlockProgram(
+        queQueue *queue, GLuint program, GLuint auxNum, GLint texLocs[]) {
+    queProgram prog;
+    if (auxNum > queMAXAUXILIARIES)
+        return 1;
+    if (shaBindBlock(program, "queDraw", queDRAWBINDING) != 0)
+        return 2;
+    prog.program = program;
+    prog.modelingLoc = -1;
+    prog.auxLocs = NULL;
+    prog.texLocs = texLocs;
+    prog.instanceLoc = -1;
+    prog.blocked = 1;
+    prog.recordAuxNum = auxNum;
+    return queUseProgram(queue, &prog);
+}
+
+/* Helper function for queMakeCode. */
+int queIsNameChar(GLchar c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '_';
+}
+
+/* Helper function for queMakeCode. Returns a pointer past the whitespace,
+comments, and preprocessor directives at p. */
+GLchar *queSkipSpace(GLchar *p) {
+    GLchar *end;
+    while (1) {
+        if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+            p += 1;
+        else if (p[0] == '/' && p[1] == '/')
+            while (*p != '\0' && *p != '\n')
+                p += 1;
+        else if (p[0] == '/' && p[1] == '*') {
+            end = strstr(p + 2, "*/");
+            p = (end == NULL) ? p + strlen(p) : end + 2;
+        } else if (*p == '#')
+            while (*p != '\0' && (*p != '\n' || p[-1] == '\\'))
+                p += 1;
+        else
+            return p;
+    }
+}
+
+/* Helper function for queMakeCode. Overwrites [from, to) with spaces, except
+for newlines, so that the line numbers in compiler messages don't change. */
+void queBlank(GLchar *from, GLchar *to) {
+    for (; from < to; from += 1)
+        if (*from != '\n')
+            *from = ' ';
+}
+
+/* Helper function for queMakeCode. Returns 0 if the word of the given length
+is modelingName, k + 1 if it is auxNames[k], or -1 if it is neither. */
+int queFindName(
+        const GLchar *word, size_t length, const GLchar *modelingName,
+        GLuint auxNum, const GLchar *auxNames[]) {
+    GLuint k;
+    if (strlen(modelingName) == length &&
+            strncmp(word, modelingName, length) == 0)
+        return 0;
+    for (k = 0; k < auxNum; k += 1)
+        if (strlen(auxNames[k]) == length &&
+                strncmp(word, auxNames[k], length) == 0)
+            return k + 1;
+    return -1;
+}
+
+/* Helper function for queMakeCode. Given p just past the word "uniform" of the
+statement starting at stmt, parses the rest of the declaration: precision
+qualifiers, a type, and declarators separated by commas, each a name with an
+optional array size. Removes the declarators of the modeling matrix and
+auxiliaries, with their commas, or the whole statement if nothing else is
+declared in it. Returns a pointer past the statement, or past as much of it as
+could be parsed, or NULL if one of the uniforms is declared with the wrong
+type, as an array, or with an initializer. */
+GLchar *queBlankDeclaration(
+        GLchar *stmt, GLchar *p, const GLchar *modelingName, GLuint auxNum,
+        const GLchar *auxNames[]) {
+    GLchar *type, *name, *list, *lastKept = NULL;
+    size_t typeLength, nameLength;
+    int which, array, pass, targetNum = 0;
+    /* Skip the precision qualifiers, if any, to reach the type. */
+    do {
+        type = queSkipSpace(p);
+        for (p = type; queIsNameChar(*p); p += 1);
+        typeLength = (size_t)(p - type);
+    } while ((typeLength == 4 && strncmp(type, "lowp", 4) == 0) ||
+        (typeLength == 5 && strncmp(type, "highp", 5) == 0) ||
+        (typeLength == 7 && strncmp(type, "mediump", 7) == 0));
+    list = queSkipSpace(p);
+    /* The first pass checks the declarators, and the second removes them. */
+    for (pass = 0; pass < 2; pass += 1) {
+        p = list;
+        while (queIsNameChar(*p)) {
+            for (name = p; queIsNameChar(*p); p += 1);
+            nameLength = (size_t)(p - name);
+            p = queSkipSpace(p);
+            array = (*p == '[');
+            while (*p != '\0' && *p != ']' && array)
+                p += 1;
+            if (array && *p == ']')
+                p = queSkipSpace(p + 1);
+            which = queFindName(name, nameLength, modelingName, auxNum,
+                auxNames);
+            if (pass == 0 && which >= 0) {
+                const GLchar *wanted = (which == 0) ? "mat4" : "vec4";
+                if (array || typeLength != 4 ||
+                        strncmp(type, wanted, 4) != 0 ||
+                        (*p != ',' && *p != ';')) {
+                    fprintf(stderr, "error: queMakeCode: %.*s must be "
+                        "declared as a plain uniform %s\n", (int)nameLength,
+                        name, wanted);
+                    return NULL;
+                }
+                targetNum += 1;
+            } else if (pass == 0)
+                lastKept = name;
+            else if (which >= 0)
+                queBlank(name, name + nameLength);
+            if (*p == ';' && pass == 0 && targetNum == 0)
+                return p + 1;
+            if (*p == ';' && pass == 0 && lastKept == NULL) {
+                queBlank(stmt, p + 1);
+                return p + 1;
+            }
+            if (*p == ';')
+                break;
+            if (*p != ',') {
+                /* Not a declaration that this parser understands, such as one
+                with an initializer. That's fine, unless it mentions one of
+                the uniforms. */
+                while (*p != '\0' && *p != ';') {
+                    for (name = p; queIsNameChar(*p); p += 1);
+                    if (p == name)
+                        p += 1;
+                    else if (queFindName(name, (size_t)(p - name),
+                            modelingName, auxNum, auxNames) >= 0)
+                        targetNum += 1;
+                    p = queSkipSpace(p);
+                }
+                if (targetNum > 0) {
+                    fprintf(stderr, "error: queMakeCode: can't parse a "
+                        "declaration of %s or an auxiliary\n", modelingName);
+                    return NULL;
+                }
+                return p;
+            }
+            /* Keep the comma after each kept declarator but the last. */
+            if (pass == 1 && (which >= 0 || name == lastKept))
+                queBlank(p, p + 1);
+            p = queSkipSpace(p + 1);
+        }
+        if (*p != ';')
+            return p;
+    }
+    return p + 1;
+}
+
+/* Helper function for queMakeInstancedCode and queMakeBlockCode. Rewrites
+shader code in which the modeling matrix and auxiliaries are uniforms with the
+given names. If blocked is 0, they become per-instance attributes; otherwise,
+members of a per-draw uniform block. Declarations, and #defines that rename
+them to the uniforms' names, are inserted after the #version line, so that the
+body of the shader is unchanged. The uniforms' declarations are removed, even
+from declarations of several names such as "uniform vec4 color, aux;", and
+comments and preprocessor lines are left alone. The modeling matrix must be a
+mat4 and each auxiliary a vec4, not arrays and not initialized; otherwise, this
+function fails. Returns a string allocated with malloc, which the caller must
+free, or NULL on failure. */
+GLchar *queMakeCode(
+        const GLchar *code, GLuint blocked, const GLchar *modelingName,
+        GLuint auxNum, const GLchar *auxNames[]) {
+    size_t length = strlen(code), extra = 160 + strlen(modelingName), at = 0;
+    GLuint k;
+    for (k = 0; k < auxNum; k += 1)
+        extra += 64 + strlen(auxNames[k]);
+    GLchar *result = (GLchar *)malloc(length + extra + 1);
+    if (result == NULL)
+        return NULL;
+    if (strncmp(code, "#version", 8) == 0) {
+        const GLchar *newline = strchr(code, '\n');
+        at = (newline == NULL) ? length : (size_t)(newline - code) + 1;
+    }
+    memcpy(result, code, at);
+    GLchar *dest = &result[at];
+    if (at > 0 && code[at - 1] != '\n')
+        dest += sprintf(dest, "\n");
+    if (blocked) {
+        dest += sprintf(dest, "#define QUEBLOCK 1\nlayout(std140) uniform "
+            "queDraw {\nmat4 queModeling;\n");
+        for (k = 0; k < auxNum; k += 1)
+            dest += sprintf(dest, "vec4 queAuxiliary%u;\n", k);
+        dest += sprintf(dest, "};\n");
+    } else {
+        dest += sprintf(dest, "#define QUEINSTANCED 1\nin mat4 queModeling;\n");
+        for (k = 0; k < auxNum; k += 1)
+            dest += sprintf(dest, "in vec4 queAuxiliary%u;\n", k);
+    }
+    dest += sprintf(dest, "#define %s queModeling\n", modelingName);
+    for (k = 0; k < auxNum; k += 1)
+        dest += sprintf(dest, "#define %s queAuxiliary%u\n", auxNames[k], k);
+    GLchar *body = dest;
+    memcpy(body, &code[at], length - at + 1);
+    /* Remove the uniforms' declarations, which are at the top level. */
+    GLchar *p = queSkipSpace(body), *stmt = p, *word;
+    int depth = 0;
+    while (*p != '\0') {
+        if (queIsNameChar(*p)) {
+            for (word = p; queIsNameChar(*p); p += 1);
+            if (depth == 0 && p - word == 7 &&
+                    strncmp(word, "uniform", 7) == 0) {
+                p = queBlankDeclaration(stmt, p, modelingName, auxNum,
+                    auxNames);
+                if (p == NULL) {
+                    free(result);
+                    return NULL;
+                }
+                if (p[-1] == ';')
+                    stmt = p = queSkipSpace(p);
+                continue;
+            }
+        } else {
+            depth += (*p == '{') - (*p == '}');
+            p += 1;
+            if (p[-1] == ';' || p[-1] == '{' || p[-1] == '}') {
+                stmt = p = queSkipSpace(p);
+                continue;
+            }
+        }
+        p = queSkipSpace(p);
+    }
+    return result;
+}
+
+/* Rewrites the code of a vertex shader written for queSetProgram, in which the
+modeling matrix and auxiliaries are uniforms with the given names, into code
+for queSetInstancedProgram, in which they are per-instance attributes (see
+queMakeCode). QUEINSTANCED is defined too, for shaders that want to tell. Only
+the vertex shader can read the attributes. Returns a string allocated with
+malloc, which the caller must free, or NULL on failure. */
+GLchar *queMakeInstancedCode(
+        const GLchar *code, const GLchar *modelingName, GLuint auxNum,
+        const GLchar *auxNames[]) {
+    return queMakeCode(code, 0, modelingName, auxNum, auxNames);
+}
+
+/* Like queMakeInstancedCode, but for queSetBlockProgram: the uniforms become
+members of the std140 uniform block queDraw, and QUEBLOCK is defined. Apply it
+to every shader of the program that uses the uniforms. */
+GLchar *queMakeBlockCode(
+        const GLchar *code, const GLchar *modelingName, GLuint auxNum,
+        const GLchar *auxNames[]) {
+    return queMakeCode(code, 1, modelingName, auxNum, auxNames);
+}
+
+/* Helper function for queAdd. Maps the camera-space depth of the point to 28
+bits, with 0 nearest. */
+uint64_t queGetDepthBits(const queQueue *queue, const GLdouble world[3]) {
+    const camCamera *cam = queue->cam;
+    GLdouble toPoint[3], depth, far;
+    if (cam == NULL)
+        return 0;
+    vec3Subtract(world, cam->isometry.translation, toPoint);
+    depth = -(toPoint[0] * cam->isometry.rotation[0][2] + toPoint[1] *
+        cam->isometry.rotation[1][2] + toPoint[2] *
+        cam->isometry.rotation[2][2]);
+    far = -cam->projection[camPROJF];
+    if (depth <= 0.0 || far <= 0.0)
+        return 0;
+    if (depth >= far)
+        return 0xFFFFFFF;
+    return (uint64_t)(depth / far * 0xFFFFFFF);
+}
+
+/* Adds a draw of the mesh with the given textures and auxiliary uniforms (4D
+vectors, as in nodeSetAuxiliary), placed by the modeling isometry, using the
+current program. If modelingFloat is not NULL, then it must hold modeling
+converted by shaConvertUniform44. Returns 0 on success, non-zero on failure. */
+int queAdd(
+        queQueue *queue, const meshGLMesh *mesh, GLuint texNum,
+        const texTexture **textures, GLuint auxNum,
+        const GLdouble *auxiliaries, GLdouble modeling[4][4],
+        const GLfloat modelingFloat[4][4]) {
+    GLuint i;
+    if (texNum > queMAXTEXTURES || queue->programNum == 0) {
+        fprintf(stderr, "error: queAdd: too many textures or no program\n");
+        return 1;
+    }
+    const queProgram *prog = &(queue->programs[queue->program]);
+    if ((texNum > 0 && prog->texLocs == NULL) || (auxNum > 0 &&
+            prog->modelingLoc >= 0 && prog->auxLocs == NULL)) {
+        fprintf(stderr, "error: queAdd: program has no locations for the "
+            "textures or auxiliaries\n");
+        return 1;
+    }
+    if (queue->itemNum == queue->itemCap) {
+        GLuint cap = queue->itemCap * 2;
+        queItem *items = (queItem *)realloc(queue->items,
+            cap * sizeof(queItem));
+        if (items == NULL)
+            return 2;
+        queue->items = items;
+        queEntry *entries = (queEntry *)realloc(queue->entries,
+            cap * sizeof(queEntry));
+        if (entries == NULL)
+            return 3;
+        queue->entries = entries;
+        queue->itemCap = cap;
+    }
+    queItem *item = &(queue->items[queue->itemNum]);
+    item->mesh = mesh;
+    item->textures = textures;
+    item->auxiliaries = auxiliaries;
+    item->texNum = texNum;
+    item->auxNum = auxNum;
+    item->program = queue->program;
+    if (mesh->quantized) {
+        GLdouble dequantized[4][4];
+        simdMat444Multiply(modeling, mesh->dequantization, dequantized);
+        shaConvertUniform44(dequantized, item->modeling);
+    } else if (modelingFloat != NULL)
+        memcpy(item->modeling, modelingFloat, sizeof(item->modeling));
+    else
+        shaConvertUniform44(modeling, item->modeling);
+    /* FNV-1a over the texture names. */
+    uint32_t hash = 2166136261u;
+    for (i = 0; i < texNum; i += 1)
+        hash = (hash ^ textures[i]->texture) * 16777619u;
+    GLdouble center[3];
+    for (i = 0; i < 3; i += 1)
+        center[i] = modeling[i][0] * mesh->center[0] + modeling[i][1] *
+            mesh->center[1] + modeling[i][2] * mesh->center[2] +
+            modeling[i][3];
+    /* Pooled meshes share a VAO, so their position in the pool stands in for
+    the VAO in the top 20 depth bits, to keep each mesh's items together. Past
+    2^20 meshes in one pool, positions alias, which splits runs into extra
+    commands but never draws the wrong mesh. */
+    uint64_t depthBits = queGetDepthBits(queue, center);
+    if (mesh->pool != NULL)
+        depthBits = ((uint64_t)(mesh->poolIndex & 0xFFFFF) << 8) |
+            (depthBits >> 20);
+    queEntry *entry = &(queue->entries[queue->itemNum]);
+    entry->key = ((uint64_t)((hash ^ (hash >> 20)) & 0xFFFFF) << 44) |
+        ((uint64_t)(mesh->vao & 0xFFFF) << 28) | depthBits;
+    entry->program = item->program;
+    entry->index = queue->itemNum;
+    queue->itemNum += 1;
+    return 0;
+}
+
+/* Helper function for queSubmit, for qsort. Ties keep the order of addition. */
+int queCompareEntries(const void *a, const void *b) {
+    const queEntry *e = (const queEntry *)a, *f = (const queEntry *)b;
+    if (e->program != f->program)
+        return (e->program < f->program) ? -1 : 1;
+    if (e->key != f->key)
+        return (e->key < f->key) ? -1 : 1;
+    return (e->index < f->index) ? -1 : (e->index > f->index);
+}
+
+/* Helper function for queSubmit. Writes the per-instance data of the items
+drawn by instanced programs, in sorted order, and uploads it to the instance
+buffer. Returns 0 on success, non-zero on failure. */
+int queUploadInstances(queQueue *queue) {
+    size_t floatNum = 0, at = 0;
+    GLuint i, k;
+    for (i = 0; i < queue->itemNum; i += 1) {
+        const queItem *item = &(queue->items[queue->entries[i].index]);
+        const queProgram *prog = &(queue->programs[item->program]);
+        if (prog->instanceLoc >= 0)
+            floatNum += 16 + 4 * prog->recordAuxNum;
+    }
+    if (floatNum == 0)
+        return 0;
+    if (floatNum > queue->instanceCap) {
+        GLfloat *data = (GLfloat *)realloc(queue->instanceData,
+            floatNum * sizeof(GLfloat));
+        if (data == NULL)
+            return 1;
+        queue->instanceData = data;
+        queue->instanceCap = floatNum;
+    }
+    for (i = 0; i < queue->itemNum; i += 1) {
+        const queItem *item = &(queue->items[queue->entries[i].index]);
+        const queProgram *prog = &(queue->programs[item->program]);
+        if (prog->instanceLoc < 0)
+            continue;
+        memcpy(&(queue->instanceData[at]), item->modeling,
+            16 * sizeof(GLfloat));
+        at += 16;
+        for (k = 0; k < 4 * prog->recordAuxNum; k += 1, at += 1)
+            queue->instanceData[at] = (k < 4 * item->auxNum) ?
+                item->auxiliaries[k] : 0.0;
+    }
+    if (queue->instanceBuffer == 0)
+        glGenBuffers(1, &(queue->instanceBuffer));
+    glBindBuffer(GL_ARRAY_BUFFER, queue->instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, floatNum * sizeof(GLfloat),
+        queue->instanceData, GL_STREAM_DRAW);
+    return 0;
+}
+
+/* Helper function for queSubmit. Writes the per-draw records of the items drawn
+by block programs into the ring, and uploads them. An item whose record doesn't
+fit gets record -1. Returns 0 on success, non-zero on failure. */
+int queUploadRecords(queQueue *queue) {
+    GLuint i, k;
+    for (i = 0; i < queue->itemNum; i += 1)
+        if (queue->programs[queue->items[i].program].blocked)
+            break;
+    if (i == queue->itemNum)
+        return 0;
+    if (queue->ring.data == NULL &&
+            shaRingInitialize(&(queue->ring), queRINGSIZE, queDRAWBINDING) != 0)
+        return 1;
+    shaRingBeginFrame(&(queue->ring));
+    for (i = 0; i < queue->itemNum; i += 1) {
+        queItem *item = &(queue->items[queue->entries[i].index]);
+        const queProgram *prog = &(queue->programs[item->program]);
+        if (!prog->blocked)
+            continue;
+        GLsizeiptr size = (16 + 4 * prog->recordAuxNum) * sizeof(GLfloat);
+        item->record = shaRingAllocate(&(queue->ring), size);
+        if (item->record < 0)
+            continue;
+        GLfloat *dest = (GLfloat *)&(queue->ring.data[item->record]);
+        memcpy(dest, item->modeling, 16 * sizeof(GLfloat));
+        for (k = 0; k < 4 * prog->recordAuxNum; k += 1)
+            dest[16 + k] = (k < 4 * item->auxNum) ? item->auxiliaries[k] : 0.0;
+    }
+    shaRingUpload(&(queue->ring));
+    return 0;
+}
+
+/* Helper function for queSubmit. Points the instanced program's per-instance
+attributes, in the currently bound VAO, at the instance buffer, starting at
+byte offset. */
+void queSetInstancePointers(const queProgram *prog, size_t offset) {
+    GLsizei stride = (16 + 4 * prog->recordAuxNum) * sizeof(GLfloat);
+    GLuint c;
+    /* A mat4 attribute occupies four consecutive locations, one per column.
+    */
+    for (c = 0; c < 4 + prog->recordAuxNum; c += 1) {
+        GLint loc = (c < 4) ? prog->instanceLoc + (GLint)c :
+            prog->recordAuxLocs[c - 4];
+        if (loc < 0)
+            continue;
+        glEnableVertexAttribArray(loc);
+        glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, stride,
+            (GLubyte *)NULL + offset + c * 4 * sizeof(GLfloat));
+        glVertexAttribDivisor(loc, 1);
+    }
+}
+
+/* Helper function for queSubmit. Undoes queSetInstancePointers, so that the
+mesh's VAO is left as meshGLInitialize made it: the per-instance attributes'
+arrays are disabled, and their divisors are back to 0, in case another program
+draws the same mesh with something else at those locations. */
+void queClearInstancePointers(const queProgram *prog) {
+    GLuint c;
+    for (c = 0; c < 4 + prog->recordAuxNum; c += 1) {
+        GLint loc = (c < 4) ? prog->instanceLoc + (GLint)c :
+            prog->recordAuxLocs[c - 4];
+        if (loc < 0)
+            continue;
+        glVertexAttribDivisor(loc, 0);
+        glDisableVertexAttribArray(loc);
+    }
+}
+
+/* Helper function for queFindRun. Returns whether the items use the same
+program and textures. */
+int queSameState(const queItem *item, const queItem *next) {
+    GLuint k;
+    if (next->program != item->program || next->texNum != item->texNum)
+        return 0;
+    for (k = 0; k < item->texNum; k += 1)
+        if (next->textures[k]->texture != item->textures[k]->texture)
+            return 0;
+    return 1;
+}
+
+/* Helper function for queSubmit and queUploadCommands. Returns one past the
+end of the run of sorted items, starting at item i, that queSubmit draws with
+one call. With an instanced program, the run is the items with the same state
+and mesh, or merely the same pool. With a plain program, it is the items with
+the same state, pool, modeling matrix, and auxiliaries, as static pooled scenery
+often has. Otherwise, it is item i alone. */
+GLuint queFindRun(const queQueue *queue, GLuint i) {
+    const queItem *item = &(queue->items[queue->entries[i].index]);
+    const queProgram *prog = &(queue->programs[item->program]);
+    GLuint j;
+    if (prog->blocked || (prog->instanceLoc < 0 && item->mesh->pool == NULL))
+        return i + 1;
+    for (j = i + 1; j < queue->itemNum; j += 1) {
+        const queItem *next = &(queue->items[queue->entries[j].index]);
+        if (!queSameState(item, next))
+            break;
+        if (item->mesh->pool == NULL || next->mesh->pool != item->mesh->pool) {
+            if (next->mesh != item->mesh)
+                break;
+        }
+        if (prog->instanceLoc < 0 && (next->auxNum != item->auxNum ||
+                memcmp(next->modeling, item->modeling,
+                    sizeof(item->modeling)) != 0 ||
+                (item->auxNum > 0 && memcmp(next->auxiliaries,
+                    item->auxiliaries, 4 * item->auxNum * sizeof(GLdouble)) !=
+                    0)))
+            break;
+    }
+    return j;
+}
+
+/* Helper function for queSubmit. Writes an indirect draw command for each run
+of items with the same mesh, within each instanced run of pooled meshes, and
+uploads them to the indirect buffer. Does nothing unless multi-draw indirect is
+available. Returns 0 on success, non-zero on failure. */
+int queUploadCommands(queQueue *queue) {
+    GLuint i, j, first, commandNum = 0;
+    if (!queue->indirect)
+        return 0;
+    if (queue->itemNum > queue->commandCap) {
+        queCommand *commands = (queCommand *)realloc(queue->commands,
+            queue->itemNum * sizeof(queCommand));
+        if (commands == NULL)
+            return 1;
+        queue->commands = commands;
+        queue->commandCap = queue->itemNum;
+    }
+    for (i = 0; i < queue->itemNum; i = j) {
+        const queItem *item = &(queue->items[queue->entries[i].index]);
+        j = queFindRun(queue, i);
+        if (queue->programs[item->program].instanceLoc < 0 ||
+                item->mesh->pool == NULL)
+            continue;
+        /* The instances are numbered from the start of the run. */
+        for (first = i; first < j; commandNum += 1) {
+            const meshGLMesh *mesh =
+                queue->items[queue->entries[first].index].mesh;
+            queCommand *command = &(queue->commands[commandNum]);
+            command->count = mesh->triNum * 3;
+            command->firstIndex = mesh->firstIndex;
+            command->baseVertex = mesh->baseVertex;
+            command->baseInstance = first - i;
+            command->instanceCount = 0;
+            for (; first < j &&
+                    queue->items[queue->entries[first].index].mesh == mesh;
+                    first += 1)
+                command->instanceCount += 1;
+        }
+    }
+    if (commandNum == 0)
+        return 0;
+    if (queue->indirectBuffer == 0)
+        glGenBuffers(1, &(queue->indirectBuffer));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, queue->indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commandNum * sizeof(queCommand),
+        queue->commands, GL_STREAM_DRAW);
+    return 0;
+}
+
+/* Helper function for queSubmit. Draws the run of sorted items [i, j) with an
+instanced program, starting at byte offset instanceOffset in the instance
+buffer, and the commands starting at *commandAt in the indirect buffer. The
+run's VAO is bound, and is restored afterward (see queClearInstancePointers).
+*/
+void queDrawInstanced(
+        queQueue *queue, const queProgram *prog, GLuint i, GLuint j,
+        size_t instanceOffset, GLuint *commandAt) {
+    size_t stride = (16 + 4 * prog->recordAuxNum) * sizeof(GLfloat);
+    const meshGLMesh *mesh = queue->items[queue->entries[i].index].mesh;
+    GLuint first, commandNum = 0;
+    glBindBuffer(GL_ARRAY_BUFFER, queue->instanceBuffer);
+    if (queue->indirect && mesh->pool != NULL) {
+        for (first = i; first < j; first += 1)
+            if (first == i ||
+                    queue->items[queue->entries[first].index].mesh !=
+                    queue->items[queue->entries[first - 1].index].mesh)
+                commandNum += 1;
+        queSetInstancePointers(prog, instanceOffset);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, mesh->indexType,
+            (GLubyte *)NULL + *commandAt * sizeof(queCommand), commandNum, 0);
+        *commandAt += commandNum;
+        queue->drawNum += 1;
+        queClearInstancePointers(prog);
+        return;
+    }
+    /* Without indirect draws, there is no base instance, so the instance
+    attributes are pointed at each mesh's instances in turn. */
+    for (first = i; first < j; ) {
+        GLuint last = first + 1;
+        mesh = queue->items[queue->entries[first].index].mesh;
+        while (last < j && queue->items[queue->entries[last].index].mesh ==
+                mesh)
+            last += 1;
+        queSetInstancePointers(prog, instanceOffset + (first - i) * stride);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh->triNum * 3,
+            mesh->indexType, meshGLGetIndexPointer(mesh), last - first,
+            mesh->baseVertex);
+        queue->drawNum += 1;
+        first = last;
+    }
+    queClearInstancePointers(prog);
+}
+
+/* Helper function for queSubmit. Draws the run of sorted items [i, j) of
+pooled meshes, with one glMultiDrawElementsBaseVertex. Their uniforms must
+already be set. */
+void queDrawMulti(queQueue *queue, GLuint i, GLuint j) {
+    GLuint k, num = j - i;
+    if (num > queue->multiCap) {
+        GLsizei *counts = (GLsizei *)realloc(queue->multiCounts,
+            num * sizeof(GLsizei));
+        if (counts != NULL)
+            queue->multiCounts = counts;
+        const GLvoid **pointers = (const GLvoid **)realloc(
+            queue->multiPointers, num * sizeof(GLvoid *));
+        if (pointers != NULL)
+            queue->multiPointers = pointers;
+        GLint *bases = (GLint *)realloc(queue->multiBases,
+            num * sizeof(GLint));
+        if (bases != NULL)
+            queue->multiBases = bases;
+        if (counts == NULL || pointers == NULL || bases == NULL) {
+            /* Draw them one by one instead. */
+            for (k = i; k < j; k += 1) {
+                const meshGLMesh *mesh =
+                    queue->items[queue->entries[k].index].mesh;
+                glDrawElementsBaseVertex(GL_TRIANGLES, mesh->triNum * 3,
+                    mesh->indexType, meshGLGetIndexPointer(mesh),
+                    mesh->baseVertex);
+                queue->drawNum += 1;
+            }
+            return;
+        }
+        queue->multiCap = num;
+    }
+    for (k = 0; k < num; k += 1) {
+        const meshGLMesh *mesh = queue->items[queue->entries[i + k].index].mesh;
+        queue->multiCounts[k] = mesh->triNum * 3;
+        queue->multiPointers[k] = meshGLGetIndexPointer(mesh);
+        queue->multiBases[k] = mesh->baseVertex;
+    }
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, queue->multiCounts,
+        queue->items[queue->entries[i].index].mesh->indexType,
+        queue->multiPointers, num, queue->multiBases);
+    queue->drawNum += 1;
+}
+
+/* Sorts and draws the items. Afterward, the last program, VAO, and textures
+used stay bound. The queue keeps its items, so it can be submitted again, until
+queClear. */
+void queSubmit(queQueue *queue) {
+    GLuint bound[queMAXTEXTURES] = {0}, i, j, k, program = queue->programNum;
+    GLuint vao = 0, samplerNum = 0, commandAt = 0;
+    const queProgram *prog = NULL;
+    size_t instanceOffset = 0;
+    queue->bindNum = 0;
+    queue->drawNum = 0;
+    qsort(queue->entries, queue->itemNum, sizeof(queEntry), queCompareEntries);
+    if (queUploadInstances(queue) != 0 || queUploadRecords(queue) != 0 ||
+            queUploadCommands(queue) != 0) {
+        fprintf(stderr, "error: queSubmit: could not allocate instances, "
+            "records, or commands\n");
+        return;
+    }
+    for (i = 0; i < queue->itemNum; i = j) {
+        const queItem *item = &(queue->items[queue->entries[i].index]);
+        j = queFindRun(queue, i);
+        if (item->program != program) {
+            program = item->program;
+            prog = &(queue->programs[program]);
+            shaUseProgram(prog->program);
+            queue->bindNum += 1;
+            samplerNum = 0;
+        }
+        /* Each program's samplers read texture units 0, 1, 2, ... */
+        for (; samplerNum < item->texNum; samplerNum += 1)
+            shaSetUniform1i(samplerNum, prog->texLocs[samplerNum]);
+        for (k = 0; k < item->texNum; k += 1)
+            if (bound[k] != item->textures[k]->texture) {
+                bound[k] = item->textures[k]->texture;
+                shaBindTexture(k, bound[k]);
+                queue->bindNum += 1;
+            }
+        if (item->mesh->vao != vao) {
+            vao = item->mesh->vao;
+            shaBindVertexArray(vao);
+            queue->bindNum += 1;
+        }
+        if (prog->instanceLoc >= 0) {
+            queDrawInstanced(queue, prog, i, j, instanceOffset, &commandAt);
+            instanceOffset += (size_t)(j - i) * (16 + 4 *
+                prog->recordAuxNum) * sizeof(GLfloat);
+            continue;
+        }
+        if (prog->blocked) {
+            if (item->record < 0)
+                continue;
+            shaRingBind(&(queue->ring), item->record,
+                (16 + 4 * prog->recordAuxNum) * sizeof(GLfloat));
+        } else {
+            for (k = 0; k < item->auxNum; k += 1)
+                shaSetUniform4((GLdouble *)&(item->auxiliaries[4 * k]),
+                    prog->auxLocs[k]);
+            shaSetConvertedUniform44(item->modeling, prog->modelingLoc);
+        }
+        if (j - i > 1)
+            queDrawMulti(queue, i, j);
+        else {
+            glDrawElementsBaseVertex(GL_TRIANGLES, item->mesh->triNum * 3,
+                item->mesh->indexType, meshGLGetIndexPointer(item->mesh),
+                item->mesh->baseVertex);
+            queue->drawNum += 1;
+        }
+    }
+    /* The last program, VAO and textures are left bound. The state cache
+    skips rebinding them next frame, if they come first again. */
+}
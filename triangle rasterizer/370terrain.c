@@ -0,0 +1,549 @@
+/*** Streaming terrain ***/
+
+/* mesh3DInitializeLandscape builds one mesh for a whole heightfield, which is
+fine for 128 x 128 samples but hopeless for 16k x 16k: that would be half a
+billion triangles. A terrain instead splits the heightfield into square tiles,
+and keeps in GPU memory only the tiles near the camera's target, each at a
+level of detail suited to its distance from the camera (geomipmapping). Level L
+of a tile uses every 2^L-th sample. Neighboring tiles at different levels
+don't meet exactly, so each tile hangs a 'skirt' down from its border, as deep
+as the tile's range of heights, which hides the cracks.
+
+Tile meshes are built on a background thread, so moving the camera doesn't
+stall rendering. The rendering thread uploads finished tiles to the GPU (a few
+per frame) and evicts tiles that have fallen out of range, keeping the total
+GPU memory of the resident tiles within a budget. Typical use, each frame:
+    terUpdate(&ter, &cam, cameraTarget);
+    terRender(&ter, identity, sha.unifLocs[UNIFMODELING]);
+The heights are GLfloats, to halve their memory, and are stored row by row as
+in mesh3DInitializeLandscape: sample (i, j) is at XY (i * spacing,
+j * spacing). The tile meshes have the same XYZ-ST-NOP attributes as
+mesh3DInitializeLandscape, with ST in units of samples. */
+
+#define terMAXLEVELS 8
+#define terMAXREQUESTS 64
+#define terUPLOADSPERFRAME 4
+
+/* A tile's resident level is -1 if it has no GPU mesh. busy is set while the
+background thread is building the tile or a built mesh awaits upload. If the
+tile was built but couldn't be uploaded, failedLevel is the level, and it isn't
+built again at that level until the terrain's GPU memory use drops below
+failedUsed; otherwise failedLevel is -1. */
+typedef struct terTile terTile;
+struct terTile {
+    GLint level, wantedLevel, failedLevel;
+    GLsizeiptr failedUsed;
+    GLuint wantedFrame, busy;
+    GLsizeiptr bytes;
+    meshGLMesh mesh;
+};
+
+typedef struct terRequest terRequest;
+struct terRequest {
+    GLuint tile, level;
+    GLdouble priority;
+};
+
+typedef struct terBuilt terBuilt;
+struct terBuilt {
+    GLuint tile, level;
+    meshMesh mesh;
+    terBuilt *next;
+};
+
+/* Feel free to read from this struct's members, but don't write to them. The
+tiles' busy flags and the members after mutex are shared with the background
+thread, and are guarded by mutex. */
+typedef struct terTerrain terTerrain;
+struct terTerrain {
+    GLuint size, tileSize, tilesPerSide, levelNum;
+    GLdouble spacing, radius, lodDistance;
+    const GLfloat *heights;
+    void *mapping;
+    size_t mappingSize;
+    GLuint attrNum, vertexSize;
+    meshGLAttribute attrs[8];
+    GLsizeiptr budget, used;
+    GLuint frame, residentNum;
+    GLuint *resident;
+    terTile *tiles;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int quit;
+    GLuint requestNum;
+    terRequest requests[terMAXREQUESTS];
+    terBuilt *ready;
+};
+
+/* Helper function for terBuildTile. Returns the height of sample (i, j),
+clamping to the heightfield. */
+GLdouble terGetHeight(const terTerrain *ter, GLint i, GLint j) {
+    GLint last = (GLint)ter->size - 1;
+    i = (i < 0) ? 0 : ((i > last) ? last : i);
+    j = (j < 0) ? 0 : ((j > last) ? last : j);
+    return ter->heights[(size_t)i * ter->size + j];
+}
+
+/* Helper function for terBuildTile. Sets the vertex for sample (i, j), dropped
+by drop. The normal comes from central differences over the whole heightfield,
+so it agrees across tile borders. */
+void terSetVertex(
+        const terTerrain *ter, meshMesh *mesh, GLuint v, GLint i, GLint j,
+        GLint step, GLdouble drop) {
+    GLdouble attr[8];
+    attr[0] = i * ter->spacing;
+    attr[1] = j * ter->spacing;
+    attr[2] = terGetHeight(ter, i, j) - drop;
+    attr[3] = (GLdouble)i;
+    attr[4] = (GLdouble)j;
+    attr[5] = (terGetHeight(ter, i - step, j) -
+        terGetHeight(ter, i + step, j)) / (2.0 * step * ter->spacing);
+    attr[6] = (terGetHeight(ter, i, j - step) -
+        terGetHeight(ter, i, j + step)) / (2.0 * step * ter->spacing);
+    attr[7] = 1.0;
+    vec3Unit(&attr[5], &attr[5]);
+    meshSetVertex(mesh, v, attr);
+}
+
+/* Builds the mesh of one tile at one level, including its skirt. The tile is
+tile % tilesPerSide along X and tile / tilesPerSide along Y. Only reads the
+terrain's fixed configuration and heights, so it is safe to call from any
+thread. Returns 0 on success, non-zero on failure. Don't forget to call
+meshDestroy when finished. */
+int terBuildTile(
+        const terTerrain *ter, GLuint tile, GLuint level, meshMesh *mesh) {
+    GLint step = 1 << level, n = (ter->tileSize - 1) >> level;
+    GLint i0 = (tile % ter->tilesPerSide) * (ter->tileSize - 1);
+    GLint j0 = (tile / ter->tilesPerSide) * (ter->tileSize - 1);
+    GLuint gridNum = (n + 1) * (n + 1), t = 0, a, b, c, d;
+    GLint i, j, side, k;
+    /* No level of the tile strays from another by more than the tile's range
+    of heights, so a skirt that deep covers any crack. */
+    GLdouble z, low = terGetHeight(ter, i0, j0), high = low, skirtDepth;
+    for (i = 0; i < (GLint)ter->tileSize; i += 1)
+        for (j = 0; j < (GLint)ter->tileSize; j += 1) {
+            z = terGetHeight(ter, i0 + i, j0 + j);
+            low = (z < low) ? z : low;
+            high = (z > high) ? z : high;
+        }
+    skirtDepth = high - low + ter->spacing;
+    /* The skirt adds a dropped copy of each border vertex, and two
+    double-sided quads per border segment, so it shows from either side. */
+    if (meshInitialize(mesh, 2 * n * n + 16 * n, gridNum + 4 * (n + 1),
+            3 + 2 + 3) != 0)
+        return 1;
+    for (i = 0; i <= n; i += 1)
+        for (j = 0; j <= n; j += 1)
+            terSetVertex(ter, mesh, i * (n + 1) + j, i0 + i * step,
+                j0 + j * step, step, 0.0);
+    for (i = 0; i < n; i += 1)
+        for (j = 0; j < n; j += 1) {
+            a = i * (n + 1) + j;
+            b = (i + 1) * (n + 1) + j;
+            c = (i + 1) * (n + 1) + j + 1;
+            d = i * (n + 1) + j + 1;
+            meshSetTriangle(mesh, t, a, b, c);
+            meshSetTriangle(mesh, t + 1, a, c, d);
+            t += 2;
+        }
+    /* The four borders, as (i, j) = (side's start) + k * (side's direction). */
+    GLint starts[4][2] = {{0, 0}, {n, 0}, {0, 0}, {0, n}};
+    GLint dirs[4][2] = {{0, 1}, {0, 1}, {1, 0}, {1, 0}};
+    for (side = 0; side < 4; side += 1)
+        for (k = 0; k <= n; k += 1) {
+            i = starts[side][0] + k * dirs[side][0];
+            j = starts[side][1] + k * dirs[side][1];
+            terSetVertex(ter, mesh, gridNum + side * (n + 1) + k,
+                i0 + i * step, j0 + j * step, step, skirtDepth);
+            if (k == n)
+                continue;
+            a = i * (n + 1) + j;
+            b = (i + dirs[side][0]) * (n + 1) + j + dirs[side][1];
+            c = gridNum + side * (n + 1) + k + 1;
+            d = gridNum + side * (n + 1) + k;
+            meshSetTriangle(mesh, t, a, d, c);
+            meshSetTriangle(mesh, t + 1, a, c, b);
+            meshSetTriangle(mesh, t + 2, a, c, d);
+            meshSetTriangle(mesh, t + 3, a, b, c);
+            t += 4;
+        }
+    return 0;
+}
+
+/* Helper function for the background thread. Builds requested tiles, nearest
+first, until told to quit. */
+void *terWorkerMain(void *data) {
+    terTerrain *ter = (terTerrain *)data;
+    terRequest request;
+    terBuilt *built;
+    GLuint i;
+    pthread_mutex_lock(&ter->mutex);
+    while (1) {
+        while (!ter->quit && ter->requestNum == 0)
+            pthread_cond_wait(&ter->cond, &ter->mutex);
+        if (ter->quit)
+            break;
+        request = ter->requests[0];
+        ter->requestNum -= 1;
+        for (i = 0; i < ter->requestNum; i += 1)
+            ter->requests[i] = ter->requests[i + 1];
+        ter->tiles[request.tile].busy = 1;
+        pthread_mutex_unlock(&ter->mutex);
+        built = (terBuilt *)malloc(sizeof(terBuilt));
+        if (built != NULL && terBuildTile(ter, request.tile, request.level,
+                &built->mesh) != 0) {
+            free(built);
+            built = NULL;
+        }
+        pthread_mutex_lock(&ter->mutex);
+        if (built == NULL)
+            ter->tiles[request.tile].busy = 0;
+        else {
+            built->tile = request.tile;
+            built->level = request.level;
+            built->next = ter->ready;
+            ter->ready = built;
+        }
+    }
+    pthread_mutex_unlock(&ter->mutex);
+    return NULL;
+}
+
+/* Initializes a terrain over heights, which must hold size * size GLfloats and
+must stay valid until terDestroy. Each tile spans tileSize * tileSize samples
+(sharing its border samples with its neighbors); tileSize - 1 must be a power
+of 2, and size - 1 a multiple of tileSize - 1. For example, a 16385 x 16385
+heightfield with 65 x 65 tiles has 256 x 256 tiles. The tile meshes are
+uploaded with meshGLInitializeFormatted using the attrNum (at most 8)
+attributes, and the resident tiles never use more than budget bytes of GPU
+memory. By default, tiles within 8 tiles' width of the target are kept, and
+detail halves with every doubling of distance from the camera beyond one
+tile's width; see terSetRanges. Starts the background thread.
+Returns 0 on success, non-zero on failure. Don't forget to call terDestroy. */
+int terInitialize(
+        terTerrain *ter, const GLfloat *heights, GLuint size, GLdouble spacing,
+        GLuint tileSize, GLuint attrNum, const meshGLAttribute attrs[],
+        GLsizeiptr budget) {
+    GLuint i, tileNum;
+    if (tileSize < 3 || ((tileSize - 1) & (tileSize - 2)) != 0 ||
+            size < tileSize || (size - 1) % (tileSize - 1) != 0 ||
+            attrNum > 8) {
+        fprintf(stderr, "error: terInitialize: bad size or tileSize\n");
+        return 1;
+    }
+    ter->heights = heights;
+    ter->mapping = NULL;
+    ter->mappingSize = 0;
+    ter->size = size;
+    ter->spacing = spacing;
+    ter->tileSize = tileSize;
+    ter->tilesPerSide = (size - 1) / (tileSize - 1);
+    ter->levelNum = 1;
+    while (ter->levelNum < terMAXLEVELS &&
+            ((tileSize - 1) >> ter->levelNum) >= 1)
+        ter->levelNum += 1;
+    ter->attrNum = attrNum;
+    ter->vertexSize = 0;
+    for (i = 0; i < attrNum; i += 1) {
+        ter->attrs[i] = attrs[i];
+        ter->vertexSize += meshGLGetAttributeSize(&attrs[i]);
+    }
+    ter->budget = budget;
+    ter->used = 0;
+    ter->frame = 0;
+    ter->residentNum = 0;
+    ter->requestNum = 0;
+    ter->ready = NULL;
+    ter->quit = 0;
+    ter->radius = 8.0 * (tileSize - 1) * spacing;
+    ter->lodDistance = (tileSize - 1) * spacing;
+    tileNum = ter->tilesPerSide * ter->tilesPerSide;
+    ter->tiles = (terTile *)malloc(tileNum * sizeof(terTile));
+    ter->resident = (GLuint *)malloc(tileNum * sizeof(GLuint));
+    if (ter->tiles == NULL || ter->resident == NULL) {
+        free(ter->tiles);
+        free(ter->resident);
+        return 2;
+    }
+    for (i = 0; i < tileNum; i += 1) {
+        ter->tiles[i].level = -1;
+        ter->tiles[i].wantedLevel = -1;
+        ter->tiles[i].failedLevel = -1;
+        ter->tiles[i].failedUsed = 0;
+        ter->tiles[i].wantedFrame = 0;
+        ter->tiles[i].busy = 0;
+        ter->tiles[i].bytes = 0;
+    }
+    pthread_mutex_init(&ter->mutex, NULL);
+    pthread_cond_init(&ter->cond, NULL);
+    if (pthread_create(&ter->thread, NULL, terWorkerMain, ter) != 0) {
+        fprintf(stderr, "error: terInitialize: pthread_create failed\n");
+        pthread_cond_destroy(&ter->cond);
+        pthread_mutex_destroy(&ter->mutex);
+        free(ter->tiles);
+        free(ter->resident);
+        return 3;
+    }
+    return 0;
+}
+
+/* Like terInitialize, but maps the heights from a file of size * size raw
+GLfloats (in this machine's byte order), so that only the parts of the
+heightfield near the camera occupy memory. */
+int terInitializeFile(
+        terTerrain *ter, const char *path, GLuint size, GLdouble spacing,
+        GLuint tileSize, GLuint attrNum, const meshGLAttribute attrs[],
+        GLsizeiptr budget) {
+    size_t bytes = (size_t)size * size * sizeof(GLfloat);
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: terInitializeFile: open failed\n");
+        return 4;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < bytes) {
+        fprintf(stderr, "error: terInitializeFile: file too small\n");
+        close(fd);
+        return 5;
+    }
+    void *mapping = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "error: terInitializeFile: mmap failed\n");
+        return 6;
+    }
+    int error = terInitialize(ter, (const GLfloat *)mapping, size, spacing,
+        tileSize, attrNum, attrs, budget);
+    if (error != 0) {
+        munmap(mapping, bytes);
+        return error;
+    }
+    ter->mapping = mapping;
+    ter->mappingSize = bytes;
+    return 0;
+}
+
+/* Sets how far from the target (in XY) tiles are kept, and the distance from
+the camera at which tiles drop from level 0 to level 1. Each doubling of that
+distance drops one more level. */
+void terSetRanges(terTerrain *ter, GLdouble radius, GLdouble lodDistance) {
+    ter->radius = radius;
+    ter->lodDistance = lodDistance;
+}
+
+/* Helper function for terUpdate. Releases a resident tile's GPU mesh. */
+void terEvict(terTerrain *ter, GLuint index) {
+    terTile *tile = &ter->tiles[ter->resident[index]];
+    meshGLDestroy(&tile->mesh);
+    ter->used -= tile->bytes;
+    tile->bytes = 0;
+    tile->level = -1;
+    ter->residentNum -= 1;
+    ter->resident[index] = ter->resident[ter->residentNum];
+}
+
+/* Helper function for terUpdate. Uploads a built tile, evicting unwanted
+tiles as needed to stay within budget. Returns 0 on success, 1 if it doesn't
+fit in the budget, or 2 if OpenGL can't make the mesh. On failure, sets
+retryUsed to the GPU memory use below which trying again could succeed. */
+int terUpload(terTerrain *ter, terBuilt *built, GLsizeiptr *retryUsed) {
+    terTile *tile = &ter->tiles[built->tile];
+    GLsizeiptr bytes = (GLsizeiptr)built->mesh.vertNum * ter->vertexSize +
+        (GLsizeiptr)built->mesh.triNum * 3 *
+        ((built->mesh.vertNum <= 65536) ? 2 : 4);
+    GLuint i;
+    GLsizeiptr freed = (tile->level >= 0) ? tile->bytes : 0;
+    for (i = 0; i < ter->residentNum && ter->used - freed + bytes >
+            ter->budget; ) {
+        if (ter->tiles[ter->resident[i]].wantedFrame != ter->frame)
+            terEvict(ter, i);
+        else
+            i += 1;
+    }
+    if (ter->used - freed + bytes > ter->budget) {
+        *retryUsed = ter->budget - bytes + freed + 1;
+        return 1;
+    }
+    meshGLMesh mesh;
+    if (meshGLInitializeFormatted(&mesh, &built->mesh, ter->attrNum,
+            ter->attrs) != 0) {
+        *retryUsed = ter->used;
+        return 2;
+    }
+    if (tile->level >= 0) {
+        meshGLDestroy(&tile->mesh);
+        ter->used -= tile->bytes;
+    } else {
+        ter->resident[ter->residentNum] = built->tile;
+        ter->residentNum += 1;
+    }
+    tile->mesh = mesh;
+    tile->level = built->level;
+    tile->bytes = bytes;
+    ter->used += bytes;
+    return 0;
+}
+
+/* Updates the terrain for a new frame: decides which tiles are wanted at
+which levels, uploads a few tiles that the background thread has finished,
+evicts tiles that are out of range, and asks the background thread for the
+nearest missing tiles. Call once per frame, from the thread that owns the
+OpenGL context, before terRender. */
+void terUpdate(
+        terTerrain *ter, const camCamera *cam, const GLdouble target[3]) {
+    GLdouble extent = (ter->tileSize - 1) * ter->spacing, center[3], diff[3];
+    GLdouble dist, distXY;
+    GLint ti, tj, lo[2], hi[2], level;
+    GLuint i, k, tile, requestNum = 0, uploadNum = 0;
+    terRequest requests[terMAXREQUESTS], request;
+    terBuilt *ready, *built, *kept = NULL;
+    ter->frame += 1;
+    /* Decide which tiles are wanted, and at which levels. */
+    for (k = 0; k < 2; k += 1) {
+        lo[k] = (GLint)floor((target[k] - ter->radius) / extent);
+        hi[k] = (GLint)floor((target[k] + ter->radius) / extent);
+        lo[k] = (lo[k] < 0) ? 0 : lo[k];
+        hi[k] = (hi[k] >= (GLint)ter->tilesPerSide) ?
+            (GLint)ter->tilesPerSide - 1 : hi[k];
+    }
+    for (tj = lo[1]; tj <= hi[1]; tj += 1)
+        for (ti = lo[0]; ti <= hi[0]; ti += 1) {
+            tile = tj * ter->tilesPerSide + ti;
+            center[0] = (ti + 0.5) * extent;
+            center[1] = (tj + 0.5) * extent;
+            center[2] = terGetHeight(ter, (GLint)((ti + 0.5) *
+                (ter->tileSize - 1)), (GLint)((tj + 0.5) *
+                (ter->tileSize - 1)));
+            distXY = sqrt((center[0] - target[0]) * (center[0] - target[0]) +
+                (center[1] - target[1]) * (center[1] - target[1]));
+            if (distXY > ter->radius)
+                continue;
+            vec3Subtract(center, cam->isometry.translation, diff);
+            dist = vec3Length(diff);
+            level = 0;
+            while (level + 1 < (GLint)ter->levelNum &&
+                    dist >= ter->lodDistance * (1 << level))
+                level += 1;
+            ter->tiles[tile].wantedLevel = level;
+            ter->tiles[tile].wantedFrame = ter->frame;
+            if (ter->tiles[tile].level == level)
+                continue;
+            /* Don't build again what couldn't be uploaded, until some memory
+            frees up. */
+            if (ter->tiles[tile].failedLevel == level &&
+                    ter->used >= ter->tiles[tile].failedUsed)
+                continue;
+            /* Keep the nearest requests, sorted by distance. */
+            request.tile = tile;
+            request.level = level;
+            request.priority = dist;
+            if (requestNum == terMAXREQUESTS &&
+                    dist >= requests[requestNum - 1].priority)
+                continue;
+            if (requestNum < terMAXREQUESTS)
+                requestNum += 1;
+            for (i = requestNum - 1; i > 0 &&
+                    requests[i - 1].priority > dist; i -= 1)
+                requests[i] = requests[i - 1];
+            requests[i] = request;
+        }
+    /* Take the finished tiles, and hand over the new requests. */
+    pthread_mutex_lock(&ter->mutex);
+    ready = ter->ready;
+    ter->ready = NULL;
+    ter->requestNum = 0;
+    for (i = 0; i < requestNum; i += 1)
+        if (!ter->tiles[requests[i].tile].busy) {
+            ter->requests[ter->requestNum] = requests[i];
+            ter->requestNum += 1;
+        }
+    if (ter->requestNum > 0)
+        pthread_cond_signal(&ter->cond);
+    pthread_mutex_unlock(&ter->mutex);
+    /* Upload the finished tiles that are still wanted, a few per frame. */
+    while (ready != NULL) {
+        built = ready;
+        ready = ready->next;
+        terTile *t = &ter->tiles[built->tile];
+        if (t->wantedFrame == ter->frame &&
+                (GLint)built->level == t->wantedLevel &&
+                uploadNum >= terUPLOADSPERFRAME) {
+            built->next = kept;
+            kept = built;
+            continue;
+        }
+        if (t->wantedFrame == ter->frame &&
+                (GLint)built->level == t->wantedLevel) {
+            if (terUpload(ter, built, &t->failedUsed) == 0)
+                t->failedLevel = -1;
+            else
+                t->failedLevel = built->level;
+            uploadNum += 1;
+        }
+        meshDestroy(&built->mesh);
+        pthread_mutex_lock(&ter->mutex);
+        t->busy = 0;
+        pthread_mutex_unlock(&ter->mutex);
+        free(built);
+    }
+    if (kept != NULL) {
+        pthread_mutex_lock(&ter->mutex);
+        for (built = kept; built->next != NULL; built = built->next);
+        built->next = ter->ready;
+        ter->ready = kept;
+        pthread_mutex_unlock(&ter->mutex);
+    }
+    /* Evict the tiles that have fallen out of range. */
+    for (i = 0; i < ter->residentNum; )
+        if (ter->tiles[ter->resident[i]].wantedFrame != ter->frame)
+            terEvict(ter, i);
+        else
+            i += 1;
+}
+
+/* Renders the resident tiles. The parent is the terrain's modeling isometry;
+pass the identity to place the terrain as described at the top of this file.
+As in nodeRender, a tile with a quantized position format gets its
+dequantization folded into the modeling matrix. */
+void terRender(
+        const terTerrain *ter, const GLdouble parent[4][4], GLint modelingLoc) {
+    GLdouble modeling[4][4];
+    GLuint i;
+    const terTile *tile;
+    shaSetUniform44((GLdouble (*)[4])parent, modelingLoc);
+    for (i = 0; i < ter->residentNum; i += 1) {
+        tile = &ter->tiles[ter->resident[i]];
+        if (tile->mesh.quantized) {
+            simdMat444Multiply(parent, tile->mesh.dequantization, modeling);
+            shaSetUniform44(modeling, modelingLoc);
+        }
+        meshGLRender(&tile->mesh);
+    }
+}
+
+/* Stops the background thread and releases the terrain's resources,
+including the GPU meshes, and the heights if they were mapped by
+terInitializeFile. */
+void terDestroy(terTerrain *ter) {
+    terBuilt *built;
+    pthread_mutex_lock(&ter->mutex);
+    ter->quit = 1;
+    pthread_cond_signal(&ter->cond);
+    pthread_mutex_unlock(&ter->mutex);
+    pthread_join(ter->thread, NULL);
+    while (ter->ready != NULL) {
+        built = ter->ready;
+        ter->ready = built->next;
+        meshDestroy(&built->mesh);
+        free(built);
+    }
+    while (ter->residentNum > 0)
+        terEvict(ter, ter->residentNum - 1);
+    pthread_cond_destroy(&ter->cond);
+    pthread_mutex_destroy(&ter->mutex);
+    free(ter->tiles);
+    free(ter->resident);
+    if (ter->mapping != NULL)
+        munmap(ter->mapping, ter->mappingSize);
+}
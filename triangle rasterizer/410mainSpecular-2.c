@@ -1,26 +1,51 @@
 /* On macOS, compile with...
     clang 410mainSpecular.c /usr/local/gl3w/src/gl3w.o -lglfw3 -framework OpenGL -framework Cocoa -framework IOKit -Wno-deprecated
 ...and you might have to change the location of gl3w.o based on your
-installation. */
+installation. Run with...
+    ./a.out [cachedirectory]
+...to keep the compiled programs in that directory between launches. */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <GL/gl3w.h>
 #include <GLFW/glfw3.h>
 
 #include "310vector.c"
 #include "310matrix.c"
+#include "310simd.c"
+#include "310parallel.c"
+#include "310simdBatch.c"
 #include "310shading.c"
 #include "330mesh.c"
+#include "330meshBinary.c"
+#include "330meshFileParallel.c"
+#include "330meshWeld.c"
+#include "330meshSimplify.c"
 #include "330mesh2D.c"
 #include "330mesh3D.c"
+#include "330meshOptimize.c"
 #include "330meshGL.c"
+#include "330meshGLFormat.c"
+#include "330meshGLLandscape.c"
+#include "330meshGLPool.c"
+#include "330meshGLStream.c"
 #include "360texture.c"
 #include "350isometry.c"
+#include "350quaternion.c"
 #include "350camera.c"
+#include "370lod.c"
+#include "370queue.c"
 #include "370node.c"
+#include "370terrain.c"
 #include "150landscape.c"
 
 #define LANDSIZE 128
@@ -29,21 +54,46 @@ installation. */
 
 /*** Shaders ***/
 
-#define UNIFVIEWING 0
-#define UNIFMODELING 1
-#define UNIFTEXTURE0 2
-#define UNIFCLIGHT 3
-#define UNIFDLIGHT 4
+#define UNIFTEXTURE0 0
 #define ATTRXYZ 0
 #define ATTRST 1
 #define ATTRNOP 2
 
+/* The program is built in variants, by whether specular highlights are drawn.
+sha is the specular variant, which the nodes use unless given another with
+nodeSetShading. It is a copy; the variant set owns the resources. */
+#define SPECULAROFF 0
+#define SPECULARON 1
+shaVariants variants;
 shaShading sha;
 
+/* The program cache's directory, from the command line, or NULL for none. */
+const char *programCache = NULL;
+
+/* The same program, with the modeling matrix in the queue's per-draw uniform
+block instead of a per-instance attribute (see queMakeBlockCode), only in the
+specular variant. Press B to switch between them. */
+shaVariants blockVariants;
+shaShading blockSha;
+int useBlocks = 0;
+
+/* The per-frame uniforms live in a uniform block, declared alike in both
+shaders, and written once per frame. */
+#define FRAMEBINDING 0
+#define FRAMEVIEWING 0
+#define FRAMECLIGHT 64
+#define FRAMEDLIGHT 80
+#define FRAMESIZE 96
+shaBlock frameBlock;
+
 int initializeShaders(void) {
     GLchar vertexCode[] =
         "#version 140\n"
-        "uniform mat4 viewing;"
+        "layout(std140) uniform frame {"
+        "    mat4 viewing;"
+        "    vec3 cLight;"
+        "    vec3 dLight;"
+        "};"
         "uniform mat4 modeling;"
         "in vec3 xyz;"
         "in vec2 st;"
@@ -60,8 +110,11 @@ int initializeShaders(void) {
     GLchar fragmentCode[] = "\
         #version 140\n\
         uniform sampler2D texture0;\
-        uniform vec3 cLight;\
-        uniform vec3 dLight;\
+        layout(std140) uniform frame {\
+            mat4 viewing;\
+            vec3 cLight;\
+            vec3 dLight;\
+        };\
         in vec2 texCoord;\
         in vec3 vary;\
         out vec4 fragColor;\
@@ -72,23 +125,89 @@ int initializeShaders(void) {
             vec3 cAmb = vec3(cLight[0]/4, cLight[1]/4, cLight[2]/4);\
             vec3 dNormal = normalize(vary);\
             vec3 dRefl = 2*dot(dLight,dNormal)*dNormal-dLight;\
-            vec3 cDiff = vec3(texture(texture0, texCoord));\
+            vec3 cDiff = vec3(texture(texture0, texCoord));\n\
+        #if SPECULAR\n\
             if((max(0.0, dot(dNormal, dLight))==0){ ;\
                 fragColor = vec4((max(0.0, dot(dNormal, dLight)) *cDiff*cLight) + (cAmb *cDiff ) , 1.0);\
             }else{ ;\
                 fragColor = vec4(max(0, dot(pCam,dRefl)) + (max(0.0, dot(dNormal, dLight)) *cDiff*cLight) + (cAmb *cDiff ), 1.0);\
-            } ;\
+            } ;\n\
+        #else\n\
+            fragColor = vec4((max(0.0, dot(dNormal, dLight)) *cDiff*cLight) + (cAmb *cDiff ) , 1.0);\n\
+        #endif\n\
         }";
     //iSpec = max(0, dot(pCam,dRefl))
     //iDiff = (max(0.0, dot(dNormal, dLight))
-    const GLchar *unifNames[5] = {"viewing", "modeling", "texture0", "cLight", "dLight"};
-    const GLchar *attrNames[3] = {"xyz", "st", "nop" };
-    return shaInitialize(&sha, vertexCode, fragmentCode, 5, unifNames, 3,
-        attrNames);
+    //modeling becomes a per-instance attribute, so that nodes sharing a mesh are drawn together
+    GLchar *instancedCode = queMakeInstancedCode(vertexCode, "modeling", 0,
+        NULL);
+    if (instancedCode == NULL)
+        return 1;
+    static const GLchar *unifNames[1] = {"texture0"};
+    static const GLchar *attrNames[3] = {"xyz", "st", "nop" };
+    const GLchar *featureNames[1] = {"SPECULAR"};
+    GLuint valueNums[1] = {2}, specular[1] = {SPECULARON}, k;
+    if (shaVariantsInitialize(&variants, instancedCode, fragmentCode, 1,
+            featureNames, valueNums, 1, unifNames, 3, attrNames) != 0) {
+        free(instancedCode);
+        return 1;
+    }
+    /* Without a cache, the programs are compiled as usual. */
+    if (programCache != NULL)
+        shaSetProgramCache(programCache);
+    shaVariantsRequireAll(&variants);
+    GLdouble seconds;
+    int error = shaVariantsBuild(&variants, &seconds);
+    free(instancedCode);
+    if (error != 0 || shaVariantsGet(&variants, specular) == NULL) {
+        shaVariantsDestroy(&variants);
+        return 2;
+    }
+    printf("initializeShaders: %u variants in %f ms (%u hits, %u misses)\n",
+        variants.variantNum, 1000.0 * seconds, shaCacheHitNum,
+        shaCacheMissNum);
+    sha = *shaVariantsGet(&variants, specular);
+    GLchar *blockCode = queMakeBlockCode(vertexCode, "modeling", 0, NULL);
+    if (blockCode == NULL) {
+        shaVariantsDestroy(&variants);
+        return 3;
+    }
+    error = shaVariantsInitialize(&blockVariants, blockCode, fragmentCode, 1,
+        featureNames, valueNums, 1, unifNames, 3, attrNames);
+    free(blockCode);
+    if (error != 0) {
+        shaVariantsDestroy(&variants);
+        return 3;
+    }
+    shaVariantsRequire(&blockVariants, specular);
+    if (shaVariantsBuild(&blockVariants, &seconds) != 0 ||
+            shaVariantsGet(&blockVariants, specular) == NULL) {
+        shaVariantsDestroy(&blockVariants);
+        shaVariantsDestroy(&variants);
+        return 4;
+    }
+    blockSha = *shaVariantsGet(&blockVariants, specular);
+    /* Nodes with their own variant find the texture in the same place. */
+    nodeSetShadingLayout(-1, -1, UNIFTEXTURE0);
+    for (k = 0; k < variants.variantNum; k += 1)
+        if (shaBindBlock(variants.variants[k].program, "frame",
+                FRAMEBINDING) != 0)
+            error = 1;
+    if (shaBindBlock(blockSha.program, "frame", FRAMEBINDING) != 0)
+        error = 1;
+    if (error != 0 ||
+            shaBlockInitialize(&frameBlock, FRAMESIZE, FRAMEBINDING) != 0) {
+        shaVariantsDestroy(&blockVariants);
+        shaVariantsDestroy(&variants);
+        return 5;
+    }
+    return 0;
 }
 
 void destroyShaders(void) {
-    shaDestroy(&sha);
+    shaBlockDestroy(&frameBlock);
+    shaVariantsDestroy(&blockVariants);
+    shaVariantsDestroy(&variants);
 }
 
 
@@ -105,6 +224,7 @@ int initializeLightsCamera(void) {
     camSetProjectionType(&cam, camPERSPECTIVE);
     camSetFrustum(&cam, M_PI / 6.0, cameraRho, 10.0, 1024, 512);
     camLookAt(&cam, cameraTarget, cameraRho, cameraPhi, cameraTheta);
+    nodeSetCullingCamera(&cam);
     return 0;
 }
 
@@ -121,6 +241,10 @@ here but configured in artwork.c. */
 nodeNode root;
 #include "390artwork.c"
 
+/* The scene graph's draws are collected here each frame, and then submitted in
+an order that minimizes state changes. */
+queQueue queue;
+
 int initializeScene(void) {
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
@@ -136,10 +260,18 @@ int initializeScene(void) {
         destroyShaders();
         return 3;
     }
+    if (queInitialize(&queue, 64) != 0) {
+        destroyArtwork();
+        destroyLightsCamera();
+        destroyShaders();
+        return 4;
+    }
+    queSetCamera(&queue, &cam);
     return 0;
 }
 
 void destroyScene(void) {
+    queDestroy(&queue);
     destroyArtwork();
     destroyLightsCamera();
     destroyShaders();
@@ -155,16 +287,26 @@ void render(void) {
     GLdouble cLight[3] = {.6, .7, .8};
     GLdouble dLight[3] = {0, 0, 1};
     camGetProjectionInverseIsometry(&cam, viewing);
-    shaSetUniform44(viewing, sha.unifLocs[UNIFVIEWING]);
-    shaSetUniform3(cLight, sha.unifLocs[UNIFCLIGHT]);
-    shaSetUniform3(dLight, sha.unifLocs[UNIFDLIGHT]);
+    shaBlockSetUniform44(&frameBlock, FRAMEVIEWING, viewing);
+    shaBlockSetUniform3(&frameBlock, FRAMECLIGHT, cLight);
+    shaBlockSetUniform3(&frameBlock, FRAMEDLIGHT, dLight);
+    shaBlockUpload(&frameBlock);
     GLdouble identity[4][4] = {
         {1.0, 0.0, 0.0, 0.0},
         {0.0, 1.0, 0.0, 0.0},
         {0.0, 0.0, 1.0, 0.0},
         {0.0, 0.0, 0.0, 1.0}};
-    nodeRender(&root, identity, sha.unifLocs[UNIFMODELING], NULL,
-        &(sha.unifLocs[UNIFTEXTURE0]));
+    nodeResetCounters();
+    shaResetCounters();
+    queClear(&queue);
+    if (useBlocks)
+        queSetBlockProgram(&queue, blockSha.program, 0,
+            &(blockSha.unifLocs[UNIFTEXTURE0]));
+    else
+        queSetInstancedProgram(&queue, sha.program, 0,
+            &(sha.unifLocs[UNIFTEXTURE0]));
+    nodeEnqueue(&root, identity, NULL, &queue);
+    queSubmit(&queue);
 }
 
 
@@ -181,8 +323,16 @@ double getTime(void) {
 }
 
 void handleTimeStep(GLFWwindow *window, double oldTime, double newTime) {
-    if (floor(newTime) - floor(oldTime) >= 1.0)
-        printf("handleTimeStep: %f frames/sec\n", 1.0 / (newTime - oldTime));
+    if (floor(newTime) - floor(oldTime) >= 1.0) {
+        printf("handleTimeStep: %f frames/sec, %u nodes recomputed, %u "
+            "reused\n", 1.0 / (newTime - oldTime), nodeRecomputedNum,
+            nodeReusedNum);
+        printf("handleTimeStep: %u bounds tested, %u culled, %u drawn, %u "
+            "binds\n", nodeTestedNum, nodeCulledNum, nodeDrawnNum,
+            queue.bindNum);
+        printf("handleTimeStep: %u state calls issued, %u skipped\n",
+            shaIssuedNum, shaSkippedNum);
+    }
     GLdouble translation[3] = {0.0, fmod(newTime, 2.0 * M_PI), 0.0};
     isoSetTranslation(&(root.isometry), translation);
     render();
@@ -226,6 +376,8 @@ void handleKeyDown(
             moveRobot(SOUTH);
         else if (key == GLFW_KEY_I)
             moveRobot(NORTH);
+        else if (key == GLFW_KEY_B)
+            useBlocks = !useBlocks;
     }
     camLookAt(&cam, cameraTarget, cameraRho, cameraPhi, cameraTheta);
 }
@@ -282,7 +434,7 @@ GLFWwindow *initializeWindow(int width, int height, const char *name) {
     }
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     GLFWwindow *window;
     window = glfwCreateWindow(width, height, name, NULL, NULL);
@@ -310,8 +462,10 @@ void destroyWindow(GLFWwindow *window) {
     glfwTerminate();
 }
 
-int main(void) {
+int main(int argc, char **argv) {
     double oldTime;
+    if (argc > 1)
+        programCache = argv[1];
     double newTime = getTime();
     GLFWwindow *window = initializeWindow(screenWidth, screenHeight,
         "380mainArtwork");